@@ -6,10 +6,15 @@
  */
 
 #include "ahtable.h"
+#include "bcache.h"
+#include "fcbucket.h"
 #include "misc.h"
 #include "murmurhash3.h"
 #include <assert.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 enum {
     AH_SORTED  = 0x01,/* sorted iteration */
@@ -19,6 +24,56 @@ enum {
 const size_t ahtable_max_load_factor = 10000.0; /* arbitrary large number => don't resize */
 static const uint16_t LONG_KEYLEN_MASK = 0x7fff;
 
+/* Contents of a cold table. */
+typedef struct ahtable_cold_t_
+{
+    fcbucket_builder_t* w;
+    fcbucket_t B;
+    bool indexed;  // rebuild the order index on expansion
+} ahtable_cold_t;
+
+static void ahtable_warm(ahtable_t* T);
+
+/* Tables paged through a bucket cache are loaded, and cold tables expanded,
+ * before their slots are touched. */
+static inline void ahtable_touch(ahtable_t* T)
+{
+    if (T->page) bcache_touch(T);
+    if (T->cold) ahtable_warm(T);
+}
+
+/* As ahtable_touch, before changing the slots or handing out a value pointer
+ * to write through, so that a paged table is written back on eviction. */
+static inline void ahtable_touch_write(ahtable_t* T)
+{
+    ahtable_touch(T);
+    if (T->page) bcache_dirty(T);
+}
+
+/* Filter probes of a key: three bits of one word. The word is picked by the
+ * low bits of the hash, the bits by the high bits of its product with the
+ * golden ratio. */
+static inline uint64_t filter_mask(uint32_t h)
+{
+    uint32_t g = h * 0x9e3779b1u;
+    return ((uint64_t) 1 << (g >> 26)) |
+           ((uint64_t) 1 << ((g >> 20) & 63)) |
+           ((uint64_t) 1 << ((g >> 14) & 63));
+}
+
+/* False if the key with this hash is surely absent. */
+static inline bool filter_has(const ahtable_t* T, uint32_t h)
+{
+    if (T->filter == NULL) return true;
+    uint64_t mask = filter_mask(h);
+    return (T->filter[h & (T->filter_words - 1)] & mask) == mask;
+}
+
+static inline void filter_add(ahtable_t* T, uint32_t h)
+{
+    T->filter[h & (T->filter_words - 1)] |= filter_mask(h);
+}
+
 /* Allocate by larger chunks to avoid frequent reallocs. */
 /* http://graphics.stanford.edu/~seander/bithacks.html#RoundUpPowerOf2 */
 static inline unsigned next_size(unsigned v) {
@@ -40,20 +95,6 @@ static size_t keylen(slot_t s) {
     }
 }
 
-static value_t* slotval(slot_t s)
-{
-    size_t k = keylen(s);
-    s += k < 128 ? 1 : 2;
-    s += k;
-    return (value_t*) s;
-}
-
-static const char* slotkey(slot_t s, size_t* len)
-{
-    *len = keylen(s);
-    return (const char*) (s + (*len < 128 ? 1 : 2));
-}
-
 static int cmpkeystr(const char* a, size_t ka, slot_t b)
 {
     size_t kb = keylen(b);
@@ -77,6 +118,45 @@ static int cmpkey(const void* a_, const void* b_)
     return c == 0 ? (int) ka - (int) kb : c;
 }
 
+/* Entries of fixed key tables are the key and the value, without a length. */
+static inline size_t entry_size(const ahtable_t* T, size_t len)
+{
+    return (T->klen ? 0 : len < 128 ? 1 : 2) + len + sizeof(value_t);
+}
+
+static int cmpentry(const ahtable_t* T, const char* a, size_t ka, slot_t b)
+{
+    if (!T->klen) return cmpkeystr(a, ka, b);
+    int c = memcmp(a, b, ka < T->klen ? ka : T->klen);
+    return c == 0 ? (int) ka - (int) T->klen : c;
+}
+
+static void sort_fixed(slot_t* xs, slot_t* tmp, size_t m, size_t klen)
+{
+    if (m < 2) return;
+    size_t h = m / 2, i = 0, j = h, k = 0;
+    sort_fixed(xs, tmp, h, klen);
+    sort_fixed(xs + h, tmp, m - h, klen);
+    while (i < h && j < m) {
+        tmp[k++] = memcmp(xs[j], xs[i], klen) < 0 ? xs[j++] : xs[i++];
+    }
+    while (i < h) tmp[k++] = xs[i++];
+    memcpy(xs, tmp, k * sizeof(slot_t));
+}
+
+/* Sort the entries of a table by key. qsort has no room for the key length of
+ * a fixed key table, so these are merge sorted. */
+static void sort_entries(const ahtable_t* T, slot_t* xs)
+{
+    if (!T->klen) {
+        qsort(xs, T->m, sizeof(slot_t), cmpkey);
+        return;
+    }
+    slot_t* tmp = malloc_or_die(T->m * sizeof(slot_t));
+    sort_fixed(xs, tmp, T->m, T->klen);
+    free(tmp);
+}
+
 ahtable_t* ahtable_create()
 {
     return ahtable_create_n(AHTABLE_INIT_SIZE);
@@ -85,31 +165,56 @@ ahtable_t* ahtable_create()
 
 ahtable_t* ahtable_create_n(size_t n)
 {
-    ahtable_t* T = malloc_or_die(sizeof(ahtable_t));
+    return ahtable_create_mm(n, NULL);
+}
+
+
+ahtable_t* ahtable_create_mm(size_t n, const mm_ctx_t* mm)
+{
+    ahtable_t* T = mm_alloc(mm, sizeof(ahtable_t));
     memset(T, 0, sizeof(ahtable_t));
+    T->mm = mm;
 
     T->n = n;
     T->max_m = (size_t) (ahtable_max_load_factor * (double) T->n);
-    T->slots = malloc_or_die(n * sizeof(slot_t));
+    T->slots = mm_alloc(mm, n * sizeof(slot_t));
     memset(T->slots, 0, n * sizeof(slot_t));
 
     const size_t sslen = 2 * T->n * sizeof(uint32_t); /* used | reserved */
-    T->slot_sizes = malloc_or_die(sslen);
+    T->slot_sizes = mm_alloc(mm, sslen);
     memset(T->slot_sizes, 0, sslen);
 
     return T;
 }
 
 
+ahtable_t* ahtable_create_fixed(size_t n, size_t klen)
+{
+    assert(klen > 0 && klen <= UINT16_MAX);
+    ahtable_t* T = ahtable_create_n(n);
+    T->klen = (uint16_t) klen;
+    return T;
+}
+
+
 void ahtable_free(ahtable_t* T)
 {
     if (T == NULL) return;
+    if (T->page) bcache_detach(T);
+    if (T->cold) {
+        fcbucket_builder_free(T->cold->w);
+        free(T->cold);
+    }
     size_t i;
-    for (i = 0; i < T->n; ++i) free(T->slots[i]);
-    free(T->slots);
-    free(T->slot_sizes);
-    free(T->index);
-    free(T);
+    /* slots of an evicted table are gone */
+    if (T->slots) {
+        for (i = 0; i < T->n; ++i) mm_free(T->mm, T->slots[i]);
+    }
+    mm_free(T->mm, T->slots);
+    mm_free(T->mm, T->slot_sizes);
+    mm_free(T->mm, T->index);
+    mm_free(T->mm, T->filter);
+    mm_free(T->mm, T);
 }
 
 
@@ -119,29 +224,69 @@ size_t ahtable_size(const ahtable_t* T)
 }
 
 
+size_t ahtable_bytes(const ahtable_t* T)
+{
+    /* the filter stays in memory in every tier */
+    size_t i, bytes = T->filter_words * sizeof(uint64_t);
+    if (T->cold) return bytes + sizeof(ahtable_cold_t) + fcbucket_bytes(&T->cold->B);
+    if (T->slots == NULL) return bytes; /* paged out */
+
+    bytes += T->n * (sizeof(slot_t) + 2 * sizeof(uint32_t));
+    for (i = 0; i < T->n; ++i) bytes += T->slot_sizes[T->n + i];
+    if (T->index) bytes += T->m * sizeof(slot_t);
+    return bytes;
+}
+
+
+#define REBASE(p, delta) ((p) = (void*) ((uintptr_t) (p) + (delta)))
+
+void ahtable_rebase(ahtable_t* T, uintptr_t delta)
+{
+    size_t i;
+    if (T->mm) REBASE(T->mm, delta);
+    REBASE(T->slots, delta);
+    REBASE(T->slot_sizes, delta);
+    if (T->filter) REBASE(T->filter, delta);
+    for (i = 0; i < T->n; ++i) {
+        if (T->slots[i]) REBASE(T->slots[i], delta);
+    }
+    if (T->index) {
+        REBASE(T->index, delta);
+        for (i = 0; i < T->m; ++i) REBASE(T->index[i], delta);
+    }
+}
+
+
 void ahtable_clear(ahtable_t* T)
 {
+    ahtable_touch_write(T);
     size_t i;
-    for (i = 0; i < T->n; ++i) free(T->slots[i]);
+    for (i = 0; i < T->n; ++i) mm_free(T->mm, T->slots[i]);
     T->n = AHTABLE_INIT_SIZE;
-    T->slots = realloc_or_die(T->slots, T->n * sizeof(slot_t));
+    T->slots = mm_realloc(T->mm, T->slots, T->n * sizeof(slot_t));
     memset(T->slots, 0, T->n * sizeof(slot_t));
 
     const size_t sslen = 2 * T->n * sizeof(uint32_t); /* used | reserved */
-    T->slot_sizes = realloc_or_die(T->slot_sizes, sslen);
+    T->slot_sizes = mm_realloc(T->mm, T->slot_sizes, sslen);
     memset(T->slot_sizes, 0, sslen);
     
     if (T->index) {
-        free(T->index);
+        mm_free(T->mm, T->index);
         T->index = NULL;
     }
+    if (T->filter) memset(T->filter, 0, T->filter_words * sizeof(uint64_t));
+    if (T->page) bcache_measure(T);
 }
 
 
-static slot_t ins_key(slot_t s, const char* key, size_t len, value_t** val)
+static slot_t ins_key(const ahtable_t* T, slot_t s, const char* key, size_t len,
+                      value_t** val)
 {
     // key length
-    if (len < 128) {
+    if (T->klen) {
+        assert(len == T->klen);
+    }
+    else if (len < 128) {
         s[0] = (unsigned char) (len << 1);
         s += 1;
     }
@@ -174,7 +319,7 @@ static void ahtable_expand(ahtable_t* T)
     assert(T->n > 0);
     size_t new_n = 2 * T->n;
     size_t slot_scount = 2 * new_n; /* used | reserved */
-    uint32_t* slot_sizes = malloc_or_die(slot_scount * sizeof(uint32_t));
+    uint32_t* slot_sizes = mm_alloc(T->mm, slot_scount * sizeof(uint32_t));
     memset(slot_sizes, 0, slot_scount * sizeof(uint32_t));
 
     const char* key;
@@ -186,8 +331,7 @@ static void ahtable_expand(ahtable_t* T)
     while (!ahtable_iter_finished(&i)) {
         key = ahtable_iter_key(&i, &len);
         h = hash(key, len) % new_n;
-        slot_sizes[h] +=
-            len + sizeof(value_t) + (len >= 128 ? 2 : 1);
+        slot_sizes[h] += entry_size(T, len);
         slot_sizes[new_n + h] = slot_sizes[h];
 
         ++m;
@@ -198,11 +342,11 @@ static void ahtable_expand(ahtable_t* T)
 
 
     /* allocate slots */
-    slot_t* slots = malloc_or_die(new_n * sizeof(slot_t));
+    slot_t* slots = mm_alloc(T->mm, new_n * sizeof(slot_t));
     size_t j;
     for (j = 0; j < new_n; ++j) {
         if (slot_sizes[j] > 0) {
-            slots[j] = malloc_or_die(slot_sizes[j]);
+            slots[j] = mm_alloc(T->mm, slot_sizes[j]);
         }
         else slots[j] = NULL;
     }
@@ -222,7 +366,7 @@ static void ahtable_expand(ahtable_t* T)
         key = ahtable_iter_key(&i, &len);
         h = hash(key, len) % new_n;
 
-        slots_next[h] = ins_key(slots_next[h], key, len, &u);
+        slots_next[h] = ins_key(T, slots_next[h], key, len, &u);
         v = ahtable_iter_val(&i);
         *u = *v;
 
@@ -234,43 +378,127 @@ static void ahtable_expand(ahtable_t* T)
 
 
     free(slots_next);
-    for (j = 0; j < T->n; ++j) free(T->slots[j]);
-
-    free(T->slots);
-    T->slots = slots;
-
-    free(T->slot_sizes);
-    T->slot_sizes = slot_sizes;
-
-    T->n = new_n;
+    for (j = 0; j < T->n; ++j) mm_free(T->mm, T->slots[j]);
+    mm_free(T->mm, T->slots);
+    mm_free(T->mm, T->slot_sizes);
+
+    /* published in this order for optimistic readers (see concurrent.c):
+     * one that sees the new size sees the new arrays */
+    __atomic_store_n(&T->slot_sizes, slot_sizes, __ATOMIC_RELEASE);
+    __atomic_store_n(&T->slots, slots, __ATOMIC_RELEASE);
+    __atomic_store_n(&T->n, new_n, __ATOMIC_RELEASE);
     T->max_m = (size_t) (ahtable_max_load_factor * (double) T->n);
+    if (T->page) bcache_measure(T);
 }
 
-static value_t* insert_key(ahtable_t* T, uint32_t h, const char* key, size_t len)
+static void filter_build(ahtable_t* T, uint32_t words);
+
+static value_t* insert_key(ahtable_t* T, uint32_t hk, const char* key, size_t len)
 {
+    uint32_t h = hk % T->n;
     uint32_t new_size = T->slot_sizes[h];
-    new_size += (len >= 128 ? 2 : 1);        // key length
-    new_size += len * sizeof(unsigned char); // key
-    new_size += sizeof(value_t);             // value
+    new_size += entry_size(T, len);
 
     /* fetch reserved size */
     uint32_t* reserved = &T->slot_sizes[T->n + h];
     if (*reserved < new_size) {
+        long grown = (long) next_size(new_size) - (long) *reserved;
         *reserved = next_size(new_size);
-        T->slots[h] = realloc_or_die(T->slots[h], *reserved);
+        __atomic_store_n(&T->slots[h], mm_realloc(T->mm, T->slots[h], *reserved),
+                         __ATOMIC_RELEASE);
+        if (T->page) bcache_resize(T, grown);
     }
-    ++T->m;
+    __atomic_store_n(&T->m, T->m + 1, __ATOMIC_RELAXED);
 
+    /* the key is written past the slot size, which publishes it */
     value_t *val = NULL;
-    ins_key(T->slots[h] + T->slot_sizes[h], key, len, &val);
-    T->slot_sizes[h] = new_size;
-    
+    ins_key(T, T->slots[h] + T->slot_sizes[h], key, len, &val);
+    __atomic_store_n(&T->slot_sizes[h], new_size, __ATOMIC_RELEASE);
+
+    if (T->filter) {
+        if (T->m * AHTABLE_FILTER_BITS > 64 * (size_t) T->filter_words) {
+            filter_build(T, 2 * T->filter_words);
+        } else {
+            filter_add(T, hk);
+        }
+    }
     return val;
 }
 
 
+/* Equality of 16 bytes, in one compare where SSE2 is available. */
+static inline bool eq16(const unsigned char* a, const unsigned char* b)
+{
+#ifdef __SSE2__
+    __m128i x = _mm_loadu_si128((const __m128i*) a);
+    __m128i y = _mm_loadu_si128((const __m128i*) b);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) == 0xffff;
+#else
+    return memcmp(a, b, 16) == 0;
+#endif
+}
+
+static inline bool eq8(const unsigned char* a, const unsigned char* b)
+{
+    uint64_t x, y;
+    memcpy(&x, a, 8);
+    memcpy(&y, b, 8);
+    return x == y;
+}
+
+static inline bool eq4(const unsigned char* a, const unsigned char* b)
+{
+    uint32_t x, y;
+    memcpy(&x, a, 4);
+    memcpy(&y, b, 4);
+    return x == y;
+}
+
+/* Equality of keys of k bytes in wide loads, the last one overlapping the
+ * previous if k is not a multiple of their width. */
+static inline bool fixed_eq(const unsigned char* a, const unsigned char* b, size_t k)
+{
+    size_t j;
+    if (k >= 16) {
+        for (j = 0; j + 16 < k; j += 16) {
+            if (!eq16(a + j, b + j)) return false;
+        }
+        return eq16(a + k - 16, b + k - 16);
+    }
+    if (k >= 8) return eq8(a, b) && eq8(a + k - 8, b + k - 8);
+    if (k >= 4) return eq4(a, b) && eq4(a + k - 4, b + k - 4);
+    return memcmp(a, b, k) == 0;
+}
+
+static inline value_t* find_fixed(ahtable_t* T, const char* key, uint32_t i, size_t k)
+{
+    slot_t s = T->slots[i];
+    slot_t np = s + T->slot_sizes[i];
+    for (; s < np; s += k + sizeof(value_t)) {
+        if (fixed_eq(s, (const unsigned char*) key, k)) return (value_t*) (s + k);
+    }
+    return NULL;
+}
+
+/* Search a slot of a fixed key table: entries are a constant stride apart
+ * and compared without decoding lengths, with the compare unrolled for
+ * common key lengths. */
+static value_t* find_val_fixed(ahtable_t* T, const char* key, size_t len, uint32_t i)
+{
+    if (len != T->klen) return NULL;
+    switch (len) {
+        case 8:  return find_fixed(T, key, i, 8);
+        case 16: return find_fixed(T, key, i, 16);
+        case 20: return find_fixed(T, key, i, 20);
+        case 32: return find_fixed(T, key, i, 32);
+        default: return find_fixed(T, key, i, len);
+    }
+}
+
+
 static value_t* find_val(ahtable_t* T, const char* key, size_t len, uint32_t i)
 {
+    if (T->klen) return find_val_fixed(T, key, len, i);
     size_t k = 0;
 
     /* search the array for our key */
@@ -302,18 +530,37 @@ static value_t* find_val(ahtable_t* T, const char* key, size_t len, uint32_t i)
 }
 
 
+/* Look a key up in a cold table. Hot tables are only expanded by tiering
+ * passes, so that lookups never move values. */
+static value_t* cold_find(ahtable_t* T, const char* key, size_t len)
+{
+    /* the cold copy is owned by the table, its values may be written */
+    bool found;
+    size_t i = fcbucket_search(&T->cold->B, key, len, &found);
+    return found ? (value_t*) &T->cold->B.values[i] : NULL;
+}
+
+
 value_t* ahtable_get(ahtable_t* T, const char* key, size_t len)
 {
+    uint32_t h = hash(key, len);
+    value_t *ret;
+
+    /* existing keys are updated in place, new keys expand a cold table */
+    bool maybe = filter_has(T, h);
+    ahtable_heat(T, h);
+    if (T->cold && maybe && (ret = cold_find(T, key, len))) return ret;
+    ahtable_touch_write(T);
+
     /* if we are at capacity, preemptively resize */
     if (T->m >= T->max_m) {
         ahtable_expand(T);
     }
 
     /* attempt to find value for given key */
-    uint32_t i = hash(key, len) % T->n;
-    value_t *ret = find_val(T, key, len, i);
+    ret = maybe ? find_val(T, key, len, h % T->n) : NULL;
     if (ret == NULL) { /* insert if not found */
-        ret = insert_key(T, i, key, len);
+        ret = insert_key(T, h, key, len);
     }
     
     return ret;
@@ -322,25 +569,41 @@ value_t* ahtable_get(ahtable_t* T, const char* key, size_t len)
 
 value_t* ahtable_tryget(ahtable_t* T, const char* key, size_t len )
 {
-    uint32_t i = hash(key, len) % T->n;
-    return find_val(T, key, len, i);
+    uint32_t h = hash(key, len);
+    if (!filter_has(T, h)) return NULL;
+    ahtable_heat(T, h);
+    if (T->cold) return cold_find(T, key, len);
+    ahtable_touch(T);
+    return find_val(T, key, len, h % T->n);
 }
 
 value_t *ahtable_indexval(ahtable_t* T, unsigned i)
 {
-    return slotval(T->index[i]);
+    if (T->cold) return (value_t*) &T->cold->B.values[i];
+    ahtable_touch(T);
+    assert(T->index != NULL);
+    return ahtable_entry_val(T, T->index[i]);
 }
 
 void ahtable_build_index(ahtable_t* T)
 {
+    /* cold tables are ordered already */
+    if (T->cold) {
+        T->cold->indexed = true;
+        return;
+    }
+    ahtable_touch_write(T);
     if (T->index) {
-        free(T->index);
+        mm_free(T->mm, T->index);
         T->index = NULL;
     }
     
-    if (T->m == 0) return;
+    if (T->m == 0) {
+        if (T->page) bcache_measure(T);
+        return;
+    }
     
-    T->index = malloc_or_die(T->m * sizeof(slot_t));
+    T->index = mm_alloc(T->mm, T->m * sizeof(slot_t));
     
     slot_t s;
     size_t j, k, u;
@@ -348,18 +611,26 @@ void ahtable_build_index(ahtable_t* T)
         s = T->slots[j];
         while (s < T->slots[j] + T->slot_sizes[j]) {
             T->index[u++] = s;
-            k = keylen(s);
-            s += k < 128 ? 1 : 2;
-            s += k + sizeof(value_t);
+            ahtable_entry_key(T, s, &k);
+            s += entry_size(T, k);
         }
     }
     
-    qsort(T->index, T->m, sizeof(slot_t), cmpkey);
+    sort_entries(T, T->index);
+    if (T->page) bcache_measure(T);
 }
 
 int ahtable_find_leq (ahtable_t* T, const char* key, size_t len, value_t** dst)
 {
     *dst = NULL;
+    if (T->cold) {
+        bool found;
+        size_t i = fcbucket_search(&T->cold->B, key, len, &found);
+        if (!found && i == 0) return 1;
+        *dst = (value_t*) &T->cold->B.values[found ? i : i - 1];
+        return found ? 0 : -1;
+    }
+    ahtable_touch(T);
     if (T->m == 0) return 1;
     assert(T->index != NULL);
     
@@ -368,7 +639,7 @@ int ahtable_find_leq (ahtable_t* T, const char* key, size_t len, value_t** dst)
     int a = 0, b = T->m - 1, k = 0;
     while (a <= b) {
         k = (a + b) / 2;    /* divide interval */
-        r = cmpkeystr(key, len, T->index[k]);
+        r = cmpentry(T, key, len, T->index[k]);
         if (r == 0) {
             break;
         }
@@ -396,40 +667,41 @@ int ahtable_find_leq (ahtable_t* T, const char* key, size_t len, value_t** dst)
 
 void ahtable_insert (ahtable_t* T, const char* key, size_t len, value_t val)
 {
+    ahtable_touch_write(T);
+
     /* if we are at capacity, preemptively resize */
     if (T->m >= T->max_m) {
         ahtable_expand(T);
     }
     
-    uint32_t i = hash(key, len) % T->n;
-    *insert_key(T, i, key, len) = val;
+    *insert_key(T, hash(key, len), key, len) = val;
 }
 
 
 int ahtable_del(ahtable_t* T, const char* key, size_t len)
 {
+    ahtable_touch_write(T);
     uint32_t i = hash(key, len) % T->n;
     size_t k;
     slot_t s;
+    const char* e;
 
     /* search the array for our key */
     s = T->slots[i];
     while ((size_t) (s - T->slots[i]) < T->slot_sizes[i]) {
         /* get the key length */
-        k = keylen(s);
-        s += k < 128 ? 1 : 2;
+        e = ahtable_entry_key(T, s, &k);
 
         /* skip keys that are longer than ours */
         if (k != len) {
-            s += k + sizeof(value_t);
+            s += entry_size(T, k);
             continue;
         }
 
         /* key found. */
-        if (memcmp(s, key, len) == 0) {
+        if (memcmp(e, key, len) == 0) {
             /* move everything over, resize the array */
-            unsigned char* t = s + len + sizeof(value_t);
-            s -= k < 128 ? 1 : 2;
+            unsigned char* t = s + entry_size(T, k);
             memmove(s, t, T->slot_sizes[i] - (size_t) (t - T->slots[i]));
             T->slot_sizes[i] -= (size_t) (t - s);
             --T->m;
@@ -437,7 +709,7 @@ int ahtable_del(ahtable_t* T, const char* key, size_t len)
         }
         /* key not found. */
         else {
-            s += k + sizeof(value_t);
+            s += entry_size(T, k);
             continue;
         }
     }
@@ -466,13 +738,12 @@ static void ahtable_sorted_iter_begin(ahtable_t* T, ahtable_iter_t *i)
         s = T->slots[j];
         while (s < T->slots[j] + T->slot_sizes[j]) {
             i->d.xs[u++] = s;
-            k = keylen(s);
-            s += k < 128 ? 1 : 2;
-            s += k + sizeof(value_t);
+            ahtable_entry_key(T, s, &k);
+            s += entry_size(T, k);
         }
     }
 
-    qsort(i->d.xs, T->m, sizeof(slot_t), cmpkey);
+    sort_entries(T, i->d.xs);
 }
 
 
@@ -508,14 +779,14 @@ static inline void ahtable_sorted_iter_free(ahtable_iter_t* i)
 static const char* ahtable_sorted_iter_key(ahtable_iter_t* i, size_t* len)
 {
     if (ahtable_iter_finished(i)) return NULL;
-    return slotkey(i->d.xs[i->i], len);
+    return ahtable_entry_key(i->T, i->d.xs[i->i], len);
 }
 
 
 static value_t*  ahtable_sorted_iter_val(ahtable_iter_t* i)
 {
     if (ahtable_iter_finished(i)) return NULL;
-    return slotval(i->d.xs[i->i]);
+    return ahtable_entry_val(i->T, i->d.xs[i->i]);
 }
 
 static void ahtable_unsorted_iter_begin(ahtable_t* T, ahtable_iter_t *i)
@@ -538,12 +809,10 @@ static void ahtable_unsorted_iter_next(ahtable_iter_t* i)
 {
     if (ahtable_iter_finished(i)) return;
 
-    /* get the key length */
-    size_t k = keylen(i->d.s);
-    i->d.s += k < 128 ? 1 : 2;
-
     /* skip to the next key */
-    i->d.s += k + sizeof(value_t);
+    size_t k;
+    ahtable_entry_key(i->T, i->d.s, &k);
+    i->d.s += entry_size(i->T, k);
 
     if ((size_t) (i->d.s - i->T->slots[i->i]) >= i->T->slot_sizes[i->i]) {
         do {
@@ -559,8 +828,9 @@ static void ahtable_unsorted_iter_next(ahtable_iter_t* i)
 static void ahtable_unsorted_iter_del(ahtable_iter_t* i)
 {
     /* get the entry length */
-    size_t k = keylen(i->d.s);
-    unsigned char* t = i->d.s + (k < 128 ? 1 : 2) + k + sizeof(value_t);
+    size_t k;
+    ahtable_entry_key(i->T, i->d.s, &k);
+    unsigned char* t = i->d.s + entry_size(i->T, k);
     memmove(i->d.s, t, i->T->slot_sizes[i->i] - (size_t)(t - i->T->slots[i->i]));
     i->T->slot_sizes[i->i] -= (size_t)(t - i->d.s);
     --i->T->m;
@@ -581,49 +851,54 @@ static const char* ahtable_unsorted_iter_key(ahtable_iter_t* i, size_t* len)
 {
     if (ahtable_iter_finished(i)) return NULL;
 
-    slot_t s = i->d.s;
-    size_t k;
-    if (0x1 & *s) {
-        k = (size_t) (*((uint16_t*) s)) >> 1;
-        s += 2;
-    }
-    else {
-        k = (size_t) (*s >> 1);
-        s += 1;
-    }
-
-    *len = k;
-    return (const char*) s;
+    return ahtable_entry_key(i->T, i->d.s, len);
 }
 
 
 static value_t* ahtable_unsorted_iter_val(ahtable_iter_t* i)
 {
     if (ahtable_iter_finished(i)) return NULL;
-    return slotval(i->d.s);
+    return ahtable_entry_val(i->T, i->d.s);
+}
+
+
+/* A cold table is iterated through its front-coded copy, in key order
+ * whether sorted or not, as filter_build does, so it is not expanded. Values
+ * are those of the cold copy, which lookups hand out as well. */
+
+static value_t* ahtable_cold_iter_val(ahtable_iter_t* i)
+{
+    if (fcbucket_iter_finished(i->fc)) return NULL;
+    return (value_t*) &i->T->cold->B.values[fcbucket_iter_rank(i->fc)];
 }
 
 
 void ahtable_iter_begin(ahtable_t* T, ahtable_iter_t* i, bool sorted) {
     memset(i, 0, sizeof(ahtable_iter_t));
     i->T = T;
-    if (sorted) {
-        i->flags |= AH_SORTED;
-        ahtable_sorted_iter_begin(T, i);
-    } else {
-        ahtable_unsorted_iter_begin(T, i);
+    if (sorted) i->flags |= AH_SORTED;
+    if (T->cold) {
+        i->fc = fcbucket_iter_begin(&T->cold->B);
+        return;
     }
+    if (T->page) bcache_pin(T);
+    if (sorted) ahtable_sorted_iter_begin(T, i);
+    else        ahtable_unsorted_iter_begin(T, i);
 }
 
 
 void ahtable_iter_next(ahtable_iter_t* i)
 {
-    if (i->flags & AH_SORTED) ahtable_sorted_iter_next(i);
-    else                      ahtable_unsorted_iter_next(i);
+    if (i->fc)                     fcbucket_iter_next(i->fc);
+    else if (i->flags & AH_SORTED) ahtable_sorted_iter_next(i);
+    else                           ahtable_unsorted_iter_next(i);
 }
 
 void ahtable_iter_del(ahtable_iter_t* i)
 {
+    /* cold tables must be expanded before deleting, see ahtable_decompress */
+    assert(i->fc == NULL);
+    if (i->T->page) bcache_dirty(i->T);
     if (i->flags & AH_SORTED) ahtable_sorted_iter_del(i);
     else                      ahtable_unsorted_iter_del(i);
 }
@@ -631,6 +906,7 @@ void ahtable_iter_del(ahtable_iter_t* i)
 
 bool ahtable_iter_finished(ahtable_iter_t* i)
 {
+    if (i->fc)                return fcbucket_iter_finished(i->fc);
     if (i->flags & AH_SORTED) return ahtable_sorted_iter_finished(i);
     else                      return ahtable_unsorted_iter_finished(i);
 }
@@ -638,12 +914,18 @@ bool ahtable_iter_finished(ahtable_iter_t* i)
 void ahtable_iter_free(ahtable_iter_t* i)
 {
     if (i == NULL) return;
+    if (i->fc) {
+        fcbucket_iter_free(i->fc);
+        return;
+    }
     if (i->flags & AH_SORTED) ahtable_sorted_iter_free(i);
+    if (i->T && i->T->page) bcache_unpin(i->T);
 }
 
 
 const char* ahtable_iter_key(ahtable_iter_t* i, size_t* len)
 {
+    if (i->fc)                return fcbucket_iter_key(i->fc, len);
     if (i->flags & AH_SORTED) return ahtable_sorted_iter_key(i, len);
     else                      return ahtable_unsorted_iter_key(i, len);
 }
@@ -651,7 +933,179 @@ const char* ahtable_iter_key(ahtable_iter_t* i, size_t* len)
 
 value_t* ahtable_iter_val(ahtable_iter_t* i)
 {
+    if (i->fc)                return ahtable_cold_iter_val(i);
     if (i->flags & AH_SORTED) return ahtable_sorted_iter_val(i);
     else                      return ahtable_unsorted_iter_val(i);
 }
 
+
+void ahtable_iter_seek(ahtable_iter_t* i, const char* key, size_t len)
+{
+    assert(i->flags & AH_SORTED);
+    if (i->fc) {
+        bool found;
+        size_t r = fcbucket_search(&i->T->cold->B, key, len, &found);
+        while (!fcbucket_iter_finished(i->fc) && fcbucket_iter_rank(i->fc) < r) {
+            fcbucket_iter_next(i->fc);
+        }
+        return;
+    }
+    size_t lo = i->i, hi = i->T->m;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cmpentry(i->T, key, len, i->d.xs[mid]) > 0) lo = mid + 1;
+        else hi = mid;
+    }
+    i->i = lo;
+}
+
+
+void ahtable_iter_dup(const ahtable_iter_t* src, ahtable_iter_t* dst)
+{
+    *dst = *src;
+    if (src->T == NULL) return;
+    if (src->fc) {
+        dst->fc = fcbucket_iter_dup(src->fc);
+        return;
+    }
+    if (src->T->page) bcache_pin(src->T);
+    if ((src->flags & AH_SORTED) && !(src->flags & AH_INDEXED)) {
+        dst->d.xs = malloc_or_die(src->T->m * sizeof(slot_t));
+        if (src->T->m > 0) memcpy(dst->d.xs, src->d.xs, src->T->m * sizeof(slot_t));
+    }
+}
+
+
+void ahtable_compress(ahtable_t* T)
+{
+    if (T->cold || T->page || T->mm || T->m == 0) return;
+
+    ahtable_cold_t* c = malloc_or_die(sizeof(ahtable_cold_t));
+    c->w = fcbucket_builder_create(0);
+    c->indexed = T->index != NULL;
+
+    size_t len;
+    const char* key;
+    ahtable_iter_t i;
+    ahtable_iter_begin(T, &i, true);
+    while (!ahtable_iter_finished(&i)) {
+        key = ahtable_iter_key(&i, &len);
+        fcbucket_builder_add(c->w, key, len, *ahtable_iter_val(&i));
+        ahtable_iter_next(&i);
+    }
+    ahtable_iter_free(&i);
+    fcbucket_builder_trim(c->w);
+    fcbucket_builder_view(c->w, &c->B);
+
+    size_t j;
+    for (j = 0; j < T->n; ++j) mm_free(T->mm, T->slots[j]);
+    mm_free(T->mm, T->slots);
+    mm_free(T->mm, T->slot_sizes);
+    mm_free(T->mm, T->index);
+    T->slots = NULL;
+    T->slot_sizes = NULL;
+    T->index = NULL;
+    T->cold = c;
+}
+
+
+void ahtable_decompress(ahtable_t* T)
+{
+    if (T->cold) ahtable_warm(T);
+}
+
+
+/* Rebuild the slots of a cold table, sized exactly as on expand. */
+static void ahtable_warm(ahtable_t* T)
+{
+    ahtable_cold_t* c = T->cold;
+    T->cold = NULL;
+
+    const size_t sslen = 2 * T->n * sizeof(uint32_t); /* used | reserved */
+    T->slot_sizes = mm_alloc(T->mm, sslen);
+    memset(T->slot_sizes, 0, sslen);
+
+    size_t len, h, j;
+    const char* key;
+    fcbucket_iter_t* i = fcbucket_iter_begin(&c->B);
+    while (!fcbucket_iter_finished(i)) {
+        key = fcbucket_iter_key(i, &len);
+        h = hash(key, len) % T->n;
+        T->slot_sizes[h] += entry_size(T, len);
+        fcbucket_iter_next(i);
+    }
+    fcbucket_iter_free(i);
+
+    T->slots = mm_alloc(T->mm, T->n * sizeof(slot_t));
+    for (j = 0; j < T->n; ++j) {
+        T->slot_sizes[T->n + j] = T->slot_sizes[j];
+        T->slots[j] = T->slot_sizes[j] > 0 ? mm_alloc(T->mm, T->slot_sizes[j]) : NULL;
+    }
+
+    slot_t* slots_next = malloc_or_die(T->n * sizeof(slot_t));
+    memcpy(slots_next, T->slots, T->n * sizeof(slot_t));
+    value_t* u;
+    i = fcbucket_iter_begin(&c->B);
+    while (!fcbucket_iter_finished(i)) {
+        key = fcbucket_iter_key(i, &len);
+        h = hash(key, len) % T->n;
+        slots_next[h] = ins_key(T, slots_next[h], key, len, &u);
+        *u = fcbucket_iter_val(i);
+        fcbucket_iter_next(i);
+    }
+    fcbucket_iter_free(i);
+    free(slots_next);
+
+    fcbucket_builder_free(c->w);
+    if (c->indexed) ahtable_build_index(T);
+    free(c);
+}
+
+
+/* Size the filter for the stored keys and add all of them. */
+static void filter_build(ahtable_t* T, uint32_t words)
+{
+    mm_free(T->mm, T->filter);
+    T->filter_words = words;
+    T->filter = mm_alloc(T->mm, words * sizeof(uint64_t));
+    memset(T->filter, 0, words * sizeof(uint64_t));
+
+    size_t len, j;
+    const char* key;
+    if (T->cold) {
+        fcbucket_iter_t* i = fcbucket_iter_begin(&T->cold->B);
+        while (!fcbucket_iter_finished(i)) {
+            key = fcbucket_iter_key(i, &len);
+            filter_add(T, hash(key, len));
+            fcbucket_iter_next(i);
+        }
+        fcbucket_iter_free(i);
+        return;
+    }
+
+    for (j = 0; j < T->n; ++j) {
+        slot_t s = T->slots[j];
+        slot_t end = s + T->slot_sizes[j];
+        while (s < end) {
+            key = ahtable_entry_key(T, s, &len);
+            filter_add(T, hash(key, len));
+            s = (slot_t) key + len + sizeof(value_t);
+        }
+    }
+}
+
+
+void ahtable_filter(ahtable_t* T, bool enable)
+{
+    if (!enable) {
+        mm_free(T->mm, T->filter);
+        T->filter = NULL;
+        T->filter_words = 0;
+        return;
+    }
+
+    uint32_t words = 1;
+    while (T->m * AHTABLE_FILTER_BITS > 64 * (size_t) words) words *= 2;
+    if (!T->cold) ahtable_touch(T);
+    filter_build(T, words);
+}
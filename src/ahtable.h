@@ -27,33 +27,131 @@ extern "C" {
 #include <stdbool.h>
 #include "pstdint.h"
 #include "common.h"
+#include "mm.h"
 
 typedef unsigned char* slot_t;
 
+struct bcache_entry_t_;
+struct ahtable_cold_t_;
+struct fcbucket_iter_t_;
+
 typedef struct ahtable_t_
 {
     /* these fields are reserved for hattrie to fiddle with */
     uint8_t flag; 
     unsigned char c0;
     unsigned char c1;
+    uint64_t digest;
 
     size_t n;        // number of slots
     size_t m;        // number of key/value pairs stored
     size_t max_m;    // number of stored keys before we resize
+    uint16_t klen;   // length of every key of a fixed key table, else 0
 
     uint32_t*  slot_sizes;
     slot_t*  slots;
     slot_t*  index;  // order index (optional)
+
+    const mm_ctx_t* mm; // allocator, NULL for malloc
+    struct bcache_entry_t_* page; // bucket cache entry (optional)
+
+    struct ahtable_cold_t_* cold; // compressed contents while cold (optional)
+    uint16_t heat;   // sampled accesses since the last tiering pass
+    uint8_t  salt;   // picks the sampled keys, changed on every pass
+    bool     tiered; // heat is counted, set by the first tiering pass
+
+    uint64_t* filter;      // membership filter of the stored keys (optional)
+    uint32_t  filter_words;
 } ahtable_t;
 
+/** Decode the key stored in a slot entry (e.g. from the order index). Entries
+ * of fixed key tables have no length, see ahtable_entry_key. */
+static inline const char* ahtable_slot_key(slot_t s, size_t* len)
+{
+    if (0x1 & *s) {
+        *len = (size_t) (*((uint16_t*) s) >> 1);
+        return (const char*) (s + 2);
+    }
+    *len = (size_t) (*s >> 1);
+    return (const char*) (s + 1);
+}
+
+/** Return the value stored in a slot entry. */
+static inline value_t* ahtable_slot_val(slot_t s)
+{
+    size_t len;
+    const char* key = ahtable_slot_key(s, &len);
+    return (value_t*) (key + len);
+}
+
+/** Decode the key of an entry of the given table, fixed key or not. */
+static inline const char* ahtable_entry_key(const ahtable_t* T, slot_t s, size_t* len)
+{
+    if (T->klen) {
+        *len = T->klen;
+        return (const char*) s;
+    }
+    return ahtable_slot_key(s, len);
+}
+
+/** Return the value of an entry of the given table. */
+static inline value_t* ahtable_entry_val(const ahtable_t* T, slot_t s)
+{
+    if (T->klen) return (value_t*) (s + T->klen);
+    return ahtable_slot_val(s);
+}
+
+/** Count one in AHTABLE_HEAT_SAMPLE accesses, once tiering passes run. Samples
+ * are picked by key hash, with a salt so that a different set of keys is
+ * counted after each pass. Called on every lookup, and by callers that reach
+ * a value without one (e.g. a cache in front of the table). */
+static inline void ahtable_heat(ahtable_t* T, uint32_t h)
+{
+    if (!T->tiered) return;
+    if (((h >> 24) ^ T->salt) % AHTABLE_HEAT_SAMPLE == 0 && T->heat < UINT16_MAX) {
+        ++T->heat;
+    }
+}
+
 ahtable_t* ahtable_create   (void);         // Create an empty hash table.
 ahtable_t* ahtable_create_n (size_t n);     // Create an empty hash table, with
                                             //  n slots reserved.
+ahtable_t* ahtable_create_mm (size_t n, const mm_ctx_t*); // As above, allocating
+                                                          //  from the context.
+
+/** Create an empty table for keys of klen bytes only, such as UUIDs or
+ * digests. Entries are stored without a length, keys are compared with wide
+ * loads, and keys of other lengths are never found and may not be inserted. */
+ahtable_t* ahtable_create_fixed (size_t n, size_t klen);
 
 void       ahtable_free   (ahtable_t*);       // Free all memory used by a table.
 void       ahtable_clear  (ahtable_t*);       // Remove all entries.
 size_t     ahtable_size   (const ahtable_t*); // Number of stored keys.
 
+/** Shift all pointers held by a table (including mm) by delta bytes, after
+ * the memory it was allocated from was moved. */
+void       ahtable_rebase (ahtable_t*, uintptr_t delta);
+
+
+/** Move the table to the cold tier: its keys are kept as a front-coded sorted
+ * copy (see fcbucket.h) and the slots are freed. Lookups, find_leq, updates
+ * of existing keys and iteration are served from the cold copy and never move
+ * it. Inserts and deletes expand the table again, which moves its values, so
+ * value pointers taken before are stale. Tables paged through a bucket cache
+ * or allocated from a memory context are left as they are. */
+void       ahtable_compress   (ahtable_t*);
+void       ahtable_decompress (ahtable_t*); //< Move a cold table back.
+size_t     ahtable_bytes      (const ahtable_t*); //< Memory held by contents.
+
+
+/** Keep a Bloom filter of the stored keys, so that most lookups of absent
+ * keys return without scanning a slot, expanding a cold table or loading a
+ * paged one. The filter uses about AHTABLE_FILTER_BITS bits per key, all
+ * probes of a key falling in one 64-bit word, and is doubled as keys are
+ * inserted. Deleted keys leave their bits set until the filter is rebuilt,
+ * which enabling it again does. */
+void       ahtable_filter (ahtable_t*, bool enable);
+
 
 /** Find the given key in the table, inserting it if it does not exist, and
  * returning a pointer to it's key.
@@ -100,6 +198,7 @@ typedef struct ahtable_iter_t_
         slot_t* xs; // pointers to keys
         slot_t s;           // slot position
     } d;
+    struct fcbucket_iter_t_* fc; // keys of a cold table, in order
     
 } ahtable_iter_t;
 
@@ -111,6 +210,13 @@ void            ahtable_iter_free      (ahtable_iter_t*);
 const char*     ahtable_iter_key       (ahtable_iter_t*, size_t* len);
 value_t*        ahtable_iter_val       (ahtable_iter_t*);
 
+/** Move a sorted iterator to the first key greater or equal to the given
+ * one, looking it up by binary search. */
+void            ahtable_iter_seek      (ahtable_iter_t*, const char* key, size_t len);
+
+/** Make dst an independent copy of the iterator src. */
+void            ahtable_iter_dup       (const ahtable_iter_t* src, ahtable_iter_t* dst);
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,211 @@
+/*
+ * This file is part of hat-trie.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "arena.h"
+#include "misc.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char ARENA_MAGIC[8] = { 'H', 'A', 'T', 'A', 'R', 'E', 'N', 'A' };
+static const uint64_t ARENA_VERSION = 1;
+
+/* Blocks come in size classes of four steps per power of two, starting at
+ * 32 bytes. Each block starts with its class, freed blocks are kept on a free
+ * list per class. */
+#define ARENA_CLASSES  160
+#define ARENA_MINSHIFT 5
+#define ARENA_BLOCKHDR sizeof(uint64_t)
+
+typedef struct arena_header_t_
+{
+    char     magic[8];
+    uint64_t version;
+    uint64_t base;   // address the arena was last mapped at
+    uint64_t size;   // capacity
+    uint64_t top;    // first unallocated offset
+    uint64_t root;   // offset of the trie
+    uint64_t free[ARENA_CLASSES]; // free list heads, offsets
+
+    /* context of the trie, functions are fixed up on every open */
+    mm_ctx_t mm;
+} arena_header_t;
+
+struct hattrie_arena_t_
+{
+    int fd;
+    unsigned char* map;
+    size_t size;
+};
+
+
+static inline size_t class_size(unsigned c)
+{
+    unsigned p = ARENA_MINSHIFT + c / 4;
+    return ((size_t) 1 << p) + (c % 4) * ((size_t) 1 << (p - 2));
+}
+
+/* smallest class holding len bytes */
+static unsigned size_class(size_t len)
+{
+    if (len <= ((size_t) 1 << ARENA_MINSHIFT)) return 0;
+    unsigned p = 0;
+    size_t x = len - 1;
+    while (x >>= 1) ++p;
+    size_t step = (size_t) 1 << (p - 2);
+    size_t k = (len - ((size_t) 1 << p) + step - 1) / step;
+    return (p - ARENA_MINSHIFT) * 4 + (unsigned) k;
+}
+
+static void* arena_alloc(void* ctx, size_t len)
+{
+    arena_header_t* h = ctx;
+    unsigned char* map = ctx;
+    unsigned c = size_class(len + ARENA_BLOCKHDR);
+    uint64_t off;
+
+    if (c >= ARENA_CLASSES) goto fail;
+    if (h->free[c]) {
+        off = h->free[c];
+        memcpy(&h->free[c], map + off + ARENA_BLOCKHDR, sizeof(uint64_t));
+    } else {
+        size_t bsize = class_size(c);
+        if (h->size - h->top < bsize) goto fail;
+        off = h->top;
+        h->top += bsize;
+    }
+
+    uint64_t cls = c;
+    memcpy(map + off, &cls, sizeof(uint64_t));
+    return map + off + ARENA_BLOCKHDR;
+
+fail:
+    fprintf(stderr, "Cannot allocate %zu bytes in arena.\n", len);
+    exit(EXIT_FAILURE);
+}
+
+static void arena_free(void* ctx, void* p)
+{
+    arena_header_t* h = ctx;
+    unsigned char* block = (unsigned char*) p - ARENA_BLOCKHDR;
+    uint64_t c;
+    memcpy(&c, block, sizeof(uint64_t));
+    memcpy(p, &h->free[c], sizeof(uint64_t));
+    h->free[c] = (uint64_t) (block - (unsigned char*) ctx);
+}
+
+static void* arena_realloc(void* ctx, void* p, size_t len)
+{
+    if (p == NULL) return arena_alloc(ctx, len);
+
+    uint64_t c;
+    memcpy(&c, (unsigned char*) p - ARENA_BLOCKHDR, sizeof(uint64_t));
+    size_t cap = class_size((unsigned) c) - ARENA_BLOCKHDR;
+    if (len <= cap) return p;
+
+    void* q = arena_alloc(ctx, len);
+    memcpy(q, p, cap);
+    arena_free(ctx, p);
+    return q;
+}
+
+static void arena_bind(arena_header_t* h)
+{
+    h->mm.ctx     = h;
+    h->mm.alloc   = arena_alloc;
+    h->mm.realloc = arena_realloc;
+    h->mm.free    = arena_free;
+}
+
+
+hattrie_arena_t* hattrie_arena_open(const char* path, size_t size, hattrie_t** T)
+{
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    arena_header_t hdr;
+    void* map = MAP_FAILED;
+    bool create = false;
+    if (fstat(fd, &st) != 0) goto fail;
+
+    if (st.st_size == 0) {
+        long page = sysconf(_SC_PAGESIZE);
+        size = (size + (size_t) page - 1) / (size_t) page * (size_t) page;
+        if (size < sizeof(arena_header_t) || ftruncate(fd, (off_t) size) != 0) {
+            goto fail;
+        }
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        create = true;
+    } else {
+        /* map at the recorded address if it is free */
+        if (pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t) sizeof(hdr) ||
+            memcmp(hdr.magic, ARENA_MAGIC, sizeof(hdr.magic)) != 0 ||
+            hdr.version != ARENA_VERSION || hdr.size != (uint64_t) st.st_size ||
+            hdr.top > hdr.size || hdr.root >= hdr.top) {
+            goto fail;
+        }
+        size = (size_t) hdr.size;
+        map = mmap((void*) (uintptr_t) hdr.base, size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+    }
+    if (map == MAP_FAILED) goto fail;
+
+    arena_header_t* h = map;
+    arena_bind(h);
+    if (create) {
+        memcpy(h->magic, ARENA_MAGIC, sizeof(h->magic));
+        h->version = ARENA_VERSION;
+        h->size = size;
+        h->top  = (sizeof(arena_header_t) + 63) / 64 * 64;
+        h->base = (uint64_t) (uintptr_t) map;
+        *T = hattrie_create_mm(&h->mm);
+        h->root = (uint64_t) ((unsigned char*) *T - (unsigned char*) map);
+    } else {
+        *T = (hattrie_t*) ((unsigned char*) map + h->root);
+        if (h->base != (uint64_t) (uintptr_t) map) {
+            hattrie_rebase(*T, (uintptr_t) map - (uintptr_t) h->base);
+            h->base = (uint64_t) (uintptr_t) map;
+        }
+        hattrie_set_log(*T, NULL);
+    }
+
+    hattrie_arena_t* A = malloc_or_die(sizeof(hattrie_arena_t));
+    A->fd = fd;
+    A->map = map;
+    A->size = size;
+    return A;
+
+fail:
+    if (map != MAP_FAILED) munmap(map, size);
+    close(fd);
+    return NULL;
+}
+
+int hattrie_arena_sync(hattrie_arena_t* A)
+{
+    return msync(A->map, A->size, MS_SYNC);
+}
+
+int hattrie_arena_close(hattrie_arena_t* A)
+{
+    if (A == NULL) return 0;
+    int ret = hattrie_arena_sync(A);
+    if (munmap(A->map, A->size) != 0) ret = -1;
+    if (close(A->fd) != 0) ret = -1;
+    free(A);
+    return ret;
+}
+
+size_t hattrie_arena_used(const hattrie_arena_t* A)
+{
+    return (size_t) ((const arena_header_t*) A->map)->top;
+}
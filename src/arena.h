@@ -0,0 +1,57 @@
+/*
+ * This file is part of hat-trie.
+ *
+ * Persistent tries.
+ *
+ * A persistent trie lives in a file-backed arena: the trie, its nodes, buckets
+ * and slot arrays are allocated from a shared mapping of the file, so it
+ * survives restarts without serialization. Reopening maps the file at the
+ * address recorded in its header, which makes it O(1); if that address range
+ * is taken, the trie's pointers are rebased in one pass over the trie.
+ *
+ * The arena has a fixed capacity, chosen when it is created. The file is
+ * sparse, so capacity that was never used takes no disk space.
+ *
+ * hattrie_arena_sync checkpoints the trie by flushing the mapping. Between
+ * checkpoints the kernel may write back pages at any time, so a crash can
+ * leave a torn trie; use the write-ahead log where that matters.
+ *
+ */
+
+#ifndef HATTRIE_ARENA_H
+#define HATTRIE_ARENA_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+#include "hat-trie.h"
+
+typedef struct hattrie_arena_t_ hattrie_arena_t;
+
+/** Open a persistent trie stored at the given path, creating it if the file
+ * does not exist or is empty.
+ *
+ * size is the capacity in bytes of a new arena, an existing arena keeps its
+ * own. The trie is stored in T and belongs to the arena, it must not be freed
+ * with hattrie_free. An arena file may only be open once at a time.
+ *
+ * Returns NULL on I/O error or if the file is not an arena.
+ */
+hattrie_arena_t* hattrie_arena_open (const char* path, size_t size, hattrie_t** T);
+
+/** Flush the arena to its file. Returns 0 on success. */
+int hattrie_arena_sync (hattrie_arena_t*);
+
+/** Sync and unmap the arena. Returns 0 on success. */
+int hattrie_arena_close (hattrie_arena_t*);
+
+/** Number of bytes of the arena in use, including freed blocks. */
+size_t hattrie_arena_used (const hattrie_arena_t*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,382 @@
+/*
+ * This file is part of hat-trie.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "bcache.h"
+#include "misc.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Extents on disk are powers of two, from 64 bytes up. Freed extents are kept
+ * on a list per size and reused. */
+#define BCACHE_MINSHIFT 6
+#define BCACHE_CLASSES  48
+#define BCACHE_NOEXTENT BCACHE_CLASSES
+
+/* Image of a bucket: n, m, max_m and whether it has an order index, the used
+ * size of each slot, then the slots back to back. The order index is rebuilt
+ * on load. */
+#define BCACHE_HEADER (4 * sizeof(uint64_t))
+
+typedef struct bcache_entry_t_
+{
+    hattrie_bcache_t* cache;
+    ahtable_t* T;
+
+    bool resident;
+    bool ref;       // referenced since the clock hand passed
+    unsigned pins;
+    size_t pos;     // position in the clock while resident
+    size_t bytes;   // held while resident
+
+    unsigned cls;   // extent size class, BCACHE_NOEXTENT if never written
+    uint64_t off;   // extent offset
+    size_t len;     // image length
+    bool dirty;     // changed since it was loaded or written
+} bcache_entry_t;
+
+typedef struct extent_list_t_
+{
+    uint64_t* offs;
+    size_t n, size;
+} extent_list_t;
+
+struct hattrie_bcache_t_
+{
+    char* path;
+    int fd;
+    uint64_t end;  // end of the file
+
+    size_t budget;
+    size_t resident;
+
+    /* resident entries, swept by the clock hand */
+    bcache_entry_t** clock;
+    size_t n, size, hand;
+
+    extent_list_t free[BCACHE_CLASSES];
+
+    unsigned char* buf; // image buffer
+    size_t bufsize;
+
+    size_t loads, writes;
+};
+
+
+static void die(const char* what, const char* path)
+{
+    fprintf(stderr, "Cannot %s bucket file %s.\n", what, path);
+    exit(EXIT_FAILURE);
+}
+
+static void reserve_buf(hattrie_bcache_t* C, size_t len)
+{
+    if (len <= C->bufsize) return;
+    while (C->bufsize < len) C->bufsize *= 2;
+    C->buf = realloc_or_die(C->buf, C->bufsize);
+}
+
+
+hattrie_bcache_t* hattrie_bcache_create(const char* path, size_t budget)
+{
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return NULL;
+
+    hattrie_bcache_t* C = malloc_or_die(sizeof(hattrie_bcache_t));
+    memset(C, 0, sizeof(hattrie_bcache_t));
+    C->path = malloc_or_die(strlen(path) + 1);
+    strcpy(C->path, path);
+    C->fd = fd;
+    C->budget = budget;
+    C->size = 64;
+    C->clock = malloc_or_die(C->size * sizeof(bcache_entry_t*));
+    C->bufsize = 4096;
+    C->buf = malloc_or_die(C->bufsize);
+    return C;
+}
+
+void hattrie_bcache_free(hattrie_bcache_t* C)
+{
+    if (C == NULL) return;
+    assert(C->n == 0);
+    size_t i;
+    for (i = 0; i < BCACHE_CLASSES; ++i) free(C->free[i].offs);
+    close(C->fd);
+    unlink(C->path);
+    free(C->path);
+    free(C->clock);
+    free(C->buf);
+    free(C);
+}
+
+size_t hattrie_bcache_resident(const hattrie_bcache_t* C)
+{
+    return C->resident;
+}
+
+void hattrie_bcache_stats(const hattrie_bcache_t* C, size_t* loads, size_t* writes)
+{
+    *loads  = C->loads;
+    *writes = C->writes;
+}
+
+hattrie_bcache_t* bcache_of(const ahtable_t* T)
+{
+    return T->page ? T->page->cache : NULL;
+}
+
+
+static void clock_add(hattrie_bcache_t* C, bcache_entry_t* e)
+{
+    if (C->n == C->size) {
+        C->size *= 2;
+        C->clock = realloc_or_die(C->clock, C->size * sizeof(bcache_entry_t*));
+    }
+    e->pos = C->n;
+    C->clock[C->n++] = e;
+}
+
+static void clock_remove(hattrie_bcache_t* C, bcache_entry_t* e)
+{
+    /* the last entry takes its place, and is looked at next */
+    C->clock[e->pos] = C->clock[--C->n];
+    C->clock[e->pos]->pos = e->pos;
+    if (C->hand >= C->n) C->hand = 0;
+}
+
+static void extent_release(hattrie_bcache_t* C, bcache_entry_t* e)
+{
+    if (e->cls == BCACHE_NOEXTENT) return;
+    extent_list_t* l = &C->free[e->cls];
+    if (l->n == l->size) {
+        l->size = l->size ? 2 * l->size : 16;
+        l->offs = realloc_or_die(l->offs, l->size * sizeof(uint64_t));
+    }
+    l->offs[l->n++] = e->off;
+    e->cls = BCACHE_NOEXTENT;
+}
+
+static void extent_alloc(hattrie_bcache_t* C, bcache_entry_t* e, size_t len)
+{
+    unsigned cls = 0;
+    while (((size_t) 1 << (BCACHE_MINSHIFT + cls)) < len) ++cls;
+    if (cls >= BCACHE_CLASSES) die("grow", C->path);
+
+    extent_list_t* l = &C->free[cls];
+    if (l->n > 0) {
+        e->off = l->offs[--l->n];
+    } else {
+        e->off = C->end;
+        C->end += (uint64_t) 1 << (BCACHE_MINSHIFT + cls);
+    }
+    e->cls = cls;
+}
+
+/* write the table's image to the buffer, returns its length */
+static size_t table_image(hattrie_bcache_t* C, const ahtable_t* T)
+{
+    size_t i, len = BCACHE_HEADER + T->n * sizeof(uint32_t);
+    for (i = 0; i < T->n; ++i) len += T->slot_sizes[i];
+    reserve_buf(C, len);
+
+    uint64_t hdr[4] = { T->n, T->m, T->max_m, T->index != NULL };
+    memcpy(C->buf, hdr, BCACHE_HEADER);
+    memcpy(C->buf + BCACHE_HEADER, T->slot_sizes, T->n * sizeof(uint32_t));
+
+    unsigned char* p = C->buf + BCACHE_HEADER + T->n * sizeof(uint32_t);
+    for (i = 0; i < T->n; ++i) {
+        if (T->slot_sizes[i] == 0) continue;
+        memcpy(p, T->slots[i], T->slot_sizes[i]);
+        p += T->slot_sizes[i];
+    }
+    return len;
+}
+
+static void evict(hattrie_bcache_t* C, bcache_entry_t* e)
+{
+    ahtable_t* T = e->T;
+
+    /* clean buckets are on disk as they are */
+    if (e->cls == BCACHE_NOEXTENT || e->dirty) {
+        size_t len = table_image(C, T);
+        if (e->cls != BCACHE_NOEXTENT &&
+            ((size_t) 1 << (BCACHE_MINSHIFT + e->cls)) < len) {
+            extent_release(C, e);
+        }
+        if (e->cls == BCACHE_NOEXTENT) extent_alloc(C, e, len);
+
+        size_t done = 0;
+        while (done < len) {
+            ssize_t r = pwrite(C->fd, C->buf + done, len - done,
+                               (off_t) (e->off + done));
+            if (r <= 0) die("write", C->path);
+            done += (size_t) r;
+        }
+        e->len   = len;
+        e->dirty = false;
+        ++C->writes;
+    }
+
+    size_t i;
+    for (i = 0; i < T->n; ++i) mm_free(T->mm, T->slots[i]);
+    mm_free(T->mm, T->slots);
+    mm_free(T->mm, T->slot_sizes);
+    mm_free(T->mm, T->index);
+    T->slots = NULL;
+    T->slot_sizes = NULL;
+    T->index = NULL;
+
+    clock_remove(C, e);
+    C->resident -= e->bytes;
+    e->bytes = 0;
+    e->resident = false;
+}
+
+/* evict unreferenced buckets until the budget is met, sparing keep */
+static void balance(hattrie_bcache_t* C, const ahtable_t* keep)
+{
+    size_t scanned = 0;
+    while (C->resident > C->budget && C->n > 0 && scanned < 2 * C->n) {
+        bcache_entry_t* e = C->clock[C->hand];
+        if (e->pins || e->T == keep) {
+            C->hand = (C->hand + 1) % C->n;
+            ++scanned;
+        } else if (e->ref) {
+            e->ref = false;
+            C->hand = (C->hand + 1) % C->n;
+            ++scanned;
+        } else {
+            evict(C, e);
+            scanned = 0;
+        }
+    }
+}
+
+static void load(hattrie_bcache_t* C, bcache_entry_t* e)
+{
+    ahtable_t* T = e->T;
+    reserve_buf(C, e->len);
+
+    size_t done = 0;
+    while (done < e->len) {
+        ssize_t r = pread(C->fd, C->buf + done, e->len - done,
+                          (off_t) (e->off + done));
+        if (r <= 0) die("read", C->path);
+        done += (size_t) r;
+    }
+    ++C->loads;
+
+    uint64_t hdr[4];
+    memcpy(hdr, C->buf, BCACHE_HEADER);
+    T->n     = (size_t) hdr[0];
+    T->m     = (size_t) hdr[1];
+    T->max_m = (size_t) hdr[2];
+
+    /* slots are allocated with the used size, as on expand */
+    T->slot_sizes = mm_alloc(T->mm, 2 * T->n * sizeof(uint32_t));
+    memcpy(T->slot_sizes, C->buf + BCACHE_HEADER, T->n * sizeof(uint32_t));
+    memcpy(T->slot_sizes + T->n, T->slot_sizes, T->n * sizeof(uint32_t));
+
+    T->slots = mm_alloc(T->mm, T->n * sizeof(slot_t));
+    const unsigned char* p = C->buf + BCACHE_HEADER + T->n * sizeof(uint32_t);
+    size_t i;
+    for (i = 0; i < T->n; ++i) {
+        if (T->slot_sizes[i] == 0) {
+            T->slots[i] = NULL;
+            continue;
+        }
+        T->slots[i] = mm_alloc(T->mm, T->slot_sizes[i]);
+        memcpy(T->slots[i], p, T->slot_sizes[i]);
+        p += T->slot_sizes[i];
+    }
+
+    e->resident = true;
+    clock_add(C, e);
+    e->bytes = ahtable_bytes(T);
+    C->resident += e->bytes;
+
+    if (hdr[3]) ahtable_build_index(T);
+    e->dirty = false;
+}
+
+
+void bcache_attach(hattrie_bcache_t* C, ahtable_t* T)
+{
+    assert(T->page == NULL);
+    bcache_entry_t* e = malloc_or_die(sizeof(bcache_entry_t));
+    memset(e, 0, sizeof(bcache_entry_t));
+    e->cache = C;
+    e->T = T;
+    e->resident = true;
+    e->ref = true;
+    e->cls = BCACHE_NOEXTENT;
+    T->page = e;
+
+    clock_add(C, e);
+    e->bytes = ahtable_bytes(T);
+    C->resident += e->bytes;
+    balance(C, T);
+}
+
+void bcache_detach(ahtable_t* T)
+{
+    bcache_entry_t* e = T->page;
+    hattrie_bcache_t* C = e->cache;
+    if (e->resident) {
+        clock_remove(C, e);
+        C->resident -= e->bytes;
+    }
+    extent_release(C, e);
+    free(e);
+    T->page = NULL;
+}
+
+void bcache_touch(ahtable_t* T)
+{
+    bcache_entry_t* e = T->page;
+    e->ref = true;
+    if (!e->resident) {
+        load(e->cache, e);
+        balance(e->cache, T);
+    }
+}
+
+void bcache_dirty(ahtable_t* T)
+{
+    T->page->dirty = true;
+}
+
+void bcache_pin(ahtable_t* T)
+{
+    bcache_touch(T);
+    ++T->page->pins;
+}
+
+void bcache_unpin(ahtable_t* T)
+{
+    assert(T->page->pins > 0);
+    --T->page->pins;
+}
+
+void bcache_resize(ahtable_t* T, long delta)
+{
+    bcache_entry_t* e = T->page;
+    e->bytes += (size_t) delta;
+    e->cache->resident += (size_t) delta;
+    if (delta > 0) balance(e->cache, T);
+}
+
+void bcache_measure(ahtable_t* T)
+{
+    bcache_entry_t* e = T->page;
+    size_t bytes = ahtable_bytes(T);
+    e->cache->resident = e->cache->resident - e->bytes + bytes;
+    e->bytes = bytes;
+    balance(e->cache, T);
+}
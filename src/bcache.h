@@ -0,0 +1,79 @@
+/*
+ * This file is part of hat-trie.
+ *
+ * Bucket cache.
+ *
+ * A trie attached to a bucket cache keeps its trie nodes and bucket headers in
+ * memory, while the contents of its buckets (slots and order index) are paged
+ * to a file on local disk. Buckets are read back with pread on first access,
+ * and evicted by the CLOCK algorithm once the resident bytes exceed the memory
+ * budget. An evicted bucket is written back only if it was changed since it
+ * was loaded, through inserts, deletes or hattrie_get. Values must therefore be
+ * written through hattrie_get or hattrie_set: a write through a pointer from
+ * hattrie_tryget or an iterator may be lost when the bucket is evicted.
+ *
+ * Since any access may evict a bucket, value pointers returned by the trie are
+ * only valid until the next call on the trie. Iterators pin the bucket they
+ * are positioned in, the budget may be exceeded while many are pinned.
+ *
+ */
+
+#ifndef HATTRIE_BCACHE_H
+#define HATTRIE_BCACHE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+#include "ahtable.h"
+
+typedef struct hattrie_bcache_t_ hattrie_bcache_t;
+
+/** Create a cache paging to the given file, which is truncated. budget is the
+ * memory for resident buckets in bytes. Returns NULL if the file cannot be
+ * created. */
+hattrie_bcache_t* hattrie_bcache_create (const char* path, size_t budget);
+
+/** Free the cache and remove its file. Tries using it must be freed first. */
+void hattrie_bcache_free (hattrie_bcache_t*);
+
+/** Bytes held by resident buckets. */
+size_t hattrie_bcache_resident (const hattrie_bcache_t*);
+
+/** Number of bucket loads and write-backs so far. */
+void hattrie_bcache_stats (const hattrie_bcache_t*, size_t* loads, size_t* writes);
+
+
+/* Used by ahtable to keep its slots resident. */
+
+/** Start paging a resident table through the cache. */
+void bcache_attach (hattrie_bcache_t*, ahtable_t*);
+
+/** Stop paging a table and release its space on disk. */
+void bcache_detach (ahtable_t*);
+
+/** Make a table resident and mark it referenced. */
+void bcache_touch (ahtable_t*);
+
+/** Mark a resident table as changed, to be written back on eviction. */
+void bcache_dirty (ahtable_t*);
+
+/** Keep a table resident until unpinned. Pins nest. */
+void bcache_pin   (ahtable_t*);
+void bcache_unpin (ahtable_t*);
+
+/** Account for delta bytes allocated (or freed) by a resident table. */
+void bcache_resize (ahtable_t*, long delta);
+
+/** Recount the bytes held by a resident table. */
+void bcache_measure (ahtable_t*);
+
+/** The cache a table is paged through, or NULL. */
+hattrie_bcache_t* bcache_of (const ahtable_t*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,249 @@
+/*
+ * This file is part of hat-trie.
+ *
+ */
+
+#include "changelog.h"
+#include "misc.h"
+#include <assert.h>
+#include <string.h>
+
+struct changelog_t_
+{
+    unsigned char* buf;
+    size_t len;        // used bytes, including the header
+    size_t size;       // reserved bytes
+    size_t batch_size; // flush threshold
+
+    uint32_t count;    // records in current batch
+    uint64_t seq;      // sequence number of the next record
+
+    changelog_sink_t sink;
+    void* ctx;
+
+    /* keys got through hattrie_get, logged with their value on flush */
+    hattrie_t* T;
+    unsigned char* gets; // length and bytes of every queued key
+    size_t gets_len, gets_size;
+    bool resolving;
+};
+
+typedef struct queued_key_t_
+{
+    const char* key;
+    size_t len;
+} queued_key_t;
+
+/* LEB128 encoding */
+static inline size_t put_varint(unsigned char* p, uint64_t v)
+{
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (unsigned char) (v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (unsigned char) v;
+    return n;
+}
+
+static inline const unsigned char* get_varint(const unsigned char* p,
+                                              const unsigned char* end,
+                                              uint64_t* v)
+{
+    unsigned shift = 0;
+    *v = 0;
+    while (p < end && shift < 64) {
+        *v |= (uint64_t) (*p & 0x7f) << shift;
+        if (!(*p++ & 0x80)) return p;
+        shift += 7;
+    }
+    return NULL;
+}
+
+changelog_t* changelog_create(size_t batch_size, changelog_sink_t sink, void* ctx)
+{
+    changelog_t* L = malloc_or_die(sizeof(changelog_t));
+    memset(L, 0, sizeof(changelog_t));
+    L->batch_size = batch_size < 2 * CHANGELOG_HEADER_SIZE ?
+                    2 * CHANGELOG_HEADER_SIZE : batch_size;
+    L->size = L->batch_size;
+    L->buf  = malloc_or_die(L->size);
+    L->len  = CHANGELOG_HEADER_SIZE;
+    L->sink = sink;
+    L->ctx  = ctx;
+    return L;
+}
+
+void changelog_free(changelog_t* L)
+{
+    if (L == NULL) return;
+    changelog_flush(L);
+    free(L->gets);
+    free(L->buf);
+    free(L);
+}
+
+static int cmp_queued(const void* a_, const void* b_)
+{
+    const queued_key_t* a = a_;
+    const queued_key_t* b = b_;
+    if (a->len != b->len) return a->len < b->len ? -1 : 1;
+    return a->len > 0 ? memcmp(a->key, b->key, a->len) : 0;
+}
+
+/* Record a set of the current value of every queued key, once per key. Keys
+ * deleted since they were queued are skipped, as their delete is logged. */
+static void resolve_gets(changelog_t* L)
+{
+    if (L->gets_len == 0 || L->resolving) return;
+    L->resolving = true;
+
+    size_t n = 0, size = 64, off, len;
+    queued_key_t* ks = malloc_or_die(size * sizeof(queued_key_t));
+    for (off = 0; off < L->gets_len; off += sizeof(size_t) + len) {
+        memcpy(&len, L->gets + off, sizeof(size_t));
+        if (n == size) {
+            size *= 2;
+            ks = realloc_or_die(ks, size * sizeof(queued_key_t));
+        }
+        ks[n].key = (const char*) L->gets + off + sizeof(size_t);
+        ks[n].len = len;
+        ++n;
+    }
+    qsort(ks, n, sizeof(queued_key_t), cmp_queued);
+
+    size_t i;
+    value_t* u;
+    for (i = 0; i < n; ++i) {
+        if (i > 0 && cmp_queued(&ks[i - 1], &ks[i]) == 0) continue;
+        if (L->T && (u = hattrie_tryget(L->T, ks[i].key, ks[i].len))) {
+            changelog_append(L, CHANGELOG_SET, ks[i].key, ks[i].len, *u);
+        }
+    }
+    free(ks);
+
+    L->gets_len = 0;
+    L->resolving = false;
+}
+
+void changelog_touch(changelog_t* L, const char* key, size_t len)
+{
+    size_t need = sizeof(size_t) + len;
+    if (L->gets_len + need > L->gets_size) {
+        L->gets_size = 2 * (L->gets_len + need);
+        L->gets = realloc_or_die(L->gets, L->gets_size);
+    }
+    memcpy(L->gets + L->gets_len, &len, sizeof(size_t));
+    if (len > 0) memcpy(L->gets + L->gets_len + sizeof(size_t), key, len);
+    L->gets_len += need;
+}
+
+void changelog_attach(changelog_t* L, hattrie_t* T)
+{
+    resolve_gets(L);
+    L->T = T;
+}
+
+void changelog_flush(changelog_t* L)
+{
+    resolve_gets(L);
+    if (L->count == 0) return;
+
+    uint32_t len = (uint32_t) (L->len - CHANGELOG_HEADER_SIZE);
+    uint64_t seq = L->seq - L->count;
+    memcpy(L->buf, &len, sizeof(uint32_t));
+    memcpy(L->buf + 4, &L->count, sizeof(uint32_t));
+    memcpy(L->buf + 8, &seq, sizeof(uint64_t));
+    if (L->sink) L->sink(L->buf, L->len, L->ctx);
+
+    L->len = CHANGELOG_HEADER_SIZE;
+    L->count = 0;
+}
+
+void changelog_append(changelog_t* L, uint8_t op,
+                      const char* key, size_t len, value_t val)
+{
+    /* op + two varints + key */
+    size_t need = 1 + 10 + 10 + len;
+    if (L->len + need > L->batch_size) changelog_flush(L);
+    if (L->len + need > L->size) {
+        L->size = L->len + need;
+        L->buf = realloc_or_die(L->buf, L->size);
+    }
+
+    unsigned char* p = L->buf + L->len;
+    *p++ = op;
+    p += put_varint(p, len);
+    memcpy(p, key, len);
+    p += len;
+    if (op == CHANGELOG_SET) p += put_varint(p, val);
+
+    L->len = (size_t) (p - L->buf);
+    ++L->count;
+    ++L->seq;
+}
+
+uint64_t changelog_seq(const changelog_t* L)
+{
+    return L->seq;
+}
+
+void changelog_set_seq(changelog_t* L, uint64_t seq)
+{
+    changelog_flush(L);
+    L->seq = seq;
+}
+
+void changelog_sink_file(const unsigned char* batch, size_t len, void* ctx)
+{
+    FILE* f = ctx;
+    if (fwrite(batch, 1, len, f) != len) {
+        fprintf(stderr, "Cannot write change log batch.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+int changelog_apply(hattrie_t* T, const unsigned char* batch, size_t len,
+                    uint64_t* seq)
+{
+    if (len < CHANGELOG_HEADER_SIZE) return -1;
+
+    uint32_t blen, count;
+    uint64_t first;
+    memcpy(&blen, batch, sizeof(uint32_t));
+    memcpy(&count, batch + 4, sizeof(uint32_t));
+    memcpy(&first, batch + 8, sizeof(uint64_t));
+    if (blen > len - CHANGELOG_HEADER_SIZE) return -1;
+
+    const unsigned char* p = batch + CHANGELOG_HEADER_SIZE;
+    const unsigned char* end = p + blen;
+    uint64_t klen, val = 0;
+    uint32_t i;
+    for (i = 0; i < count; ++i) {
+        if (p >= end) return -1;
+        uint8_t op = *p++;
+        p = get_varint(p, end, &klen);
+        if (p == NULL || klen > (uint64_t) (end - p)) return -1;
+        const char* key = (const char*) p;
+        p += klen;
+
+        switch (op) {
+        case CHANGELOG_INSERT:
+            hattrie_get(T, key, klen);
+            break;
+        case CHANGELOG_SET:
+            p = get_varint(p, end, &val);
+            if (p == NULL) return -1;
+            hattrie_set(T, key, klen, (value_t) val);
+            break;
+        case CHANGELOG_DEL:
+            hattrie_del(T, key, klen);
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    if (seq) *seq = first + count;
+    return (int) count;
+}
@@ -0,0 +1,105 @@
+/*
+ * This file is part of hat-trie.
+ *
+ * Change log of trie mutations.
+ *
+ * Every insert, value write-through and delete on a trie with an attached log
+ * is appended as a compact record to the current batch. Full batches are
+ * handed to a sink (e.g. a file or a replication channel) and can be applied
+ * to a replica with changelog_apply, so replicas receive deltas instead of
+ * whole tries.
+ *
+ * hattrie_set records the value it writes. A value written through the
+ * pointer returned by hattrie_get is recorded as it is when the batch is
+ * flushed: hattrie_get queues the key, and the flush looks every queued key
+ * up once and records a set of its current value. Write through the pointer
+ * before the next call on the trie, which may flush. Writes through pointers
+ * returned by hattrie_tryget are not recorded.
+ *
+ * Batch layout (host byte order):
+ *
+ *    uint32_t len;    // size of records in bytes
+ *    uint32_t count;  // number of records
+ *    uint64_t seq;    // sequence number of the first record
+ *    records ...
+ *
+ * Record layout:
+ *
+ *    uint8_t op;      // CHANGELOG_INSERT, CHANGELOG_SET or CHANGELOG_DEL
+ *    varint  keylen;
+ *    char    key[keylen];
+ *    varint  value;   // CHANGELOG_SET only
+ *
+ */
+
+#ifndef HATTRIE_CHANGELOG_H
+#define HATTRIE_CHANGELOG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "pstdint.h"
+#include "common.h"
+#include "hat-trie.h"
+
+enum {
+    CHANGELOG_INSERT = 1, /* new key with zero value */
+    CHANGELOG_SET    = 2, /* value written through hattrie_set or hattrie_get */
+    CHANGELOG_DEL    = 3  /* key deleted */
+};
+
+/* size of the batch header */
+#define CHANGELOG_HEADER_SIZE 16
+
+typedef struct changelog_t_ changelog_t;
+
+/** Receives a complete batch. The buffer is reused after return. */
+typedef void (*changelog_sink_t)(const unsigned char* batch, size_t len, void* ctx);
+
+/** Create a log handing batches of about batch_size bytes to the sink. */
+changelog_t* changelog_create (size_t batch_size, changelog_sink_t sink, void* ctx);
+
+/** Flush pending records and free the log. */
+void         changelog_free   (changelog_t*);
+
+/** Append a record, the batch is flushed when full. */
+void         changelog_append (changelog_t*, uint8_t op,
+                               const char* key, size_t len, value_t val);
+
+/** Record the values of queued keys, then hand the pending batch to the
+ * sink, if not empty. */
+void         changelog_flush  (changelog_t*);
+
+/** Queue a key got through hattrie_get, whose value is recorded on flush. */
+void         changelog_touch  (changelog_t*, const char* key, size_t len);
+
+/** Read queued keys from the given trie, NULL to detach. Keys queued for the
+ * previous trie are recorded first. Called by hattrie_set_log and
+ * hattrie_free. */
+void         changelog_attach (changelog_t*, hattrie_t*);
+
+/** Sequence number of the next record. */
+uint64_t     changelog_seq    (const changelog_t*);
+
+/** Continue numbering from the given sequence number, flushes pending records. */
+void         changelog_set_seq (changelog_t*, uint64_t seq);
+
+/** Sink writing batches to a FILE* passed as the context. */
+void         changelog_sink_file (const unsigned char* batch, size_t len, void* ctx);
+
+/** Apply one batch to a trie.
+ *
+ * If seq is not NULL, it is set to the sequence number following the batch.
+ * Returns the number of applied records, or -1 if the batch is malformed.
+ */
+int          changelog_apply  (hattrie_t*, const unsigned char* batch, size_t len,
+                               uint64_t* seq);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,208 @@
+/*
+ * This file is part of hat-trie.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "combining.h"
+#include "misc.h"
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+/* scans of the records by one combiner before it lets go of the lock */
+#define COMBINE_PASSES 3
+
+typedef enum { OP_TRYGET, OP_SET, OP_ADD, OP_DEL } op_t;
+
+/* The request of a registered thread, pending while published. */
+typedef struct fc_rec_t_
+{
+    int pending;
+    int used;
+    op_t op;
+    const char* key;
+    size_t len;
+    value_t arg;
+    value_t res;
+    int ret;
+    struct fc_rec_t_* next;
+} fc_rec_t;
+
+struct hattrie_combining_t_
+{
+    hattrie_t* T;
+    int locked;          // combiner lock
+    fc_rec_t* recs;      // every thread that used the front-end
+    pthread_key_t key;   // record of the calling thread
+
+    /* requests of the current batch, used by the combiner only */
+    fc_rec_t** batch;
+    size_t size;
+};
+
+
+static void thread_exit(void* rec)
+{
+    fc_rec_t* r = rec;
+    __atomic_store_n(&r->used, 0, __ATOMIC_RELEASE);
+}
+
+static fc_rec_t* thread_rec(hattrie_combining_t* C)
+{
+    fc_rec_t* r = pthread_getspecific(C->key);
+    if (r) return r;
+
+    /* take over the record of a thread that exited */
+    for (r = __atomic_load_n(&C->recs, __ATOMIC_ACQUIRE); r; r = r->next) {
+        int unused = 0;
+        if (__atomic_compare_exchange_n(&r->used, &unused, 1, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) break;
+    }
+    if (r == NULL) {
+        r = malloc_or_die(sizeof(fc_rec_t));
+        memset(r, 0, sizeof(fc_rec_t));
+        r->used = 1;
+        r->next = __atomic_load_n(&C->recs, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&C->recs, &r->next, r, true,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+    pthread_setspecific(C->key, r);
+    return r;
+}
+
+
+hattrie_combining_t* hattrie_combining_create(hattrie_t* T)
+{
+    hattrie_combining_t* C = malloc_or_die(sizeof(hattrie_combining_t));
+    memset(C, 0, sizeof(hattrie_combining_t));
+    C->T = T;
+    pthread_key_create(&C->key, thread_exit);
+    C->size = 16;
+    C->batch = malloc_or_die(C->size * sizeof(fc_rec_t*));
+    return C;
+}
+
+void hattrie_combining_free(hattrie_combining_t* C)
+{
+    if (C == NULL) return;
+    fc_rec_t* r = C->recs;
+    while (r) {
+        fc_rec_t* next = r->next;
+        free(r);
+        r = next;
+    }
+    pthread_key_delete(C->key);
+    free(C->batch);
+    free(C);
+}
+
+
+static int cmp_rec(const void* a_, const void* b_)
+{
+    const fc_rec_t* a = *(fc_rec_t* const*) a_;
+    const fc_rec_t* b = *(fc_rec_t* const*) b_;
+    int c = memcmp(a->key, b->key, a->len < b->len ? a->len : b->len);
+    return c == 0 ? (a->len > b->len) - (a->len < b->len) : c;
+}
+
+static void apply(hattrie_t* T, fc_rec_t* r)
+{
+    value_t* u;
+    switch (r->op) {
+        case OP_TRYGET:
+            u = hattrie_tryget(T, r->key, r->len);
+            r->ret = u != NULL;
+            r->res = u ? *u : 0;
+            break;
+        case OP_SET:
+            hattrie_set(T, r->key, r->len, r->arg);
+            break;
+        case OP_ADD:
+            u = hattrie_get(T, r->key, r->len);
+            *u += r->arg;
+            r->res = *u;
+            break;
+        case OP_DEL:
+            r->ret = hattrie_del(T, r->key, r->len);
+            break;
+    }
+}
+
+/* Serve published requests, with the combiner lock held. */
+static void combine(hattrie_combining_t* C)
+{
+    unsigned pass;
+    for (pass = 0; pass < COMBINE_PASSES; ++pass) {
+        size_t n = 0, i;
+        fc_rec_t* r;
+        for (r = __atomic_load_n(&C->recs, __ATOMIC_ACQUIRE); r; r = r->next) {
+            if (!__atomic_load_n(&r->pending, __ATOMIC_ACQUIRE)) continue;
+            if (n == C->size) {
+                C->size *= 2;
+                C->batch = realloc_or_die(C->batch, C->size * sizeof(fc_rec_t*));
+            }
+            C->batch[n++] = r;
+        }
+        if (n == 0) break;
+
+        if (n > 1) qsort(C->batch, n, sizeof(fc_rec_t*), cmp_rec);
+        for (i = 0; i < n; ++i) {
+            apply(C->T, C->batch[i]);
+            __atomic_store_n(&C->batch[i]->pending, 0, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+/* Publish a request and wait until some combiner, maybe this thread, served
+ * it. */
+static fc_rec_t* submit(hattrie_combining_t* C, op_t op, const char* key,
+                        size_t len, value_t arg)
+{
+    fc_rec_t* r = thread_rec(C);
+    r->op  = op;
+    r->key = key;
+    r->len = len;
+    r->arg = arg;
+    __atomic_store_n(&r->pending, 1, __ATOMIC_RELEASE);
+
+    unsigned spins = 0;
+    while (__atomic_load_n(&r->pending, __ATOMIC_ACQUIRE)) {
+        int unlocked = 0;
+        if (__atomic_load_n(&C->locked, __ATOMIC_RELAXED) == 0 &&
+            __atomic_compare_exchange_n(&C->locked, &unlocked, 1, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            combine(C);
+            __atomic_store_n(&C->locked, 0, __ATOMIC_RELEASE);
+        }
+        else if (++spins % 16 == 0) sched_yield();
+    }
+    return r;
+}
+
+
+bool hattrie_combining_tryget(hattrie_combining_t* C, const char* key, size_t len,
+                              value_t* val)
+{
+    fc_rec_t* r = submit(C, OP_TRYGET, key, len, 0);
+    *val = r->res;
+    return r->ret;
+}
+
+void hattrie_combining_set(hattrie_combining_t* C, const char* key, size_t len,
+                           value_t val)
+{
+    submit(C, OP_SET, key, len, val);
+}
+
+value_t hattrie_combining_add(hattrie_combining_t* C, const char* key, size_t len,
+                              value_t delta)
+{
+    return submit(C, OP_ADD, key, len, delta)->res;
+}
+
+int hattrie_combining_del(hattrie_combining_t* C, const char* key, size_t len)
+{
+    return submit(C, OP_DEL, key, len, 0)->ret;
+}
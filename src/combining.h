@@ -0,0 +1,61 @@
+/*
+ * This file is part of hat-trie.
+ *
+ * Flat combining.
+ *
+ * A front-end sharing one ordinary trie between threads without locking it
+ * for every operation (Hendler et al. 2010). A thread publishes its request
+ * in a record of its own and waits; whichever thread takes the combiner lock
+ * applies all published requests in one batch, sorted by key so that
+ * neighbouring keys are served together, and hands back the results. The
+ * trie itself is used single threaded, as ever.
+ *
+ * Values are copied in and out, as a pointer into the trie would not stay
+ * valid while other threads write. Threads are registered on their first call
+ * and do not need to be set up.
+ *
+ */
+
+#ifndef HATTRIE_COMBINING_H
+#define HATTRIE_COMBINING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include "common.h"
+#include "hat-trie.h"
+
+typedef struct hattrie_combining_t_ hattrie_combining_t;
+
+/** Share a trie. The trie is not owned, and may be used directly again once
+ * the front-end is freed. */
+hattrie_combining_t* hattrie_combining_create (hattrie_t*);
+
+/** Free the front-end. No other thread may be using it. */
+void hattrie_combining_free (hattrie_combining_t*);
+
+/** Copy the value of a key into val. Returns false if the key does not
+ * exist. */
+bool hattrie_combining_tryget (hattrie_combining_t*, const char* key, size_t len,
+                               value_t* val);
+
+/** Set the value of a key, inserting it if it does not exist. */
+void hattrie_combining_set (hattrie_combining_t*, const char* key, size_t len,
+                            value_t val);
+
+/** Add delta to the value of a key, inserting it with value 0 first if it
+ * does not exist (hattrie_get). Returns the new value. */
+value_t hattrie_combining_add (hattrie_combining_t*, const char* key, size_t len,
+                               value_t delta);
+
+/** Delete a key. Returns 0 on success, -1 if the key does not exist. */
+int hattrie_combining_del (hattrie_combining_t*, const char* key, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -24,21 +24,20 @@ typedef unsigned long value_t;
   #define TRIE_BUCKET_SIZE 16384
 #endif
 
-/* alphabet size (0xff for full, 0x7f for 7-bit ASCII) */
-#ifndef TRIE_MAXCHAR
-  #define TRIE_MAXCHAR 0xff
+/* one in this many bucket accesses is counted for hot/cold tiering */
+#ifndef AHTABLE_HEAT_SAMPLE
+  #define AHTABLE_HEAT_SAMPLE 8
 #endif
 
-/* turn off SLAB memory allocation */
-/* #define SLAB_OFF */
-
-/* slab debugging */
-#ifdef MEM_DEBUG
-  #define dbg_mem(msg,...) fprintf(stderr, msg)
-#else
-  #define dbg_mem(msg,...)
+/* bits per key of the optional bucket membership filters */
+#ifndef AHTABLE_FILTER_BITS
+  #define AHTABLE_FILTER_BITS 10
 #endif
 
+/* alphabet size (0xff for full, 0x7f for 7-bit ASCII) */
+#ifndef TRIE_MAXCHAR
+  #define TRIE_MAXCHAR 0xff
 #endif
 
+#endif
 
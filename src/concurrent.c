@@ -0,0 +1,730 @@
+/*
+ * This file is part of hat-trie.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "concurrent.h"
+#include "ahtable.h"
+#include "misc.h"
+#include "mm.h"
+#include "murmurhash3.h"
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+/* number of child nodes for used alphabet */
+#define NODE_CHILDS (TRIE_MAXCHAR+1)
+
+static const uint8_t NODE_TYPE_TRIE          = 0x1;
+static const uint8_t NODE_TYPE_PURE_BUCKET   = 0x2;
+static const uint8_t NODE_TYPE_HYBRID_BUCKET = 0x4;
+static const uint8_t NODE_HAS_VAL            = 0x8;
+
+/* Versions: bit 0 marks a bucket replaced by a burst, bit 1 a locked node or
+ * bucket, the rest counts modifications. */
+static const uint64_t VERSION_OBSOLETE = 0x1;
+static const uint64_t VERSION_LOCKED   = 0x2;
+
+/* retired blocks gathered before trying to free some */
+#define RETIRE_BATCH 256
+
+/* blocks carry their size in front, aligned for any value */
+#define BLOCK_HEADER 16
+
+/* common head of trie nodes and buckets, the type never changes */
+typedef struct chead_t_
+{
+    uint64_t version;
+    uint8_t flag;
+} chead_t;
+
+typedef struct cnode_t_
+{
+    chead_t h;
+    value_t val;
+    chead_t* xs[NODE_CHILDS];
+} cnode_t;
+
+typedef struct cbucket_t_
+{
+    chead_t h;
+    unsigned char c0, c1; // range of children sharing the bucket
+    ahtable_t* b;
+} cbucket_t;
+
+/* A registered thread, with the epoch it entered its current operation in,
+ * or 0 between operations. */
+typedef struct epoch_rec_t_
+{
+    uint64_t local;
+    int used;
+    struct epoch_rec_t_* next;
+    char pad[40]; // one cache line per thread
+} epoch_rec_t;
+
+/* A freed block, waiting for the threads that might still read it. */
+typedef struct retired_t_
+{
+    void* p;
+    uint64_t epoch;
+} retired_t;
+
+struct hattrie_concurrent_t_
+{
+    cnode_t* root;
+    size_t m;             // number of stored keys
+
+    mm_ctx_t mm;          // buckets allocate from here, frees are deferred
+    uint64_t epoch;       // global epoch, advanced under lock
+    epoch_rec_t* recs;    // every thread that used the trie
+    pthread_key_t key;    // record of the calling thread
+
+    pthread_mutex_t lock; // guards the retired blocks and the epoch
+    retired_t* retired;   // in order of epochs
+    size_t nretired, size, collect;
+};
+
+
+/* Versions, as in optimistic lock coupling. */
+
+/* Wait for a writer, false if the node was replaced. */
+static inline bool read_lock(chead_t* h, uint64_t* v)
+{
+    unsigned spins = 0;
+    uint64_t x;
+    while ((x = __atomic_load_n(&h->version, __ATOMIC_ACQUIRE)) & VERSION_LOCKED) {
+        if (++spins % 64 == 0) sched_yield();
+    }
+    *v = x;
+    return !(x & VERSION_OBSOLETE);
+}
+
+/* True if nothing read since version v was taken has changed. */
+static inline bool validate(chead_t* h, uint64_t v)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&h->version, __ATOMIC_RELAXED) == v;
+}
+
+static inline bool upgrade(chead_t* h, uint64_t v)
+{
+    return __atomic_compare_exchange_n(&h->version, &v, v + VERSION_LOCKED, false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline void unlock(chead_t* h)
+{
+    __atomic_add_fetch(&h->version, VERSION_LOCKED, __ATOMIC_RELEASE);
+}
+
+static inline void unlock_obsolete(chead_t* h)
+{
+    __atomic_add_fetch(&h->version, VERSION_LOCKED + VERSION_OBSOLETE, __ATOMIC_RELEASE);
+}
+
+
+/* Epoch based reclamation:
+ * A block freed while the global epoch is e may still be read by threads in
+ * operations entered in epoch e or before. The epoch only advances once every
+ * thread in an operation entered the current one, so blocks freed in epoch e
+ * are released once the global epoch reaches e + 2.
+ */
+
+static void thread_exit(void* rec)
+{
+    epoch_rec_t* r = rec;
+    __atomic_store_n(&r->local, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&r->used, 0, __ATOMIC_RELEASE);
+}
+
+static epoch_rec_t* thread_rec(hattrie_concurrent_t* T)
+{
+    epoch_rec_t* r = pthread_getspecific(T->key);
+    if (r) return r;
+
+    /* take over the record of a thread that exited */
+    for (r = __atomic_load_n(&T->recs, __ATOMIC_ACQUIRE); r; r = r->next) {
+        int unused = 0;
+        if (__atomic_compare_exchange_n(&r->used, &unused, 1, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) break;
+    }
+    if (r == NULL) {
+        r = malloc_or_die(sizeof(epoch_rec_t));
+        memset(r, 0, sizeof(epoch_rec_t));
+        r->used = 1;
+        r->next = __atomic_load_n(&T->recs, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&T->recs, &r->next, r, true,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+    pthread_setspecific(T->key, r);
+    return r;
+}
+
+static epoch_rec_t* enter(hattrie_concurrent_t* T)
+{
+    epoch_rec_t* r = thread_rec(T);
+    uint64_t e;
+    /* the epoch must not have moved on before the record shows it */
+    do {
+        e = __atomic_load_n(&T->epoch, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&r->local, e, __ATOMIC_SEQ_CST);
+    } while (__atomic_load_n(&T->epoch, __ATOMIC_SEQ_CST) != e);
+    return r;
+}
+
+static inline void leave(epoch_rec_t* r)
+{
+    __atomic_store_n(&r->local, 0, __ATOMIC_RELEASE);
+}
+
+/* Called with the lock held. */
+static void advance(hattrie_concurrent_t* T)
+{
+    uint64_t e = __atomic_load_n(&T->epoch, __ATOMIC_SEQ_CST), l;
+    epoch_rec_t* r;
+    for (r = __atomic_load_n(&T->recs, __ATOMIC_ACQUIRE); r; r = r->next) {
+        l = __atomic_load_n(&r->local, __ATOMIC_SEQ_CST);
+        if (l != 0 && l != e) return;
+    }
+    __atomic_store_n(&T->epoch, e + 1, __ATOMIC_SEQ_CST);
+}
+
+static void retire(hattrie_concurrent_t* T, void* p)
+{
+    pthread_mutex_lock(&T->lock);
+    if (T->nretired == T->size) {
+        T->size *= 2;
+        T->retired = realloc_or_die(T->retired, T->size * sizeof(retired_t));
+    }
+    T->retired[T->nretired].p = p;
+    T->retired[T->nretired].epoch = __atomic_load_n(&T->epoch, __ATOMIC_SEQ_CST);
+    ++T->nretired;
+
+    if (T->nretired >= T->collect) {
+        advance(T);
+        uint64_t e = __atomic_load_n(&T->epoch, __ATOMIC_SEQ_CST);
+        size_t i;
+        for (i = 0; i < T->nretired && T->retired[i].epoch + 2 <= e; ++i) {
+            free((char*) T->retired[i].p - BLOCK_HEADER);
+        }
+        T->nretired -= i;
+        memmove(T->retired, T->retired + i, T->nretired * sizeof(retired_t));
+        T->collect = T->nretired + RETIRE_BATCH;
+    }
+    pthread_mutex_unlock(&T->lock);
+}
+
+
+/* Memory context of the buckets. Reallocation always moves, so that readers
+ * of the old block see it unchanged until it is released. */
+
+static void* block_alloc(void* ctx, size_t len)
+{
+    (void) ctx;
+    char* p = malloc_or_die(BLOCK_HEADER + len);
+    *(size_t*) p = len;
+    return p + BLOCK_HEADER;
+}
+
+static inline size_t block_size(const void* p)
+{
+    return *(const size_t*) ((const char*) p - BLOCK_HEADER);
+}
+
+static void block_free(void* ctx, void* p)
+{
+    retire((hattrie_concurrent_t*) ctx, p);
+}
+
+static void* block_realloc(void* ctx, void* p, size_t len)
+{
+    void* q = block_alloc(ctx, len);
+    if (p) {
+        size_t n = block_size(p);
+        memcpy(q, p, n < len ? n : len);
+        retire((hattrie_concurrent_t*) ctx, p);
+    }
+    return q;
+}
+
+
+static cnode_t* cnode_create(chead_t* child)
+{
+    cnode_t* node = malloc_or_die(sizeof(cnode_t));
+    node->h.version = 0;
+    node->h.flag = NODE_TYPE_TRIE;
+    node->val = 0;
+    size_t i;
+    for (i = 0; i < NODE_CHILDS; ++i) node->xs[i] = child;
+    return node;
+}
+
+static cbucket_t* cbucket_create(hattrie_concurrent_t* T,
+                                 unsigned char c0, unsigned char c1)
+{
+    cbucket_t* B = block_alloc(T, sizeof(cbucket_t));
+    B->h.version = 0;
+    B->h.flag = c0 == c1 ? NODE_TYPE_PURE_BUCKET : NODE_TYPE_HYBRID_BUCKET;
+    B->c0 = c0;
+    B->c1 = c1;
+    B->b = ahtable_create_mm(AHTABLE_INIT_SIZE, &T->mm);
+    return B;
+}
+
+
+hattrie_concurrent_t* hattrie_concurrent_create()
+{
+    hattrie_concurrent_t* T = malloc_or_die(sizeof(hattrie_concurrent_t));
+    memset(T, 0, sizeof(hattrie_concurrent_t));
+    T->mm.ctx     = T;
+    T->mm.alloc   = block_alloc;
+    T->mm.realloc = block_realloc;
+    T->mm.free    = block_free;
+    T->epoch = 1;
+    pthread_key_create(&T->key, thread_exit);
+    pthread_mutex_init(&T->lock, NULL);
+    T->size = RETIRE_BATCH;
+    T->collect = RETIRE_BATCH;
+    T->retired = malloc_or_die(T->size * sizeof(retired_t));
+
+    T->root = cnode_create(&cbucket_create(T, 0x00, TRIE_MAXCHAR)->h);
+    return T;
+}
+
+static void free_node(hattrie_concurrent_t* T, chead_t* h)
+{
+    if (h->flag & NODE_TYPE_TRIE) {
+        cnode_t* node = (cnode_t*) h;
+        size_t i;
+        for (i = 0; i < NODE_CHILDS; ++i) {
+            if (i > 0 && node->xs[i] == node->xs[i - 1]) continue;
+            free_node(T, node->xs[i]);
+        }
+        free(node);
+    } else {
+        cbucket_t* B = (cbucket_t*) h;
+        ahtable_free(B->b);
+        retire(T, B);
+    }
+}
+
+void hattrie_concurrent_free(hattrie_concurrent_t* T)
+{
+    if (T == NULL) return;
+    free_node(T, &T->root->h);
+
+    size_t i;
+    for (i = 0; i < T->nretired; ++i) free((char*) T->retired[i].p - BLOCK_HEADER);
+    free(T->retired);
+
+    epoch_rec_t* r = T->recs;
+    while (r) {
+        epoch_rec_t* next = r->next;
+        free(r);
+        r = next;
+    }
+    pthread_key_delete(T->key);
+    pthread_mutex_destroy(&T->lock);
+    free(T);
+}
+
+size_t hattrie_concurrent_size(hattrie_concurrent_t* T)
+{
+    return __atomic_load_n(&T->m, __ATOMIC_RELAXED);
+}
+
+
+/* Values are stored unaligned, and updated in place while readers copy them:
+ * both sides go byte by byte, and a torn value fails validation. */
+static inline void load_val(const unsigned char* p, value_t* val)
+{
+    unsigned char* d = (unsigned char*) val;
+    size_t j;
+    for (j = 0; j < sizeof(value_t); ++j) d[j] = __atomic_load_n(&p[j], __ATOMIC_RELAXED);
+}
+
+static inline void store_val(unsigned char* p, value_t val)
+{
+    const unsigned char* d = (const unsigned char*) &val;
+    size_t j;
+    for (j = 0; j < sizeof(value_t); ++j) __atomic_store_n(&p[j], d[j], __ATOMIC_RELAXED);
+}
+
+/* Look a key up in a bucket that may be written meanwhile. Writers publish
+ * slots, then slot sizes, with release stores (see ahtable_expand and
+ * insert_key), and only write past the published size of a slot, except for
+ * values; deletes copy the slot (bucket_del). The slot is read within its
+ * allocation, whatever its size; torn entries end the scan, and the caller
+ * validates the bucket version anyway. */
+static bool bucket_find(const ahtable_t* b, const char* key, size_t len,
+                        value_t* val)
+{
+    /* arrays loaded after the table size are at least that large */
+    uint32_t i = hash(key, len) % __atomic_load_n(&b->n, __ATOMIC_ACQUIRE);
+    slot_t* slots = __atomic_load_n(&b->slots, __ATOMIC_ACQUIRE);
+    slot_t s = __atomic_load_n(&slots[i], __ATOMIC_ACQUIRE);
+    if (s == NULL) return false;
+    uint32_t* sizes = __atomic_load_n(&b->slot_sizes, __ATOMIC_ACQUIRE);
+    size_t size = __atomic_load_n(&sizes[i], __ATOMIC_ACQUIRE);
+    if (size > block_size(s)) size = block_size(s);
+
+    slot_t end = s + size;
+    size_t k;
+    uint16_t k2;
+    while (s < end) {
+        if (*s & 0x1) {
+            if (end - s < 2) break;
+            memcpy(&k2, s, 2);
+            k = k2 >> 1;
+            s += 2;
+        } else {
+            k = *s >> 1;
+            s += 1;
+        }
+        if ((size_t) (end - s) < k + sizeof(value_t)) break;
+        if (k == len && memcmp(s, key, len) == 0) {
+            load_val(s + len, val);
+            return true;
+        }
+        s += k + sizeof(value_t);
+    }
+    return false;
+}
+
+/* Delete a key from a bucket that may be read meanwhile. Unlike ahtable_del,
+ * which moves the following entries over in place, the slot is copied
+ * without the entry to a block of its exact size, so that the next insert
+ * moves it again and no published byte is rewritten. */
+static int bucket_del(ahtable_t* b, const char* key, size_t len)
+{
+    uint32_t i = hash(key, len) % b->n;
+    slot_t base = b->slots[i], s = base, end = base + b->slot_sizes[i];
+    size_t k;
+    const char* e;
+    while (s < end) {
+        e = ahtable_slot_key(s, &k);
+        slot_t t = (slot_t) e + k + sizeof(value_t);
+        if (k == len && (len == 0 || memcmp(e, key, len) == 0)) {
+            size_t size = b->slot_sizes[i] - (size_t) (t - s);
+            slot_t q = NULL;
+            if (size > 0) {
+                q = mm_alloc(b->mm, size);
+                memcpy(q, base, (size_t) (s - base));
+                memcpy(q + (s - base), t, (size_t) (end - t));
+            }
+            b->slot_sizes[b->n + i] = size;
+            __atomic_store_n(&b->slots[i], q, __ATOMIC_RELEASE);
+            __atomic_store_n(&b->slot_sizes[i], size, __ATOMIC_RELEASE);
+            __atomic_store_n(&b->m, b->m - 1, __ATOMIC_RELAXED);
+            mm_free(b->mm, base);
+            return 0;
+        }
+        s = t;
+    }
+    return -1;
+}
+
+/* One optimistic descent, false if it has to start over. */
+static bool lookup(hattrie_concurrent_t* T, const char* key, size_t len,
+                   value_t* val, bool* found)
+{
+    cnode_t* node = T->root;
+    chead_t* child;
+    uint64_t v, cv;
+    if (!read_lock(&node->h, &v)) return false;
+
+    while (true) {
+        /* the key ends on a trie node */
+        if (len == 0) {
+            *found = __atomic_load_n(&node->h.flag, __ATOMIC_RELAXED) & NODE_HAS_VAL;
+            *val = __atomic_load_n(&node->val, __ATOMIC_RELAXED);
+            return validate(&node->h, v);
+        }
+
+        child = __atomic_load_n(&node->xs[(unsigned char) *key], __ATOMIC_ACQUIRE);
+        if (!read_lock(child, &cv) || !validate(&node->h, v)) return false;
+
+        uint8_t flag = __atomic_load_n(&child->flag, __ATOMIC_RELAXED);
+        if (flag & NODE_TYPE_TRIE) {
+            node = (cnode_t*) child;
+            v = cv;
+            ++key;
+            --len;
+            continue;
+        }
+
+        /* pure buckets hold suffixes after the consumed char */
+        if (flag & NODE_TYPE_PURE_BUCKET) {
+            ++key;
+            --len;
+        }
+        *found = bucket_find(((cbucket_t*) child)->b, key, len, val);
+        return validate(child, cv);
+    }
+}
+
+bool hattrie_concurrent_tryget(hattrie_concurrent_t* T, const char* key, size_t len,
+                               value_t* val)
+{
+    epoch_rec_t* r = enter(T);
+    bool found = false;
+    while (!lookup(T, key, len, val, &found));
+    leave(r);
+    return found;
+}
+
+
+/* Burst a full bucket, with it and its parent locked. Both are unlocked. A
+ * pure bucket gets a trie node of its own and becomes hybrid, a hybrid one
+ * is split in two new buckets by leading char. */
+static void burst(hattrie_concurrent_t* T, cnode_t* parent, cbucket_t* B)
+{
+    if (B->h.flag & NODE_TYPE_PURE_BUCKET) {
+        cnode_t* node = cnode_create(&B->h);
+
+        /* the empty suffix is the value of the new node */
+        value_t* u = ahtable_tryget(B->b, NULL, 0);
+        if (u) {
+            node->val = *u;
+            node->h.flag |= NODE_HAS_VAL;
+            bucket_del(B->b, NULL, 0);
+        }
+
+        unsigned char c = B->c0;
+        B->c0 = 0x00;
+        B->c1 = TRIE_MAXCHAR;
+        __atomic_store_n(&B->h.flag, NODE_TYPE_HYBRID_BUCKET, __ATOMIC_RELAXED);
+        __atomic_store_n(&parent->xs[c], &node->h, __ATOMIC_RELEASE);
+        unlock(&B->h);
+        unlock(&parent->h);
+        return;
+    }
+
+    /* split where both halves are closest in size, as hattrie_split_mid */
+    unsigned cs[NODE_CHILDS];
+    memset(cs, 0, sizeof(cs));
+    size_t len;
+    const char* key;
+    ahtable_iter_t i;
+    ahtable_iter_begin(B->b, &i, false);
+    while (!ahtable_iter_finished(&i)) {
+        key = ahtable_iter_key(&i, &len);
+        ++cs[(unsigned char) key[0]];
+        ahtable_iter_next(&i);
+    }
+    ahtable_iter_free(&i);
+
+    unsigned char j = B->c0;
+    long all_m = (long) ahtable_size(B->b), left_m = cs[j], right_m = all_m - left_m;
+    while (j + 1 < B->c1) {
+        long d = labs(left_m + cs[j + 1] - (right_m - cs[j + 1]));
+        if (d <= labs(left_m - right_m) && left_m + cs[j + 1] < all_m) {
+            ++j;
+            left_m  += cs[j];
+            right_m -= cs[j];
+        }
+        else break;
+    }
+
+    cbucket_t* left  = cbucket_create(T, B->c0, j);
+    cbucket_t* right = cbucket_create(T, j + 1, B->c1);
+    ahtable_iter_begin(B->b, &i, false);
+    while (!ahtable_iter_finished(&i)) {
+        key = ahtable_iter_key(&i, &len);
+        cbucket_t* dst = (unsigned char) key[0] > j ? right : left;
+        if (dst->h.flag & NODE_TYPE_PURE_BUCKET) {
+            ahtable_insert(dst->b, key + 1, len - 1, *ahtable_iter_val(&i));
+        } else {
+            ahtable_insert(dst->b, key, len, *ahtable_iter_val(&i));
+        }
+        ahtable_iter_next(&i);
+    }
+    ahtable_iter_free(&i);
+
+    unsigned c;
+    for (c = B->c0; c <= B->c1; ++c) {
+        __atomic_store_n(&parent->xs[c], c > j ? &right->h : &left->h, __ATOMIC_RELEASE);
+    }
+    unlock(&parent->h);
+    unlock_obsolete(&B->h);
+    ahtable_free(B->b);
+    retire(T, B);
+}
+
+
+typedef enum { OP_SET, OP_ADD, OP_DEL } op_t;
+
+static int update_node(hattrie_concurrent_t* T, cnode_t* node, op_t op,
+                       value_t arg, value_t* res)
+{
+    uint8_t flag = node->h.flag;
+    if (op == OP_DEL) {
+        if (!(flag & NODE_HAS_VAL)) return -1;
+        __atomic_store_n(&node->h.flag, flag & ~NODE_HAS_VAL, __ATOMIC_RELAXED);
+        __atomic_store_n(&node->val, 0, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&T->m, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    value_t val = node->val;
+    if (!(flag & NODE_HAS_VAL)) {
+        val = 0;
+        __atomic_store_n(&node->h.flag, flag | NODE_HAS_VAL, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&T->m, 1, __ATOMIC_RELAXED);
+    }
+    *res = op == OP_SET ? arg : val + arg;
+    __atomic_store_n(&node->val, *res, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static int update_bucket(hattrie_concurrent_t* T, ahtable_t* b,
+                         const char* key, size_t len, op_t op,
+                         value_t arg, value_t* res)
+{
+    if (op == OP_DEL) {
+        if (bucket_del(b, key, len) != 0) return -1;
+        __atomic_sub_fetch(&T->m, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    size_t m_old = b->m;
+    value_t* u = ahtable_get(b, key, len);
+    if (b->m != m_old) __atomic_add_fetch(&T->m, 1, __ATOMIC_RELAXED);
+    *res = op == OP_SET ? arg : *u + arg;
+    store_val((unsigned char*) u, *res);
+    return 0;
+}
+
+/* One descent applying an update, false if it has to start over. */
+static bool update(hattrie_concurrent_t* T, const char* key, size_t len,
+                   op_t op, value_t arg, value_t* res, int* ret)
+{
+    cnode_t* node = T->root;
+    chead_t* child;
+    uint64_t v, cv;
+    if (!read_lock(&node->h, &v)) return false;
+
+    while (true) {
+        if (len == 0) {
+            if (!upgrade(&node->h, v)) return false;
+            *ret = update_node(T, node, op, arg, res);
+            unlock(&node->h);
+            return true;
+        }
+
+        child = __atomic_load_n(&node->xs[(unsigned char) *key], __ATOMIC_ACQUIRE);
+        if (!read_lock(child, &cv) || !validate(&node->h, v)) return false;
+
+        if (__atomic_load_n(&child->flag, __ATOMIC_RELAXED) & NODE_TYPE_TRIE) {
+            node = (cnode_t*) child;
+            v = cv;
+            ++key;
+            --len;
+            continue;
+        }
+
+        /* preemptively burst a full bucket, then look again */
+        cbucket_t* B = (cbucket_t*) child;
+        if (op != OP_DEL &&
+            __atomic_load_n(&B->b->m, __ATOMIC_RELAXED) >= TRIE_BUCKET_SIZE) {
+            if (!upgrade(&node->h, v)) return false;
+            if (!upgrade(child, cv)) {
+                unlock(&node->h);
+                return false;
+            }
+            burst(T, node, B);
+            return false;
+        }
+
+        if (!upgrade(child, cv)) return false;
+        if (B->h.flag & NODE_TYPE_PURE_BUCKET) {
+            ++key;
+            --len;
+        }
+        *ret = update_bucket(T, B->b, key, len, op, arg, res);
+        unlock(child);
+        return true;
+    }
+}
+
+static int apply(hattrie_concurrent_t* T, const char* key, size_t len,
+                 op_t op, value_t arg, value_t* res)
+{
+    epoch_rec_t* r = enter(T);
+    int ret = 0;
+    while (!update(T, key, len, op, arg, res, &ret));
+    leave(r);
+    return ret;
+}
+
+void hattrie_concurrent_set(hattrie_concurrent_t* T, const char* key, size_t len,
+                            value_t val)
+{
+    value_t res;
+    apply(T, key, len, OP_SET, val, &res);
+}
+
+value_t hattrie_concurrent_add(hattrie_concurrent_t* T, const char* key, size_t len,
+                               value_t delta)
+{
+    value_t res = 0;
+    apply(T, key, len, OP_ADD, delta, &res);
+    return res;
+}
+
+int hattrie_concurrent_del(hattrie_concurrent_t* T, const char* key, size_t len)
+{
+    value_t res;
+    return apply(T, key, len, OP_DEL, 0, &res);
+}
+
+
+/* Copy a subtree, whose keys start with the first depth chars of buf. */
+static void copy_node(hattrie_t* C, chead_t* h, char** buf, size_t* size,
+                      size_t depth)
+{
+    size_t i, len;
+    const char* key;
+    if (h->flag & NODE_TYPE_TRIE) {
+        cnode_t* node = (cnode_t*) h;
+        if (depth + 1 > *size) {
+            *size = 2 * (depth + 1);
+            *buf = realloc_or_die(*buf, *size);
+        }
+        if (node->h.flag & NODE_HAS_VAL) *hattrie_get(C, *buf, depth) = node->val;
+        for (i = 0; i < NODE_CHILDS; ++i) {
+            if (i > 0 && node->xs[i] == node->xs[i - 1]) continue;
+            (*buf)[depth] = (char) i;
+            copy_node(C, node->xs[i], buf, size,
+                      node->xs[i]->flag & NODE_TYPE_HYBRID_BUCKET ? depth : depth + 1);
+        }
+        return;
+    }
+
+    ahtable_iter_t it;
+    ahtable_iter_begin(((cbucket_t*) h)->b, &it, false);
+    while (!ahtable_iter_finished(&it)) {
+        key = ahtable_iter_key(&it, &len);
+        if (depth + len + 1 > *size) {
+            *size = 2 * (depth + len + 1);
+            *buf = realloc_or_die(*buf, *size);
+        }
+        memcpy(*buf + depth, key, len);
+        *hattrie_get(C, *buf, depth + len) = *ahtable_iter_val(&it);
+        ahtable_iter_next(&it);
+    }
+    ahtable_iter_free(&it);
+}
+
+hattrie_t* hattrie_concurrent_copy(hattrie_concurrent_t* T)
+{
+    hattrie_t* C = hattrie_create();
+    size_t size = 1024;
+    char* buf = malloc_or_die(size);
+    copy_node(C, &T->root->h, &buf, &size, 0);
+    free(buf);
+    return C;
+}
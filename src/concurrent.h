@@ -0,0 +1,76 @@
+/*
+ * This file is part of hat-trie.
+ *
+ * Concurrent tries.
+ *
+ * A HAT-trie shared by any number of reading and writing threads, using
+ * optimistic lock coupling (Leis et al. 2016, as in ART-OLC). Trie nodes and
+ * buckets carry a version counter with a lock bit. Readers descend without
+ * writing shared memory: they note the version of each node, read it, and
+ * check that the version did not change, starting over if it did. Writers lock
+ * only the bucket they modify, or the trie node holding the value of a key
+ * that ends on it; bursting a full bucket also locks its parent.
+ *
+ * Buckets are ordinary array hash tables (see ahtable.h) allocated from a
+ * memory context that defers frees until no thread can still be reading the
+ * memory (epoch based reclamation), so an optimistic reader never touches
+ * freed memory, and scans slots within the bounds of their allocation.
+ * Writers publish slots with release stores and delete by copying a slot, so
+ * that the bytes a reader scans are not written meanwhile, values aside,
+ * which both sides copy with atomic byte accesses. test/check_concurrent_tsan
+ * runs the tests under ThreadSanitizer where the compiler supports it.
+ *
+ * Values are copied in and out, as a pointer into a bucket would not stay
+ * valid while other threads write. Threads are registered on their first call
+ * and do not need to be set up.
+ *
+ */
+
+#ifndef HATTRIE_CONCURRENT_H
+#define HATTRIE_CONCURRENT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include "common.h"
+#include "hat-trie.h"
+
+typedef struct hattrie_concurrent_t_ hattrie_concurrent_t;
+
+hattrie_concurrent_t* hattrie_concurrent_create (void); //< Create an empty trie.
+
+/** Free a trie. No other thread may be using it. */
+void hattrie_concurrent_free (hattrie_concurrent_t*);
+
+/** Number of stored keys. */
+size_t hattrie_concurrent_size (hattrie_concurrent_t*);
+
+/** Copy the value of a key into val. Returns false if the key does not
+ * exist. */
+bool hattrie_concurrent_tryget (hattrie_concurrent_t*, const char* key, size_t len,
+                                value_t* val);
+
+/** Set the value of a key, inserting it if it does not exist. */
+void hattrie_concurrent_set (hattrie_concurrent_t*, const char* key, size_t len,
+                             value_t val);
+
+/** Add delta to the value of a key, inserting it with value 0 first if it
+ * does not exist. Returns the new value. */
+value_t hattrie_concurrent_add (hattrie_concurrent_t*, const char* key, size_t len,
+                                value_t delta);
+
+/** Delete a key. Returns 0 on success, -1 if the key does not exist. */
+int hattrie_concurrent_del (hattrie_concurrent_t*, const char* key, size_t len);
+
+/** Copy all keys and values into a new ordinary trie. No other thread may be
+ * writing. */
+hattrie_t* hattrie_concurrent_copy (hattrie_concurrent_t*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
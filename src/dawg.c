@@ -0,0 +1,443 @@
+/*
+ * This file is part of hat-trie.
+ *
+ */
+
+#include "dawg.h"
+#include "misc.h"
+#include <assert.h>
+#include <string.h>
+
+static inline bool is_final(const dawg_t* D, uint32_t s)
+{
+    return D->first[s] == D->first[s + 1] || D->before[D->first[s]] == 1;
+}
+
+size_t dawg_search(const dawg_t* D, const char* key, size_t len, bool* found)
+{
+    const unsigned char* k = (const unsigned char*) key;
+    size_t i, rank = 0;
+    uint32_t s = 0;
+    *found = false;
+    if (D->n == 0) return 0;
+
+    for (i = 0; i < len; ++i) {
+        /* first edge not less than the next character */
+        uint32_t lo = D->first[s], hi = D->first[s + 1];
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (D->labels[mid] < k[i]) lo = mid + 1;
+            else hi = mid;
+        }
+        if (lo == D->first[s + 1]) return rank + D->total[s];
+        rank += D->before[lo];
+        if (D->labels[lo] != k[i]) return rank;
+        s = D->targets[lo];
+    }
+
+    /* keys extending the searched key sort after it */
+    *found = is_final(D, s);
+    return rank;
+}
+
+
+typedef struct bedge_t_
+{
+    unsigned char label;
+    uint32_t target;
+} bedge_t;
+
+typedef struct bstate_t_
+{
+    bedge_t* e;
+    uint32_t n, size;
+    bool final;
+} bstate_t;
+
+struct dawg_builder_t_
+{
+    bstate_t* states;
+    size_t nstates, size;
+    uint32_t* free;       // ids of merged states, for reuse
+    size_t nfree, freesize;
+
+    /* register of minimized states, hashed by their edges, 0 is empty (the
+     * root is never registered) */
+    uint32_t* reg;
+    size_t regn, regsize;
+
+    uint32_t* path;       // states along the previous key
+    char* prev;           // previous key
+    size_t prev_len, prev_size;
+
+    size_t n;
+    bool finished;
+
+    /* layout */
+    size_t out_states, out_edges;
+    uint32_t *first, *total, *targets, *before;
+    unsigned char* labels;
+};
+
+
+static uint32_t new_state(dawg_builder_t* b)
+{
+    uint32_t s;
+    if (b->nfree > 0) {
+        s = b->free[--b->nfree];
+    } else {
+        if (b->nstates == b->size) {
+            b->size *= 2;
+            b->states = realloc_or_die(b->states, b->size * sizeof(bstate_t));
+        }
+        s = (uint32_t) b->nstates++;
+        assert(b->nstates < UINT32_MAX);
+    }
+    memset(&b->states[s], 0, sizeof(bstate_t));
+    return s;
+}
+
+static void free_state(dawg_builder_t* b, uint32_t s)
+{
+    free(b->states[s].e);
+    b->states[s].e = NULL;
+    if (b->nfree == b->freesize) {
+        b->freesize = b->freesize ? 2 * b->freesize : 1024;
+        b->free = realloc_or_die(b->free, b->freesize * sizeof(uint32_t));
+    }
+    b->free[b->nfree++] = s;
+}
+
+static void add_edge(dawg_builder_t* b, uint32_t s, unsigned char label,
+                     uint32_t target)
+{
+    bstate_t* st = &b->states[s];
+    if (st->n == st->size) {
+        st->size = st->size ? 2 * st->size : 2;
+        st->e = realloc_or_die(st->e, st->size * sizeof(bedge_t));
+    }
+    st->e[st->n].label  = label;
+    st->e[st->n].target = target;
+    ++st->n;
+}
+
+static uint64_t state_hash(const bstate_t* st)
+{
+    /* FNV-1a over the final flag and edges */
+    uint64_t h = 0xcbf29ce484222325ULL ^ (uint64_t) st->final;
+    uint32_t i;
+    for (i = 0; i < st->n; ++i) {
+        h = (h ^ st->e[i].label) * 0x100000001b3ULL;
+        h = (h ^ st->e[i].target) * 0x100000001b3ULL;
+    }
+    h ^= h >> 32;
+    return h;
+}
+
+static bool state_equal(const bstate_t* a, const bstate_t* b)
+{
+    uint32_t i;
+    if (a->final != b->final || a->n != b->n) return false;
+    for (i = 0; i < a->n; ++i) {
+        if (a->e[i].label != b->e[i].label || a->e[i].target != b->e[i].target) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void reg_grow(dawg_builder_t* b)
+{
+    uint32_t* old = b->reg;
+    size_t i, oldsize = b->regsize;
+    b->regsize *= 2;
+    b->reg = malloc_or_die(b->regsize * sizeof(uint32_t));
+    memset(b->reg, 0, b->regsize * sizeof(uint32_t));
+    for (i = 0; i < oldsize; ++i) {
+        if (old[i] == 0) continue;
+        size_t j = (size_t) state_hash(&b->states[old[i]]) & (b->regsize - 1);
+        while (b->reg[j]) j = (j + 1) & (b->regsize - 1);
+        b->reg[j] = old[i];
+    }
+    free(old);
+}
+
+/* the registered state equivalent to s, registering s if there is none */
+static uint32_t reg_get(dawg_builder_t* b, uint32_t s)
+{
+    if (2 * (b->regn + 1) > b->regsize) reg_grow(b);
+    const bstate_t* st = &b->states[s];
+    size_t j = (size_t) state_hash(st) & (b->regsize - 1);
+    while (b->reg[j]) {
+        if (state_equal(&b->states[b->reg[j]], st)) return b->reg[j];
+        j = (j + 1) & (b->regsize - 1);
+    }
+    b->reg[j] = s;
+    ++b->regn;
+    return s;
+}
+
+/* Replace the states of the previous key below depth by equivalent
+ * registered ones, deepest first, as they can no longer change. */
+static void minimize(dawg_builder_t* b, size_t depth)
+{
+    size_t i;
+    for (i = b->prev_len; i > depth; --i) {
+        uint32_t child = b->path[i];
+        uint32_t q = reg_get(b, child);
+        if (q != child) {
+            bstate_t* parent = &b->states[b->path[i - 1]];
+            parent->e[parent->n - 1].target = q;
+            free_state(b, child);
+        }
+    }
+}
+
+
+dawg_builder_t* dawg_builder_create()
+{
+    dawg_builder_t* b = malloc_or_die(sizeof(dawg_builder_t));
+    memset(b, 0, sizeof(dawg_builder_t));
+    b->size = 1024;
+    b->states = malloc_or_die(b->size * sizeof(bstate_t));
+    b->regsize = 1024;
+    b->reg = malloc_or_die(b->regsize * sizeof(uint32_t));
+    memset(b->reg, 0, b->regsize * sizeof(uint32_t));
+    b->prev_size = 64;
+    b->prev = malloc_or_die(b->prev_size);
+    b->path = malloc_or_die((b->prev_size + 1) * sizeof(uint32_t));
+    b->path[0] = new_state(b);
+    return b;
+}
+
+static void free_states(dawg_builder_t* b)
+{
+    size_t i;
+    for (i = 0; i < b->nstates; ++i) free(b->states[i].e);
+    free(b->states);
+    free(b->free);
+    free(b->reg);
+    free(b->path);
+    free(b->prev);
+    b->states = NULL;
+    b->nstates = 0;
+    b->free = NULL;
+    b->reg = NULL;
+    b->path = NULL;
+    b->prev = NULL;
+}
+
+void dawg_builder_free(dawg_builder_t* b)
+{
+    if (b == NULL) return;
+    free_states(b);
+    free(b->first);
+    free(b->total);
+    free(b->labels);
+    free(b->targets);
+    free(b->before);
+    free(b);
+}
+
+void dawg_builder_add(dawg_builder_t* b, const char* key, size_t len)
+{
+    assert(!b->finished);
+    size_t i = 0;
+    size_t m = b->prev_len < len ? b->prev_len : len;
+    while (i < m && b->prev[i] == key[i]) ++i;
+    assert(b->n == 0 || (i < len && (i == b->prev_len ||
+           (unsigned char) b->prev[i] < (unsigned char) key[i])));
+
+    minimize(b, i);
+
+    if (len > b->prev_size) {
+        while (b->prev_size < len) b->prev_size *= 2;
+        b->prev = realloc_or_die(b->prev, b->prev_size);
+        b->path = realloc_or_die(b->path, (b->prev_size + 1) * sizeof(uint32_t));
+    }
+    for (; i < len; ++i) {
+        uint32_t s = new_state(b);
+        add_edge(b, b->path[i], (unsigned char) key[i], s);
+        b->path[i + 1] = s;
+    }
+    b->states[b->path[len]].final = true;
+
+    if (len > 0) memcpy(b->prev, key, len);
+    b->prev_len = len;
+    ++b->n;
+    assert(b->n < UINT32_MAX);
+}
+
+void dawg_builder_finish(dawg_builder_t* b, dawg_t* dst)
+{
+    if (!b->finished) {
+        minimize(b, 0);
+        b->finished = true;
+
+        /* Number states in reverse post-order, so that every state comes
+         * before the states it leads to, counting keys on the way. */
+        const uint32_t root = b->path[0];
+        uint32_t* id = malloc_or_die(b->nstates * sizeof(uint32_t));
+        uint32_t* count = malloc_or_die(b->nstates * sizeof(uint32_t));
+        uint32_t* post = malloc_or_die(b->nstates * sizeof(uint32_t));
+        size_t i, npost = 0, nedges = 0;
+        for (i = 0; i < b->nstates; ++i) id[i] = UINT32_MAX;
+
+        size_t sp = 0, stacksize = 64;
+        uint32_t (*stack)[2] = malloc_or_die(stacksize * sizeof(*stack));
+        stack[sp][0] = root;
+        stack[sp++][1] = 0;
+        id[root] = 0;
+        while (sp > 0) {
+            uint32_t s = stack[sp - 1][0];
+            bstate_t* st = &b->states[s];
+            if (stack[sp - 1][1] < st->n) {
+                uint32_t t = st->e[stack[sp - 1][1]++].target;
+                if (id[t] != UINT32_MAX) continue;
+                id[t] = 0; /* visited */
+                if (sp == stacksize) {
+                    stacksize *= 2;
+                    stack = realloc_or_die(stack, stacksize * sizeof(*stack));
+                }
+                stack[sp][0] = t;
+                stack[sp++][1] = 0;
+                continue;
+            }
+            count[s] = st->final ? 1 : 0;
+            for (i = 0; i < st->n; ++i) count[s] += count[st->e[i].target];
+            nedges += st->n;
+            post[npost++] = s;
+            --sp;
+        }
+        free(stack);
+        for (i = 0; i < npost; ++i) id[post[npost - 1 - i]] = (uint32_t) i;
+
+        b->first   = malloc_or_die((npost + 1) * sizeof(uint32_t));
+        b->total   = malloc_or_die(npost * sizeof(uint32_t));
+        b->labels  = malloc_or_die(nedges ? nedges : 1);
+        b->targets = malloc_or_die((nedges ? nedges : 1) * sizeof(uint32_t));
+        b->before  = malloc_or_die((nedges ? nedges : 1) * sizeof(uint32_t));
+
+        uint32_t e = 0, j;
+        for (i = 0; i < npost; ++i) {
+            const bstate_t* st = &b->states[post[npost - 1 - i]];
+            uint32_t acc = st->final ? 1 : 0;
+            b->first[i] = e;
+            b->total[i] = count[post[npost - 1 - i]];
+            for (j = 0; j < st->n; ++j, ++e) {
+                b->labels[e]  = st->e[j].label;
+                b->targets[e] = id[st->e[j].target];
+                b->before[e]  = acc;
+                acc += count[st->e[j].target];
+            }
+        }
+        b->first[npost] = e;
+
+        b->out_states = npost;
+        b->out_edges  = nedges;
+        free(id);
+        free(count);
+        free(post);
+        free_states(b);
+    }
+
+    dst->n       = b->n;
+    dst->nstates = b->out_states;
+    dst->nedges  = b->out_edges;
+    dst->first   = b->first;
+    dst->total   = b->total;
+    dst->labels  = b->labels;
+    dst->targets = b->targets;
+    dst->before  = b->before;
+}
+
+
+struct dawg_iter_t_
+{
+    const dawg_t* D;
+    size_t rank;
+    bool finished;
+
+    uint32_t (*stack)[2]; // state and next edge, one per key character
+    size_t sp, size;
+    char* key;
+};
+
+static void iter_push(dawg_iter_t* i, uint32_t s)
+{
+    if (i->sp == i->size) {
+        i->size *= 2;
+        i->stack = realloc_or_die(i->stack, i->size * sizeof(*i->stack));
+        i->key = realloc_or_die(i->key, i->size);
+    }
+    i->stack[i->sp][0] = s;
+    i->stack[i->sp++][1] = i->D->first[s];
+}
+
+/* advance to the next final state */
+static void iter_advance(dawg_iter_t* i)
+{
+    const dawg_t* D = i->D;
+    while (i->sp > 0) {
+        uint32_t s = i->stack[i->sp - 1][0];
+        uint32_t e = i->stack[i->sp - 1][1];
+        if (e == D->first[s + 1]) {
+            --i->sp;
+            continue;
+        }
+        ++i->stack[i->sp - 1][1];
+        i->key[i->sp - 1] = (char) D->labels[e];
+        iter_push(i, D->targets[e]);
+        if (is_final(D, D->targets[e])) return;
+    }
+    i->finished = true;
+}
+
+dawg_iter_t* dawg_iter_begin(const dawg_t* D)
+{
+    dawg_iter_t* i = malloc_or_die(sizeof(dawg_iter_t));
+    i->D = D;
+    i->rank = 0;
+    i->finished = D->n == 0;
+    i->size = 64;
+    i->stack = malloc_or_die(i->size * sizeof(*i->stack));
+    i->key = malloc_or_die(i->size);
+    i->sp = 0;
+    if (!i->finished) {
+        iter_push(i, 0);
+        if (!is_final(D, 0)) iter_advance(i);
+    }
+    return i;
+}
+
+void dawg_iter_next(dawg_iter_t* i)
+{
+    if (i->finished) return;
+    ++i->rank;
+    iter_advance(i);
+}
+
+bool dawg_iter_finished(dawg_iter_t* i)
+{
+    return i->finished;
+}
+
+void dawg_iter_free(dawg_iter_t* i)
+{
+    if (i == NULL) return;
+    free(i->stack);
+    free(i->key);
+    free(i);
+}
+
+const char* dawg_iter_key(dawg_iter_t* i, size_t* len)
+{
+    if (i->finished) return NULL;
+    *len = i->sp - 1;
+    return i->key;
+}
+
+size_t dawg_iter_rank(dawg_iter_t* i)
+{
+    return i->rank;
+}
@@ -0,0 +1,83 @@
+/*
+ * This file is part of hat-trie.
+ *
+ * Directed acyclic word graphs.
+ *
+ * A DAWG is the minimal automaton accepting a sorted key set: states reached
+ * by the same set of suffixes are merged, so a suffix shared by many keys
+ * (such as inflections in a dictionary) is stored once. It is built
+ * incrementally from sorted keys (Daciuk et al., 2000).
+ *
+ * Values cannot live in merged states. Instead every edge records how many
+ * keys of its state sort before it, so that a lookup sums them into the rank
+ * of the key, which indexes a separate value array.
+ *
+ * Encoding (state 0 is the root, a state is final if it has no edges or its
+ * first edge has one key before it, the empty suffix):
+ *
+ *    uint32_t      first[nstates + 1]  first edge of each state, and the end
+ *    uint32_t      total[nstates]      keys accepted from each state
+ *    unsigned char labels[nedges]      edge labels, ascending per state
+ *    uint32_t      targets[nedges]
+ *    uint32_t      before[nedges]      keys of the state before the edge
+ *
+ */
+
+#ifndef HATTRIE_DAWG_H
+#define HATTRIE_DAWG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include "pstdint.h"
+#include "common.h"
+
+typedef struct dawg_t_
+{
+    size_t n;        // number of keys
+    size_t nstates;
+    size_t nedges;
+    const uint32_t* first;
+    const uint32_t* total;
+    const unsigned char* labels;
+    const uint32_t* targets;
+    const uint32_t* before;
+} dawg_t;
+
+/** Rank of the first key not less than the given key, setting found if it is
+ * equal. */
+size_t dawg_search (const dawg_t*, const char* key, size_t len, bool* found);
+
+
+/* Build a DAWG from keys added in ascending order. At most 2^32 - 1 keys and
+ * states. */
+typedef struct dawg_builder_t_ dawg_builder_t;
+
+dawg_builder_t* dawg_builder_create (void);
+void            dawg_builder_free   (dawg_builder_t*);
+void            dawg_builder_add    (dawg_builder_t*, const char* key, size_t len);
+
+/** Minimize the remaining states and lay the automaton out. No keys may be
+ * added afterwards. The view is valid until the builder is freed. */
+void dawg_builder_finish (dawg_builder_t*, dawg_t* dst);
+
+
+/* Sorted iteration. Keys are decoded into the iterator, and are valid until
+ * the next call to dawg_iter_next. */
+typedef struct dawg_iter_t_ dawg_iter_t;
+
+dawg_iter_t* dawg_iter_begin    (const dawg_t*);
+void         dawg_iter_next     (dawg_iter_t*);
+bool         dawg_iter_finished (dawg_iter_t*);
+void         dawg_iter_free     (dawg_iter_t*);
+const char*  dawg_iter_key      (dawg_iter_t*, size_t* len);
+size_t       dawg_iter_rank     (dawg_iter_t*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,424 @@
+/*
+ * This file is part of hat-trie.
+ *
+ */
+
+#include "fcbucket.h"
+#include "misc.h"
+#include <assert.h>
+#include <string.h>
+
+static inline const unsigned char* get_varint(const unsigned char* p, uint64_t* x)
+{
+    unsigned shift = 0;
+    *x = 0;
+    do {
+        *x |= (uint64_t) (*p & 0x7f) << shift;
+        shift += 7;
+    } while (*p++ & 0x80);
+    return p;
+}
+
+static inline size_t put_varint(unsigned char* p, uint64_t x)
+{
+    size_t k = 0;
+    while (x >= 0x80) {
+        p[k++] = (unsigned char) (x | 0x80);
+        x >>= 7;
+    }
+    p[k++] = (unsigned char) x;
+    return k;
+}
+
+static inline size_t block_count(const fcbucket_t* B, size_t b)
+{
+    size_t left = B->n - b * FCBUCKET_BLOCK;
+    return left < FCBUCKET_BLOCK ? left : FCBUCKET_BLOCK;
+}
+
+static inline const unsigned char* block_head(const fcbucket_t* B, size_t b,
+                                              size_t* len)
+{
+    uint64_t x;
+    const unsigned char* p = get_varint(B->data + B->heads[b], &x);
+    *len = (size_t) x;
+    return p;
+}
+
+static int keycmp(const unsigned char* a, size_t alen,
+                  const unsigned char* b, size_t blen)
+{
+    size_t m = alen < blen ? alen : blen;
+    int c = m > 0 ? memcmp(a, b, m) : 0;
+    if (c != 0) return c;
+    return alen < blen ? -1 : (alen > blen ? 1 : 0);
+}
+
+/* length of the common prefix */
+static inline size_t prefix_len(const unsigned char* a, size_t alen,
+                                const unsigned char* b, size_t blen)
+{
+    size_t i, m = alen < blen ? alen : blen;
+    for (i = 0; i < m && a[i] == b[i]; ++i);
+    return i;
+}
+
+/* Scan block b, whose head is less than key, for the first key not less than
+ * key. Front coding lets this compare suffixes only: m is the prefix the
+ * previous key shares with the searched key. Returns the rank, and the
+ * position of the value if found. */
+static size_t block_search(const fcbucket_t* B, size_t b,
+                           const unsigned char* key, size_t len,
+                           bool* found, const unsigned char** val)
+{
+    size_t hlen, i, count = block_count(B, b);
+    const unsigned char* p = block_head(B, b, &hlen);
+    size_t m = prefix_len(p, hlen, key, len);
+    p += hlen;
+
+    uint64_t x, shared, slen;
+    for (i = 1; i < count; ++i) {
+        if (B->flags & FCBUCKET_VARINT) p = get_varint(p, &x);
+        p = get_varint(p, &shared);
+        p = get_varint(p, &slen);
+        const unsigned char* s = p;
+        p += slen;
+
+        /* diverging before the previous key did makes this key greater,
+         * diverging later keeps it as small */
+        if (shared < m) break;
+        if (shared > m) continue;
+
+        size_t c = prefix_len(s, slen, key + m, len - m);
+        if (c == slen && m + c == len) {
+            *found = true;
+            *val = p;
+            return b * FCBUCKET_BLOCK + i;
+        }
+        if (c == slen) {                      /* a prefix of key */
+            m += c;
+            continue;
+        }
+        if (m + c < len && s[c] < key[m + c]) {
+            m += c;
+            continue;
+        }
+        break;
+    }
+    *found = false;
+    return b * FCBUCKET_BLOCK + i;
+}
+
+static size_t search(const fcbucket_t* B, const char* key, size_t len,
+                     bool* found, const unsigned char** val)
+{
+    const unsigned char* k = (const unsigned char*) key;
+    size_t hlen;
+    *found = false;
+
+    /* last block whose head is not greater than the key */
+    size_t lo = 0, hi = B->nblocks;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const unsigned char* h = block_head(B, mid, &hlen);
+        int c = keycmp(h, hlen, k, len);
+        if (c == 0) {
+            *found = true;
+            *val = h + hlen;
+            return mid * FCBUCKET_BLOCK;
+        }
+        if (c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == 0) return 0;
+    return block_search(B, lo - 1, k, len, found, val);
+}
+
+size_t fcbucket_search(const fcbucket_t* B, const char* key, size_t len, bool* found)
+{
+    const unsigned char* val;
+    return search(B, key, len, found, &val);
+}
+
+bool fcbucket_get(const fcbucket_t* B, const char* key, size_t len, value_t* val)
+{
+    bool found;
+    const unsigned char* p;
+    size_t i = search(B, key, len, &found, &p);
+    if (!found) return false;
+    if (B->flags & FCBUCKET_VARINT) {
+        uint64_t x;
+        get_varint(p, &x);
+        *val = (value_t) x;
+    } else {
+        *val = B->values[i];
+    }
+    return true;
+}
+
+value_t fcbucket_value(const fcbucket_t* B, size_t i)
+{
+    assert(i < B->n);
+    if (!(B->flags & FCBUCKET_VARINT)) return B->values[i];
+
+    size_t b = i / FCBUCKET_BLOCK, j, hlen;
+    const unsigned char* p = block_head(B, b, &hlen);
+    p += hlen;
+    uint64_t x, shared, slen;
+    for (j = b * FCBUCKET_BLOCK; j < i; ++j) {
+        p = get_varint(p, &x);
+        p = get_varint(p, &shared);
+        p = get_varint(p, &slen);
+        p += slen;
+    }
+    get_varint(p, &x);
+    return (value_t) x;
+}
+
+bool fcbucket_equal(const fcbucket_t* B, size_t i, const char* key, size_t len)
+{
+    assert(i < B->n);
+    const unsigned char* k = (const unsigned char*) key;
+    size_t b = i / FCBUCKET_BLOCK, j, hlen;
+    const unsigned char* p = block_head(B, b, &hlen);
+
+    /* m is the prefix the current entry shares with the key */
+    size_t m = prefix_len(p, hlen, k, len), klen = hlen;
+    p += hlen;
+    uint64_t x, shared, slen;
+    for (j = b * FCBUCKET_BLOCK; j < i; ++j) {
+        if (B->flags & FCBUCKET_VARINT) p = get_varint(p, &x);
+        p = get_varint(p, &shared);
+        p = get_varint(p, &slen);
+        if (shared <= m) {
+            m = shared + prefix_len(p, slen, k + shared, len - shared);
+        }
+        klen = shared + slen;
+        p += slen;
+    }
+    return m == len && klen == len;
+}
+
+size_t fcbucket_bytes(const fcbucket_t* B)
+{
+    size_t bytes = (size_t) B->heads[B->nblocks] +
+                   (B->nblocks + 1) * sizeof(uint64_t);
+    if (!(B->flags & FCBUCKET_VARINT)) bytes += B->n * sizeof(value_t);
+    return bytes;
+}
+
+
+struct fcbucket_builder_t_
+{
+    unsigned flags;
+    size_t n;
+
+    unsigned char* data;
+    size_t len, size;
+
+    uint64_t* heads;
+    size_t nblocks, heads_size;
+
+    value_t* values;
+    size_t values_size;
+
+    char* prev;  // previous key
+    size_t prev_len, prev_size;
+};
+
+fcbucket_builder_t* fcbucket_builder_create(unsigned flags)
+{
+    fcbucket_builder_t* w = malloc_or_die(sizeof(fcbucket_builder_t));
+    memset(w, 0, sizeof(fcbucket_builder_t));
+    w->flags = flags;
+    w->size = 4096;
+    w->data = malloc_or_die(w->size);
+    w->heads_size = 64;
+    w->heads = malloc_or_die(w->heads_size * sizeof(uint64_t));
+    w->heads[0] = 0;
+    w->prev_size = 64;
+    w->prev = malloc_or_die(w->prev_size);
+    return w;
+}
+
+void fcbucket_builder_free(fcbucket_builder_t* w)
+{
+    if (w == NULL) return;
+    free(w->data);
+    free(w->heads);
+    free(w->values);
+    free(w->prev);
+    free(w);
+}
+
+void fcbucket_builder_add(fcbucket_builder_t* w, const char* key, size_t len,
+                          value_t val)
+{
+    const unsigned char* k = (const unsigned char*) key;
+    bool head = w->n % FCBUCKET_BLOCK == 0;
+    assert(w->n == 0 ||
+           keycmp((const unsigned char*) w->prev, w->prev_len, k, len) < 0);
+
+    size_t need = w->len + len + 30;
+    if (need > w->size) {
+        while (w->size < need) w->size *= 2;
+        w->data = realloc_or_die(w->data, w->size);
+    }
+
+    if (head) {
+        if (w->nblocks + 2 > w->heads_size) {
+            w->heads_size *= 2;
+            w->heads = realloc_or_die(w->heads, w->heads_size * sizeof(uint64_t));
+        }
+        w->heads[w->nblocks++] = w->len;
+        w->len += put_varint(w->data + w->len, len);
+        if (len > 0) memcpy(w->data + w->len, k, len);
+        w->len += len;
+    } else {
+        size_t shared = prefix_len((const unsigned char*) w->prev, w->prev_len, k, len);
+        w->len += put_varint(w->data + w->len, shared);
+        w->len += put_varint(w->data + w->len, len - shared);
+        memcpy(w->data + w->len, k + shared, len - shared);
+        w->len += len - shared;
+    }
+
+    if (w->flags & FCBUCKET_VARINT) {
+        w->len += put_varint(w->data + w->len, val);
+    } else {
+        if (w->n == w->values_size) {
+            w->values_size = w->values_size ? 2 * w->values_size : 1024;
+            w->values = realloc_or_die(w->values, w->values_size * sizeof(value_t));
+        }
+        w->values[w->n] = val;
+    }
+
+    if (len > w->prev_size) {
+        while (w->prev_size < len) w->prev_size *= 2;
+        w->prev = realloc_or_die(w->prev, w->prev_size);
+    }
+    if (len > 0) memcpy(w->prev, k, len);
+    w->prev_len = len;
+    ++w->n;
+    w->heads[w->nblocks] = w->len;
+}
+
+void fcbucket_builder_trim(fcbucket_builder_t* w)
+{
+    if (w->len > 0) {
+        w->size = w->len;
+        w->data = realloc_or_die(w->data, w->size);
+    }
+    w->heads_size = w->nblocks + 2;
+    w->heads = realloc_or_die(w->heads, w->heads_size * sizeof(uint64_t));
+    if (w->n > 0 && w->values) {
+        w->values_size = w->n;
+        w->values = realloc_or_die(w->values, w->values_size * sizeof(value_t));
+    }
+}
+
+void fcbucket_builder_view(const fcbucket_builder_t* w, fcbucket_t* dst)
+{
+    dst->flags   = w->flags;
+    dst->n       = w->n;
+    dst->nblocks = w->nblocks;
+    dst->data    = w->data;
+    dst->heads   = w->heads;
+    dst->values  = (w->flags & FCBUCKET_VARINT) ? NULL : w->values;
+}
+
+
+struct fcbucket_iter_t_
+{
+    const fcbucket_t* B;
+    size_t i;
+    const unsigned char* p; // next entry
+
+    char* key;
+    size_t len, size;
+    value_t val;
+};
+
+/* decode the entry at i->p */
+static void iter_decode(fcbucket_iter_t* i)
+{
+    uint64_t shared = 0, slen, x;
+    const unsigned char* p = i->p;
+    if (i->i % FCBUCKET_BLOCK == 0) p = i->B->data + i->B->heads[i->i / FCBUCKET_BLOCK];
+    else p = get_varint(p, &shared);
+    p = get_varint(p, &slen);
+
+    size_t len = (size_t) (shared + slen);
+    if (len > i->size) {
+        while (i->size < len) i->size *= 2;
+        i->key = realloc_or_die(i->key, i->size);
+    }
+    if (slen > 0) memcpy(i->key + shared, p, (size_t) slen);
+    i->len = len;
+    p += slen;
+
+    if (i->B->flags & FCBUCKET_VARINT) {
+        p = get_varint(p, &x);
+        i->val = (value_t) x;
+    } else {
+        i->val = i->B->values[i->i];
+    }
+    i->p = p;
+}
+
+fcbucket_iter_t* fcbucket_iter_begin(const fcbucket_t* B)
+{
+    fcbucket_iter_t* i = malloc_or_die(sizeof(fcbucket_iter_t));
+    i->B = B;
+    i->i = 0;
+    i->p = NULL;
+    i->size = 64;
+    i->key = malloc_or_die(i->size);
+    i->len = 0;
+    i->val = 0;
+    if (B->n > 0) iter_decode(i);
+    return i;
+}
+
+fcbucket_iter_t* fcbucket_iter_dup(const fcbucket_iter_t* src)
+{
+    fcbucket_iter_t* i = malloc_or_die(sizeof(fcbucket_iter_t));
+    *i = *src;
+    i->key = malloc_or_die(i->size);
+    memcpy(i->key, src->key, src->len);
+    return i;
+}
+
+void fcbucket_iter_next(fcbucket_iter_t* i)
+{
+    if (i->i >= i->B->n) return;
+    if (++i->i < i->B->n) iter_decode(i);
+}
+
+bool fcbucket_iter_finished(fcbucket_iter_t* i)
+{
+    return i->i >= i->B->n;
+}
+
+void fcbucket_iter_free(fcbucket_iter_t* i)
+{
+    if (i == NULL) return;
+    free(i->key);
+    free(i);
+}
+
+const char* fcbucket_iter_key(fcbucket_iter_t* i, size_t* len)
+{
+    if (fcbucket_iter_finished(i)) return NULL;
+    *len = i->len;
+    return i->key;
+}
+
+value_t fcbucket_iter_val(fcbucket_iter_t* i)
+{
+    return i->val;
+}
+
+size_t fcbucket_iter_rank(fcbucket_iter_t* i)
+{
+    return i->i;
+}
@@ -0,0 +1,103 @@
+/*
+ * This file is part of hat-trie.
+ *
+ * Front-coded buckets.
+ *
+ * A read-only representation of a sorted key set. Keys are cut into blocks of
+ * FCBUCKET_BLOCK keys. The first key of a block is stored in full, every other
+ * key as the length of the prefix it shares with its predecessor followed by
+ * the remaining suffix. Lookups binary search the block heads, which need no
+ * decoding, then scan a single block.
+ *
+ * Block entries (lengths are LEB128 varints):
+ *
+ *    head:   len, key[len]                 [, value]
+ *    others: shared, len, suffix[len]      [, value]
+ *
+ * Values are either fixed width, in a separate array so that they can be
+ * pointed to, or varints inline with the keys (FCBUCKET_VARINT), which is
+ * smaller when values are small counts or ids.
+ *
+ */
+
+#ifndef HATTRIE_FCBUCKET_H
+#define HATTRIE_FCBUCKET_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include "pstdint.h"
+#include "common.h"
+
+/* keys per block, trading lookup speed for size */
+#ifndef FCBUCKET_BLOCK
+  #define FCBUCKET_BLOCK 16
+#endif
+
+#define FCBUCKET_VARINT 0x1 // values are stored inline as varints
+
+typedef struct fcbucket_t_
+{
+    unsigned flags;
+    size_t n;                    // number of keys
+    size_t nblocks;              // number of blocks
+    const unsigned char* data;   // blocks, back to back
+    const uint64_t* heads;       // start of each block in data, and its end
+    const value_t* values;       // fixed width values, NULL if FCBUCKET_VARINT
+} fcbucket_t;
+
+/** Rank of the first key not less than the given key, setting found if it is
+ * equal. */
+size_t fcbucket_search (const fcbucket_t*, const char* key, size_t len, bool* found);
+
+/** Value of the i-th key. */
+value_t fcbucket_value (const fcbucket_t*, size_t i);
+
+/** Whether the i-th key equals the given key, decoding its block only as far
+ * as the key. */
+bool fcbucket_equal (const fcbucket_t*, size_t i, const char* key, size_t len);
+
+/** Find a given key, returning false if it does not exist. */
+bool fcbucket_get (const fcbucket_t*, const char* key, size_t len, value_t* val);
+
+/** Bytes used by keys, values and block heads. */
+size_t fcbucket_bytes (const fcbucket_t*);
+
+
+/* Build a bucket from keys added in ascending order. */
+typedef struct fcbucket_builder_t_ fcbucket_builder_t;
+
+fcbucket_builder_t* fcbucket_builder_create (unsigned flags);
+void                fcbucket_builder_free   (fcbucket_builder_t*);
+void                fcbucket_builder_add    (fcbucket_builder_t*, const char* key,
+                                             size_t len, value_t val);
+
+/** Release spare capacity, once all keys are added. */
+void fcbucket_builder_trim (fcbucket_builder_t*);
+
+/** A bucket over the keys added so far, valid until the next add, trim or
+ * free. */
+void fcbucket_builder_view (const fcbucket_builder_t*, fcbucket_t* dst);
+
+
+/* Sorted iteration. Keys are decoded into the iterator, and are valid until
+ * the next call to fcbucket_iter_next. */
+typedef struct fcbucket_iter_t_ fcbucket_iter_t;
+
+fcbucket_iter_t* fcbucket_iter_begin    (const fcbucket_t*);
+fcbucket_iter_t* fcbucket_iter_dup      (const fcbucket_iter_t*);
+void             fcbucket_iter_next     (fcbucket_iter_t*);
+bool             fcbucket_iter_finished (fcbucket_iter_t*);
+void             fcbucket_iter_free     (fcbucket_iter_t*);
+const char*      fcbucket_iter_key      (fcbucket_iter_t*, size_t* len);
+value_t          fcbucket_iter_val      (fcbucket_iter_t*);
+size_t           fcbucket_iter_rank     (fcbucket_iter_t*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
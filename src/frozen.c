@@ -0,0 +1,617 @@
+/*
+ * This file is part of hat-trie.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "frozen.h"
+#include "fcbucket.h"
+#include "dawg.h"
+#include "louds.h"
+#include "mph.h"
+#include "misc.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char FROZEN_MAGIC[4] = { 'H', 'A', 'T', 'F' };
+static const uint32_t FROZEN_VERSION = 4;
+
+/* image kinds */
+enum { FROZEN_FC = 0, FROZEN_DAWG = 1, FROZEN_LOUDS = 2, FROZEN_KINDS };
+
+/* sections, the values come first in every kind */
+#define FROZEN_SECTIONS 8
+enum { SECT_VALUES = 0 };
+enum { SECT_FC_DATA = 1, SECT_FC_HEADS, SECT_FC_PILOTS, SECT_FC_REMAP,
+       SECT_FC_SLOTS };
+enum { SECT_DAWG_FIRST = 1, SECT_DAWG_TOTAL, SECT_DAWG_LABELS,
+       SECT_DAWG_TARGETS, SECT_DAWG_BEFORE };
+enum { SECT_LOUDS_LABELS = 1, SECT_LOUDS_CHILD, SECT_LOUDS_FIRST,
+       SECT_LOUDS_PREFIX, SECT_LOUDS_TAILS, SECT_LOUDS_TAIL };
+
+typedef struct frozen_header_t_
+{
+    char     magic[4];
+    uint32_t version;
+    uint32_t kind;
+    uint32_t seed;                   // of the hash index, if any
+    uint64_t n;                      // number of keys
+    uint64_t off[FROZEN_SECTIONS];   // file offset of each section, 8-aligned
+    uint64_t len[FROZEN_SECTIONS];   // length of each section in bytes
+} frozen_header_t;
+
+typedef struct section_t_
+{
+    const void* p;
+    size_t len;
+} section_t;
+
+struct hattrie_frozen_t_
+{
+    unsigned char* map;
+    size_t size;
+    uint32_t kind;
+    size_t n;
+    const value_t* values;  // by rank, or by id in a succinct trie
+    fcbucket_t B;
+    dawg_t D;
+    louds_t L;
+
+    /* hash index of a front-coded image */
+    bool hashed;
+    mph_t H;
+    const uint32_t* slots;  // rank of the key in each slot
+};
+
+struct hattrie_frozen_writer_t_
+{
+    FILE* f;
+    uint32_t kind;
+    bool hashed;
+    fcbucket_builder_t* b;
+    dawg_builder_t* d;
+    louds_builder_t* l;
+    value_t* values;    // values of a DAWG or succinct trie, by rank
+    size_t n, size;
+};
+
+struct hattrie_frozen_iter_t_
+{
+    const hattrie_frozen_t* F;
+    fcbucket_iter_t* i;
+    dawg_iter_t* d;
+    louds_iter_t* l;
+};
+
+
+static hattrie_frozen_writer_t* writer_open(const char* path, uint32_t kind)
+{
+    FILE* f = fopen(path, "wb");
+    if (f == NULL) return NULL;
+
+    hattrie_frozen_writer_t* w = malloc_or_die(sizeof(hattrie_frozen_writer_t));
+    memset(w, 0, sizeof(hattrie_frozen_writer_t));
+    w->f = f;
+    w->kind = kind;
+    if (kind == FROZEN_DAWG)       w->d = dawg_builder_create();
+    else if (kind == FROZEN_LOUDS) w->l = louds_builder_create();
+    else                           w->b = fcbucket_builder_create(0);
+    return w;
+}
+
+hattrie_frozen_writer_t* hattrie_frozen_writer_open(const char* path)
+{
+    return writer_open(path, FROZEN_FC);
+}
+
+hattrie_frozen_writer_t* hattrie_frozen_writer_open_hashed(const char* path)
+{
+    hattrie_frozen_writer_t* w = writer_open(path, FROZEN_FC);
+    if (w) w->hashed = true;
+    return w;
+}
+
+hattrie_frozen_writer_t* hattrie_frozen_writer_open_dawg(const char* path)
+{
+    return writer_open(path, FROZEN_DAWG);
+}
+
+hattrie_frozen_writer_t* hattrie_frozen_writer_open_succinct(const char* path)
+{
+    return writer_open(path, FROZEN_LOUDS);
+}
+
+int hattrie_frozen_writer_add(hattrie_frozen_writer_t* w,
+                              const char* key, size_t len, value_t val)
+{
+    if (w->kind == FROZEN_FC) {
+        fcbucket_builder_add(w->b, key, len, val);
+        return 0;
+    }
+
+    if (w->kind == FROZEN_DAWG) dawg_builder_add(w->d, key, len);
+    else                        louds_builder_add(w->l, key, len);
+    if (w->n == w->size) {
+        w->size = w->size ? 2 * w->size : 1024;
+        w->values = realloc_or_die(w->values, w->size * sizeof(value_t));
+    }
+    w->values[w->n++] = val;
+    return 0;
+}
+
+/* Index the keys of a bucket by a minimal perfect hash, returning the rank
+ * of the key in each slot. */
+static uint32_t* build_index(const fcbucket_t* B, mph_builder_t** mb, mph_t* H)
+{
+    uint32_t seed;
+    size_t len;
+    const char* key;
+    fcbucket_iter_t* i;
+    assert(B->n < UINT32_MAX);
+
+    for (seed = 0; ; ++seed) {
+        *mb = mph_builder_create(seed);
+        i = fcbucket_iter_begin(B);
+        for (; !fcbucket_iter_finished(i); fcbucket_iter_next(i)) {
+            key = fcbucket_iter_key(i, &len);
+            mph_builder_add(*mb, key, len);
+        }
+        fcbucket_iter_free(i);
+        if (mph_builder_finish(*mb, H)) break;
+        mph_builder_free(*mb);
+    }
+
+    uint32_t* slots = malloc_or_die((B->n ? B->n : 1) * sizeof(uint32_t));
+    i = fcbucket_iter_begin(B);
+    for (; !fcbucket_iter_finished(i); fcbucket_iter_next(i)) {
+        key = fcbucket_iter_key(i, &len);
+        slots[mph_lookup(H, key, len)] = (uint32_t) fcbucket_iter_rank(i);
+    }
+    fcbucket_iter_free(i);
+    return slots;
+}
+
+/* write the header and sections, each padded to 8 bytes */
+static int write_image(FILE* f, uint32_t kind, uint32_t seed, size_t n,
+                       const section_t* s, size_t nsections)
+{
+    static const char pad[8] = { 0 };
+    frozen_header_t h;
+    memset(&h, 0, sizeof(frozen_header_t));
+    memcpy(h.magic, FROZEN_MAGIC, sizeof(h.magic));
+    h.version = FROZEN_VERSION;
+    h.kind = kind;
+    h.seed = seed;
+    h.n = n;
+
+    size_t j;
+    uint64_t off = sizeof(frozen_header_t);
+    for (j = 0; j < nsections; ++j) {
+        h.off[j] = off;
+        h.len[j] = s[j].len;
+        off += (s[j].len + 7) & ~(uint64_t) 7;
+    }
+    for (; j < FROZEN_SECTIONS; ++j) h.off[j] = off;
+
+    if (fwrite(&h, sizeof(frozen_header_t), 1, f) != 1) return -1;
+    for (j = 0; j < nsections; ++j) {
+        size_t padlen = (8 - s[j].len % 8) % 8;
+        if ((s[j].len && fwrite(s[j].p, 1, s[j].len, f) != s[j].len) ||
+            (padlen && fwrite(pad, 1, padlen, f) != padlen)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int hattrie_frozen_writer_close(hattrie_frozen_writer_t* w)
+{
+    section_t s[FROZEN_SECTIONS];
+    size_t n, nsections;
+    value_t* byid = NULL;
+    uint32_t seed = 0, *slots = NULL;
+    mph_builder_t* mb = NULL;
+
+    if (w->kind == FROZEN_FC) {
+        fcbucket_t B;
+        fcbucket_builder_view(w->b, &B);
+        n = B.n;
+        s[SECT_VALUES].p    = B.values;
+        s[SECT_VALUES].len  = B.n * sizeof(value_t);
+        s[SECT_FC_DATA].p   = B.data;
+        s[SECT_FC_DATA].len = (size_t) B.heads[B.nblocks];
+        s[SECT_FC_HEADS].p  = B.heads;
+        s[SECT_FC_HEADS].len = (B.nblocks + 1) * sizeof(uint64_t);
+        nsections = 3;
+
+        if (w->hashed) {
+            mph_t H;
+            slots = build_index(&B, &mb, &H);
+            seed = H.seed;
+            s[SECT_FC_PILOTS].p   = H.pilots;
+            s[SECT_FC_PILOTS].len = H.nbuckets * sizeof(uint32_t);
+            s[SECT_FC_REMAP].p    = H.remap;
+            s[SECT_FC_REMAP].len  = (H.m - H.n) * sizeof(uint32_t);
+            s[SECT_FC_SLOTS].p    = slots;
+            s[SECT_FC_SLOTS].len  = B.n * sizeof(uint32_t);
+            nsections = 6;
+        }
+    } else if (w->kind == FROZEN_LOUDS) {
+        louds_t L;
+        size_t i, *ids = malloc_or_die((w->n ? w->n : 1) * sizeof(size_t));
+        louds_builder_finish(w->l, &L, ids);
+        byid = malloc_or_die((w->n ? w->n : 1) * sizeof(value_t));
+        for (i = 0; i < w->n; ++i) byid[ids[i]] = w->values[i];
+        free(ids);
+        n = L.n;
+        s[SECT_VALUES].p          = byid;
+        s[SECT_VALUES].len        = w->n * sizeof(value_t);
+        s[SECT_LOUDS_LABELS].p    = L.labels;
+        s[SECT_LOUDS_LABELS].len  = L.nedges;
+        s[SECT_LOUDS_CHILD].p     = L.child.words;
+        s[SECT_LOUDS_CHILD].len   = louds_bits_bytes(&L.child);
+        s[SECT_LOUDS_FIRST].p     = L.first.words;
+        s[SECT_LOUDS_FIRST].len   = louds_bits_bytes(&L.first);
+        s[SECT_LOUDS_PREFIX].p    = L.prefix.words;
+        s[SECT_LOUDS_PREFIX].len  = louds_bits_bytes(&L.prefix);
+        s[SECT_LOUDS_TAILS].p     = L.tails.words;
+        s[SECT_LOUDS_TAILS].len   = louds_bits_bytes(&L.tails);
+        s[SECT_LOUDS_TAIL].p      = L.tail;
+        s[SECT_LOUDS_TAIL].len    = L.tail_len;
+        nsections = 7;
+    } else {
+        dawg_t D;
+        dawg_builder_finish(w->d, &D);
+        n = D.n;
+        s[SECT_VALUES].p          = w->values;
+        s[SECT_VALUES].len        = w->n * sizeof(value_t);
+        s[SECT_DAWG_FIRST].p      = D.first;
+        s[SECT_DAWG_FIRST].len    = (D.nstates + 1) * sizeof(uint32_t);
+        s[SECT_DAWG_TOTAL].p      = D.total;
+        s[SECT_DAWG_TOTAL].len    = D.nstates * sizeof(uint32_t);
+        s[SECT_DAWG_LABELS].p     = D.labels;
+        s[SECT_DAWG_LABELS].len   = D.nedges;
+        s[SECT_DAWG_TARGETS].p    = D.targets;
+        s[SECT_DAWG_TARGETS].len  = D.nedges * sizeof(uint32_t);
+        s[SECT_DAWG_BEFORE].p     = D.before;
+        s[SECT_DAWG_BEFORE].len   = D.nedges * sizeof(uint32_t);
+        nsections = 6;
+    }
+
+    bool error = write_image(w->f, w->kind, seed, n, s, nsections) != 0 ||
+                 fflush(w->f) != 0 || fsync(fileno(w->f)) != 0;
+    if (fclose(w->f) != 0) error = true;
+
+    fcbucket_builder_free(w->b);
+    dawg_builder_free(w->d);
+    louds_builder_free(w->l);
+    free(w->values);
+    free(byid);
+    free(slots);
+    mph_builder_free(mb);
+    free(w);
+    return error ? -1 : 0;
+}
+
+static int freeze(const hattrie_t* T, hattrie_frozen_writer_t* w)
+{
+    if (w == NULL) return -1;
+
+    size_t len;
+    const char* key;
+    hattrie_iter_t* i = hattrie_iter_begin(T, true);
+    while (!hattrie_iter_finished(i)) {
+        key = hattrie_iter_key(i, &len);
+        hattrie_frozen_writer_add(w, key, len, *hattrie_iter_val(i));
+        hattrie_iter_next(i);
+    }
+    hattrie_iter_free(i);
+
+    return hattrie_frozen_writer_close(w);
+}
+
+int hattrie_freeze(const hattrie_t* T, const char* path)
+{
+    return freeze(T, hattrie_frozen_writer_open(path));
+}
+
+int hattrie_freeze_hashed(const hattrie_t* T, const char* path)
+{
+    return freeze(T, hattrie_frozen_writer_open_hashed(path));
+}
+
+int hattrie_freeze_dawg(const hattrie_t* T, const char* path)
+{
+    return freeze(T, hattrie_frozen_writer_open_dawg(path));
+}
+
+int hattrie_freeze_succinct(const hattrie_t* T, const char* path)
+{
+    return freeze(T, hattrie_frozen_writer_open_succinct(path));
+}
+
+
+static bool open_fc(hattrie_frozen_t* F, const frozen_header_t* h)
+{
+    size_t nblocks = (F->n + FCBUCKET_BLOCK - 1) / FCBUCKET_BLOCK;
+    if (h->len[SECT_FC_HEADS] != (nblocks + 1) * sizeof(uint64_t)) return false;
+
+    F->B.flags   = 0;
+    F->B.n       = F->n;
+    F->B.nblocks = nblocks;
+    F->B.data    = F->map + h->off[SECT_FC_DATA];
+    F->B.heads   = (const uint64_t*) (F->map + h->off[SECT_FC_HEADS]);
+    F->B.values  = F->values;
+
+    /* blocks must lie within their section */
+    size_t b;
+    for (b = 0; b <= nblocks; ++b) {
+        if (F->B.heads[b] > h->len[SECT_FC_DATA] ||
+            (b > 0 && F->B.heads[b] <= F->B.heads[b - 1])) {
+            return false;
+        }
+    }
+
+    F->hashed = h->len[SECT_FC_PILOTS] > 0 || h->len[SECT_FC_SLOTS] > 0;
+    if (!F->hashed) return true;
+
+    F->H.n        = F->n;
+    F->H.m        = F->n + (size_t) (h->len[SECT_FC_REMAP] / sizeof(uint32_t));
+    F->H.nbuckets = (size_t) (h->len[SECT_FC_PILOTS] / sizeof(uint32_t));
+    F->H.seed     = h->seed;
+    F->H.pilots   = (const uint32_t*) (F->map + h->off[SECT_FC_PILOTS]);
+    F->H.remap    = (const uint32_t*) (F->map + h->off[SECT_FC_REMAP]);
+    F->slots      = (const uint32_t*) (F->map + h->off[SECT_FC_SLOTS]);
+    if (h->len[SECT_FC_PILOTS] % sizeof(uint32_t) != 0 ||
+        h->len[SECT_FC_REMAP] % sizeof(uint32_t) != 0 ||
+        h->len[SECT_FC_SLOTS] != F->n * sizeof(uint32_t) ||
+        !mph_check(&F->H)) {
+        return false;
+    }
+    for (b = 0; b < F->n; ++b) {
+        if (F->slots[b] >= F->n) return false;
+    }
+    return true;
+}
+
+static bool open_dawg(hattrie_frozen_t* F, const frozen_header_t* h)
+{
+    size_t nstates = (size_t) (h->len[SECT_DAWG_TOTAL] / sizeof(uint32_t));
+    size_t nedges  = (size_t) h->len[SECT_DAWG_LABELS];
+    if (h->len[SECT_DAWG_TOTAL] != nstates * sizeof(uint32_t) ||
+        h->len[SECT_DAWG_FIRST] != (nstates + 1) * sizeof(uint32_t) ||
+        h->len[SECT_DAWG_TARGETS] != nedges * sizeof(uint32_t) ||
+        h->len[SECT_DAWG_BEFORE] != nedges * sizeof(uint32_t) ||
+        nstates == 0) {
+        return false;
+    }
+
+    F->D.n       = F->n;
+    F->D.nstates = nstates;
+    F->D.nedges  = nedges;
+    F->D.first   = (const uint32_t*) (F->map + h->off[SECT_DAWG_FIRST]);
+    F->D.total   = (const uint32_t*) (F->map + h->off[SECT_DAWG_TOTAL]);
+    F->D.labels  = F->map + h->off[SECT_DAWG_LABELS];
+    F->D.targets = (const uint32_t*) (F->map + h->off[SECT_DAWG_TARGETS]);
+    F->D.before  = (const uint32_t*) (F->map + h->off[SECT_DAWG_BEFORE]);
+
+    /* edges must lead to later states, so that walks terminate */
+    size_t s, e;
+    if (F->D.first[0] != 0 || F->D.first[nstates] != nedges ||
+        F->D.total[0] != F->n) {
+        return false;
+    }
+    for (s = 0; s < nstates; ++s) {
+        if (F->D.first[s + 1] < F->D.first[s]) return false;
+        for (e = F->D.first[s]; e < F->D.first[s + 1]; ++e) {
+            if (F->D.targets[e] <= s || F->D.targets[e] >= nstates) return false;
+        }
+    }
+    return true;
+}
+
+static bool open_louds(hattrie_frozen_t* F, const frozen_header_t* h)
+{
+    louds_t* L = &F->L;
+    L->n        = F->n;
+    L->nedges   = (size_t) h->len[SECT_LOUDS_LABELS];
+    L->labels   = F->map + h->off[SECT_LOUDS_LABELS];
+    L->tail_len = (size_t) h->len[SECT_LOUDS_TAIL];
+    L->tail     = F->map + h->off[SECT_LOUDS_TAIL];
+
+    /* bit vector lengths follow from the edges and tails */
+    if (!louds_bits_map(&L->child, F->map + h->off[SECT_LOUDS_CHILD],
+                        (size_t) h->len[SECT_LOUDS_CHILD], L->nedges) ||
+        !louds_bits_map(&L->first, F->map + h->off[SECT_LOUDS_FIRST],
+                        (size_t) h->len[SECT_LOUDS_FIRST], L->nedges + 1)) {
+        return false;
+    }
+    L->nnodes = louds_rank1(&L->child, L->nedges) + 1;
+    if (!louds_bits_map(&L->prefix, F->map + h->off[SECT_LOUDS_PREFIX],
+                        (size_t) h->len[SECT_LOUDS_PREFIX], L->nnodes)) {
+        return false;
+    }
+    L->nprefix = louds_rank1(&L->prefix, L->nnodes);
+    if (!louds_bits_map(&L->tails, F->map + h->off[SECT_LOUDS_TAILS],
+                        (size_t) h->len[SECT_LOUDS_TAILS], L->tail_len + L->nedges)) {
+        return false;
+    }
+    return louds_check(L);
+}
+
+hattrie_frozen_t* hattrie_frozen_open(const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(frozen_header_t)) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = (size_t) st.st_size;
+    void* map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    /* validate header and section bounds */
+    const frozen_header_t* h = map;
+    bool valid = memcmp(h->magic, FROZEN_MAGIC, sizeof(h->magic)) == 0 &&
+                 h->version == FROZEN_VERSION && h->kind < FROZEN_KINDS &&
+                 h->len[SECT_VALUES] / sizeof(value_t) == h->n &&
+                 h->len[SECT_VALUES] % sizeof(value_t) == 0;
+    size_t j;
+    for (j = 0; valid && j < FROZEN_SECTIONS; ++j) {
+        valid = h->off[j] % 8 == 0 && h->off[j] >= sizeof(frozen_header_t) &&
+                h->off[j] <= size && h->len[j] <= size - h->off[j];
+    }
+    if (!valid) {
+        munmap(map, size);
+        return NULL;
+    }
+
+    hattrie_frozen_t* F = malloc_or_die(sizeof(hattrie_frozen_t));
+    memset(F, 0, sizeof(hattrie_frozen_t));
+    F->map    = map;
+    F->size   = size;
+    F->kind   = h->kind;
+    F->n      = (size_t) h->n;
+    F->values = (const value_t*) (F->map + h->off[SECT_VALUES]);
+
+    bool ok;
+    if (F->kind == FROZEN_DAWG)       ok = open_dawg(F, h);
+    else if (F->kind == FROZEN_LOUDS) ok = open_louds(F, h);
+    else                              ok = open_fc(F, h);
+    if (!ok) {
+        hattrie_frozen_close(F);
+        return NULL;
+    }
+    return F;
+}
+
+void hattrie_frozen_close(hattrie_frozen_t* F)
+{
+    if (F == NULL) return;
+    munmap(F->map, F->size);
+    free(F);
+}
+
+size_t hattrie_frozen_size(const hattrie_frozen_t* F)
+{
+    return F->n;
+}
+
+/* rank of the first key not less than the given key */
+static size_t frozen_search(const hattrie_frozen_t* F, const char* key,
+                            size_t len, bool* found)
+{
+    size_t i;
+    if (F->kind == FROZEN_DAWG) i = dawg_search(&F->D, key, len, found);
+    else                        i = fcbucket_search(&F->B, key, len, found);
+    if (i >= F->n) {
+        *found = false;
+        i = F->n;
+    }
+    return i;
+}
+
+const value_t* hattrie_frozen_tryget(const hattrie_frozen_t* F,
+                                     const char* key, size_t len)
+{
+    bool found;
+    size_t i;
+    if (F->hashed) {
+        /* one slot to verify */
+        if (F->n == 0) return NULL;
+        i = F->slots[mph_lookup(&F->H, key, len)];
+        found = fcbucket_equal(&F->B, i, key, len);
+    } else if (F->kind == FROZEN_LOUDS) {
+        found = louds_get(&F->L, key, len, &i);
+    } else {
+        i = frozen_search(F, key, len, &found);
+    }
+    return found ? &F->values[i] : NULL;
+}
+
+int hattrie_frozen_find_leq(const hattrie_frozen_t* F, const char* key, size_t len,
+                            const value_t** dst)
+{
+    bool found;
+    size_t i;
+    if (F->kind == FROZEN_LOUDS) {
+        int c = louds_find_leq(&F->L, key, len, &i);
+        *dst = c == 1 ? NULL : &F->values[i];
+        return c;
+    }
+
+    i = frozen_search(F, key, len, &found);
+    if (found) {
+        *dst = &F->values[i];
+        return 0;
+    }
+    if (i == 0) {
+        *dst = NULL;
+        return 1;
+    }
+    *dst = &F->values[i - 1];
+    return -1;
+}
+
+hattrie_frozen_iter_t* hattrie_frozen_iter_begin(const hattrie_frozen_t* F)
+{
+    hattrie_frozen_iter_t* i = malloc_or_die(sizeof(hattrie_frozen_iter_t));
+    i->F = F;
+    i->i = NULL;
+    i->d = NULL;
+    i->l = NULL;
+    if (F->kind == FROZEN_DAWG)       i->d = dawg_iter_begin(&F->D);
+    else if (F->kind == FROZEN_LOUDS) i->l = louds_iter_begin(&F->L);
+    else                              i->i = fcbucket_iter_begin(&F->B);
+    return i;
+}
+
+void hattrie_frozen_iter_next(hattrie_frozen_iter_t* i)
+{
+    if (i->d)      dawg_iter_next(i->d);
+    else if (i->l) louds_iter_next(i->l);
+    else           fcbucket_iter_next(i->i);
+}
+
+bool hattrie_frozen_iter_finished(hattrie_frozen_iter_t* i)
+{
+    if (i->d) return dawg_iter_finished(i->d) || dawg_iter_rank(i->d) >= i->F->n;
+    if (i->l) return louds_iter_finished(i->l);
+    return fcbucket_iter_finished(i->i);
+}
+
+void hattrie_frozen_iter_free(hattrie_frozen_iter_t* i)
+{
+    if (i == NULL) return;
+    fcbucket_iter_free(i->i);
+    dawg_iter_free(i->d);
+    louds_iter_free(i->l);
+    free(i);
+}
+
+const char* hattrie_frozen_iter_key(hattrie_frozen_iter_t* i, size_t* len)
+{
+    if (hattrie_frozen_iter_finished(i)) return NULL;
+    if (i->d) return dawg_iter_key(i->d, len);
+    if (i->l) return louds_iter_key(i->l, len);
+    return fcbucket_iter_key(i->i, len);
+}
+
+const value_t* hattrie_frozen_iter_val(hattrie_frozen_iter_t* i)
+{
+    if (hattrie_frozen_iter_finished(i)) return NULL;
+    if (i->d) return &i->F->values[dawg_iter_rank(i->d)];
+    if (i->l) return &i->F->values[louds_iter_id(i->l)];
+    return &i->F->values[fcbucket_iter_rank(i->i)];
+}
@@ -0,0 +1,102 @@
+/*
+ * This file is part of hat-trie.
+ *
+ * Frozen tries.
+ *
+ * A frozen trie is a read-only image of a sorted key set, written once and
+ * memory-mapped for lookups. It is compact (no buckets, slots or trie nodes)
+ * and can be shared between processes through the page cache.
+ *
+ * Keys are stored in one of two ways. By default they are front-coded (see
+ * fcbucket.h), which suits keys sharing prefixes such as URLs or paths. A
+ * DAWG image (see dawg.h) also merges shared suffixes, which suits natural
+ * language dictionaries, and finds values by the rank of their key. A
+ * succinct image (see louds.h) encodes the trie in a few bits per edge plus
+ * packed key tails, for the largest key sets.
+ *
+ * A front-coded image can also carry a minimal perfect hash of its keys (see
+ * mph.h), at about 39 bits per key, so that hattrie_frozen_tryget finds the
+ * only candidate without searching and verifies it with one comparison.
+ *
+ * Image layout (host byte order):
+ *
+ *    header                      magic, version, kind, n, section offsets
+ *                                and lengths
+ *    value_t values[n]           in key order, or by id in a succinct image
+ *    sections of the kind        each 8-byte aligned
+ *
+ */
+
+#ifndef HATTRIE_FROZEN_H
+#define HATTRIE_FROZEN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include "pstdint.h"
+#include "common.h"
+#include "hat-trie.h"
+
+typedef struct hattrie_frozen_t_ hattrie_frozen_t;
+typedef struct hattrie_frozen_writer_t_ hattrie_frozen_writer_t;
+
+/** Write an image of the trie to the given path. Returns 0 on success. */
+int hattrie_freeze (const hattrie_t*, const char* path);
+
+/** Write a front-coded image of the trie with a hash index for point
+ * lookups. Returns 0 on success. */
+int hattrie_freeze_hashed (const hattrie_t*, const char* path);
+
+/** Write a DAWG image of the trie to the given path. Returns 0 on success. */
+int hattrie_freeze_dawg (const hattrie_t*, const char* path);
+
+/** Write a succinct image of the trie to the given path. Returns 0 on
+ * success. */
+int hattrie_freeze_succinct (const hattrie_t*, const char* path);
+
+/** Build a new image, keys must be added in ascending order. Keys are held
+ * front-coded in memory until the image is closed. */
+hattrie_frozen_writer_t* hattrie_frozen_writer_open  (const char* path);
+/** Build a new front-coded image with a hash index. */
+hattrie_frozen_writer_t* hattrie_frozen_writer_open_hashed (const char* path);
+/** Build a new DAWG image, minimized as keys are added. */
+hattrie_frozen_writer_t* hattrie_frozen_writer_open_dawg (const char* path);
+/** Build a new succinct image. Keys are buffered until the image is closed. */
+hattrie_frozen_writer_t* hattrie_frozen_writer_open_succinct (const char* path);
+int                      hattrie_frozen_writer_add   (hattrie_frozen_writer_t*,
+                                                      const char* key, size_t len,
+                                                      value_t val);
+/** Finish and sync the image. Returns 0 on success. */
+int                      hattrie_frozen_writer_close (hattrie_frozen_writer_t*);
+
+hattrie_frozen_t* hattrie_frozen_open  (const char* path); //< Map an image, NULL on error.
+void              hattrie_frozen_close (hattrie_frozen_t*);
+size_t            hattrie_frozen_size  (const hattrie_frozen_t*); //< Number of keys.
+
+/** Find a given key, returning a NULL pointer if it does not exist. */
+const value_t* hattrie_frozen_tryget (const hattrie_frozen_t*, const char* key, size_t len);
+
+/** Find a key that is exact match or lexicographic predecessor, with the same
+ * return values as hattrie_find_leq. */
+int hattrie_frozen_find_leq (const hattrie_frozen_t*, const char* key, size_t len,
+                             const value_t** dst);
+
+/** Sorted iteration over a frozen trie. Keys are valid until the next call
+ * to hattrie_frozen_iter_next. */
+typedef struct hattrie_frozen_iter_t_ hattrie_frozen_iter_t;
+
+hattrie_frozen_iter_t* hattrie_frozen_iter_begin    (const hattrie_frozen_t*);
+void                   hattrie_frozen_iter_next     (hattrie_frozen_iter_t*);
+bool                   hattrie_frozen_iter_finished (hattrie_frozen_iter_t*);
+void                   hattrie_frozen_iter_free     (hattrie_frozen_iter_t*);
+const char*            hattrie_frozen_iter_key      (hattrie_frozen_iter_t*, size_t* len);
+const value_t*         hattrie_frozen_iter_val      (hattrie_frozen_iter_t*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
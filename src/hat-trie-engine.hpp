@@ -0,0 +1,556 @@
+/*
+ * This file is part of hat-trie.
+ *
+ * A HAT-trie specialized at compile time, in the header only.
+ *
+ *    hat_trie_engine<Value, Alphabet, BucketSize, Hash>
+ *
+ * It follows the algorithms of hat-trie.c and ahtable.c (trie nodes over
+ * pure and hybrid array hash buckets, bursting full buckets at the split
+ * point balancing their keys), but the value type, the alphabet, the bucket
+ * size and the hash are template parameters rather than value_t and the
+ * TRIE_MAXCHAR and TRIE_BUCKET_SIZE macros fixed when the library is built.
+ * Trie nodes have one child per symbol of the alphabet, buckets hold values
+ * of their own size and index slots with a mask, and the hash is inlined.
+ *
+ * Keys may only hold symbols of the alphabet: get throws std::invalid_argument
+ * for a key holding another byte, find and erase do not find it. Values must
+ * be trivially copyable, start with all bits zero and, as in ahtable.c, are
+ * stored unaligned after their key. Pointers to values are invalidated by
+ * inserts and erases.
+ */
+
+#ifndef HATTRIE_HATTRIE_ENGINE_HPP
+#define HATTRIE_HATTRIE_ENGINE_HPP
+
+#include "common.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+/* Alphabets map key bytes to child indexes, keeping their order. */
+
+/** All bytes, as TRIE_MAXCHAR 0xff. */
+struct byte_alphabet
+{
+    static constexpr unsigned size = 256;
+    static constexpr unsigned index(unsigned char c) { return c; }
+    static constexpr unsigned char symbol(unsigned i) { return (unsigned char) i; }
+};
+
+/** 7-bit ASCII, as TRIE_MAXCHAR 0x7f. */
+struct ascii_alphabet
+{
+    static constexpr unsigned size = 128;
+    static constexpr unsigned index(unsigned char c) { return c; }
+    static constexpr unsigned char symbol(unsigned i) { return (unsigned char) i; }
+};
+
+/** The bytes Lo to Hi, such as 'a' to 'z'. */
+template <unsigned char Lo, unsigned char Hi>
+struct range_alphabet
+{
+    static_assert(Lo <= Hi, "empty alphabet");
+    static constexpr unsigned size = Hi - Lo + 1;
+    static constexpr unsigned index(unsigned char c) { return c - Lo; }
+    static constexpr unsigned char symbol(unsigned i) { return (unsigned char) (Lo + i); }
+};
+
+/** MurmurHash3, as used by ahtable.c. */
+struct murmur_hash
+{
+    static uint32_t rotl32(uint32_t x, int r) { return (x << r) | (x >> (32 - r)); }
+
+    uint32_t operator()(const char* data, size_t len) const
+    {
+        const uint32_t c1 = 0xcc9e2d51, c2 = 0x1b873593;
+        uint32_t h = 0xc062fb4a, k;
+        size_t i;
+        for (i = 0; i + 4 <= len; i += 4) {
+            std::memcpy(&k, data + i, 4);
+            k *= c1;
+            k = rotl32(k, 15);
+            k *= c2;
+            h ^= k;
+            h = rotl32(h, 13);
+            h = h * 5 + 0xe6546b64;
+        }
+
+        k = 0;
+        switch (len & 3) {
+            case 3: k ^= (uint32_t) (unsigned char) data[i + 2] << 16; /* fall through */
+            case 2: k ^= (uint32_t) (unsigned char) data[i + 1] << 8;  /* fall through */
+            case 1: k ^= (uint32_t) (unsigned char) data[i];
+                    k *= c1;
+                    k = rotl32(k, 15);
+                    k *= c2;
+                    h ^= k;
+        }
+
+        h ^= (uint32_t) len;
+        h ^= h >> 16;
+        h *= 0x85ebca6b;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35;
+        h ^= h >> 16;
+        return h;
+    }
+};
+
+template <typename Value = value_t, typename Alphabet = byte_alphabet,
+          size_t BucketSize = TRIE_BUCKET_SIZE, typename Hash = murmur_hash>
+class hat_trie_engine
+{
+    static_assert(std::is_trivially_copyable<Value>::value, "values are copied as bytes");
+    static_assert(Alphabet::size >= 1 && Alphabet::size <= 256, "alphabets index bytes");
+    static_assert(BucketSize >= 1, "buckets hold at least one key");
+
+    /* slots per bucket: about four keys each when full, as AHTABLE_INIT_SIZE
+     * for TRIE_BUCKET_SIZE, rounded to a power of two to be masked */
+    static constexpr size_t slot_count()
+    {
+        size_t n = 16;
+        while (4 * n < BucketSize) n *= 2;
+        return n;
+    }
+
+    static constexpr size_t nslots = slot_count();
+    static constexpr unsigned nchilds = Alphabet::size;
+
+    enum : uint8_t { TRIE = 0x1, PURE = 0x2, HYBRID = 0x4 };
+
+    struct node_t
+    {
+        uint8_t flag;
+    };
+
+    struct trie_t : node_t
+    {
+        bool has_val;
+        Value val;
+        node_t* xs[nchilds];
+    };
+
+    /* An array hash table, each slot holding entries of a key length (one
+     * byte, or two with the low bit set), the key and the value. */
+    struct bucket_t : node_t
+    {
+        unsigned char c0, c1;  // range of child indexes
+        size_t m;              // number of keys
+        unsigned char* slots[nslots];
+        uint32_t sizes[nslots];
+        uint32_t reserved[nslots];
+    };
+
+public:
+    hat_trie_engine() : root(new_trie(new_bucket(0, nchilds - 1))), m(0) {}
+    ~hat_trie_engine() { free_trie(root); }
+
+    hat_trie_engine(const hat_trie_engine&) = delete;
+    hat_trie_engine& operator=(const hat_trie_engine&) = delete;
+
+    hat_trie_engine(hat_trie_engine&& other) noexcept : root(other.root), m(other.m)
+    {
+        other.root = nullptr;
+        other.m = 0;
+    }
+
+    hat_trie_engine& operator=(hat_trie_engine&& other) noexcept
+    {
+        std::swap(root, other.root);
+        std::swap(m, other.m);
+        return *this;
+    }
+
+    size_t size() const { return m; }
+
+    /** Find the key, inserting it if it does not exist. */
+    Value* get(const char* key, size_t len)
+    {
+        if (!in_alphabet(key, len)) {
+            throw std::invalid_argument("hat_trie_engine::get: byte outside the alphabet");
+        }
+
+        trie_t* parent = root;
+        if (len == 0) return use_val(parent);
+
+        while (true) {
+            node_t* node = child(parent, key[0]);
+            if (node->flag & TRIE) {
+                parent = static_cast<trie_t*>(node);
+                ++key;
+                --len;
+                if (len == 0) return use_val(parent);
+                continue;
+            }
+
+            /* preemptively split the bucket if it is full, and descend
+             * again from the parent */
+            bucket_t* b = static_cast<bucket_t*>(node);
+            if (b->m >= BucketSize) {
+                split(parent, b);
+                continue;
+            }
+
+            bool inserted;
+            Value* val = b->flag & PURE ? bucket_get(b, key + 1, len - 1, &inserted)
+                                        : bucket_get(b, key, len, &inserted);
+            m += inserted;
+            return val;
+        }
+    }
+
+    /** Find the key, returning NULL if it does not exist. */
+    Value* find(const char* key, size_t len) const
+    {
+        node_t* node = root;
+        while (node->flag & TRIE) {
+            trie_t* t = static_cast<trie_t*>(node);
+            if (len == 0) return t->has_val ? &t->val : nullptr;
+            node = child(t, key[0]);
+            if (node == nullptr) return nullptr;
+            if (node->flag & TRIE) {
+                ++key;
+                --len;
+            }
+        }
+
+        const bucket_t* b = static_cast<const bucket_t*>(node);
+        if (b->flag & PURE) return bucket_find(b, key + 1, len - 1);
+        return bucket_find(b, key, len);
+    }
+
+    /** Delete the key. Returns true if it existed. */
+    bool erase(const char* key, size_t len)
+    {
+        node_t* node = root;
+        while (node->flag & TRIE) {
+            trie_t* t = static_cast<trie_t*>(node);
+            if (len == 0) {
+                if (!t->has_val) return false;
+                t->has_val = false;
+                std::memset(&t->val, 0, sizeof(Value));
+                --m;
+                return true;
+            }
+            node = child(t, key[0]);
+            if (node == nullptr) return false;
+            if (node->flag & TRIE) {
+                ++key;
+                --len;
+            }
+        }
+
+        bucket_t* b = static_cast<bucket_t*>(node);
+        bool found = b->flag & PURE ? bucket_del(b, key + 1, len - 1)
+                                    : bucket_del(b, key, len);
+        m -= found;
+        return found;
+    }
+
+    Value& operator[](std::string_view key) { return *get(key.data(), key.size()); }
+    Value* find(std::string_view key) const { return find(key.data(), key.size()); }
+    bool erase(std::string_view key) { return erase(key.data(), key.size()); }
+
+    /** Call fn(std::string_view key, Value& val) for every key, in order.
+     * fn may change the value but not the trie. */
+    template <typename F>
+    void for_each(F&& fn) const
+    {
+        std::string prefix;
+        walk(root, prefix, fn);
+    }
+
+private:
+    /* NULL if c is not a symbol of the alphabet */
+    static node_t* child(const trie_t* t, char c)
+    {
+        unsigned i = Alphabet::index((unsigned char) c);
+        return i < nchilds ? t->xs[i] : nullptr;
+    }
+
+    static bool in_alphabet(const char* key, size_t len)
+    {
+        for (size_t i = 0; i < len; ++i) {
+            if (Alphabet::index((unsigned char) key[i]) >= nchilds) return false;
+        }
+        return true;
+    }
+
+    static trie_t* new_trie(node_t* child)
+    {
+        trie_t* t = new trie_t;
+        t->flag = TRIE;
+        t->has_val = false;
+        std::memset(&t->val, 0, sizeof(Value));
+        std::fill(t->xs, t->xs + nchilds, child);
+        return t;
+    }
+
+    static bucket_t* new_bucket(unsigned c0, unsigned c1)
+    {
+        bucket_t* b = new bucket_t;
+        b->flag = c0 == c1 ? PURE : HYBRID;
+        b->c0 = (unsigned char) c0;
+        b->c1 = (unsigned char) c1;
+        b->m = 0;
+        std::fill(b->slots, b->slots + nslots, nullptr);
+        std::fill(b->sizes, b->sizes + nslots, 0);
+        std::fill(b->reserved, b->reserved + nslots, 0);
+        return b;
+    }
+
+    static void free_bucket(bucket_t* b)
+    {
+        for (size_t i = 0; i < nslots; ++i) std::free(b->slots[i]);
+        delete b;
+    }
+
+    /* Trie nodes and buckets are freed on separate paths, starting from the
+     * root, which is always a trie node: the flag is only tested on children,
+     * and no path casts a node to the type it was not allocated as. */
+    static void free_trie(trie_t* t)
+    {
+        if (t == nullptr) return;
+        for (unsigned i = 0; i < nchilds; ++i) {
+            if (i > 0 && t->xs[i] == t->xs[i - 1]) continue;
+            node_t* x = t->xs[i];
+            if (x->flag & TRIE) free_trie(static_cast<trie_t*>(x));
+            else free_bucket(static_cast<bucket_t*>(x));
+        }
+        delete t;
+    }
+
+    Value* use_val(trie_t* t)
+    {
+        if (!t->has_val) {
+            t->has_val = true;
+            ++m;
+        }
+        return &t->val;
+    }
+
+    static size_t keylen(const unsigned char* s)
+    {
+        if (*s & 0x1) {
+            uint16_t k;
+            std::memcpy(&k, s, 2);
+            return k >> 1;
+        }
+        return *s >> 1;
+    }
+
+    static size_t entry_size(size_t len)
+    {
+        return (len < 128 ? 1 : 2) + len + sizeof(Value);
+    }
+
+    static uint32_t slot_of(const char* key, size_t len)
+    {
+        return Hash()(key, len) & (nslots - 1);
+    }
+
+    /* the entry holding key in slot i, or NULL */
+    static unsigned char* find_entry(const bucket_t* b, uint32_t i,
+                                     const char* key, size_t len)
+    {
+        unsigned char* s = b->slots[i];
+        unsigned char* end = s + b->sizes[i];
+        while (s < end) {
+            size_t k = keylen(s);
+            size_t skip = k < 128 ? 1 : 2;
+            if (k == len && std::memcmp(s + skip, key, len) == 0) return s;
+            s += skip + k + sizeof(Value);
+        }
+        return nullptr;
+    }
+
+    static Value* entry_val(unsigned char* s)
+    {
+        size_t k = keylen(s);
+        return reinterpret_cast<Value*>(s + (k < 128 ? 1 : 2) + k);
+    }
+
+    static Value* bucket_find(const bucket_t* b, const char* key, size_t len)
+    {
+        unsigned char* s = find_entry(b, slot_of(key, len), key, len);
+        return s ? entry_val(s) : nullptr;
+    }
+
+    /* Append a key with a zero value to its slot, growing it by powers of
+     * two as ahtable.c does. */
+    static Value* bucket_insert(bucket_t* b, uint32_t i, const char* key, size_t len)
+    {
+        uint32_t size = b->sizes[i] + (uint32_t) entry_size(len);
+        if (b->reserved[i] < size) {
+            uint32_t r = 2;
+            while (r < size) r *= 2;
+            r *= 2;
+            void* s = std::realloc(b->slots[i], r);
+            if (s == nullptr) throw std::bad_alloc();
+            b->slots[i] = static_cast<unsigned char*>(s);
+            b->reserved[i] = r;
+        }
+
+        unsigned char* s = b->slots[i] + b->sizes[i];
+        if (len < 128) *s++ = (unsigned char) (len << 1);
+        else {
+            uint16_t k = (uint16_t) ((len << 1) | 0x1);
+            std::memcpy(s, &k, 2);
+            s += 2;
+        }
+        std::memcpy(s, key, len);
+        std::memset(s + len, 0, sizeof(Value));
+        b->sizes[i] = size;
+        ++b->m;
+        return reinterpret_cast<Value*>(s + len);
+    }
+
+    static Value* bucket_get(bucket_t* b, const char* key, size_t len, bool* inserted)
+    {
+        uint32_t i = slot_of(key, len);
+        unsigned char* s = find_entry(b, i, key, len);
+        *inserted = s == nullptr;
+        return s ? entry_val(s) : bucket_insert(b, i, key, len);
+    }
+
+    static bool bucket_del(bucket_t* b, const char* key, size_t len)
+    {
+        uint32_t i = slot_of(key, len);
+        unsigned char* s = find_entry(b, i, key, len);
+        if (s == nullptr) return false;
+        size_t n = entry_size(len);
+        unsigned char* end = b->slots[i] + b->sizes[i];
+        std::memmove(s, s + n, (size_t) (end - s - n));
+        b->sizes[i] -= (uint32_t) n;
+        --b->m;
+        return true;
+    }
+
+    /* call fn(key, len, val) for every entry of a bucket */
+    template <typename F>
+    static void bucket_scan(const bucket_t* b, F&& fn)
+    {
+        for (size_t i = 0; i < nslots; ++i) {
+            unsigned char* s = b->slots[i];
+            unsigned char* end = s + b->sizes[i];
+            while (s < end) {
+                size_t k = keylen(s);
+                const char* key = reinterpret_cast<const char*>(s + (k < 128 ? 1 : 2));
+                fn(key, k, reinterpret_cast<Value*>(const_cast<char*>(key) + k));
+                s += entry_size(k);
+            }
+        }
+    }
+
+    /* Burst a full bucket, as hattrie_split: a pure bucket becomes a trie
+     * node over a hybrid bucket, a hybrid one is split in two at the child
+     * balancing their keys. */
+    void split(trie_t* parent, bucket_t* b)
+    {
+        if (b->flag & PURE) {
+            trie_t* t = new_trie(b);
+            parent->xs[b->c0] = t;
+
+            /* the empty key moves to the new trie node */
+            Value* val = bucket_find(b, "", 0);
+            if (val) {
+                std::memcpy(&t->val, val, sizeof(Value));
+                t->has_val = true;
+                bucket_del(b, "", 0);
+            }
+
+            b->c0 = 0;
+            b->c1 = (unsigned char) (nchilds - 1);
+            b->flag = HYBRID;
+            return;
+        }
+
+        /* count the keys by leading symbol and pick the split point */
+        size_t cs[nchilds] = {};
+        bucket_scan(b, [&](const char* key, size_t, Value*) {
+            ++cs[Alphabet::index((unsigned char) key[0])];
+        });
+
+        unsigned j = b->c0;
+        long left = (long) cs[j], right = (long) b->m - left;
+        while (j + 1 < b->c1) {
+            long c = (long) cs[j + 1];
+            if (std::labs(left + c - (right - c)) <= std::labs(left - right) &&
+                left + c < (long) b->m) {
+                ++j;
+                left += c;
+                right -= c;
+            }
+            else break;
+        }
+
+        /* a hybrid bucket of one child, as left by bursting a pure bucket
+         * over a one symbol alphabet, becomes pure */
+        bucket_t* l = new_bucket(b->c0, j);
+        bucket_t* r = j < b->c1 ? new_bucket(j + 1, b->c1) : nullptr;
+        bucket_scan(b, [&](const char* key, size_t len, Value* val) {
+            bucket_t* dst = Alphabet::index((unsigned char) key[0]) <= j ? l : r;
+            bool inserted;
+            Value* v = dst->flag & PURE ? bucket_get(dst, key + 1, len - 1, &inserted)
+                                        : bucket_get(dst, key, len, &inserted);
+            std::memcpy(v, val, sizeof(Value));
+        });
+
+        unsigned c;
+        for (c = b->c0; c <= j; ++c) parent->xs[c] = l;
+        for (; c <= b->c1; ++c)      parent->xs[c] = r;
+        free_bucket(b);
+    }
+
+    template <typename F>
+    static void walk(const node_t* node, std::string& prefix, F& fn)
+    {
+        if (!(node->flag & TRIE)) {
+            const bucket_t* b = static_cast<const bucket_t*>(node);
+            std::vector<std::pair<std::string_view, Value*>> entries;
+            entries.reserve(b->m);
+            bucket_scan(b, [&](const char* key, size_t len, Value* val) {
+                entries.emplace_back(std::string_view(key, len), val);
+            });
+            std::sort(entries.begin(), entries.end(),
+                      [](const auto& a, const auto& b) { return a.first < b.first; });
+
+            size_t plen = prefix.size();
+            for (const auto& e : entries) {
+                prefix.append(e.first);
+                fn(std::string_view(prefix), *e.second);
+                prefix.resize(plen);
+            }
+            return;
+        }
+
+        trie_t* t = const_cast<trie_t*>(static_cast<const trie_t*>(node));
+        if (t->has_val) fn(std::string_view(prefix), t->val);
+
+        for (unsigned i = 0; i < nchilds; ++i) {
+            if (i > 0 && t->xs[i] == t->xs[i - 1]) continue;
+            const node_t* c = t->xs[i];
+            if (c->flag & HYBRID) walk(c, prefix, fn);
+            else {
+                prefix.push_back((char) Alphabet::symbol(i));
+                walk(c, prefix, fn);
+                prefix.pop_back();
+            }
+        }
+    }
+
+    trie_t* root;
+    size_t m;
+};
+
+#endif
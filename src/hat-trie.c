@@ -7,10 +7,13 @@
 
 #include "hat-trie.h"
 #include "ahtable.h"
+#include "bcache.h"
+#include "changelog.h"
 #include "misc.h"
+#include "murmurhash3.h"
 #include "pstdint.h"
-#include "slab.h"
 #include <assert.h>
+#include <pthread.h>
 #include <string.h>
 
 /* number of child nodes for used alphabet */
@@ -22,6 +25,7 @@ static const uint8_t NODE_TYPE_TRIE          = 0x1;
 static const uint8_t NODE_TYPE_PURE_BUCKET   = 0x2;
 static const uint8_t NODE_TYPE_HYBRID_BUCKET = 0x4;
 static const uint8_t NODE_HAS_VAL            = 0x8;
+static const uint8_t NODE_DIGEST_OK          = 0x10;
 
 
 struct trie_node_t_;
@@ -43,24 +47,86 @@ typedef struct trie_node_t_
     /* the value for the key that is consumed on a trie node */
     value_t val;
 
+    /* subtree digest, valid if NODE_DIGEST_OK is set */
+    uint64_t digest;
+
     /* Map a character to either a trie_node_t or a ahtable_t. The first byte
      * must be examined to determine which. */
     node_ptr xs[NODE_CHILDS];
 
 } trie_node_t;
 
+/* An entry of the hot-key cache. Entries of older generations are empty. */
+typedef struct hotkey_t_
+{
+    uint64_t h;     // hash of the full key
+    uint64_t gen;   // trie generation the value pointer is valid for
+    value_t* val;
+    ahtable_t* b;   // bucket holding the value, NULL for a trie node
+    uint32_t len;   // full key length
+    uint32_t tail;  // length of the key suffix stored just before the value
+} hotkey_t;
+
 struct hattrie_t_
 {
     node_ptr root; // root node
     size_t m;      // number of stored keys
-    slab_cache_t slab; // trie-node allocator
+    const mm_ctx_t* mm; // allocator replacing malloc (optional)
+    bool digests;  // track subtree digests
+    bool filters;  // keep membership filters on buckets
+    changelog_t* log; // mutation log (optional)
+    hattrie_bcache_t* bcache; // pages bucket contents to disk (optional)
+    size_t klen;   // length of every key, 0 if keys may have any length
+
+    hotkey_t* hot;    // hot-key cache, two entries per set (optional)
+    size_t hot_mask;  // number of sets - 1
+    uint64_t gen;     // bumped whenever values may move or vanish
 };
 
+/* Trie nodes come from the memory context if there is one, from malloc
+ * otherwise, so that they are not owned by the trie and hattrie_split_at and
+ * hattrie_join can move them between tries by pointer. */
+static trie_node_t* node_alloc(hattrie_t* T)
+{
+    return mm_alloc(T->mm, sizeof(trie_node_t));
+}
+
+static void node_release(hattrie_t* T, trie_node_t* node)
+{
+    mm_free(T->mm, node);
+}
+
+/* Create an empty bucket, paged through the cache if one is given, for keys
+ * of klen bytes only unless klen is 0. */
+static ahtable_t* bucket_create(const mm_ctx_t* mm, hattrie_bcache_t* cache,
+                                bool filter, size_t klen)
+{
+    ahtable_t* b = ahtable_create_mm(AHTABLE_INIT_SIZE, mm);
+    b->klen = (uint16_t) klen;
+    if (filter) ahtable_filter(b, true);
+    if (cache) bcache_attach(cache, b);
+    return b;
+}
+
+/* Create an empty bucket for children [c0, c1] and keys of klen bytes, or of
+ * any length if klen is 0, as for the buckets splits and joins leave behind. */
+static node_ptr alloc_empty_bucket(const mm_ctx_t* mm, hattrie_bcache_t* cache,
+                                   bool filter, unsigned char c0, unsigned char c1,
+                                   size_t klen)
+{
+    node_ptr node;
+    node.b = bucket_create(mm, cache, filter, klen);
+    node.b->c0   = c0;
+    node.b->c1   = c1;
+    node.b->flag = c0 == c1 ? NODE_TYPE_PURE_BUCKET : NODE_TYPE_HYBRID_BUCKET;
+    return node;
+}
+
 /* Create a new trie node with all pointer pointing to the given child (which
  * can be NULL). */
 static trie_node_t* alloc_trie_node(hattrie_t* T, node_ptr child)
 {
-    trie_node_t* node = slab_cache_alloc(&T->slab);
+    trie_node_t* node = node_alloc(T);
     node->flag = NODE_TYPE_TRIE;
     node->val  = 0;
 
@@ -69,13 +135,16 @@ static trie_node_t* alloc_trie_node(hattrie_t* T, node_ptr child)
     return node;
 }
 
-/* iterate trie nodes until string is consumed or bucket is found */
+/* iterate trie nodes until string is consumed or bucket is found, clearing
+ * the digests of the nodes reached below the parent if touch is set */
 static node_ptr hattrie_consume_ns(node_ptr **s, size_t *sp, size_t slen,
-                                const char **k, size_t *l, unsigned brk)
+                                const char **k, size_t *l, unsigned brk,
+                                bool touch)
 {
     
     node_ptr *bs = *s;
     node_ptr node = bs[*sp].t->xs[(unsigned char) **k];
+    if (touch) *node.flag &= ~NODE_DIGEST_OK;
     while (*node.flag & NODE_TYPE_TRIE && *l > brk) {
         ++*k;
         --*l;
@@ -101,6 +170,7 @@ static node_ptr hattrie_consume_ns(node_ptr **s, size_t *sp, size_t slen,
         }
         bs[*sp] = node;
         node = node.t->xs[(unsigned char) **k];
+        if (touch) *node.flag &= ~NODE_DIGEST_OK;
     }
     
     /* stack top is always parent node */
@@ -109,10 +179,10 @@ static node_ptr hattrie_consume_ns(node_ptr **s, size_t *sp, size_t slen,
 }
 
 static inline node_ptr hattrie_consume(node_ptr *parent, const char **k,
-                                       size_t *l, unsigned brk)
+                                       size_t *l, unsigned brk, bool touch)
 {
     size_t sp = 0;
-    return hattrie_consume_ns(&parent, &sp, 0, k, l, brk);
+    return hattrie_consume_ns(&parent, &sp, 0, k, l, brk, touch);
 }
 
 /* use node value and return pointer to it */
@@ -167,19 +237,18 @@ static value_t* hattrie_find_rightmost(node_ptr node)
         return NULL;
     }
     /* return rightmost value */
-    assert(node.b->index);
     return ahtable_indexval(node.b, node.b->m - 1);
 }
 
 /* find node in trie and keep node stack (if slen > 0) */
 static node_ptr hattrie_find_ns(node_ptr **s, size_t *sp, size_t slen,
-                                const char **key, size_t *len)
+                                const char **key, size_t *len, bool touch)
 {
     assert(*(*s)[*sp].flag & NODE_TYPE_TRIE);
 
     if (*len == 0) return (*s)[*sp]; /* parent, as sp == 0 */
 
-    node_ptr node = hattrie_consume_ns(s, sp, slen, key, len, 1);
+    node_ptr node = hattrie_consume_ns(s, sp, slen, key, len, 1, touch);
     
     /* if the trie node consumes value, use it */
     if (*node.flag & NODE_TYPE_TRIE) {
@@ -200,31 +269,105 @@ static node_ptr hattrie_find_ns(node_ptr **s, size_t *sp, size_t slen,
 }
 
 /* find node in trie */
-static inline node_ptr hattrie_find(node_ptr *parent, const char **key, size_t *len)
+static inline node_ptr hattrie_find(node_ptr *parent, const char **key,
+                                    size_t *len, bool touch)
 {
     size_t sp = 0;
-    return hattrie_find_ns(&parent, &sp, 1, key, len);
+    return hattrie_find_ns(&parent, &sp, 1, key, len, touch);
     
 }
 
+/* Hot-key cache:
+ * Keys found by hattrie_get and hattrie_tryget are remembered with the
+ * address of their value, in 2-way sets picked by a 64-bit hash of the full
+ * key. A hit compares the hash, the length and the key suffix stored in front
+ * of the value, so only keys of equal hash, length and suffix can be
+ * confused. Anything that can move values (inserts, which may reallocate a
+ * slot, deletes, bursts, tiering, splitting and rebasing) bumps the trie
+ * generation, which empties the cache at once. Values in cold or paged
+ * buckets are not cached, as these move on their own.
+ */
+static inline value_t* hot_find(hattrie_t* T, uint64_t h,
+                                const char* key, size_t len)
+{
+    hotkey_t* e = T->hot + 2 * (h & T->hot_mask);
+    unsigned w;
+    for (w = 0; w < 2; ++w) {
+        if (e[w].h == h && e[w].gen == T->gen && e[w].len == len &&
+            memcmp((const char*) e[w].val - e[w].tail,
+                   key + len - e[w].tail, e[w].tail) == 0) {
+            if (w == 1) { /* most recent first */
+                hotkey_t t = e[0];
+                e[0] = e[1];
+                e[1] = t;
+            }
+            /* a hit is an access of the bucket, as for tiering */
+            if (e[0].b) ahtable_heat(e[0].b, (uint32_t) (h >> 32));
+            return e[0].val;
+        }
+    }
+    return NULL;
+}
+
+static inline void hot_add(hattrie_t* T, uint64_t h, size_t len,
+                           ahtable_t* b, size_t tail, value_t* val)
+{
+    if (b && (b->cold || b->page)) return;
+    hotkey_t* e = T->hot + 2 * (h & T->hot_mask);
+    e[1] = e[0];
+    e[0].h    = h;
+    e[0].gen  = T->gen;
+    e[0].val  = val;
+    e[0].b    = b;
+    e[0].len  = (uint32_t) len;
+    e[0].tail = (uint32_t) tail;
+}
+
+void hattrie_hot_cache_enable(hattrie_t* T, size_t entries)
+{
+    mm_free(T->mm, T->hot);
+    T->hot = NULL;
+    T->hot_mask = 0;
+    if (entries == 0) return;
+
+    size_t sets = 1;
+    while (2 * sets < entries) sets *= 2;
+    T->hot = mm_alloc(T->mm, 2 * sets * sizeof(hotkey_t));
+    memset(T->hot, 0, 2 * sets * sizeof(hotkey_t));
+    T->hot_mask = sets - 1;
+    ++T->gen;
+}
+
 hattrie_t* hattrie_create()
 {
-    hattrie_t* T = malloc_or_die(sizeof(hattrie_t));
+    return hattrie_create_mm(NULL);
+}
+
+static hattrie_t* hattrie_create_klen(const mm_ctx_t* mm, size_t klen)
+{
+    hattrie_t* T = mm_alloc(mm, sizeof(hattrie_t));
     memset(T, 0, sizeof(hattrie_t));
-    slab_cache_init(&T->slab, sizeof(trie_node_t));
+    T->mm = mm;
+    T->klen = klen;
 
-    node_ptr node;
-    node.b = ahtable_create();
-    node.b->flag = NODE_TYPE_HYBRID_BUCKET;
-    node.b->c0 = 0x00;
-    node.b->c1 = TRIE_MAXCHAR;
+    node_ptr node = alloc_empty_bucket(mm, NULL, false, 0x00, TRIE_MAXCHAR, klen);
     T->root.t = alloc_trie_node(T, node);
 
     return T;
 }
 
+hattrie_t* hattrie_create_mm(const mm_ctx_t* mm)
+{
+    return hattrie_create_klen(mm, 0);
+}
+
+hattrie_t* hattrie_create_u64()
+{
+    return hattrie_create_klen(NULL, sizeof(uint64_t));
+}
+
 
-static void hattrie_free_node(node_ptr node, bool free_nodes)
+static void hattrie_free_node(hattrie_t* T, node_ptr node, bool free_nodes)
 {
     if (*node.flag & NODE_TYPE_TRIE) {
         size_t i;
@@ -233,10 +376,10 @@ static void hattrie_free_node(node_ptr node, bool free_nodes)
 
             /* XXX: recursion might not be the best choice here. It is possible
              * to build a very deep trie. */
-            if (node.t->xs[i].t) hattrie_free_node(node.t->xs[i], free_nodes);
+            if (node.t->xs[i].t) hattrie_free_node(T, node.t->xs[i], free_nodes);
         }
         if (free_nodes) {
-            slab_free(node.t);
+            node_release(T, node.t);
         }
     }
     else {
@@ -247,14 +390,17 @@ static void hattrie_free_node(node_ptr node, bool free_nodes)
 
 void hattrie_free(hattrie_t* T)
 {
-    hattrie_free_node(T->root, false);
-    slab_cache_destroy(&T->slab);
-    free(T);
+    if (T->log) changelog_attach(T->log, NULL);
+    mm_free(T->mm, T->hot);
+    hattrie_free_node(T, T->root, true);
+    mm_free(T->mm, T);
 }
 
 hattrie_t* hattrie_dup(const hattrie_t* T)
 {
-    hattrie_t *N = hattrie_create();
+    hattrie_t *N = hattrie_create_klen(NULL, T->klen);
+    hattrie_filter_enable(N, T->filters);
+    if (T->hot) hattrie_hot_cache_enable(N, 2 * (T->hot_mask + 1));
 
     /*! \todo could be probably implemented faster */
 
@@ -270,6 +416,11 @@ hattrie_t* hattrie_dup(const hattrie_t* T)
     return N;
 }
 
+size_t hattrie_size(const hattrie_t* T)
+{
+    return T->m;
+}
+
 static void node_build_index(node_ptr node)
 {
     /* build index on all ahtable nodes */
@@ -285,6 +436,37 @@ static void node_build_index(node_ptr node)
     }
 }
 
+static void node_rebase(node_ptr node, uintptr_t delta)
+{
+    if (*node.flag & NODE_TYPE_TRIE) {
+        size_t i;
+        node_ptr prev = { NULL };
+        for (i = 0; i < NODE_CHILDS; ++i) {
+            /* runs of a bucket share the pointer, shift it once */
+            if (i > 0 && node.t->xs[i].t == prev.t) {
+                node.t->xs[i] = node.t->xs[i - 1];
+                continue;
+            }
+            prev = node.t->xs[i];
+            if (prev.t == NULL) continue;
+            node.t->xs[i].t = (trie_node_t*) ((uintptr_t) prev.t + delta);
+            node_rebase(node.t->xs[i], delta);
+        }
+    }
+    else {
+        ahtable_rebase(node.b, delta);
+    }
+}
+
+void hattrie_rebase(hattrie_t* T, uintptr_t delta)
+{
+    T->mm = (const mm_ctx_t*) ((uintptr_t) T->mm + delta);
+    T->root.t = (trie_node_t*) ((uintptr_t) T->root.t + delta);
+    node_rebase(T->root, delta);
+    if (T->hot) T->hot = (hotkey_t*) ((uintptr_t) T->hot + delta);
+    ++T->gen;
+}
+
 void hattrie_build_index(hattrie_t *T)
 {
     node_build_index(T->root);
@@ -334,6 +516,10 @@ static void hattrie_split_fill(node_ptr src, node_ptr left, node_ptr right, uint
 {
     /* right should be most of the time hybrid */
 
+    /* keys are deleted while iterating, which a cold bucket does not allow;
+     * the bucket is split for an insert, which expands it anyway */
+    ahtable_decompress(src.b);
+
     /* keep or distribute keys to the new right node */
     value_t* u;
     const char* key;
@@ -400,16 +586,21 @@ static void hattrie_split_h(node_ptr parent, node_ptr node)
      */
     unsigned char c0 = node.b->c0, c1 = node.b->c1;
     node_ptr left, right;
+    const mm_ctx_t* mm = node.b->mm;
+    hattrie_bcache_t* cache = bcache_of(node.b);
+    bool filter = node.b->filter != NULL;
+    size_t klen = node.b->klen;
+    size_t pure_klen = klen > 0 ? klen - 1 : 0; /* an empty suffix is variable */
     if (j + 1 == c1) { /* right will be pure */
-        right.b = ahtable_create();
+        right.b = bucket_create(mm, cache, filter, pure_klen);
         if (j == c0) { /* left will be pure as well */
-            left.b = ahtable_create();
+            left.b = bucket_create(mm, cache, filter, pure_klen);
         } else {       /* left will be hybrid */
             left.b = node.b;
         }
     } else {           /* right will be hybrid */
         right.b = node.b;
-        left.b = ahtable_create();
+        left.b = bucket_create(mm, cache, filter, c0 == j ? pure_klen : klen);
     }
     
     /* setup created nodes */
@@ -432,6 +623,9 @@ static void hattrie_split_h(node_ptr parent, node_ptr node)
     hattrie_split_fill(node, left, right, j);
     if (node.b != left.b && node.b != right.b) {
         ahtable_free(node.b);
+    } else if (filter) {
+        /* drop the keys moved out of the reused bucket */
+        ahtable_filter(node.b, true);
     }
 }
 
@@ -444,6 +638,7 @@ static void hattrie_split(hattrie_t* T, node_ptr parent, node_ptr node)
            *node.flag & NODE_TYPE_HYBRID_BUCKET);
 
     assert(*parent.flag & NODE_TYPE_TRIE);
+    ++T->gen;
 
     if (*node.flag & NODE_TYPE_PURE_BUCKET) {
         /* turn the pure bucket into a hybrid bucket */
@@ -469,15 +664,23 @@ static void hattrie_split(hattrie_t* T, node_ptr parent, node_ptr node)
     hattrie_split_h(parent, node);
 }
 
-value_t* hattrie_get(hattrie_t* T, const char* key, size_t len)
+/* Find or insert a key, setting the bucket holding its value (NULL for a trie
+ * node) and the length of the key stored there. */
+static value_t* hattrie_get_at(hattrie_t* T, const char* key, size_t len,
+                               ahtable_t** bucket, size_t* tail)
 {
+    *bucket = NULL;
+    *tail = 0;
+
     node_ptr parent = T->root;
     assert(*parent.flag & NODE_TYPE_TRIE);
 
-    if (len == 0) return &parent.t->val;
+    /* the value may change, drop the digests on the path of the key */
+    if (T->digests) parent.t->flag &= ~NODE_DIGEST_OK;
+    if (len == 0) return hattrie_useval(T, parent);
 
     /* consume all trie nodes, now parent must be trie and child anything */
-    node_ptr node = hattrie_consume(&parent, &key, &len, 0);
+    node_ptr node = hattrie_consume(&parent, &key, &len, 0, T->digests);
     assert(*parent.flag & NODE_TYPE_TRIE);
 
     /* if the key has been consumed on a trie node, use its value */
@@ -497,7 +700,7 @@ value_t* hattrie_get(hattrie_t* T, const char* key, size_t len)
 
         /* after the split, the node pointer is invalidated, so we search from
          * the parent again. */
-        node = hattrie_consume(&parent, &key, &len, 0);
+        node = hattrie_consume(&parent, &key, &len, 0, T->digests);
 
         /* if the key has been consumed on a trie node, use its value */
         if (len == 0) {
@@ -517,31 +720,179 @@ value_t* hattrie_get(hattrie_t* T, const char* key, size_t len)
     value_t* val;
     if (*node.flag & NODE_TYPE_PURE_BUCKET) {
         val = ahtable_get(node.b, key + 1, len - 1);
+        *tail = len - 1;
     }
     else {
         val = ahtable_get(node.b, key, len);
+        *tail = len;
     }
     T->m += (node.b->m - m_old);
+    *bucket = node.b;
+
+    return val;
+}
+
+static value_t* hattrie_get_(hattrie_t* T, const char* key, size_t len)
+{
+    /* a cache hit would skip dropping the digests on the path */
+    bool hot = T->hot && !T->digests;
+    uint64_t h = 0;
+    value_t* val;
+    if (hot) {
+        h = hash64(key, len, 0);
+        if ((val = hot_find(T, h, key, len))) return val;
+    }
+
+    size_t m_old = T->m, tail;
+    ahtable_t* b;
+    val = hattrie_get_at(T, key, len, &b, &tail);
+    if (T->m != m_old) ++T->gen;
+    if (hot) hot_add(T, h, len, b, tail, val);
+    return val;
+}
 
+value_t* hattrie_get(hattrie_t* T, const char* key, size_t len)
+{
+    size_t m_old = T->m;
+    value_t* val = hattrie_get_(T, key, len);
+    if (T->log) {
+        if (T->m != m_old) changelog_append(T->log, CHANGELOG_INSERT, key, len, 0);
+        /* the value may be written through val, it is read back on flush */
+        changelog_touch(T->log, key, len);
+    }
     return val;
 }
 
+void hattrie_set(hattrie_t* T, const char* key, size_t len, value_t val)
+{
+    *hattrie_get_(T, key, len) = val;
+    if (T->log) changelog_append(T->log, CHANGELOG_SET, key, len, val);
+}
+
+void hattrie_set_log(hattrie_t* T, changelog_t* log)
+{
+    if (log) changelog_attach(log, T);
+    T->log = log;
+}
+
+static void node_set_bcache(node_ptr node, hattrie_bcache_t* cache)
+{
+    if (*node.flag & NODE_TYPE_TRIE) {
+        size_t i;
+        for (i = 0; i < NODE_CHILDS; ++i) {
+            if (i > 0 && node.t->xs[i].t == node.t->xs[i - 1].t) continue;
+            if (node.t->xs[i].t) node_set_bcache(node.t->xs[i], cache);
+        }
+    }
+    else {
+        if (bcache_of(node.b) == cache) return;
+        ahtable_decompress(node.b);
+        if (node.b->page) {
+            bcache_touch(node.b);
+            bcache_detach(node.b);
+        }
+        if (cache) bcache_attach(cache, node.b);
+    }
+}
+
+void hattrie_set_bcache(hattrie_t* T, hattrie_bcache_t* cache)
+{
+    assert(T->mm == NULL);
+    node_set_bcache(T->root, cache);
+    T->bcache = cache;
+    ++T->gen;
+}
+
+static void node_set_filter(node_ptr node, bool enable)
+{
+    if (*node.flag & NODE_TYPE_TRIE) {
+        size_t i;
+        for (i = 0; i < NODE_CHILDS; ++i) {
+            if (i > 0 && node.t->xs[i].t == node.t->xs[i - 1].t) continue;
+            if (node.t->xs[i].t) node_set_filter(node.t->xs[i], enable);
+        }
+    }
+    else {
+        ahtable_filter(node.b, enable);
+    }
+}
+
+void hattrie_filter_enable(hattrie_t* T, bool enable)
+{
+    node_set_filter(T->root, enable);
+    T->filters = enable;
+}
+
+
+static void node_tier(node_ptr node, unsigned cold, unsigned hot,
+                      hattrie_tier_stats_t* stats)
+{
+    if (*node.flag & NODE_TYPE_TRIE) {
+        size_t i;
+        for (i = 0; i < NODE_CHILDS; ++i) {
+            if (i > 0 && node.t->xs[i].t == node.t->xs[i - 1].t) continue;
+            if (node.t->xs[i].t) node_tier(node.t->xs[i], cold, hot, stats);
+        }
+        return;
+    }
+
+    /* buckets are not counted before their first pass */
+    ahtable_t* b = node.b;
+    if (!b->tiered) b->tiered = true;
+    else if (b->cold && b->heat >= hot) ahtable_decompress(b);
+    else if (!b->cold && b->heat < cold) ahtable_compress(b);
+    b->heat = 0;
+    ++b->salt;
+
+    if (b->cold) {
+        ++stats->cold;
+        stats->cold_bytes += ahtable_bytes(b);
+    } else {
+        ++stats->hot;
+        stats->hot_bytes += ahtable_bytes(b);
+    }
+}
+
+void hattrie_tier(hattrie_t* T, unsigned cold, unsigned hot,
+                  hattrie_tier_stats_t* stats)
+{
+    hattrie_tier_stats_t dummy;
+    if (stats == NULL) stats = &dummy;
+    memset(stats, 0, sizeof(hattrie_tier_stats_t));
+    node_tier(T->root, cold, hot, stats);
+    ++T->gen;
+}
+
 
 value_t* hattrie_tryget(hattrie_t* T, const char* key, size_t len)
 {
+    uint64_t h = 0;
+    value_t* val;
+    if (T->hot) {
+        h = hash64(key, len, 0);
+        if ((val = hot_find(T, h, key, len))) return val;
+    }
+
     /* find node for given key */
+    const char* k = key;
+    size_t l = len;
     node_ptr parent = T->root;
-    node_ptr node = hattrie_find(&parent, &key, &len);
+    node_ptr node = hattrie_find(&parent, &k, &l, false);
     if (node.flag == NULL) {
         return NULL;
     }
     
     /* if the trie node consumes value, use it */
     if (*node.flag & NODE_TYPE_TRIE) {
-        return &node.t->val;
+        if (!(node.t->flag & NODE_HAS_VAL)) return NULL; /* empty key */
+        val = &node.t->val;
+        if (T->hot) hot_add(T, h, len, NULL, 0, val);
+        return val;
     }
     
-    return ahtable_tryget(node.b, key, len);
+    val = ahtable_tryget(node.b, k, l);
+    if (val && T->hot) hot_add(T, h, len, node.b, l, val);
+    return val;
 }
 
 static value_t* hattrie_walk(node_ptr* s, size_t sp,
@@ -553,7 +904,7 @@ static value_t* hattrie_walk(node_ptr* s, size_t sp,
          * the rightmost of the nodes left of the current
          */
         node_ptr visited = s[sp].t->xs[(unsigned char)*key];
-        for (int i = *key - 1; i > -1; --i) {
+        for (int i = (unsigned char) *key - 1; i > -1; --i) {
             if (s[sp].t->xs[i].flag == visited.flag)
                 continue; /* skip pointers to visited container */
             r = f(s[sp].t->xs[i]);
@@ -585,7 +936,8 @@ int hattrie_find_leq (hattrie_t* T, const char* key, size_t len, value_t** dst)
     
     /* find node for given key */
     int ret = 1; /* no node on the left matches */
-    node_ptr node = hattrie_find_ns(&ns, &sp, NODESTACK_INIT, &key, &len);
+    node_ptr node = hattrie_find_ns(&ns, &sp, NODESTACK_INIT, &key, &len,
+                                    false);
     if (node.flag == NULL) {
         *dst = hattrie_walk(ns, sp, key, hattrie_find_rightmost);
         if (ns != bs) free(ns);
@@ -610,6 +962,8 @@ int hattrie_find_leq (hattrie_t* T, const char* key, size_t len, value_t** dst)
     
     /* return if found equal or left in ahtable */
     if (*dst == 0) {
+        /* the char that picked a pure bucket was consumed */
+        if (*node.flag & NODE_TYPE_PURE_BUCKET) --key;
         *dst = hattrie_walk(ns, sp, key, hattrie_find_rightmost);
         if (*dst) {
             ret = -1; /* found previous */
@@ -623,26 +977,88 @@ int hattrie_find_leq (hattrie_t* T, const char* key, size_t len, value_t** dst)
 }
 
 
+/* Integer keys are stored as their big-endian bytes, which sort as the
+ * integers do. */
+static inline void u64_encode(char* key, uint64_t x)
+{
+    int i;
+    for (i = 7; i >= 0; --i, x >>= 8) key[i] = (char) (x & 0xff);
+}
+
+static inline uint64_t u64_decode(const char* key)
+{
+    uint64_t x = 0;
+    int i;
+    for (i = 0; i < 8; ++i) x = x << 8 | (unsigned char) key[i];
+    return x;
+}
+
+value_t* hattrie_get_u64(hattrie_t* T, uint64_t x)
+{
+    char key[8];
+    u64_encode(key, x);
+    return hattrie_get(T, key, sizeof(key));
+}
+
+value_t* hattrie_tryget_u64(hattrie_t* T, uint64_t x)
+{
+    char key[8];
+    u64_encode(key, x);
+    if (T->hot) return hattrie_tryget(T, key, sizeof(key));
+
+    /* one byte per trie level, without the length bookkeeping of
+     * hattrie_find */
+    size_t i = 0;
+    node_ptr node = T->root;
+    do node = node.t->xs[(unsigned char) key[i++]];
+    while ((*node.flag & NODE_TYPE_TRIE) && i < sizeof(key));
+
+    if (*node.flag & NODE_TYPE_TRIE) {
+        return node.t->flag & NODE_HAS_VAL ? &node.t->val : NULL;
+    }
+
+    /* hybrid buckets hold the byte that picked them */
+    if (*node.flag & NODE_TYPE_HYBRID_BUCKET) --i;
+    return ahtable_tryget(node.b, key + i, sizeof(key) - i);
+}
+
+int hattrie_find_leq_u64(hattrie_t* T, uint64_t x, value_t** dst)
+{
+    char key[8];
+    u64_encode(key, x);
+    return hattrie_find_leq(T, key, sizeof(key), dst);
+}
+
+
 int hattrie_del(hattrie_t* T, const char* key, size_t len)
 {
     node_ptr parent = T->root;
     assert(*parent.flag & NODE_TYPE_TRIE);
+    if (T->digests) parent.t->flag &= ~NODE_DIGEST_OK;
 
-    /* find node for deletion */
-    node_ptr node = hattrie_find(&parent, &key, &len);
+    /* find node for deletion, dropping the digests on the path */
+    const char* k = key;
+    size_t l = len;
+    node_ptr node = hattrie_find(&parent, &k, &l, T->digests);
     if (node.flag == NULL) {
         return -1;
     }
     
     /* if consumed on a trie node, clear the value */
+    int ret;
     if (*node.flag & NODE_TYPE_TRIE) {
-        return hattrie_clrval(T, node);
+        ret = hattrie_clrval(T, node);
+    } else {
+        /* remove from bucket */
+        size_t m_old = ahtable_size(node.b);
+        ret = ahtable_del(node.b, k, l);
+        T->m -= (m_old - ahtable_size(node.b));
     }
 
-    /* remove from bucket */
-    size_t m_old = ahtable_size(node.b);
-    int ret =  ahtable_del(node.b, key, len);
-    T->m -= (m_old - ahtable_size(node.b));
+    if (ret == 0) ++T->gen;
+    if (T->log && ret == 0) {
+        changelog_append(T->log, CHANGELOG_DEL, key, len, 0);
+    }
     
     /* merge empty buckets */
     /*! \todo */
@@ -651,80 +1067,566 @@ int hattrie_del(hattrie_t* T, const char* key, size_t len)
 }
 
 
-/* plan for iteration:
- * This is tricky, as we have no parent pointers currently, and I would like to
- * avoid adding them. That means maintaining a stack
- *
+/* Subtree digests:
+ * A digest is the sum of a hash of every full key and its value, so it does
+ * not depend on the order of keys or the shape of the trie. Digests are
+ * cached on trie nodes and buckets and invalidated along the path of every
+ * hattrie_get and hattrie_del, so only modified subtrees are rehashed.
+ * Keys are hashed with FNV-1a, which lets the prefix state be carried down the
+ * trie instead of assembling full keys.
  */
 
-typedef struct hattrie_node_stack_t_
+static const uint64_t DIGEST_BASIS = 0xcbf29ce484222325ULL;
+
+static inline uint64_t digest_step(uint64_t h, const char* s, size_t len)
 {
-    unsigned char   c;
-    size_t level;
+    while (len-- > 0) {
+        h ^= (unsigned char) *s++;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
 
-    node_ptr node;
-    struct hattrie_node_stack_t_* next;
+static inline uint64_t digest_char(uint64_t h, unsigned char c)
+{
+    return (h ^ c) * 0x100000001b3ULL;
+}
 
-} hattrie_node_stack_t;
+/* hash of one key/value pair, the key hash already covers the whole key */
+static inline uint64_t digest_entry(uint64_t h, value_t val)
+{
+    h ^= (uint64_t) val * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
 
+/* digest of bucket entries starting with the given suffix */
+static uint64_t bucket_digest(ahtable_t* b, uint64_t h,
+                              const char* pfx, size_t pfxlen)
+{
+    uint64_t d = 0;
+    size_t len;
+    const char* key;
+    ahtable_iter_t i;
+    ahtable_iter_begin(b, &i, false);
+    while (!ahtable_iter_finished(&i)) {
+        key = ahtable_iter_key(&i, &len);
+        if (pfxlen == 0 || (len >= pfxlen && memcmp(key, pfx, pfxlen) == 0)) {
+            d += digest_entry(digest_step(h, key, len), *ahtable_iter_val(&i));
+        }
+        ahtable_iter_next(&i);
+    }
+    ahtable_iter_free(&i);
+    return d;
+}
 
-struct hattrie_iter_t_
+/* digest of a child subtree, h is the hash state of the parent's prefix */
+static uint64_t node_digest(node_ptr node, uint64_t h, unsigned char c)
 {
-    char* key;
-    size_t keysize; // space reserved for the key
-    size_t level;
+    if (*node.flag & NODE_DIGEST_OK) {
+        return *node.flag & NODE_TYPE_TRIE ? node.t->digest : node.b->digest;
+    }
 
-    /* keep track of keys stored in trie nodes */
-    bool    has_nil_key;
-    value_t nil_val;
+    /* hybrid buckets store keys with the leading char */
+    if (*node.flag & NODE_TYPE_HYBRID_BUCKET) {
+        node.b->digest = bucket_digest(node.b, h, NULL, 0);
+        node.b->flag |= NODE_DIGEST_OK;
+        return node.b->digest;
+    }
 
-    const hattrie_t* T;
-    bool sorted;
-    ahtable_iter_t* i;
-    hattrie_node_stack_t* stack;
-};
+    h = digest_char(h, c);
+    if (*node.flag & NODE_TYPE_PURE_BUCKET) {
+        node.b->digest = bucket_digest(node.b, h, NULL, 0);
+        node.b->flag |= NODE_DIGEST_OK;
+        return node.b->digest;
+    }
 
+    uint64_t d = 0;
+    if (node.t->flag & NODE_HAS_VAL) d += digest_entry(h, node.t->val);
 
-static void hattrie_iter_pushchar(hattrie_iter_t* i, size_t level, char c)
+    size_t i;
+    for (i = 0; i < NODE_CHILDS; ++i) {
+        if (i > 0 && node.t->xs[i].t == node.t->xs[i - 1].t) continue;
+        d += node_digest(node.t->xs[i], h, (unsigned char) i);
+    }
+    node.t->digest = d;
+    node.t->flag |= NODE_DIGEST_OK;
+    return d;
+}
+
+static uint64_t root_digest(const hattrie_t* T)
 {
-    if (i->keysize < level) {
-        i->keysize *= 2;
-        i->key = realloc_or_die(i->key, i->keysize * sizeof(char));
+    /* the root consumes no char, account for it by hashing its children */
+    node_ptr root = T->root;
+    if (root.t->flag & NODE_DIGEST_OK) return root.t->digest;
+
+    uint64_t d = 0;
+    if (root.t->flag & NODE_HAS_VAL) d += digest_entry(DIGEST_BASIS, root.t->val);
+
+    size_t i;
+    for (i = 0; i < NODE_CHILDS; ++i) {
+        if (i > 0 && root.t->xs[i].t == root.t->xs[i - 1].t) continue;
+        d += node_digest(root.t->xs[i], DIGEST_BASIS, (unsigned char) i);
     }
+    root.t->digest = d;
+    root.t->flag |= NODE_DIGEST_OK;
+    return d;
+}
 
-    if (level > 0) {
-        i->key[level - 1] = c;
+static void node_digest_clear(node_ptr node)
+{
+    *node.flag &= ~NODE_DIGEST_OK;
+    if (*node.flag & NODE_TYPE_TRIE) {
+        size_t i;
+        for (i = 0; i < NODE_CHILDS; ++i) {
+            if (i > 0 && node.t->xs[i].t == node.t->xs[i - 1].t) continue;
+            node_digest_clear(node.t->xs[i]);
+        }
     }
+}
 
-    i->level = level;
+void hattrie_digest_enable(hattrie_t* T, bool enable)
+{
+    /* digests went stale while they were not tracked */
+    if (enable && !T->digests) node_digest_clear(T->root);
+    T->digests = enable;
+}
+
+uint64_t hattrie_digest(hattrie_t* T, const char* prefix, size_t len)
+{
+    if (len == 0) return root_digest(T);
+
+    /* descend trie nodes consumed by the prefix */
+    uint64_t h = DIGEST_BASIS;
+    node_ptr node = T->root;
+    while (true) {
+        unsigned char c = (unsigned char) *prefix;
+        node_ptr child = node.t->xs[c];
+        if (len == 1 || !(*child.flag & NODE_TYPE_TRIE)) {
+            /* whole child subtree */
+            if (len == 1 && !(*child.flag & NODE_TYPE_HYBRID_BUCKET)) {
+                return node_digest(child, h, c);
+            }
+            /* remainder of the prefix is inside a bucket */
+            if (*child.flag & NODE_TYPE_PURE_BUCKET) {
+                return bucket_digest(child.b, digest_char(h, c),
+                                     prefix + 1, len - 1);
+            }
+            return bucket_digest(child.b, h, prefix, len);
+        }
+        h = digest_char(h, c);
+        node = child;
+        ++prefix;
+        --len;
+    }
 }
 
 
-static void hattrie_iter_nextnode(hattrie_iter_t* i)
+/* Record every key of S in the log, as a delete or as a set of its value. */
+static void hattrie_log_keys(changelog_t* log, const hattrie_t* S, uint8_t op)
 {
-    if (i->stack == NULL) return;
+    /* values got through hattrie_get are read back before S is iterated */
+    changelog_flush(log);
 
-    /* pop the stack */
-    node_ptr node;
-    hattrie_node_stack_t* next;
-    unsigned char   c;
-    size_t level;
+    size_t len;
+    const char* key;
+    hattrie_iter_t* i = hattrie_iter_begin(S, false);
+    for (; !hattrie_iter_finished(i); hattrie_iter_next(i)) {
+        key = hattrie_iter_key(i, &len);
+        changelog_append(log, op, key, len,
+                         op == CHANGELOG_SET ? *hattrie_iter_val(i) : 0);
+    }
+    hattrie_iter_free(i);
+}
 
-    node  = i->stack->node;
-    next  = i->stack->next;
-    c     = i->stack->c;
-    level = i->stack->level;
+void hattrie_clear(hattrie_t* T)
+{
+    if (T->log) hattrie_log_keys(T->log, T, CHANGELOG_DEL);
 
-    free(i->stack);
-    i->stack = next;
+    hattrie_free_node(T, T->root, true);
+    node_ptr node = alloc_empty_bucket(T->mm, T->bcache, T->filters,
+                                       0x00, TRIE_MAXCHAR, T->klen);
+    T->root.t = alloc_trie_node(T, node);
+    T->m = 0;
+    ++T->gen;
+}
 
-    if (*node.flag & NODE_TYPE_TRIE) {
-        hattrie_iter_pushchar(i, level, c);
+/* Move a subtree to another trie with the same memory context. Nodes and
+ * buckets are kept by pointer, the subtree is only walked to add its number
+ * of keys to m, and to drop its digests unless its trie kept them current. */
+static node_ptr hattrie_adopt(node_ptr node, bool digests, size_t* m)
+{
+    if (!digests) *node.flag &= ~NODE_DIGEST_OK;
+    if (!(*node.flag & NODE_TYPE_TRIE)) {
+        *m += node.b->m;
+        return node;
+    }
 
-        if(node.t->flag & NODE_HAS_VAL) {
-            i->has_nil_key = true;
-            i->nil_val = node.t->val;
-        }
+    if (node.t->flag & NODE_HAS_VAL) ++*m;
+
+    size_t i;
+    for (i = 0; i < NODE_CHILDS; ++i) {
+        if (i > 0 && node.t->xs[i].t == node.t->xs[i - 1].t) continue;
+        hattrie_adopt(node.t->xs[i], digests, m);
+    }
+    return node;
+}
+
+/* Split bucket at the given key, both halves keep the children range of the
+ * original bucket. Returns number of keys moved to the right. */
+static size_t hattrie_split_bucket(node_ptr node, const char* key, size_t len,
+                                   node_ptr* left, node_ptr* right)
+{
+    hattrie_bcache_t* cache = bcache_of(node.b);
+    bool filter = node.b->filter != NULL;
+    *left  = alloc_empty_bucket(node.b->mm, cache, filter, node.b->c0, node.b->c1,
+                                node.b->klen);
+    *right = alloc_empty_bucket(node.b->mm, cache, filter, node.b->c0, node.b->c1,
+                                node.b->klen);
+
+    /* pure buckets hold suffixes after the consumed char */
+    if (*node.flag & NODE_TYPE_PURE_BUCKET) {
+        ++key;
+        --len;
+    }
+
+    size_t moved = 0;
+    size_t klen;
+    const char* k;
+    ahtable_iter_t i;
+    ahtable_iter_begin(node.b, &i, false);
+    while (!ahtable_iter_finished(&i)) {
+        k = ahtable_iter_key(&i, &klen);
+        int r = memcmp(k, key, klen < len ? klen : len);
+        if (r > 0 || (r == 0 && klen >= len)) {
+            ahtable_insert(right->b, k, klen, *ahtable_iter_val(&i));
+            ++moved;
+        } else {
+            ahtable_insert(left->b, k, klen, *ahtable_iter_val(&i));
+        }
+        ahtable_iter_next(&i);
+    }
+    ahtable_iter_free(&i);
+    ahtable_free(node.b);
+
+    return moved;
+}
+
+/* Empty bucket for children c0 to c1 of a node at the given depth. In a fixed
+ * key trie it holds the rest of the keys, less the char a pure bucket drops. */
+static node_ptr alloc_filler_bucket(hattrie_t* T, size_t depth,
+                                    unsigned char c0, unsigned char c1)
+{
+    size_t used = depth + (c0 == c1);
+    return alloc_empty_bucket(T->mm, T->bcache, T->filters, c0, c1,
+                              T->klen > used ? T->klen - used : 0);
+}
+
+int hattrie_split_at(hattrie_t* T, const char* key, size_t len, hattrie_t** right)
+{
+    hattrie_t* R = hattrie_create_klen(T->mm, T->klen);
+    node_ptr l = T->root;
+    node_ptr r = R->root;
+    ahtable_free(r.t->xs[0].b);
+    R->bcache = T->bcache;
+    R->filters = T->filters;
+
+    size_t m = 0, depth = 0;
+    unsigned int c, cl, cr, i;
+    while (true) {
+        /* the key ends on this node, everything below is greater or equal */
+        if (len == 0) {
+            r.t->flag = l.t->flag & ~NODE_DIGEST_OK;
+            r.t->val  = l.t->val;
+            l.t->flag &= ~(NODE_HAS_VAL | NODE_DIGEST_OK);
+            l.t->val  = 0;
+            if (r.t->flag & NODE_HAS_VAL) ++m;
+
+            node_ptr empty = alloc_filler_bucket(T, depth, 0x00, TRIE_MAXCHAR);
+            for (i = 0; i < NODE_CHILDS; ++i) {
+                if (i > 0 && l.t->xs[i].t == l.t->xs[i - 1].t) {
+                    r.t->xs[i] = r.t->xs[i - 1];
+                } else {
+                    r.t->xs[i] = hattrie_adopt(l.t->xs[i], T->digests, &m);
+                }
+            }
+            for (i = 0; i < NODE_CHILDS; ++i) l.t->xs[i] = empty;
+            break;
+        }
+
+        l.t->flag &= ~NODE_DIGEST_OK;
+        c = (unsigned char) *key;
+        node_ptr node = l.t->xs[c];
+        cl = c;
+        cr = c + 1;
+        if (!(*node.flag & NODE_TYPE_TRIE)) {
+            cl = node.b->c0;
+            cr = node.b->c1 + 1;
+        }
+
+        /* greater children move to the right as a whole */
+        if (cr < NODE_CHILDS) {
+            node_ptr empty = alloc_filler_bucket(T, depth, cr, TRIE_MAXCHAR);
+            for (i = cr; i < NODE_CHILDS; ++i) {
+                if (i > cr && l.t->xs[i].t == l.t->xs[i - 1].t) {
+                    r.t->xs[i] = r.t->xs[i - 1];
+                } else {
+                    r.t->xs[i] = hattrie_adopt(l.t->xs[i], T->digests, &m);
+                }
+            }
+            for (i = cr; i < NODE_CHILDS; ++i) l.t->xs[i] = empty;
+        }
+
+        /* lesser children stay on the left */
+        if (cl > 0) {
+            node_ptr empty = alloc_filler_bucket(T, depth, 0x00, cl - 1);
+            for (i = 0; i < cl; ++i) r.t->xs[i] = empty;
+        }
+
+        /* split boundary bucket */
+        if (!(*node.flag & NODE_TYPE_TRIE)) {
+            node_ptr lb, rb;
+            m += hattrie_split_bucket(node, key, len, &lb, &rb);
+            for (i = cl; i < cr; ++i) {
+                l.t->xs[i] = lb;
+                r.t->xs[i] = rb;
+            }
+            break;
+        }
+
+        /* the key ends on the child, move it as a whole */
+        if (len == 1) {
+            r.t->xs[c] = hattrie_adopt(node, T->digests, &m);
+            l.t->xs[c] = alloc_filler_bucket(T, depth, c, c);
+            break;
+        }
+
+        /* descend, the child's own value is a prefix and stays left */
+        node_ptr child;
+        child.t = alloc_trie_node(R, node);
+        r.t->xs[c] = child;
+        l = node;
+        r = child;
+        ++key;
+        --len;
+        ++depth;
+    }
+
+    T->m -= m;
+    R->m  = m;
+    ++T->gen;
+
+    /* the moved keys are gone from T, and R starts without a log */
+    if (T->log) hattrie_log_keys(T->log, R, CHANGELOG_DEL);
+    *right = R;
+    return 0;
+}
+
+/* Least (or greatest) first byte of the keys below the root child of c, -1 if
+ * there are none. Trie nodes count as holding keys. */
+static int node_first_byte(node_ptr node, int c, bool greatest)
+{
+    if (*node.flag & NODE_TYPE_TRIE) return c;
+    if (ahtable_size(node.b) == 0) return -1;
+    if (*node.flag & NODE_TYPE_PURE_BUCKET) return node.b->c0;
+
+    c = greatest ? node.b->c0 : node.b->c1;
+    size_t len;
+    ahtable_iter_t i;
+    ahtable_iter_begin(node.b, &i, false);
+    for (; !ahtable_iter_finished(&i); ahtable_iter_next(&i)) {
+        int k = (unsigned char) *ahtable_iter_key(&i, &len);
+        if (greatest ? k > c : k < c) c = k;
+    }
+    ahtable_iter_free(&i);
+    return c;
+}
+
+/* Narrow the children range of a root bucket to [c0, c1], which must cover
+ * all of its keys. A hybrid bucket left with one child becomes pure. */
+static node_ptr bucket_clip(node_ptr node, unsigned char c0, unsigned char c1)
+{
+    node.b->flag &= ~NODE_DIGEST_OK;
+    if (c0 != c1 || (*node.flag & NODE_TYPE_PURE_BUCKET)) {
+        node.b->c0 = c0;
+        node.b->c1 = c1;
+        return node;
+    }
+
+    node_ptr pure = alloc_empty_bucket(node.b->mm, bcache_of(node.b),
+                                       node.b->filter != NULL, c0, c0,
+                                       node.b->klen > 0 ? node.b->klen - 1 : 0);
+    size_t len;
+    const char* key;
+    ahtable_iter_t i;
+    ahtable_iter_begin(node.b, &i, false);
+    for (; !ahtable_iter_finished(&i); ahtable_iter_next(&i)) {
+        key = ahtable_iter_key(&i, &len);
+        ahtable_insert(pure.b, key + 1, len - 1, *ahtable_iter_val(&i));
+    }
+    ahtable_iter_free(&i);
+    ahtable_free(node.b);
+    return pure;
+}
+
+int hattrie_join(hattrie_t* T, hattrie_t* R)
+{
+    node_ptr l = T->root;
+    node_ptr r = R->root;
+    int lo = NODE_CHILDS, hi = -1, c, i;
+
+    for (c = 0; c < NODE_CHILDS && lo == NODE_CHILDS; ++c) {
+        if (c > 0 && r.t->xs[c].t == r.t->xs[c - 1].t) continue;
+        i = node_first_byte(r.t->xs[c], c, false);
+        if (i != -1) lo = i;
+    }
+    for (c = TRIE_MAXCHAR; c >= 0 && hi == -1; --c) {
+        if (c < TRIE_MAXCHAR && l.t->xs[c].t == l.t->xs[c + 1].t) continue;
+        i = node_first_byte(l.t->xs[c], c, true);
+        if (i != -1) hi = i;
+    }
+    if (T->mm != R->mm || hi >= lo ||
+        ((r.t->flag & NODE_HAS_VAL) && T->m > 0)) {
+        return -1;
+    }
+
+    /* the moved keys are new to T */
+    if (T->log) hattrie_log_keys(T->log, R, CHANGELOG_SET);
+
+    if (lo < NODE_CHILDS) {
+        /* empty children of T from lo up go, one may reach below lo */
+        for (c = lo; c < NODE_CHILDS; ++c) {
+            node_ptr node = l.t->xs[c];
+            if (c > lo && node.t == l.t->xs[c - 1].t) continue;
+            if (node.b->c0 >= lo) {
+                ahtable_free(node.b);
+                continue;
+            }
+            node = bucket_clip(node, node.b->c0, lo - 1);
+            for (i = node.b->c0; i < lo; ++i) l.t->xs[i] = node;
+        }
+
+        /* empty children of R below lo go, one may reach up from lo */
+        for (c = 0; c < lo; ++c) {
+            node_ptr node = r.t->xs[c];
+            if (c > 0 && node.t == r.t->xs[c - 1].t) continue;
+            if (node.b->c1 < lo) {
+                ahtable_free(node.b);
+                continue;
+            }
+            node = bucket_clip(node, lo, node.b->c1);
+            for (i = lo; i <= node.b->c1; ++i) r.t->xs[i] = node;
+        }
+
+        size_t m = 0;
+        for (c = lo; c < NODE_CHILDS; ++c) {
+            if (c > lo && r.t->xs[c].t == r.t->xs[c - 1].t) {
+                l.t->xs[c] = l.t->xs[c - 1];
+            } else {
+                l.t->xs[c] = hattrie_adopt(r.t->xs[c], R->digests, &m);
+            }
+        }
+    } else {
+        for (c = 0; c < NODE_CHILDS; ++c) {
+            if (c == 0 || r.t->xs[c].t != r.t->xs[c - 1].t) {
+                hattrie_free_node(R, r.t->xs[c], true);
+            }
+        }
+    }
+
+    if (r.t->flag & NODE_HAS_VAL) {
+        l.t->flag |= NODE_HAS_VAL;
+        l.t->val   = r.t->val;
+    }
+    l.t->flag &= ~NODE_DIGEST_OK;
+    T->m += R->m;
+    ++T->gen;
+
+    mm_free(R->mm, R->hot);
+    node_release(R, r.t);
+    mm_free(R->mm, R);
+    return 0;
+}
+
+
+/* plan for iteration:
+ * This is tricky, as we have no parent pointers currently, and I would like to
+ * avoid adding them. That means maintaining a stack
+ *
+ */
+
+typedef struct hattrie_node_stack_t_
+{
+    unsigned char   c;
+    size_t level;
+
+    node_ptr node;
+    struct hattrie_node_stack_t_* next;
+
+} hattrie_node_stack_t;
+
+
+struct hattrie_iter_t_
+{
+    char* key;
+    size_t keysize; // space reserved for the key
+    size_t level;
+
+    /* keep track of keys stored in trie nodes */
+    bool     has_nil_key;
+    value_t* nil_val;
+
+    const hattrie_t* T;
+    bool sorted;
+    ahtable_iter_t* i;
+    hattrie_node_stack_t* stack;
+};
+
+
+static void hattrie_iter_pushchar(hattrie_iter_t* i, size_t level, char c)
+{
+    if (i->keysize < level) {
+        i->keysize *= 2;
+        i->key = realloc_or_die(i->key, i->keysize * sizeof(char));
+    }
+
+    if (level > 0) {
+        i->key[level - 1] = c;
+    }
+
+    i->level = level;
+}
+
+
+static void hattrie_iter_nextnode(hattrie_iter_t* i)
+{
+    if (i->stack == NULL) return;
+
+    /* pop the stack */
+    node_ptr node;
+    hattrie_node_stack_t* next;
+    unsigned char   c;
+    size_t level;
+
+    node  = i->stack->node;
+    next  = i->stack->next;
+    c     = i->stack->c;
+    level = i->stack->level;
+
+    free(i->stack);
+    i->stack = next;
+
+    if (*node.flag & NODE_TYPE_TRIE) {
+        hattrie_iter_pushchar(i, level, c);
+
+        if(node.t->flag & NODE_HAS_VAL) {
+            i->has_nil_key = true;
+            i->nil_val = &node.t->val;
+        }
 
         /* push all child nodes from right to left */
         int j;
@@ -756,7 +1658,7 @@ static void hattrie_iter_nextnode(hattrie_iter_t* i)
 }
 
 
-hattrie_iter_t* hattrie_iter_begin(const hattrie_t* T, bool sorted)
+static hattrie_iter_t* hattrie_iter_alloc(const hattrie_t* T, bool sorted)
 {
     hattrie_iter_t* i = malloc_or_die(sizeof(hattrie_iter_t));
     i->T = T;
@@ -766,15 +1668,27 @@ hattrie_iter_t* hattrie_iter_begin(const hattrie_t* T, bool sorted)
     i->key = malloc_or_die(i->keysize * sizeof(char));
     i->level   = 0;
     i->has_nil_key = false;
-    i->nil_val     = 0;
+    i->nil_val     = NULL;
+    i->stack = NULL;
+    return i;
+}
+
 
+static void hattrie_iter_push(hattrie_iter_t* i, node_ptr node, size_t level,
+                              unsigned char c)
+{
+    hattrie_node_stack_t* next = i->stack;
     i->stack = malloc_or_die(sizeof(hattrie_node_stack_t));
-    i->stack->next   = NULL;
-    i->stack->node   = T->root;
-    i->stack->c      = '\0';
-    i->stack->level  = 0;
+    i->stack->node  = node;
+    i->stack->next  = next;
+    i->stack->level = level;
+    i->stack->c     = c;
+}
 
 
+/* Move on to the next node until there is an entry, or none is left. */
+static void hattrie_iter_settle(hattrie_iter_t* i)
+{
     while (((i->i == NULL || ahtable_iter_finished(i->i)) && !i->has_nil_key) &&
            i->stack != NULL ) {
 
@@ -789,11 +1703,89 @@ hattrie_iter_t* hattrie_iter_begin(const hattrie_t* T, bool sorted)
         free(i->i);
         i->i = NULL;
     }
+}
 
+
+hattrie_iter_t* hattrie_iter_begin(const hattrie_t* T, bool sorted)
+{
+    hattrie_iter_t* i = hattrie_iter_alloc(T, sorted);
+    hattrie_iter_push(i, T->root, 0, '\0');
+    hattrie_iter_settle(i);
     return i;
 }
 
 
+hattrie_iter_t* hattrie_iter_lower_bound(const hattrie_t* T, const char* key, size_t len)
+{
+    hattrie_iter_t* i = hattrie_iter_alloc(T, true);
+    node_ptr node = T->root;
+    size_t level = 0;
+    int j;
+
+    /* descend along the key, keeping the greater siblings on the stack */
+    while (true) {
+        if (len == level) {
+            hattrie_iter_push(i, node, level, level ? key[level - 1] : '\0');
+            break;
+        }
+
+        unsigned char c = (unsigned char) key[level];
+        node_ptr child = node.t->xs[c];
+        int last = *child.flag & NODE_TYPE_TRIE ? c : child.b->c1;
+        for (j = TRIE_MAXCHAR; j > last; --j) {
+            if (j < TRIE_MAXCHAR && node.t->xs[j].t == node.t->xs[j + 1].t) continue;
+            hattrie_iter_push(i, node.t->xs[j], level + 1, (unsigned char) j);
+        }
+
+        if (*child.flag & NODE_TYPE_TRIE) {
+            hattrie_iter_pushchar(i, level + 1, c);
+            node = child;
+            ++level;
+            continue;
+        }
+
+        /* the rest of the key is looked up in the bucket */
+        if (*child.flag & NODE_TYPE_PURE_BUCKET) {
+            hattrie_iter_pushchar(i, level + 1, c);
+            ++level;
+        } else {
+            i->level = level;
+        }
+        i->i = malloc_or_die(sizeof(ahtable_iter_t));
+        ahtable_iter_begin(child.b, i->i, true);
+        ahtable_iter_seek(i->i, key + level, len - level);
+        break;
+    }
+
+    hattrie_iter_settle(i);
+    return i;
+}
+
+
+hattrie_iter_t* hattrie_iter_dup(const hattrie_iter_t* i)
+{
+    hattrie_iter_t* d = malloc_or_die(sizeof(hattrie_iter_t));
+    *d = *i;
+    d->key = malloc_or_die(i->keysize * sizeof(char));
+    memcpy(d->key, i->key, i->level);
+
+    if (i->i) {
+        d->i = malloc_or_die(sizeof(ahtable_iter_t));
+        ahtable_iter_dup(i->i, d->i);
+    }
+
+    hattrie_node_stack_t** tail = &d->stack;
+    const hattrie_node_stack_t* s;
+    for (s = i->stack; s; s = s->next) {
+        *tail = malloc_or_die(sizeof(hattrie_node_stack_t));
+        **tail = *s;
+        tail = &(*tail)->next;
+    }
+    *tail = NULL;
+    return d;
+}
+
+
 void hattrie_iter_next(hattrie_iter_t* i)
 {
     if (hattrie_iter_finished(i)) return;
@@ -803,7 +1795,7 @@ void hattrie_iter_next(hattrie_iter_t* i)
     }
     else if (i->has_nil_key) {
         i->has_nil_key = false;
-        i->nil_val = 0;
+        i->nil_val = NULL;
         hattrie_iter_nextnode(i);
     }
 
@@ -868,19 +1860,967 @@ const char* hattrie_iter_key(hattrie_iter_t* i, size_t* len)
         i->key = realloc_or_die(i->key, i->keysize * sizeof(char));
     }
 
-    memcpy(i->key + i->level, subkey, sublen);
+    if (sublen > 0) memcpy(i->key + i->level, subkey, sublen);
     i->key[i->level + sublen] = '\0';
 
     *len = i->level + sublen;
     return i->key;
 }
 
+uint64_t hattrie_iter_key_u64(hattrie_iter_t* i)
+{
+    size_t len;
+    const char* key = hattrie_iter_key(i, &len);
+    assert(len == sizeof(uint64_t));
+    return u64_decode(key);
+}
+
 
 value_t* hattrie_iter_val(hattrie_iter_t* i)
 {
-    if (i->has_nil_key) return &i->nil_val;
+    if (i->has_nil_key) return i->nil_val;
 
     if (hattrie_iter_finished(i)) return NULL;
 
     return ahtable_iter_val(i->i);
 }
+
+
+/* Append a record to buf if it fits. */
+static inline bool fill_record(unsigned char* out, size_t* used, size_t bufsize,
+                               const char* prefix, size_t plen,
+                               const char* suffix, size_t slen, value_t val)
+{
+    size_t len  = plen + slen;
+    size_t size = hattrie_record_size(len);
+    if (size > bufsize - *used) return false;
+
+    unsigned char* rec = out + *used;
+    uint32_t len32 = (uint32_t) len;
+    memcpy(rec, &val, sizeof(value_t));
+    memcpy(rec + sizeof(value_t), &len32, sizeof(uint32_t));
+    rec += sizeof(value_t) + sizeof(uint32_t);
+    memcpy(rec, prefix, plen);
+    if (slen > 0) memcpy(rec + plen, suffix, slen);
+    memset(rec + len, 0, out + *used + size - (rec + len));
+    *used += size;
+    return true;
+}
+
+size_t hattrie_iter_fill(hattrie_iter_t* i, void* buf, size_t bufsize, size_t* count)
+{
+    size_t used = 0, n = 0, sublen;
+    const char* subkey;
+
+    /* the prefix is in the key buffer already, copy straight from there */
+    while (!hattrie_iter_finished(i)) {
+        if (i->has_nil_key) {
+            if (!fill_record(buf, &used, bufsize, i->key, i->level, NULL, 0, *i->nil_val)) break;
+            ++n;
+            hattrie_iter_next(i);
+            continue;
+        }
+
+        /* run through the bucket, the trie iterator is only needed between them */
+        while (!ahtable_iter_finished(i->i)) {
+            subkey = ahtable_iter_key(i->i, &sublen);
+            if (!fill_record(buf, &used, bufsize, i->key, i->level, subkey, sublen,
+                             *ahtable_iter_val(i->i))) {
+                *count = n;
+                return used;
+            }
+            ++n;
+            ahtable_iter_next(i->i);
+        }
+        hattrie_iter_next(i);
+    }
+
+    *count = n;
+    return used;
+}
+
+
+/* Parallel scan:
+ * A task is a subtree with the key prefix leading to it. Workers take tasks
+ * from the bottom of their own deque, where the children of a trie node are
+ * pushed, and an idle worker steals from the top of another one's deque,
+ * where the tasks closest to the root and so the largest subtrees are. A
+ * worker that finds nothing to steal sleeps until a task is pushed, and the
+ * scan ends when no task is queued or running.
+ */
+
+typedef struct scan_task_t_
+{
+    node_ptr node;
+    char* prefix;
+    size_t len;
+} scan_task_t;
+
+typedef struct scan_worker_t_
+{
+    pthread_mutex_t lock;
+    scan_task_t* tasks;  // deque of tasks [top, bottom)
+    size_t top, bottom, size;
+
+    struct scan_t_* scan;
+    size_t id;
+    char* key;           // key of the current entry
+    size_t keysize;
+} scan_worker_t;
+
+typedef struct scan_t_
+{
+    scan_worker_t* workers;
+    size_t nworkers;
+    size_t pending;      // tasks queued or running
+    size_t queued;       // tasks queued
+    size_t idle;         // workers waiting for a task
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    hattrie_visit_t fn;
+    void* ctx;
+} scan_t;
+
+
+static void scan_push(scan_worker_t* w, node_ptr node, const char* prefix, size_t len)
+{
+    scan_task_t task;
+    task.node   = node;
+    task.len    = len;
+    task.prefix = malloc_or_die(len + 1);
+    memcpy(task.prefix, prefix, len);
+    __atomic_fetch_add(&w->scan->pending, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&w->lock);
+    if (w->bottom == w->size) {
+        if (w->top > 0) {
+            memmove(w->tasks, w->tasks + w->top, (w->bottom - w->top) * sizeof(scan_task_t));
+            w->bottom -= w->top;
+            w->top = 0;
+        } else {
+            w->size *= 2;
+            w->tasks = realloc_or_die(w->tasks, w->size * sizeof(scan_task_t));
+        }
+    }
+    w->tasks[w->bottom++] = task;
+    pthread_mutex_unlock(&w->lock);
+
+    /* an idle worker counts itself before checking the queue under the scan
+     * lock, so either it sees this task or it is counted here */
+    scan_t* s = w->scan;
+    __atomic_fetch_add(&s->queued, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&s->idle, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&s->lock);
+        pthread_cond_signal(&s->wake);
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+static bool scan_take(scan_worker_t* w, bool steal, scan_task_t* task)
+{
+    bool found = false;
+    pthread_mutex_lock(&w->lock);
+    if (w->top < w->bottom) {
+        *task = steal ? w->tasks[w->top++] : w->tasks[--w->bottom];
+        found = true;
+    }
+    pthread_mutex_unlock(&w->lock);
+    if (found) __atomic_fetch_sub(&w->scan->queued, 1, __ATOMIC_RELAXED);
+    return found;
+}
+
+static void scan_key_reserve(scan_worker_t* w, size_t len)
+{
+    if (w->keysize < len) {
+        while (w->keysize < len) w->keysize *= 2;
+        w->key = realloc_or_die(w->key, w->keysize);
+    }
+}
+
+static void scan_run_task(scan_worker_t* w, scan_task_t* task)
+{
+    scan_t* s = w->scan;
+    node_ptr node = task->node;
+
+    if (*node.flag & NODE_TYPE_TRIE) {
+        if (node.t->flag & NODE_HAS_VAL) {
+            s->fn(task->prefix, task->len, &node.t->val, w->id, s->ctx);
+        }
+
+        /* push from the right, so the left children are run first */
+        scan_key_reserve(w, task->len + 1);
+        memcpy(w->key, task->prefix, task->len);
+        int c;
+        for (c = TRIE_MAXCHAR; c >= 0; --c) {
+            if (c < TRIE_MAXCHAR && node.t->xs[c].t == node.t->xs[c + 1].t) continue;
+            node_ptr child = node.t->xs[c];
+            if (!(*child.flag & NODE_TYPE_TRIE) && ahtable_size(child.b) == 0) continue;
+            w->key[task->len] = (char) c;
+            scan_push(w, child, w->key,
+                      task->len + !(*child.flag & NODE_TYPE_HYBRID_BUCKET));
+        }
+        return;
+    }
+
+    size_t len;
+    const char* key;
+    ahtable_iter_t i;
+    ahtable_iter_begin(node.b, &i, false);
+    for (; !ahtable_iter_finished(&i); ahtable_iter_next(&i)) {
+        key = ahtable_iter_key(&i, &len);
+        scan_key_reserve(w, task->len + len + 1);
+        memcpy(w->key, task->prefix, task->len);
+        memcpy(w->key + task->len, key, len);
+        w->key[task->len + len] = '\0';
+        s->fn(w->key, task->len + len, ahtable_iter_val(&i), w->id, s->ctx);
+    }
+    ahtable_iter_free(&i);
+}
+
+static void* scan_worker(void* arg)
+{
+    scan_worker_t* w = arg;
+    scan_t* s = w->scan;
+    scan_task_t task;
+    size_t j;
+
+    while (true) {
+        bool found = scan_take(w, false, &task);
+        for (j = 1; !found && j < s->nworkers; ++j) {
+            found = scan_take(&s->workers[(w->id + j) % s->nworkers], true, &task);
+        }
+        if (!found) {
+            pthread_mutex_lock(&s->lock);
+            __atomic_fetch_add(&s->idle, 1, __ATOMIC_SEQ_CST);
+            while (__atomic_load_n(&s->pending, __ATOMIC_ACQUIRE) > 0 &&
+                   __atomic_load_n(&s->queued, __ATOMIC_SEQ_CST) == 0) {
+                pthread_cond_wait(&s->wake, &s->lock);
+            }
+            __atomic_fetch_sub(&s->idle, 1, __ATOMIC_RELAXED);
+            bool done = __atomic_load_n(&s->pending, __ATOMIC_ACQUIRE) == 0;
+            pthread_mutex_unlock(&s->lock);
+            if (done) break;
+            continue;
+        }
+
+        scan_run_task(w, &task);
+        free(task.prefix);
+        if (__atomic_sub_fetch(&s->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+            pthread_mutex_lock(&s->lock);
+            pthread_cond_broadcast(&s->wake);
+            pthread_mutex_unlock(&s->lock);
+        }
+    }
+    return NULL;
+}
+
+void hattrie_parallel_for_each(const hattrie_t* T, size_t nthreads,
+                               hattrie_visit_t fn, void* ctx)
+{
+    /* the bucket cache is not shared between threads */
+    if (nthreads == 0 || T->bcache) nthreads = 1;
+
+    scan_t s;
+    s.nworkers = nthreads;
+    s.pending  = 0;
+    s.queued   = 0;
+    s.idle     = 0;
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.wake, NULL);
+    s.fn  = fn;
+    s.ctx = ctx;
+    s.workers = malloc_or_die(nthreads * sizeof(scan_worker_t));
+
+    size_t j;
+    for (j = 0; j < nthreads; ++j) {
+        scan_worker_t* w = &s.workers[j];
+        pthread_mutex_init(&w->lock, NULL);
+        w->size = 64;
+        w->tasks = malloc_or_die(w->size * sizeof(scan_task_t));
+        w->top = w->bottom = 0;
+        w->scan = &s;
+        w->id = j;
+        w->keysize = 64;
+        w->key = malloc_or_die(w->keysize);
+    }
+    scan_push(&s.workers[0], T->root, "", 0);
+
+    /* a worker that could not be started leaves its empty deque behind,
+     * the others do its share */
+    pthread_t* threads = malloc_or_die(nthreads * sizeof(pthread_t));
+    bool* started = malloc_or_die(nthreads * sizeof(bool));
+    for (j = 1; j < nthreads; ++j) {
+        started[j] = pthread_create(&threads[j], NULL, scan_worker, &s.workers[j]) == 0;
+    }
+    scan_worker(&s.workers[0]);
+    for (j = 1; j < nthreads; ++j) {
+        if (started[j]) pthread_join(threads[j], NULL);
+    }
+    free(started);
+    free(threads);
+
+    for (j = 0; j < nthreads; ++j) {
+        pthread_mutex_destroy(&s.workers[j].lock);
+        free(s.workers[j].tasks);
+        free(s.workers[j].key);
+    }
+    free(s.workers);
+    pthread_cond_destroy(&s.wake);
+    pthread_mutex_destroy(&s.lock);
+}
+
+
+/* Internal iteration:
+ * Trie nodes are walked with an explicit stack of (node, next child) frames
+ * and the prefix consumed so far in one buffer. Entries of plain buckets are
+ * decoded straight from the slots, or through the bucket's order index, and
+ * passed to the callback without copying the suffix. Cold and paged buckets
+ * go through the table iterator, which expands or pins them.
+ */
+
+typedef struct walk_frame_t_
+{
+    node_ptr node;
+    int c;           // next child, -1 before the node's own value
+} walk_frame_t;
+
+typedef struct walk_t_
+{
+    char* prefix;
+    size_t prefixsize;
+    slot_t* order;   // sorted entries of an unindexed bucket
+    size_t ordersize;
+    bool sorted;
+    hattrie_walk_t fn;
+    void* ctx;
+} walk_t;
+
+static int walk_cmp(const void* a_, const void* b_)
+{
+    size_t ka, kb;
+    const char* a = ahtable_slot_key(*(const slot_t*) a_, &ka);
+    const char* b = ahtable_slot_key(*(const slot_t*) b_, &kb);
+    int c = memcmp(a, b, ka < kb ? ka : kb);
+    return c == 0 ? (ka > kb) - (ka < kb) : c;
+}
+
+static int walk_bucket(walk_t* w, ahtable_t* b, size_t plen)
+{
+    size_t len, j, u;
+    const char* key;
+    int r = 0;
+
+    /* fixed key entries are sorted by the table's own iterator */
+    if (b->cold || b->page || (b->klen && w->sorted && b->index == NULL)) {
+        ahtable_iter_t i;
+        ahtable_iter_begin(b, &i, w->sorted);
+        for (; r == 0 && !ahtable_iter_finished(&i); ahtable_iter_next(&i)) {
+            key = ahtable_iter_key(&i, &len);
+            r = w->fn(w->prefix, plen, key, len, ahtable_iter_val(&i), w->ctx);
+        }
+        ahtable_iter_free(&i);
+        return r;
+    }
+
+    slot_t s, end;
+    if (!w->sorted) {
+        for (j = 0; j < b->n; ++j) {
+            s   = b->slots[j];
+            end = s + b->slot_sizes[j];
+            while (s < end) {
+                key = ahtable_entry_key(b, s, &len);
+                s = (slot_t) key + len + sizeof(value_t);
+                r = w->fn(w->prefix, plen, key, len, (value_t*) (key + len), w->ctx);
+                if (r) return r;
+            }
+        }
+        return 0;
+    }
+
+    slot_t* order = b->index;
+    if (order == NULL && b->m > 0) {
+        if (w->ordersize < b->m) {
+            w->ordersize = b->m;
+            w->order = realloc_or_die(w->order, w->ordersize * sizeof(slot_t));
+        }
+        for (j = 0, u = 0; j < b->n; ++j) {
+            s   = b->slots[j];
+            end = s + b->slot_sizes[j];
+            while (s < end) {
+                w->order[u++] = s;
+                key = ahtable_slot_key(s, &len);
+                s = (slot_t) key + len + sizeof(value_t);
+            }
+        }
+        qsort(w->order, b->m, sizeof(slot_t), walk_cmp);
+        order = w->order;
+    }
+    for (j = 0; j < b->m && r == 0; ++j) {
+        key = ahtable_entry_key(b, order[j], &len);
+        r = w->fn(w->prefix, plen, key, len, (value_t*) (key + len), w->ctx);
+    }
+    return r;
+}
+
+int hattrie_walk_all(const hattrie_t* T, bool sorted, hattrie_walk_t fn, void* ctx)
+{
+    walk_t w;
+    w.prefixsize = 64;
+    w.prefix = malloc_or_die(w.prefixsize);
+    w.order = NULL;
+    w.ordersize = 0;
+    w.sorted = sorted;
+    w.fn  = fn;
+    w.ctx = ctx;
+
+    size_t stacksize = NODESTACK_INIT, sp = 0;
+    walk_frame_t* stack = malloc_or_die(stacksize * sizeof(walk_frame_t));
+    stack[sp].node = T->root;
+    stack[sp].c    = -1;
+    ++sp;
+
+    int r = 0;
+    while (sp > 0 && r == 0) {
+        /* the depth of the top frame is the length of its prefix */
+        walk_frame_t* f = &stack[sp - 1];
+        size_t level = sp - 1;
+        node_ptr node = f->node;
+
+        if (f->c < 0) {
+            f->c = 0;
+            if (node.t->flag & NODE_HAS_VAL) {
+                r = fn(w.prefix, level, "", 0, &node.t->val, ctx);
+                continue;
+            }
+        }
+
+        while (f->c > 0 && f->c < NODE_CHILDS &&
+               node.t->xs[f->c].t == node.t->xs[f->c - 1].t) ++f->c;
+        if (f->c == NODE_CHILDS) {
+            --sp;
+            continue;
+        }
+
+        int c = f->c++;
+        node_ptr child = node.t->xs[c];
+        if (level + 1 > w.prefixsize) {
+            w.prefixsize *= 2;
+            w.prefix = realloc_or_die(w.prefix, w.prefixsize);
+        }
+        w.prefix[level] = (char) c;
+
+        if (*child.flag & NODE_TYPE_TRIE) {
+            if (sp == stacksize) {
+                stacksize *= 2;
+                stack = realloc_or_die(stack, stacksize * sizeof(walk_frame_t));
+            }
+            stack[sp].node = child;
+            stack[sp].c    = -1;
+            ++sp;
+        } else {
+            r = walk_bucket(&w, child.b,
+                            level + !!(*child.flag & NODE_TYPE_PURE_BUCKET));
+        }
+    }
+
+    free(stack);
+    free(w.prefix);
+    free(w.order);
+    return r;
+}
+
+
+/* Set operations:
+ * Both tries are walked in lockstep, one character per level. While both
+ * sides are trie nodes, children are paired through xs[] and subtrees that
+ * are missing on one side are pruned without being visited. Once a side
+ * reaches a bucket, it becomes a range of the bucket's sorted entries that
+ * share the consumed prefix, which is narrowed as the other side descends.
+ * Two ranges are merge-joined directly.
+ */
+
+enum {
+    SETOP_INTERSECT,
+    SETOP_DIFFERENCE,
+    SETOP_UNION,
+    SETOP_DIFF      /* keys with different presence or value */
+};
+
+/* One side of the traversal, either a trie node or a bucket range. */
+typedef struct setop_side_t_
+{
+    node_ptr node;   /* trie node, NULL for ranges */
+    const ahtable_t* b; /* bucket of the entries */
+    slot_t*  xs;     /* sorted bucket entries */
+    size_t   lo, hi; /* remaining range of entries */
+    size_t   skip;   /* bytes of entry keys already consumed by the trie */
+} setop_side_t;
+
+typedef struct setop_frame_t_
+{
+    setop_side_t a, b;
+    size_t level;
+    uint64_t h; /* digest hash state of the prefix */
+    int c; /* next child, -1 if node values were not visited yet */
+} setop_frame_t;
+
+/* Sorted entries of the bucket a side currently descends into. */
+typedef struct setop_cache_t_
+{
+    ahtable_t* b;
+    ahtable_t* copy; /* expanded copy of b if it is cold, else NULL */
+    ahtable_iter_t i;
+} setop_cache_t;
+
+struct hattrie_setop_t_
+{
+    int op;
+    bool digests; /* prune subtrees with equal digests */
+
+    char* key;
+    size_t keysize;
+    size_t keylen;
+    value_t* va;
+    value_t* vb;
+    bool finished;
+
+    setop_cache_t ca, cb;
+    setop_frame_t* stack;
+    size_t sp, stacksize;
+};
+
+
+static void setop_cache_free(setop_cache_t* cache)
+{
+    if (cache->b) ahtable_iter_free(&cache->i);
+    ahtable_free(cache->copy);
+    cache->copy = NULL;
+    cache->b = NULL;
+}
+
+/* Sorted entries of bucket b, and the table holding them. Ranges are binary
+ * searched, which the front-coded form of a cold bucket does not allow, so a
+ * cold bucket is expanded into a copy for the iterator, leaving it cold. */
+static const ahtable_t* setop_cache_get(setop_cache_t* cache, ahtable_t* b,
+                                        slot_t** xs)
+{
+    /* Only the innermost bucket of each side is ever referenced, as ranges
+     * are only narrowed once a side leaves the trie. */
+    if (cache->b != b) {
+        setop_cache_free(cache);
+        ahtable_t* t = b;
+        if (b->cold) {
+            size_t len;
+            const char* key;
+            ahtable_iter_t i;
+            t = cache->copy = b->klen ? ahtable_create_fixed(b->m, b->klen)
+                                      : ahtable_create_n(b->m);
+            ahtable_iter_begin(b, &i, false);
+            for (; !ahtable_iter_finished(&i); ahtable_iter_next(&i)) {
+                key = ahtable_iter_key(&i, &len);
+                ahtable_insert(t, key, len, *ahtable_iter_val(&i));
+            }
+            ahtable_iter_free(&i);
+        }
+        ahtable_iter_begin(t, &cache->i, true);
+        cache->b = b;
+    }
+    *xs = cache->i.d.xs;
+    return cache->i.T;
+}
+
+static inline bool setop_empty(const setop_side_t* s)
+{
+    return s->node.flag == NULL && s->lo >= s->hi;
+}
+
+static inline unsigned char setop_char(const setop_side_t* s, size_t i)
+{
+    size_t len;
+    return (unsigned char) ahtable_entry_key(s->b, s->xs[i], &len)[s->skip];
+}
+
+/* first entry in range with the consumed char greater than c */
+static size_t setop_bound(const setop_side_t* s, size_t lo, int c)
+{
+    size_t hi = s->hi;
+    while (lo < hi) {
+        size_t k = lo + (hi - lo) / 2;
+        if ((int) setop_char(s, k) <= c) lo = k + 1;
+        else hi = k;
+    }
+    return lo;
+}
+
+/* first entry in range not less than the given key suffix */
+static size_t setop_seek(const setop_side_t* s, const char* key, size_t len)
+{
+    size_t lo = s->lo, hi = s->hi, klen;
+    while (lo < hi) {
+        size_t k = lo + (hi - lo) / 2;
+        const char* kk = ahtable_entry_key(s->b, s->xs[k], &klen) + s->skip;
+        klen -= s->skip;
+        int c = memcmp(kk, key, klen < len ? klen : len);
+        if (c < 0 || (c == 0 && klen < len)) lo = k + 1;
+        else hi = k;
+    }
+    return lo;
+}
+
+/* narrow the side to the entries continuing with char c */
+static void setop_narrow(setop_side_t* s, int c)
+{
+    s->lo = c > 0 ? setop_bound(s, s->lo, c - 1) : s->lo;
+    s->hi = setop_bound(s, s->lo, c);
+    ++s->skip;
+}
+
+/* consume the value for the key ending at the current level */
+static value_t* setop_nil(setop_side_t* s)
+{
+    if (s->node.flag) {
+        if (s->node.t->flag & NODE_HAS_VAL) return &s->node.t->val;
+        return NULL;
+    }
+
+    size_t len;
+    if (s->lo < s->hi) {
+        ahtable_entry_key(s->b, s->xs[s->lo], &len);
+        if (len == s->skip) return ahtable_entry_val(s->b, s->xs[s->lo++]);
+    }
+    return NULL;
+}
+
+/* descend to child c of the side */
+static void setop_child(setop_cache_t* cache, const setop_side_t* s, int c,
+                        setop_side_t* child)
+{
+    if (s->node.flag == NULL) {
+        *child = *s;
+        setop_narrow(child, c);
+        return;
+    }
+
+    node_ptr node = s->node.t->xs[c];
+    memset(child, 0, sizeof(setop_side_t));
+    if (node.flag == NULL) return;
+
+    if (*node.flag & NODE_TYPE_TRIE) {
+        child->node = node;
+        return;
+    }
+
+    if (node.b->m == 0) return;
+    child->b  = setop_cache_get(cache, node.b, &child->xs);
+    child->hi = node.b->m;
+    if (*node.flag & NODE_TYPE_HYBRID_BUCKET) {
+        setop_narrow(child, c);
+    }
+}
+
+/* last child sharing an empty bucket with child c in a trie side */
+static int setop_span(const setop_side_t* s, int c)
+{
+    if (s->node.flag == NULL) return c;
+    node_ptr node = s->node.t->xs[c];
+    if (node.flag == NULL || *node.flag & NODE_TYPE_TRIE) return c;
+    return node.b->m == 0 ? node.b->c1 : c;
+}
+
+/* skip to the first char present in a range that must produce output,
+ * returns the next child to visit */
+static int setop_jump(int op, setop_frame_t* f)
+{
+    const setop_side_t* s[2] = { &f->a, &f->b };
+    int n = op == SETOP_INTERSECT ? 2 : op == SETOP_DIFFERENCE ? 1 : 0;
+    int i;
+    for (i = 0; i < n && f->c < NODE_CHILDS; ++i) {
+        if (s[i]->node.flag) continue;
+        if (s[i]->lo >= s[i]->hi) f->c = NODE_CHILDS;
+        else if (setop_char(s[i], s[i]->lo) > f->c) {
+            f->c = setop_char(s[i], s[i]->lo);
+        }
+    }
+    return f->c;
+}
+
+static void setop_reserve(hattrie_setop_t* it, size_t len)
+{
+    if (it->keysize < len) {
+        while (it->keysize < len) it->keysize *= 2;
+        it->key = realloc_or_die(it->key, it->keysize);
+    }
+}
+
+static void setop_emit(hattrie_setop_t* it, size_t level,
+                       const setop_side_t* s, slot_t e,
+                       value_t* va, value_t* vb)
+{
+    size_t len = 0;
+    const char* suffix = NULL;
+    if (e) {
+        suffix = ahtable_entry_key(s->b, e, &len) + s->skip;
+        len -= s->skip;
+    }
+    setop_reserve(it, level + len + 1);
+    if (len > 0) memcpy(it->key + level, suffix, len);
+    it->key[level + len] = '\0';
+    it->keylen = level + len;
+    it->va = va;
+    it->vb = vb;
+}
+
+/* merge-join two ranges, returns true if a key was emitted */
+static bool setop_merge(hattrie_setop_t* it, setop_frame_t* f)
+{
+    setop_side_t* a = &f->a;
+    setop_side_t* b = &f->b;
+    size_t alen = 0, blen = 0;
+    const char *ak = NULL, *bk = NULL;
+
+    while (true) {
+        bool ha = a->lo < a->hi, hb = b->lo < b->hi;
+        bool both = it->op == SETOP_UNION || it->op == SETOP_DIFF;
+        if (!ha && !(hb && both)) return false;
+        if (!hb && it->op == SETOP_INTERSECT) return false;
+
+        int c = ha ? -1 : 1;
+        if (ha && hb) {
+            ak = ahtable_entry_key(a->b, a->xs[a->lo], &alen) + a->skip;
+            bk = ahtable_entry_key(b->b, b->xs[b->lo], &blen) + b->skip;
+            alen -= a->skip;
+            blen -= b->skip;
+            c = memcmp(ak, bk, alen < blen ? alen : blen);
+            if (c == 0) c = alen < blen ? -1 : alen > blen;
+        }
+
+        if (c == 0) {
+            slot_t e = a->xs[a->lo];
+            value_t* vb = ahtable_entry_val(b->b, b->xs[b->lo]);
+            ++a->lo;
+            ++b->lo;
+            if (it->op == SETOP_DIFF && *ahtable_entry_val(a->b, e) == *vb) continue;
+            if (it->op != SETOP_DIFFERENCE) {
+                setop_emit(it, f->level, a, e, ahtable_entry_val(a->b, e), vb);
+                return true;
+            }
+        }
+        else if (c < 0) {
+            if (it->op == SETOP_INTERSECT) {
+                /* gallop over entries missing on the other side */
+                a->lo = setop_seek(a, bk, blen);
+                continue;
+            }
+            slot_t e = a->xs[a->lo++];
+            setop_emit(it, f->level, a, e, ahtable_entry_val(a->b, e), NULL);
+            return true;
+        }
+        else {
+            if (both) {
+                slot_t e = b->xs[b->lo++];
+                setop_emit(it, f->level, b, e, NULL, ahtable_entry_val(b->b, e));
+                return true;
+            }
+            b->lo = setop_seek(b, ak, alen);
+        }
+    }
+}
+
+/* can the pair of sides produce any output */
+static inline bool setop_useful(int op, const setop_side_t* a,
+                                const setop_side_t* b)
+{
+    switch (op) {
+    case SETOP_INTERSECT:  return !setop_empty(a) && !setop_empty(b);
+    case SETOP_DIFFERENCE: return !setop_empty(a);
+    default:               return !setop_empty(a) || !setop_empty(b);
+    }
+}
+
+/* compare digests of children c of two trie nodes, skip equal subtrees */
+static bool setop_same(setop_frame_t* f, int c)
+{
+    if (f->a.node.flag == NULL || f->b.node.flag == NULL) return false;
+
+    node_ptr a = f->a.node.t->xs[c];
+    node_ptr b = f->b.node.t->xs[c];
+    uint8_t type = NODE_TYPE_TRIE | NODE_TYPE_PURE_BUCKET | NODE_TYPE_HYBRID_BUCKET;
+    if ((*a.flag & type) != (*b.flag & type)) return false;
+
+    /* buckets must cover the same children */
+    if (!(*a.flag & NODE_TYPE_TRIE) &&
+        (a.b->c0 != b.b->c0 || a.b->c1 != b.b->c1)) return false;
+
+    if (node_digest(a, f->h, (unsigned char) c) !=
+        node_digest(b, f->h, (unsigned char) c)) return false;
+
+    if (!(*a.flag & NODE_TYPE_TRIE)) f->c = a.b->c1 + 1;
+    return true;
+}
+
+static void setop_push(hattrie_setop_t* it, const setop_side_t* a,
+                       const setop_side_t* b, size_t level, uint64_t h)
+{
+    if (it->sp == it->stacksize) {
+        it->stacksize *= 2;
+        it->stack = realloc_or_die(it->stack,
+                                   it->stacksize * sizeof(setop_frame_t));
+    }
+    setop_frame_t* f = &it->stack[it->sp++];
+    f->a = *a;
+    f->b = *b;
+    f->level = level;
+    f->h = h;
+    f->c = -1;
+}
+
+/* advance to the next key in the result */
+static void setop_advance(hattrie_setop_t* it)
+{
+    setop_side_t a, b;
+
+    while (it->sp > 0) {
+        setop_frame_t* f = &it->stack[it->sp - 1];
+
+        /* both sides are bucket ranges */
+        if (f->a.node.flag == NULL && f->b.node.flag == NULL) {
+            if (setop_merge(it, f)) return;
+            --it->sp;
+            continue;
+        }
+
+        /* key consumed at this level */
+        if (f->c < 0) {
+            f->c = 0;
+            value_t* va = setop_nil(&f->a);
+            value_t* vb = setop_nil(&f->b);
+            bool emit;
+            switch (it->op) {
+            case SETOP_INTERSECT:  emit = va && vb;  break;
+            case SETOP_DIFFERENCE: emit = va && !vb; break;
+            case SETOP_DIFF:       emit = (va || vb) &&
+                                          !(va && vb && *va == *vb); break;
+            default:               emit = va || vb;  break;
+            }
+            if (emit) {
+                setop_emit(it, f->level, NULL, NULL, va, vb);
+                return;
+            }
+        }
+
+        /* find next child pair that may produce output */
+        bool pushed = false;
+        while (setop_jump(it->op, f) < NODE_CHILDS) {
+            int c = f->c++;
+            setop_child(&it->ca, &f->a, c, &a);
+            setop_child(&it->cb, &f->b, c, &b);
+            if (f->a.node.flag == NULL) f->a.lo = a.hi;
+            if (f->b.node.flag == NULL) f->b.lo = b.hi;
+            if (!setop_useful(it->op, &a, &b)) {
+                /* prune the whole span of an empty hybrid bucket */
+                if (it->op == SETOP_INTERSECT || it->op == SETOP_DIFFERENCE) {
+                    f->c = setop_span(&f->a, c) + 1;
+                }
+                if (it->op == SETOP_INTERSECT &&
+                    setop_span(&f->b, c) + 1 > f->c) {
+                    f->c = setop_span(&f->b, c) + 1;
+                }
+                continue;
+            }
+            if (it->digests && setop_same(f, c)) continue;
+
+            setop_reserve(it, f->level + 2);
+            it->key[f->level] = (char) c;
+            setop_push(it, &a, &b, f->level + 1, digest_char(f->h, c));
+            pushed = true;
+            break;
+        }
+
+        if (!pushed) --it->sp;
+    }
+
+    it->finished = true;
+}
+
+static hattrie_setop_t* hattrie_setop_begin(const hattrie_t* A,
+                                            const hattrie_t* B, int op,
+                                            bool digests)
+{
+    hattrie_setop_t* it = malloc_or_die(sizeof(hattrie_setop_t));
+    memset(it, 0, sizeof(hattrie_setop_t));
+    it->op = op;
+    it->digests = digests;
+    it->keysize = 16;
+    it->key = malloc_or_die(it->keysize);
+    it->stacksize = NODESTACK_INIT;
+    it->stack = malloc_or_die(it->stacksize * sizeof(setop_frame_t));
+
+    setop_side_t a, b;
+    memset(&a, 0, sizeof(setop_side_t));
+    memset(&b, 0, sizeof(setop_side_t));
+    a.node = A->root;
+    b.node = B->root;
+    setop_push(it, &a, &b, 0, DIGEST_BASIS);
+
+    if (digests && root_digest(A) == root_digest(B)) {
+        it->finished = true;
+        return it;
+    }
+
+    setop_advance(it);
+    return it;
+}
+
+hattrie_setop_t* hattrie_intersect(const hattrie_t* A, const hattrie_t* B)
+{
+    return hattrie_setop_begin(A, B, SETOP_INTERSECT, false);
+}
+
+hattrie_setop_t* hattrie_difference(const hattrie_t* A, const hattrie_t* B)
+{
+    return hattrie_setop_begin(A, B, SETOP_DIFFERENCE, false);
+}
+
+hattrie_setop_t* hattrie_union(const hattrie_t* A, const hattrie_t* B)
+{
+    return hattrie_setop_begin(A, B, SETOP_UNION, false);
+}
+
+hattrie_setop_t* hattrie_diff(hattrie_t* A, hattrie_t* B)
+{
+    return hattrie_setop_begin(A, B, SETOP_DIFF, A->digests && B->digests);
+}
+
+void hattrie_setop_next(hattrie_setop_t* it)
+{
+    if (it->finished) return;
+    setop_advance(it);
+}
+
+bool hattrie_setop_finished(hattrie_setop_t* it)
+{
+    return it->finished;
+}
+
+void hattrie_setop_free(hattrie_setop_t* it)
+{
+    if (it == NULL) return;
+    setop_cache_free(&it->ca);
+    setop_cache_free(&it->cb);
+    free(it->stack);
+    free(it->key);
+    free(it);
+}
+
+const char* hattrie_setop_key(hattrie_setop_t* it, size_t* len)
+{
+    if (it->finished) return NULL;
+    *len = it->keylen;
+    return it->key;
+}
+
+void hattrie_setop_val(hattrie_setop_t* it, value_t** a, value_t** b)
+{
+    *a = it->finished ? NULL : it->va;
+    *b = it->finished ? NULL : it->vb;
+}
@@ -23,15 +23,28 @@ extern "C" {
 #endif
 
 #include "common.h"
+#include "pstdint.h"
+#include "mm.h"
 #include <stdlib.h>
 #include <stdbool.h>
 
 typedef struct hattrie_t_ hattrie_t;
+struct changelog_t_;
+struct hattrie_bcache_t_;
 
 hattrie_t* hattrie_create (void);             //< Create an empty hat-trie.
 void       hattrie_free   (hattrie_t*);       //< Free all memory used by a trie.
 hattrie_t* hattrie_dup    (const hattrie_t*); //< Duplicate an existing trie.
 void       hattrie_clear  (hattrie_t*);       //< Remove all entries.
+size_t     hattrie_size   (const hattrie_t*); //< Number of keys.
+
+/** Create an empty hat-trie whose nodes, buckets and the trie itself are
+ * allocated from the given memory context. */
+hattrie_t* hattrie_create_mm (const mm_ctx_t*);
+
+/** Shift all pointers held by a trie created with a memory context by delta
+ * bytes, after the memory it was allocated from was moved. */
+void hattrie_rebase (hattrie_t*, uintptr_t delta);
 
 /** Build order index on all ahtable nodes in trie.
  */
@@ -47,6 +60,13 @@ void hattrie_build_index (hattrie_t*);
  */
 value_t* hattrie_get (hattrie_t*, const char* key, size_t len);
 
+/** Store a value for the given key, inserting it if it does not exist.
+ *
+ * Unlike writing through the pointer returned by hattrie_get, the write is
+ * recorded in the attached change log.
+ */
+void hattrie_set (hattrie_t*, const char* key, size_t len, value_t val);
+
 /** Find a given key in the table, returning a NULL pointer if it does not
  * exist. */
 value_t* hattrie_tryget (hattrie_t*, const char* key, size_t len);
@@ -59,6 +79,93 @@ int hattrie_find_leq (hattrie_t*, const char* key, size_t len, value_t** dst);
  */
 int hattrie_del(hattrie_t* T, const char* key, size_t len);
 
+/** Create an empty trie for 64-bit integer keys, stored by the _u64 functions
+ * below as 8 big-endian bytes, so that sorted iteration is in numeric order.
+ * Buckets keep the 1 to 7 byte suffixes left below the trie nodes as fixed
+ * key tables. Keys of other lengths may not be inserted. */
+hattrie_t* hattrie_create_u64 (void);
+
+/** As hattrie_get, hattrie_tryget and hattrie_find_leq, for an integer key.
+ * These work on any trie, but only tries from hattrie_create_u64 keep the
+ * suffixes in fixed key buckets. */
+value_t* hattrie_get_u64      (hattrie_t*, uint64_t key);
+value_t* hattrie_tryget_u64   (hattrie_t*, uint64_t key);
+int      hattrie_find_leq_u64 (hattrie_t*, uint64_t key, value_t** dst);
+
+/** Split the trie at the given key.
+ *
+ * Keys greater or equal to the split key are moved to a new trie stored in
+ * right, the rest stays in T. Whole subtrees are moved by pointer and only the
+ * buckets on the path of the split key are split, in O(depth * bucket size).
+ * Counting the moved keys also reads every trie node moved, but no bucket
+ * contents. Order indexes of the split buckets must be rebuilt with
+ * hattrie_build_index. With a change log attached to T, a delete is recorded
+ * for every moved key.
+ *
+ * Returns 0 on success.
+ */
+int hattrie_split_at(hattrie_t* T, const char* key, size_t len, hattrie_t** right);
+
+/** Move all keys of R to T and free R.
+ *
+ * The first byte of every key in R must be greater than the first byte of
+ * every key in T, as after splitting at a one-byte key with hattrie_split_at,
+ * and both tries must use the same memory context. Children of the root are
+ * moved by pointer, only buckets spanning the boundary are touched. Counting
+ * the moved keys reads every trie node of R, but no bucket contents. If T has
+ * a change log, a set is recorded for every key of R, which reads them all.
+ *
+ * Returns 0 on success, -1 if the key ranges overlap and nothing was moved.
+ */
+int hattrie_join(hattrie_t* T, hattrie_t* R);
+
+/** Attach a change log recording inserts, value writes through hattrie_set
+ * and hattrie_get, and deletes, or detach it if NULL. The log is not owned by
+ * the trie; flush it before detaching it (see changelog.h). */
+void hattrie_set_log (hattrie_t*, struct changelog_t_* log);
+
+/** Page the contents of all buckets through a bucket cache, or keep them in
+ * memory again if NULL. The cache is not owned by the trie. Not available for
+ * tries created with a memory context. */
+void hattrie_set_bcache (hattrie_t*, struct hattrie_bcache_t_* cache);
+
+/** Keep a membership filter on every bucket (see ahtable_filter), so that
+ * lookups of absent keys mostly stop at the bucket without scanning it.
+ * Buckets created by splits inherit the setting, and enabling it again
+ * rebuilds all filters, dropping bits left by deleted keys. */
+void hattrie_filter_enable (hattrie_t*, bool enable);
+
+/** Keep a cache of about the given number of recently found keys and the
+ * addresses of their values, so that repeated hattrie_get and hattrie_tryget
+ * calls skip the descent. Any insert, delete, burst or tiering pass empties
+ * it, so it pays off when lookups repeat between writes. Keys are told apart
+ * by a 64-bit hash, their length and the suffix stored in their bucket. Zero
+ * disables the cache.
+ */
+void hattrie_hot_cache_enable (hattrie_t*, size_t entries);
+
+/** Hot/cold tiering pass.
+ *
+ * Buckets count a sample of their lookups and writes (one in
+ * AHTABLE_HEAT_SAMPLE) once they have seen a pass; until the first pass
+ * nothing is counted. A pass moves buckets counted fewer than cold times
+ * since the previous pass to a compact front-coded form, moves cold buckets
+ * counted at least hot times back, and restarts the counts. Cold buckets
+ * serve lookups, updates of existing keys and iteration in place, so these
+ * never move values. Inserts and deletes expand them, and values looked up
+ * before are stale afterwards. Run it
+ * periodically: a shorter period or a higher cold threshold saves more memory
+ * at the cost of slower lookups. Buckets paged through a bucket cache or
+ * allocated from a memory context stay hot. Stats may be NULL.
+ */
+typedef struct hattrie_tier_stats_t_
+{
+    size_t hot, cold;             // buckets in each tier
+    size_t hot_bytes, cold_bytes; // memory held by their contents
+} hattrie_tier_stats_t;
+
+void hattrie_tier (hattrie_t*, unsigned cold, unsigned hot, hattrie_tier_stats_t* stats);
+
 typedef struct hattrie_iter_t_ hattrie_iter_t;
 
 hattrie_iter_t* hattrie_iter_begin     (const hattrie_t*, bool sorted);
@@ -68,6 +175,125 @@ void            hattrie_iter_free      (hattrie_iter_t*);
 const char*     hattrie_iter_key       (hattrie_iter_t*, size_t* len);
 value_t*        hattrie_iter_val       (hattrie_iter_t*);
 
+/** Integer key of the current entry, which must have been stored by
+ * hattrie_get_u64. */
+uint64_t hattrie_iter_key_u64 (hattrie_iter_t*);
+
+/** Sorted iterator starting at the first key not less than the given key. */
+hattrie_iter_t* hattrie_iter_lower_bound (const hattrie_t*, const char* key, size_t len);
+
+/** Copy of an iterator at the same position, advancing independently. */
+hattrie_iter_t* hattrie_iter_dup (const hattrie_iter_t*);
+
+/** Copy as many entries as fit into buf, starting at the current one, and
+ * advance past them. Returns the number of bytes written and sets count to
+ * the number of records. Nothing is written if the next record is larger
+ * than bufsize.
+ *
+ * Each record is the value (value_t), the key length (uint32_t) and the key,
+ * zero padded to a multiple of sizeof(value_t), so records stay aligned if
+ * buf is. Use the hattrie_record_ functions to read them.
+ */
+size_t hattrie_iter_fill (hattrie_iter_t*, void* buf, size_t bufsize, size_t* count);
+
+/** Size of a record of hattrie_iter_fill holding a key of the given length. */
+static inline size_t hattrie_record_size(size_t len)
+{
+    size_t size = sizeof(value_t) + sizeof(uint32_t) + len;
+    return (size + sizeof(value_t) - 1) / sizeof(value_t) * sizeof(value_t);
+}
+
+static inline value_t hattrie_record_val(const void* rec)
+{
+    return *(const value_t*) rec;
+}
+
+static inline const char* hattrie_record_key(const void* rec, size_t* len)
+{
+    *len = *(const uint32_t*) ((const char*) rec + sizeof(value_t));
+    return (const char*) rec + sizeof(value_t) + sizeof(uint32_t);
+}
+
+/** The record following rec. */
+static inline const void* hattrie_record_next(const void* rec)
+{
+    size_t len;
+    hattrie_record_key(rec, &len);
+    return (const char*) rec + hattrie_record_size(len);
+}
+
+/** Called for every key of a parallel scan, with the number of the calling
+ * worker (0 to nthreads - 1). The key is only valid during the call. */
+typedef void (*hattrie_visit_t) (const char* key, size_t len, value_t* val,
+                                 size_t worker, void* ctx);
+
+/** Call fn for every key, in no particular order, from nthreads threads
+ * including the caller. Subtrees are handed out as units of work and idle
+ * threads steal them from busy ones, so skewed tries keep all threads busy.
+ *
+ * fn may change the value but not the trie. A trie paged through a bucket
+ * cache is scanned by the calling thread alone.
+ */
+void hattrie_parallel_for_each (const hattrie_t*, size_t nthreads,
+                                hattrie_visit_t fn, void* ctx);
+
+/** Called for every key of a walk. The key is prefix followed by suffix,
+ * both only valid during the call; the suffix points into the bucket. A
+ * non-zero return value stops the walk. */
+typedef int (*hattrie_walk_t) (const char* prefix, size_t plen,
+                               const char* suffix, size_t slen,
+                               value_t* val, void* ctx);
+
+/** Call fn for every key, in order if sorted is set.
+ *
+ * Cheaper than the iterator: there is no call per key besides fn, and keys
+ * are not assembled. fn may change the value but not the trie. Returns the
+ * non-zero value that stopped the walk, or 0.
+ */
+int hattrie_walk_all (const hattrie_t*, bool sorted, hattrie_walk_t fn, void* ctx);
+
+/** Streaming set operations over two tries.
+ *
+ * Keys are produced in sorted order. Both tries are traversed together and
+ * subtrees present on one side only are pruned at the trie node level, so the
+ * cost is driven by the overlap of the key sets rather than their sizes.
+ * Neither trie may be modified while the iterator is in use. Values of keys in
+ * cold buckets (see hattrie_tier) point to a copy made for the iterator.
+ */
+typedef struct hattrie_setop_t_ hattrie_setop_t;
+
+hattrie_setop_t* hattrie_intersect      (const hattrie_t* A, const hattrie_t* B); //< Keys in A and B.
+hattrie_setop_t* hattrie_difference     (const hattrie_t* A, const hattrie_t* B); //< Keys in A, not in B.
+hattrie_setop_t* hattrie_union          (const hattrie_t* A, const hattrie_t* B); //< Keys in A or B.
+void             hattrie_setop_next     (hattrie_setop_t*);
+bool             hattrie_setop_finished (hattrie_setop_t*);
+void             hattrie_setop_free     (hattrie_setop_t*);
+const char*      hattrie_setop_key      (hattrie_setop_t*, size_t* len);
+
+/** Values of the current key in A and B, NULL where the key is absent. */
+void             hattrie_setop_val      (hattrie_setop_t*, value_t** a, value_t** b);
+
+/** Enable or disable subtree digests.
+ *
+ * A digest is an order independent hash of all keys and values in a subtree.
+ * Digests are cached on trie nodes and buckets and invalidated along the path
+ * of hattrie_get and hattrie_del, so only modified subtrees are rehashed when
+ * a digest is requested. Values modified through iterator pointers are not
+ * tracked. While digests are tracked, hattrie_get bypasses the hot-key cache.
+ * Enabling invalidates all cached digests.
+ */
+void hattrie_digest_enable (hattrie_t*, bool enable);
+
+/** Digest of all keys starting with the given prefix. */
+uint64_t hattrie_digest (hattrie_t*, const char* prefix, size_t len);
+
+/** Stream keys whose presence or value differ between A and B.
+ *
+ * If both tries track digests, the tries are compared top-down and subtrees
+ * with equal digests are skipped.
+ */
+hattrie_setop_t* hattrie_diff (hattrie_t* A, hattrie_t* B);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,287 @@
+/*
+ * This file is part of hat-trie.
+ *
+ * C++17 interface: hat_trie<Value>, a map from byte strings to small
+ * trivially copyable values, in the header only and on top of the C API.
+ *
+ *    hat_trie<int> T;
+ *    T["apple"] += 1;
+ *    for (auto [key, val] : T) ...
+ *
+ * Values live in the value_t slot of their key, so Value may not be larger
+ * than value_t, and new keys start with all bits zero. As with the C API,
+ * pointers, references and iterators are invalidated by inserts and erases.
+ *
+ * Const members leave keys and values as they are, but not the trie: lookups
+ * fill the hot cache, count accesses for tiering and page buckets through a
+ * bucket cache, and iteration expands cold buckets, which moves their values.
+ * A const hat_trie may not be read from several threads at once.
+ */
+
+#ifndef HATTRIE_HATTRIE_HPP
+#define HATTRIE_HATTRIE_HPP
+
+#include "hat-trie.h"
+
+#include <cstddef>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+template <typename Value = value_t>
+class hat_trie
+{
+    static_assert(std::is_trivially_copyable<Value>::value &&
+                  sizeof(Value) <= sizeof(value_t) &&
+                  alignof(Value) <= alignof(value_t),
+                  "values are stored in place of a value_t");
+
+    template <bool Const> class basic_iterator;
+
+public:
+    using key_type       = std::string_view;
+    using mapped_type    = Value;
+    using size_type      = std::size_t;
+    using iterator       = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+
+    hat_trie() : T(hattrie_create()) {}
+    ~hat_trie() { hattrie_free(T); }
+
+    /* a moved-from trie is left empty and usable */
+    hat_trie(const hat_trie& other) : T(hattrie_dup(other.T)) {}
+    hat_trie(hat_trie&& other) noexcept : T(other.T) { other.T = hattrie_create(); }
+
+    hat_trie& operator=(hat_trie other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    void swap(hat_trie& other) noexcept { std::swap(T, other.T); }
+
+    size_type size() const { return hattrie_size(T); }
+    bool empty() const { return size() == 0; }
+    void clear() { hattrie_clear(T); }
+
+    /** The value of key, inserting it if it does not exist. */
+    Value& operator[](std::string_view key)
+    {
+        return *as_value(hattrie_get(T, key.data(), key.size()));
+    }
+
+    Value& at(std::string_view key)
+    {
+        value_t* v = hattrie_tryget(T, key.data(), key.size());
+        if (v == nullptr) throw std::out_of_range("hat_trie::at");
+        return *as_value(v);
+    }
+
+    const Value& at(std::string_view key) const
+    {
+        return const_cast<hat_trie*>(this)->at(key);
+    }
+
+    /* lookups through const members still write the trie's caches, see above */
+    bool contains(std::string_view key) const
+    {
+        return hattrie_tryget(T, key.data(), key.size()) != nullptr;
+    }
+
+    size_type count(std::string_view key) const { return contains(key); }
+
+    /** Insert key with the given value unless it exists. Returns an
+     * iterator to the key and whether it was inserted. */
+    std::pair<iterator, bool> try_emplace(std::string_view key, Value val = Value())
+    {
+        size_t m = hattrie_size(T);
+        value_t* v = hattrie_get(T, key.data(), key.size());
+        bool inserted = hattrie_size(T) != m;
+        if (inserted) *as_value(v) = val;
+        return { iterator(T, key, v), inserted };
+    }
+
+    /** Iterator to key, or end(). Costs a lookup and a copy of the key; the
+     * sorted iterator is only set up when the result is advanced. */
+    iterator find(std::string_view key)
+    {
+        value_t* v = hattrie_tryget(T, key.data(), key.size());
+        return v ? iterator(T, key, v) : end();
+    }
+
+    const_iterator find(std::string_view key) const
+    {
+        return const_cast<hat_trie*>(this)->find(key);
+    }
+
+    /** First key not less than the given one, in byte order. */
+    iterator lower_bound(std::string_view key)
+    {
+        return iterator(hattrie_iter_lower_bound(T, key.data(), key.size()));
+    }
+
+    const_iterator lower_bound(std::string_view key) const
+    {
+        return const_cast<hat_trie*>(this)->lower_bound(key);
+    }
+
+    /** Remove key, returning the number of keys removed. */
+    size_type erase(std::string_view key)
+    {
+        return hattrie_del(T, key.data(), key.size()) == 0;
+    }
+
+    /** Remove the key at pos, returning an iterator to the following one. */
+    iterator erase(const_iterator pos)
+    {
+        std::string key(pos->first);
+        hattrie_del(T, key.data(), key.size());
+        iterator next = lower_bound(key);
+        return next;
+    }
+
+    /** Iteration is in byte order of the keys. */
+    iterator begin() { return iterator(hattrie_iter_begin(T, true)); }
+    iterator end() { return iterator(); }
+    const_iterator begin() const { return const_iterator(hattrie_iter_begin(T, true)); }
+    const_iterator end() const { return const_iterator(); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
+    /** The underlying trie, for the rest of the C API. */
+    hattrie_t* get() { return T; }
+    const hattrie_t* get() const { return T; }
+
+private:
+    static Value* as_value(value_t* v) { return reinterpret_cast<Value*>(v); }
+
+    /* A forward iterator over a hattrie_iter_t. Iterators returned by find
+     * and try_emplace hold the key and the value only, and set up a sorted
+     * iterator at the key when advanced. */
+    template <bool Const>
+    class basic_iterator
+    {
+        using value_ref = std::conditional_t<Const, const Value&, Value&>;
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type        = std::pair<std::string_view, Value>;
+        using difference_type   = std::ptrdiff_t;
+        using reference         = std::pair<std::string_view, value_ref>;
+
+        struct pointer
+        {
+            reference ref;
+            const reference* operator->() const { return &ref; }
+        };
+
+        basic_iterator() = default;
+        ~basic_iterator() { hattrie_iter_free(it); }
+
+        basic_iterator(const basic_iterator& other)
+            : T(other.T), it(other.it ? hattrie_iter_dup(other.it) : nullptr),
+              val(other.val), key(other.key) {}
+
+        basic_iterator(basic_iterator&& other) noexcept
+            : T(other.T), it(other.it), val(other.val), key(std::move(other.key))
+        {
+            other.it = nullptr;
+            other.val = nullptr;
+        }
+
+        /* iterator to const_iterator */
+        template <bool C = Const, typename = std::enable_if_t<C>>
+        basic_iterator(const basic_iterator<false>& other)
+            : T(other.T), it(other.it ? hattrie_iter_dup(other.it) : nullptr),
+              val(other.val), key(other.key) {}
+
+        template <bool C = Const, typename = std::enable_if_t<C>>
+        basic_iterator(basic_iterator<false>&& other) noexcept
+            : T(other.T), it(other.it), val(other.val), key(std::move(other.key))
+        {
+            other.it = nullptr;
+            other.val = nullptr;
+        }
+
+        basic_iterator& operator=(basic_iterator other) noexcept
+        {
+            std::swap(T, other.T);
+            std::swap(it, other.it);
+            std::swap(val, other.val);
+            key.swap(other.key);
+            return *this;
+        }
+
+        reference operator*() const
+        {
+            if (it == nullptr) return reference(key, *as_value(val));
+            size_t len;
+            const char* k = hattrie_iter_key(it, &len);
+            return reference(std::string_view(k, len), *as_value(val));
+        }
+
+        pointer operator->() const { return pointer{ **this }; }
+
+        basic_iterator& operator++()
+        {
+            if (it == nullptr) {
+                /* past the key found */
+                it = hattrie_iter_lower_bound(T, key.data(), key.size());
+                key.clear();
+                hattrie_iter_next(it);
+            }
+            else hattrie_iter_next(it);
+            settle();
+            return *this;
+        }
+
+        basic_iterator operator++(int)
+        {
+            basic_iterator prev(*this);
+            ++*this;
+            return prev;
+        }
+
+        /* keys are unique, so their values tell positions apart */
+        friend bool operator==(const basic_iterator& a, const basic_iterator& b)
+        {
+            return a.val == b.val;
+        }
+
+        friend bool operator!=(const basic_iterator& a, const basic_iterator& b)
+        {
+            return a.val != b.val;
+        }
+
+    private:
+        friend class hat_trie;
+        friend class basic_iterator<!Const>;
+
+        explicit basic_iterator(hattrie_iter_t* it) : it(it) { settle(); }
+
+        basic_iterator(hattrie_t* T, std::string_view key, value_t* val)
+            : T(T), val(val), key(key) {}
+
+        void settle()
+        {
+            if (hattrie_iter_finished(it)) {
+                hattrie_iter_free(it);
+                it = nullptr;
+                val = nullptr;
+            }
+            else val = hattrie_iter_val(it);
+        }
+
+        const hattrie_t* T = nullptr;  // trie of a point iterator
+        hattrie_iter_t* it = nullptr;
+        value_t* val = nullptr;        // current value, NULL at the end
+        std::string key;               // key of a point iterator
+    };
+
+    hattrie_t* T;
+};
+
+#endif
@@ -0,0 +1,438 @@
+/*
+ * This file is part of hat-trie.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "layered.h"
+#include "frozen.h"
+#include "misc.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/* A mutable layer: values and tombstones of keys in older layers. A key is
+ * never in both. */
+typedef struct layer_t_
+{
+    hattrie_t* puts;
+    hattrie_t* dead;
+} layer_t;
+
+struct hattrie_layered_t_
+{
+    char* path;
+
+    /* layers[0] takes writes, layers[1] is being compacted (puts is NULL
+     * otherwise), base is the oldest layer */
+    layer_t layers[2];
+    hattrie_frozen_t* base;
+
+    /* background compaction */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    bool running;  // thread was started and not joined
+    bool done;     // thread finished
+    int status;    // result of the image write
+};
+
+
+/* Merged sorted iteration. Every layer contributes a stream of values and one
+ * of tombstones, the base a stream of values. Of equal keys the newest layer
+ * wins, a winning tombstone hides the key. */
+
+#define MERGE_STREAMS 5
+
+typedef struct merge_stream_t_
+{
+    hattrie_iter_t* it;            // trie stream, or
+    hattrie_frozen_iter_t* fit;    // base stream
+    unsigned level;                // layer, 0 is the newest
+    bool dead;
+} merge_stream_t;
+
+struct hattrie_layered_iter_t_
+{
+    merge_stream_t s[MERGE_STREAMS];
+    size_t n;
+
+    char* key;          // copy of the current key
+    size_t len, size;
+    const value_t* val;
+    bool finished;
+};
+
+static const char* stream_key(merge_stream_t* s, size_t* len)
+{
+    if (s->it) {
+        if (hattrie_iter_finished(s->it)) return NULL;
+        return hattrie_iter_key(s->it, len);
+    }
+    return hattrie_frozen_iter_key(s->fit, len);
+}
+
+static const value_t* stream_val(merge_stream_t* s)
+{
+    if (s->it) return hattrie_iter_val(s->it);
+    return hattrie_frozen_iter_val(s->fit);
+}
+
+static void stream_next(merge_stream_t* s)
+{
+    if (s->it) hattrie_iter_next(s->it);
+    else       hattrie_frozen_iter_next(s->fit);
+}
+
+static int keycmp(const char* a, size_t alen, const char* b, size_t blen)
+{
+    size_t len = alen < blen ? alen : blen;
+    int c = len > 0 ? memcmp(a, b, len) : 0;  /* the empty key may be NULL */
+    if (c != 0) return c;
+    return alen < blen ? -1 : alen > blen;
+}
+
+static void merge_next(hattrie_layered_iter_t* i)
+{
+    size_t j, best, len, minlen = 0;
+    const char *k, *min;
+    bool dead;
+
+    do {
+        min = NULL;
+        best = 0;
+        for (j = 0; j < i->n; ++j) {
+            k = stream_key(&i->s[j], &len);
+            if (k == NULL) continue;
+            if (min != NULL) {
+                int c = keycmp(k, len, min, minlen);
+                if (c > 0 || (c == 0 && i->s[j].level >= i->s[best].level)) continue;
+            }
+            min = k;
+            minlen = len;
+            best = j;
+        }
+
+        if (min == NULL) {
+            i->finished = true;
+            return;
+        }
+
+        if (minlen > i->size) {
+            i->size = 2 * minlen;
+            i->key = realloc_or_die(i->key, i->size);
+        }
+        if (minlen > 0) memcpy(i->key, min, minlen);
+        i->len = minlen;
+        i->val = stream_val(&i->s[best]);
+        dead   = i->s[best].dead;
+
+        for (j = 0; j < i->n; ++j) {
+            k = stream_key(&i->s[j], &len);
+            if (k != NULL && keycmp(k, len, i->key, i->len) == 0) {
+                stream_next(&i->s[j]);
+            }
+        }
+    } while (dead);
+}
+
+static hattrie_layered_iter_t* merge_begin(layer_t* layers, size_t n,
+                                           const hattrie_frozen_t* base)
+{
+    hattrie_layered_iter_t* i = malloc_or_die(sizeof(hattrie_layered_iter_t));
+    memset(i, 0, sizeof(hattrie_layered_iter_t));
+
+    size_t j;
+    for (j = 0; j < n; ++j) {
+        if (layers[j].puts == NULL) continue;
+        i->s[i->n].it = hattrie_iter_begin(layers[j].puts, true);
+        i->s[i->n++].level = (unsigned) j;
+        i->s[i->n].it = hattrie_iter_begin(layers[j].dead, true);
+        i->s[i->n].level = (unsigned) j;
+        i->s[i->n++].dead = true;
+    }
+    if (base) {
+        i->s[i->n].fit = hattrie_frozen_iter_begin(base);
+        i->s[i->n++].level = (unsigned) n;
+    }
+    assert(i->n <= MERGE_STREAMS);
+
+    merge_next(i);
+    return i;
+}
+
+hattrie_layered_iter_t* hattrie_layered_iter_begin(hattrie_layered_t* L)
+{
+    return merge_begin(L->layers, 2, L->base);
+}
+
+void hattrie_layered_iter_next(hattrie_layered_iter_t* i)
+{
+    if (!i->finished) merge_next(i);
+}
+
+bool hattrie_layered_iter_finished(hattrie_layered_iter_t* i)
+{
+    return i->finished;
+}
+
+void hattrie_layered_iter_free(hattrie_layered_iter_t* i)
+{
+    if (i == NULL) return;
+    size_t j;
+    for (j = 0; j < i->n; ++j) {
+        if (i->s[j].it) hattrie_iter_free(i->s[j].it);
+        else            hattrie_frozen_iter_free(i->s[j].fit);
+    }
+    free(i->key);
+    free(i);
+}
+
+const char* hattrie_layered_iter_key(hattrie_layered_iter_t* i, size_t* len)
+{
+    if (i->finished) return NULL;
+    *len = i->len;
+    return i->key;
+}
+
+const value_t* hattrie_layered_iter_val(hattrie_layered_iter_t* i)
+{
+    if (i->finished) return NULL;
+    return i->val;
+}
+
+
+hattrie_layered_t* hattrie_layered_open(const char* path)
+{
+    hattrie_frozen_t* base = NULL;
+    if (access(path, F_OK) == 0) {
+        base = hattrie_frozen_open(path);
+        if (base == NULL) return NULL;
+    }
+
+    hattrie_layered_t* L = malloc_or_die(sizeof(hattrie_layered_t));
+    memset(L, 0, sizeof(hattrie_layered_t));
+    L->path = malloc_or_die(strlen(path) + 1);
+    strcpy(L->path, path);
+    L->layers[0].puts = hattrie_create();
+    L->layers[0].dead = hattrie_create();
+    L->base = base;
+    pthread_mutex_init(&L->lock, NULL);
+    return L;
+}
+
+static void layer_free(layer_t* l)
+{
+    hattrie_free(l->puts);
+    hattrie_free(l->dead);
+    l->puts = l->dead = NULL;
+}
+
+void hattrie_layered_close(hattrie_layered_t* L)
+{
+    if (L == NULL) return;
+    hattrie_layered_compact_finish(L, true);
+    layer_free(&L->layers[0]);
+    hattrie_frozen_close(L->base);
+    pthread_mutex_destroy(&L->lock);
+    free(L->path);
+    free(L);
+}
+
+/* look up a key in the layers from the given one on */
+static const value_t* layered_find(hattrie_layered_t* L, const char* key,
+                                   size_t len, size_t from)
+{
+    size_t j;
+    value_t* val;
+    for (j = from; j < 2; ++j) {
+        if (L->layers[j].puts == NULL) continue;
+        if ((val = hattrie_tryget(L->layers[j].puts, key, len))) return val;
+        if (hattrie_tryget(L->layers[j].dead, key, len)) return NULL;
+    }
+    return L->base ? hattrie_frozen_tryget(L->base, key, len) : NULL;
+}
+
+value_t* hattrie_layered_get(hattrie_layered_t* L, const char* key, size_t len)
+{
+    layer_t* l = &L->layers[0];
+    value_t* val = hattrie_tryget(l->puts, key, len);
+    if (val) return val;
+
+    /* a deleted key starts over, otherwise copy up an older value */
+    const value_t* old = NULL;
+    if (hattrie_del(l->dead, key, len) != 0) old = layered_find(L, key, len, 1);
+
+    val = hattrie_get(l->puts, key, len);
+    if (old) *val = *old;
+    return val;
+}
+
+const value_t* hattrie_layered_tryget(hattrie_layered_t* L, const char* key, size_t len)
+{
+    return layered_find(L, key, len, 0);
+}
+
+int hattrie_layered_del(hattrie_layered_t* L, const char* key, size_t len)
+{
+    layer_t* l = &L->layers[0];
+    if (hattrie_tryget(l->dead, key, len)) return -1;
+
+    int ret = hattrie_del(l->puts, key, len);
+    if (layered_find(L, key, len, 1)) {
+        hattrie_get(l->dead, key, len);
+        ret = 0;
+    }
+    return ret;
+}
+
+
+/* fsync the directory containing path */
+static int sync_parent(const char* path)
+{
+    const char* slash = strrchr(path, '/');
+    char* dir;
+    if (slash == NULL) {
+        dir = malloc_or_die(2);
+        strcpy(dir, ".");
+    } else {
+        size_t len = slash == path ? 1 : (size_t) (slash - path);
+        dir = malloc_or_die(len + 1);
+        memcpy(dir, path, len);
+        dir[len] = '\0';
+    }
+
+    int ret = -1, fd = open(dir, O_RDONLY);
+    if (fd >= 0) {
+        ret = fsync(fd);
+        close(fd);
+    }
+    free(dir);
+    return ret;
+}
+
+/* Write the frozen layer merged with the base to a temporary file and
+ * atomically replace the base image. Only reads state shared with lookups. */
+static int compact_write(const char* path, layer_t* frozen,
+                         const hattrie_frozen_t* base)
+{
+    size_t plen = strlen(path);
+    char* tmp = malloc_or_die(plen + 5);
+    memcpy(tmp, path, plen);
+    strcpy(tmp + plen, ".tmp");
+
+    int ret = -1;
+    hattrie_frozen_writer_t* w = hattrie_frozen_writer_open(tmp);
+    if (w != NULL) {
+        size_t len;
+        const char* key;
+        hattrie_layered_iter_t* i = merge_begin(frozen, 1, base);
+        while (!hattrie_layered_iter_finished(i)) {
+            key = hattrie_layered_iter_key(i, &len);
+            hattrie_frozen_writer_add(w, key, len, *hattrie_layered_iter_val(i));
+            hattrie_layered_iter_next(i);
+        }
+        hattrie_layered_iter_free(i);
+
+        ret = hattrie_frozen_writer_close(w);
+        if (ret == 0 && rename(tmp, path) != 0) ret = -1;
+        if (ret == 0) ret = sync_parent(path);
+    }
+    if (ret != 0) unlink(tmp);
+    free(tmp);
+    return ret;
+}
+
+static void* compact_thread(void* arg)
+{
+    hattrie_layered_t* L = arg;
+    int ret = compact_write(L->path, &L->layers[1], L->base);
+
+    pthread_mutex_lock(&L->lock);
+    L->status = ret;
+    L->done = true;
+    pthread_mutex_unlock(&L->lock);
+    return NULL;
+}
+
+/* Fold the frozen layer back under the current one after a failed
+ * compaction. */
+static void layered_restore(hattrie_layered_t* L)
+{
+    layer_t* l = &L->layers[0];
+    layer_t* f = &L->layers[1];
+    size_t len;
+    const char* key;
+    hattrie_iter_t* i;
+
+    for (i = hattrie_iter_begin(f->puts, false);
+         !hattrie_iter_finished(i); hattrie_iter_next(i)) {
+        key = hattrie_iter_key(i, &len);
+        if (hattrie_tryget(l->puts, key, len) || hattrie_tryget(l->dead, key, len)) continue;
+        *hattrie_get(l->puts, key, len) = *hattrie_iter_val(i);
+    }
+    hattrie_iter_free(i);
+
+    for (i = hattrie_iter_begin(f->dead, false);
+         !hattrie_iter_finished(i); hattrie_iter_next(i)) {
+        key = hattrie_iter_key(i, &len);
+        if (hattrie_tryget(l->puts, key, len) || hattrie_tryget(l->dead, key, len)) continue;
+        hattrie_get(l->dead, key, len);
+    }
+    hattrie_iter_free(i);
+
+    layer_free(f);
+}
+
+/* replace the base with the written image, returns 1 on success */
+static int layered_install(hattrie_layered_t* L, int status)
+{
+    hattrie_frozen_t* base = status == 0 ? hattrie_frozen_open(L->path) : NULL;
+    if (base == NULL) {
+        layered_restore(L);
+        return -1;
+    }
+    hattrie_frozen_close(L->base);
+    L->base = base;
+    layer_free(&L->layers[1]);
+    return 1;
+}
+
+int hattrie_layered_compact_finish(hattrie_layered_t* L, bool wait)
+{
+    if (!L->running) return 0;
+    if (!wait) {
+        pthread_mutex_lock(&L->lock);
+        bool done = L->done;
+        pthread_mutex_unlock(&L->lock);
+        if (!done) return 0;
+    }
+
+    pthread_join(L->thread, NULL);
+    L->running = false;
+    L->done = false;
+    return layered_install(L, L->status);
+}
+
+int hattrie_layered_compact(hattrie_layered_t* L, bool background)
+{
+    /* a failed compaction leaves its changes in the delta, retry them */
+    hattrie_layered_compact_finish(L, true);
+
+    L->layers[1] = L->layers[0];
+    L->layers[0].puts = hattrie_create();
+    L->layers[0].dead = hattrie_create();
+
+    if (background) {
+        L->done = false;
+        if (pthread_create(&L->thread, NULL, compact_thread, L) == 0) {
+            L->running = true;
+            return 0;
+        }
+    }
+
+    return layered_install(L, compact_write(L->path, &L->layers[1], L->base)) == 1 ? 0 : -1;
+}
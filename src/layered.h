@@ -0,0 +1,80 @@
+/*
+ * This file is part of hat-trie.
+ *
+ * Layered tries.
+ *
+ * A small mutable hattrie_t (the delta) in front of a frozen base image.
+ * Writes go to the delta; deleting a key that exists in the base records a
+ * tombstone. Lookups and sorted iteration merge the layers, newest first.
+ *
+ * Compaction folds the delta into a new base image. The delta is frozen and a
+ * fresh one takes new writes, so a background compaction does not block
+ * updates; the new image replaces the base file once it is complete.
+ *
+ */
+
+#ifndef HATTRIE_LAYERED_H
+#define HATTRIE_LAYERED_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include "common.h"
+#include "hat-trie.h"
+
+typedef struct hattrie_layered_t_ hattrie_layered_t;
+
+/** Open a layered trie with its base image at the given path. A missing file
+ * is an empty base. Returns NULL if the image is invalid. */
+hattrie_layered_t* hattrie_layered_open  (const char* path);
+
+/** Wait for a running compaction and free the trie. Changes that were not
+ * compacted are lost. */
+void               hattrie_layered_close (hattrie_layered_t*);
+
+/** Find the given key in the delta, creating it if it does not exist. A key
+ * that is only in the base is copied into the delta first. */
+value_t* hattrie_layered_get (hattrie_layered_t*, const char* key, size_t len);
+
+/** Find a given key, returning a NULL pointer if it does not exist. The value
+ * may live in the read-only base. */
+const value_t* hattrie_layered_tryget (hattrie_layered_t*, const char* key, size_t len);
+
+/** Delete a given key. Returns 0 on success, -1 if the key does not exist. */
+int hattrie_layered_del (hattrie_layered_t*, const char* key, size_t len);
+
+/** Fold the delta into a new base image.
+ *
+ * A running compaction is finished first. If background is set, the image is
+ * written by a separate thread and installed by hattrie_layered_compact_finish.
+ * Returns 0 on success.
+ */
+int hattrie_layered_compact (hattrie_layered_t*, bool background);
+
+/** Install the result of a background compaction.
+ *
+ * If wait is not set and the compaction is still running, returns 0 right
+ * away. Returns 1 if a new base was installed, 0 if there is nothing to
+ * install and -1 if the compaction failed; its changes are kept in the delta.
+ * Iterators must not be live across this call.
+ */
+int hattrie_layered_compact_finish (hattrie_layered_t*, bool wait);
+
+/** Sorted iteration over the merged layers. */
+typedef struct hattrie_layered_iter_t_ hattrie_layered_iter_t;
+
+hattrie_layered_iter_t* hattrie_layered_iter_begin    (hattrie_layered_t*);
+void                    hattrie_layered_iter_next     (hattrie_layered_iter_t*);
+bool                    hattrie_layered_iter_finished (hattrie_layered_iter_t*);
+void                    hattrie_layered_iter_free     (hattrie_layered_iter_t*);
+const char*             hattrie_layered_iter_key      (hattrie_layered_iter_t*, size_t* len);
+const value_t*          hattrie_layered_iter_val      (hattrie_layered_iter_t*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,719 @@
+/*
+ * This file is part of hat-trie.
+ *
+ */
+
+#include "louds.h"
+#include "misc.h"
+#include <assert.h>
+#include <string.h>
+
+#define BLOCK_WORDS 8     // words per rank directory entry
+#define SELECT_SAMPLE 512 // ones per select sample
+
+static inline unsigned popcount(uint64_t x)
+{
+#ifdef __GNUC__
+    return (unsigned) __builtin_popcountll(x);
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (unsigned) ((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+static inline unsigned ctz(uint64_t x)
+{
+#ifdef __GNUC__
+    return (unsigned) __builtin_ctzll(x);
+#else
+    unsigned k = 0;
+    while (!(x & 1)) { x >>= 1; ++k; }
+    return k;
+#endif
+}
+
+static inline size_t num_words(size_t nbits)
+{
+    return (nbits + 63) / 64;
+}
+
+static inline size_t num_blocks(size_t nbits)
+{
+    return (num_words(nbits) + BLOCK_WORDS - 1) / BLOCK_WORDS;
+}
+
+static inline bool get_bit(const louds_bits_t* B, size_t i)
+{
+    return (B->words[i / 64] >> (i % 64)) & 1;
+}
+
+static inline size_t num_samples(size_t ones)
+{
+    return (ones + SELECT_SAMPLE - 1) / SELECT_SAMPLE + 1;
+}
+
+size_t louds_bits_size(size_t nbits, size_t ones)
+{
+    return num_words(nbits) * sizeof(uint64_t) +
+           (num_blocks(nbits) + 1 + num_samples(ones)) * sizeof(uint32_t);
+}
+
+bool louds_bits_map(louds_bits_t* B, const void* p, size_t len, size_t nbits)
+{
+    size_t nw = num_words(nbits), nb = num_blocks(nbits), k;
+    if (nbits >= UINT32_MAX || len < louds_bits_size(nbits, 0)) return false;
+    B->nbits = nbits;
+    B->words = p;
+    B->ranks = (const uint32_t*) (B->words + nw);
+    B->samples = B->ranks + nb + 1;
+    if (len != louds_bits_size(nbits, B->ranks[nb])) return false;
+
+    /* bits past the end must be clear, and the directories right */
+    if (nbits % 64 && B->words[nw - 1] >> (nbits % 64)) return false;
+    uint32_t r = 0;
+    for (k = 0; k < nw; ++k) {
+        if (k % BLOCK_WORDS == 0 && B->ranks[k / BLOCK_WORDS] != r) return false;
+        r += popcount(B->words[k]);
+    }
+    if (B->ranks[nb] != r) return false;
+
+    size_t ns = num_samples(r);
+    for (k = 0; k + 1 < ns; ++k) {
+        uint32_t b = B->samples[k];
+        if (b >= nb || B->ranks[b] > k * SELECT_SAMPLE ||
+            B->ranks[b + 1] <= k * SELECT_SAMPLE) {
+            return false;
+        }
+    }
+    return B->samples[ns - 1] == nb;
+}
+
+size_t louds_rank1(const louds_bits_t* B, size_t i)
+{
+    assert(i <= B->nbits);
+    size_t w = i / 64, k;
+    size_t r = B->ranks[w / BLOCK_WORDS];
+    for (k = w / BLOCK_WORDS * BLOCK_WORDS; k < w; ++k) r += popcount(B->words[k]);
+    if (i % 64) r += popcount(B->words[w] & ((UINT64_C(1) << (i % 64)) - 1));
+    return r;
+}
+
+size_t louds_select1(const louds_bits_t* B, size_t j)
+{
+    /* last block with at most j ones before it, between the samples */
+    size_t nb = num_blocks(B->nbits);
+    assert(j < B->ranks[nb]);
+    size_t lo = B->samples[j / SELECT_SAMPLE];
+    size_t hi = B->samples[j / SELECT_SAMPLE + 1] + 1;
+    if (hi > nb) hi = nb;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (B->ranks[mid] <= j) lo = mid;
+        else hi = mid;
+    }
+
+    j -= B->ranks[lo];
+    size_t k = lo * BLOCK_WORDS;
+    unsigned c;
+    while (j >= (c = popcount(B->words[k]))) {
+        j -= c;
+        ++k;
+    }
+    uint64_t x = B->words[k];
+    while (j--) x &= x - 1;
+    return k * 64 + ctz(x);
+}
+
+/* the first one at or after position i, which must exist */
+static inline size_t next_one(const louds_bits_t* B, size_t i)
+{
+    size_t k = i / 64;
+    uint64_t x = B->words[k] & (~UINT64_C(0) << (i % 64));
+    while (x == 0) x = B->words[++k];
+    return k * 64 + ctz(x);
+}
+
+
+/* edges of a node, [*b, *e) */
+static inline void node_edges(const louds_t* L, size_t node, size_t* b, size_t* e)
+{
+    if (L->nedges == 0) {
+        *b = *e = 0;
+        return;
+    }
+    *b = louds_select1(&L->first, node);
+    *e = next_one(&L->first, *b + 1);
+}
+
+static inline size_t child_node(const louds_t* L, size_t e)
+{
+    return louds_rank1(&L->child, e) + 1;
+}
+
+static inline size_t leaf_of(const louds_t* L, size_t e)
+{
+    return e - louds_rank1(&L->child, e);
+}
+
+static inline const unsigned char* edge_tail(const louds_t* L, size_t e,
+                                             size_t* len)
+{
+    size_t start = e == 0 ? 0 : louds_select1(&L->tails, e - 1) + 1;
+    size_t end = next_one(&L->tails, start);
+    *len = end - start;
+    return L->tail + (start - e);
+}
+
+/* first edge in [b, e) whose label is not less than c */
+static inline size_t lower_bound(const louds_t* L, size_t b, size_t e,
+                                 unsigned char c)
+{
+    while (b < e) {
+        size_t mid = b + (e - b) / 2;
+        if (L->labels[mid] < c) b = mid + 1;
+        else e = mid;
+    }
+    return b;
+}
+
+static int tailcmp(const unsigned char* a, size_t alen,
+                   const unsigned char* b, size_t blen)
+{
+    size_t m = alen < blen ? alen : blen;
+    int c = m > 0 ? memcmp(a, b, m) : 0;
+    if (c != 0) return c;
+    return alen < blen ? -1 : (alen > blen ? 1 : 0);
+}
+
+
+bool louds_check(const louds_t* L)
+{
+    if (L->child.nbits != L->nedges || L->first.nbits != L->nedges + 1 ||
+        L->prefix.nbits != L->nnodes) {
+        return false;
+    }
+    size_t nchild = louds_rank1(&L->child, L->nedges);
+    size_t nleaves = L->nedges - nchild;
+    if (L->nnodes != nchild + 1 ||
+        L->nprefix != louds_rank1(&L->prefix, L->nnodes) ||
+        L->n != L->nprefix + nleaves ||
+        L->tails.nbits != L->tail_len + L->nedges ||
+        louds_rank1(&L->tails, L->tails.nbits) != L->nedges ||
+        (L->nedges > 0 && !get_bit(&L->tails, L->tails.nbits - 1)) ||
+        !get_bit(&L->first, L->nedges) ||
+        louds_rank1(&L->first, L->nedges + 1) != (L->nedges ? L->nnodes : 0) + 1 ||
+        (L->nedges > 0 && !get_bit(&L->first, 0))) {
+        return false;
+    }
+
+    /* nodes lead to later nodes, with ascending labels */
+    size_t e, node = 0;
+    nchild = 0;
+    for (e = 0; e < L->nedges; ++e) {
+        if (e > 0 && get_bit(&L->first, e)) ++node;
+        else if (e > 0 && L->labels[e] <= L->labels[e - 1]) return false;
+        if (get_bit(&L->child, e) && ++nchild <= node) return false;
+    }
+    return true;
+}
+
+bool louds_get(const louds_t* L, const char* key, size_t len, size_t* id)
+{
+    const unsigned char* k = (const unsigned char*) key;
+    size_t node = 0, pos = 0, b, e, p;
+
+    for (;;) {
+        if (pos == len) {
+            if (!get_bit(&L->prefix, node)) return false;
+            *id = louds_rank1(&L->prefix, node);
+            return true;
+        }
+
+        node_edges(L, node, &b, &e);
+        p = lower_bound(L, b, e, k[pos]);
+        if (p == e || L->labels[p] != k[pos]) return false;
+        ++pos;
+
+        size_t tlen;
+        const unsigned char* t = edge_tail(L, p, &tlen);
+        if (get_bit(&L->child, p)) {
+            if (tlen > len - pos || (tlen && memcmp(t, k + pos, tlen) != 0)) {
+                return false;
+            }
+            pos += tlen;
+            node = child_node(L, p);
+            continue;
+        }
+
+        if (tlen != len - pos || (tlen && memcmp(t, k + pos, tlen) != 0)) {
+            return false;
+        }
+        *id = L->nprefix + leaf_of(L, p);
+        return true;
+    }
+}
+
+int louds_find_leq(const louds_t* L, const char* key, size_t len, size_t* id)
+{
+    const unsigned char* k = (const unsigned char*) key;
+    size_t node = 0, pos = 0, b, e, p;
+
+    /* The greatest key seen to be less than the searched one: the prefix
+     * key of a node or the greatest key under an edge. Deeper candidates are
+     * greater. */
+    enum { NONE, PREFIX, EDGE } cand = NONE;
+    size_t cand_at = 0;
+
+    for (;;) {
+        bool has_prefix = get_bit(&L->prefix, node);
+        if (pos == len) {
+            if (has_prefix) {
+                *id = louds_rank1(&L->prefix, node);
+                return 0;
+            }
+            break;
+        }
+        if (has_prefix) {
+            cand = PREFIX;
+            cand_at = node;
+        }
+
+        node_edges(L, node, &b, &e);
+        p = lower_bound(L, b, e, k[pos]);
+        if (p > b) {
+            cand = EDGE;
+            cand_at = p - 1;
+        }
+        if (p == e || L->labels[p] != k[pos]) break;
+        ++pos;
+
+        size_t tlen;
+        const unsigned char* t = edge_tail(L, p, &tlen);
+        if (get_bit(&L->child, p)) {
+            /* below the edge all keys are less, or greater, unless the key
+             * follows its whole path */
+            size_t m = tlen < len - pos ? tlen : len - pos;
+            int c = m > 0 ? memcmp(t, k + pos, m) : 0;
+            if (c < 0) {
+                cand = EDGE;
+                cand_at = p;
+            }
+            if (c != 0 || tlen > len - pos) break;
+            pos += tlen;
+            node = child_node(L, p);
+            continue;
+        }
+
+        int c = tailcmp(t, tlen, k + pos, len - pos);
+        if (c <= 0) {
+            *id = L->nprefix + leaf_of(L, p);
+            return c == 0 ? 0 : -1;
+        }
+        break;
+    }
+
+    if (cand == NONE) return 1;
+    if (cand == PREFIX) {
+        *id = louds_rank1(&L->prefix, cand_at);
+        return -1;
+    }
+
+    /* the greatest key under an edge follows last edges down to a leaf */
+    e = cand_at;
+    while (get_bit(&L->child, e)) {
+        node_edges(L, child_node(L, e), &b, &p);
+        e = p - 1;
+    }
+    *id = L->nprefix + leaf_of(L, e);
+    return -1;
+}
+
+size_t louds_bytes(const louds_t* L)
+{
+    return L->nedges + L->tail_len +
+           louds_bits_bytes(&L->child) + louds_bits_bytes(&L->first) +
+           louds_bits_bytes(&L->prefix) + louds_bits_bytes(&L->tails);
+}
+
+
+/* growable bit vector, with its directory once finished */
+typedef struct bitbuf_t_
+{
+    uint64_t* w;
+    size_t nbits, size; // size in words
+} bitbuf_t;
+
+static void push_bit(bitbuf_t* B, bool bit)
+{
+    if (B->nbits == 64 * B->size) {
+        size_t size = B->size ? 2 * B->size : 64;
+        B->w = realloc_or_die(B->w, size * sizeof(uint64_t));
+        memset(B->w + B->size, 0, (size - B->size) * sizeof(uint64_t));
+        B->size = size;
+    }
+    if (bit) B->w[B->nbits / 64] |= UINT64_C(1) << (B->nbits % 64);
+    ++B->nbits;
+}
+
+static void bits_finish(bitbuf_t* B, louds_bits_t* dst)
+{
+    assert(B->nbits < UINT32_MAX);
+    size_t nw = num_words(B->nbits), nb = num_blocks(B->nbits), k;
+    uint32_t r = 0;
+    for (k = 0; k < nw; ++k) r += popcount(B->w[k]);
+
+    size_t size = (louds_bits_size(B->nbits, r) + sizeof(uint64_t) - 1) /
+                  sizeof(uint64_t);
+    if (size > B->size) {
+        B->w = realloc_or_die(B->w, size * sizeof(uint64_t));
+        memset(B->w + B->size, 0, (size - B->size) * sizeof(uint64_t));
+    }
+    B->size = size;
+
+    uint32_t* ranks = (uint32_t*) (B->w + nw);
+    uint32_t* samples = ranks + nb + 1;
+    r = 0;
+    for (k = 0; k < nw; ++k) {
+        if (k % BLOCK_WORDS == 0) ranks[k / BLOCK_WORDS] = r;
+        /* the block of every sampled one */
+        uint32_t j, c = popcount(B->w[k]);
+        for (j = (r + SELECT_SAMPLE - 1) / SELECT_SAMPLE * SELECT_SAMPLE;
+             j < r + c; j += SELECT_SAMPLE) {
+            samples[j / SELECT_SAMPLE] = (uint32_t) (k / BLOCK_WORDS);
+        }
+        r += c;
+    }
+    ranks[nb] = r;
+    samples[num_samples(r) - 1] = (uint32_t) nb;
+
+    dst->nbits = B->nbits;
+    dst->words = B->w;
+    dst->ranks = ranks;
+    dst->samples = samples;
+}
+
+size_t louds_bits_bytes(const louds_bits_t* B)
+{
+    return louds_bits_size(B->nbits, B->ranks[num_blocks(B->nbits)]);
+}
+
+
+struct louds_builder_t_
+{
+    char* keys;           // keys added, back to back
+    size_t len, size;
+    uint64_t* offs;       // start of each key, and the end
+    size_t n, offs_size;
+    bool finished;
+
+    louds_t L;
+    unsigned char* labels;
+    size_t labels_size;
+    bitbuf_t child, first, prefix, tails;
+    unsigned char* tail;
+    size_t tail_size;
+};
+
+louds_builder_t* louds_builder_create()
+{
+    louds_builder_t* b = malloc_or_die(sizeof(louds_builder_t));
+    memset(b, 0, sizeof(louds_builder_t));
+    b->size = 4096;
+    b->keys = malloc_or_die(b->size);
+    b->offs_size = 1024;
+    b->offs = malloc_or_die(b->offs_size * sizeof(uint64_t));
+    b->offs[0] = 0;
+    return b;
+}
+
+void louds_builder_free(louds_builder_t* b)
+{
+    if (b == NULL) return;
+    free(b->keys);
+    free(b->offs);
+    free(b->labels);
+    free(b->child.w);
+    free(b->first.w);
+    free(b->prefix.w);
+    free(b->tails.w);
+    free(b->tail);
+    free(b);
+}
+
+static inline const char* key_at(const louds_builder_t* b, size_t i, size_t* len)
+{
+    *len = (size_t) (b->offs[i + 1] - b->offs[i]);
+    return b->keys + b->offs[i];
+}
+
+void louds_builder_add(louds_builder_t* b, const char* key, size_t len)
+{
+    assert(!b->finished);
+    if (b->n > 0) {
+        size_t plen;
+        const char* prev = key_at(b, b->n - 1, &plen);
+        assert(tailcmp((const unsigned char*) prev, plen,
+                       (const unsigned char*) key, len) < 0);
+        (void) prev;
+    }
+
+    if (b->len + len > b->size) {
+        while (b->size < b->len + len) b->size *= 2;
+        b->keys = realloc_or_die(b->keys, b->size);
+    }
+    if (b->n + 2 > b->offs_size) {
+        b->offs_size *= 2;
+        b->offs = realloc_or_die(b->offs, b->offs_size * sizeof(uint64_t));
+    }
+    if (len > 0) memcpy(b->keys + b->len, key, len);
+    b->len += len;
+    b->offs[++b->n] = b->len;
+}
+
+static void push_label(louds_builder_t* b, unsigned char c)
+{
+    if (b->L.nedges == b->labels_size) {
+        b->labels_size = b->labels_size ? 2 * b->labels_size : 1024;
+        b->labels = realloc_or_die(b->labels, b->labels_size);
+    }
+    b->labels[b->L.nedges++] = c;
+}
+
+static void push_tail(louds_builder_t* b, const char* t, size_t len)
+{
+    size_t i;
+    if (b->L.tail_len + len > b->tail_size) {
+        if (b->tail_size == 0) b->tail_size = 1024;
+        while (b->tail_size < b->L.tail_len + len) b->tail_size *= 2;
+        b->tail = realloc_or_die(b->tail, b->tail_size);
+    }
+    if (len > 0) memcpy(b->tail + b->L.tail_len, t, len);
+    b->L.tail_len += len;
+    for (i = 0; i < len; ++i) push_bit(&b->tails, false);
+    push_bit(&b->tails, true);
+}
+
+typedef struct range_t_
+{
+    size_t lo, hi, depth; // keys sharing their first depth characters
+} range_t;
+
+void louds_builder_finish(louds_builder_t* b, louds_t* dst, size_t* ids)
+{
+    if (!b->finished) {
+        b->finished = true;
+
+        /* Nodes in level order: the queue holds the key range of each node,
+         * and its index is the node. */
+        size_t qsize = 1024, qn = 1, q, nleaves = 0;
+        range_t* queue = malloc_or_die(qsize * sizeof(range_t));
+        bool* is_prefix = ids ? malloc_or_die(b->n ? b->n : 1) : NULL;
+        queue[0].lo = 0;
+        queue[0].hi = b->n;
+        queue[0].depth = 0;
+
+        for (q = 0; q < qn; ++q) {
+            size_t lo = queue[q].lo, hi = queue[q].hi, d = queue[q].depth;
+            size_t len, i, j;
+            const char* key;
+
+            bool prefix = false;
+            if (lo < hi) {
+                key_at(b, lo, &len);
+                prefix = len == d;
+            }
+            push_bit(&b->prefix, prefix);
+            if (prefix) {
+                if (ids) {
+                    ids[lo] = b->L.nprefix;
+                    is_prefix[lo] = true;
+                }
+                ++b->L.nprefix;
+                ++lo;
+            }
+
+            for (i = lo; i < hi; i = j) {
+                key = key_at(b, i, &len);
+                unsigned char c = (unsigned char) key[d];
+                for (j = i + 1; j < hi; ++j) {
+                    size_t jlen;
+                    if ((unsigned char) key_at(b, j, &jlen)[d] != c) break;
+                }
+
+                push_label(b, c);
+                push_bit(&b->first, i == lo);
+                push_bit(&b->child, j - i > 1);
+                if (j - i > 1) {
+                    /* the path the keys share is the tail of the edge */
+                    size_t llen, m = d + 1;
+                    const char* last = key_at(b, j - 1, &llen);
+                    while (m < len && m < llen && key[m] == last[m]) ++m;
+                    push_tail(b, key + d + 1, m - d - 1);
+
+                    if (qn == qsize) {
+                        qsize *= 2;
+                        queue = realloc_or_die(queue, qsize * sizeof(range_t));
+                    }
+                    queue[qn].lo = i;
+                    queue[qn].hi = j;
+                    queue[qn++].depth = m;
+                } else {
+                    push_tail(b, key + d + 1, len - d - 1);
+                    if (ids) {
+                        ids[i] = nleaves;
+                        is_prefix[i] = false;
+                    }
+                    ++nleaves;
+                }
+            }
+        }
+        push_bit(&b->first, true);
+
+        if (ids) {
+            for (q = 0; q < b->n; ++q) {
+                if (!is_prefix[q]) ids[q] += b->L.nprefix;
+            }
+        }
+        free(is_prefix);
+        free(queue);
+
+        b->L.n = b->n;
+        b->L.nnodes = qn;
+        b->L.labels = b->labels;
+        b->L.tail = b->tail;
+        bits_finish(&b->child, &b->L.child);
+        bits_finish(&b->first, &b->L.first);
+        bits_finish(&b->prefix, &b->L.prefix);
+        bits_finish(&b->tails, &b->L.tails);
+
+        free(b->keys);
+        free(b->offs);
+        b->keys = NULL;
+        b->offs = NULL;
+    }
+    *dst = b->L;
+}
+
+
+struct louds_iter_t_
+{
+    const louds_t* L;
+    bool finished;
+    size_t id;
+
+    struct {
+        size_t node, e, end;
+        size_t depth;      // length of the key leading to the node
+        bool pending;      // the prefix key of the node is yet to come
+    }* stack;
+    size_t sp, size;
+
+    char* key;
+    size_t len, key_size;
+};
+
+static void iter_reserve(louds_iter_t* i, size_t len)
+{
+    if (len > i->key_size) {
+        while (i->key_size < len) i->key_size *= 2;
+        i->key = realloc_or_die(i->key, i->key_size);
+    }
+}
+
+static void iter_push(louds_iter_t* i, size_t node, size_t depth)
+{
+    if (i->sp == i->size) {
+        i->size *= 2;
+        i->stack = realloc_or_die(i->stack, i->size * sizeof(*i->stack));
+    }
+    i->stack[i->sp].node = node;
+    node_edges(i->L, node, &i->stack[i->sp].e, &i->stack[i->sp].end);
+    i->stack[i->sp].depth = depth;
+    i->stack[i->sp++].pending = true;
+}
+
+/* advance to the next key */
+static void iter_advance(louds_iter_t* i)
+{
+    const louds_t* L = i->L;
+    while (i->sp > 0) {
+        size_t top = i->sp - 1;
+        size_t node = i->stack[top].node, depth = i->stack[top].depth;
+        if (i->stack[top].pending) {
+            i->stack[top].pending = false;
+            if (get_bit(&L->prefix, node)) {
+                i->len = depth;
+                i->id = louds_rank1(&L->prefix, node);
+                return;
+            }
+        }
+        if (i->stack[top].e == i->stack[top].end) {
+            --i->sp;
+            continue;
+        }
+
+        size_t tlen, e = i->stack[top].e++;
+        const unsigned char* t = edge_tail(L, e, &tlen);
+        iter_reserve(i, depth + 1 + tlen);
+        i->key[depth] = (char) L->labels[e];
+        if (tlen > 0) memcpy(i->key + depth + 1, t, tlen);
+        if (get_bit(&L->child, e)) {
+            iter_push(i, child_node(L, e), depth + 1 + tlen);
+            continue;
+        }
+
+        i->len = depth + 1 + tlen;
+        i->id = L->nprefix + leaf_of(L, e);
+        return;
+    }
+    i->finished = true;
+}
+
+louds_iter_t* louds_iter_begin(const louds_t* L)
+{
+    louds_iter_t* i = malloc_or_die(sizeof(louds_iter_t));
+    i->L = L;
+    i->finished = false;
+    i->id = 0;
+    i->size = 64;
+    i->stack = malloc_or_die(i->size * sizeof(*i->stack));
+    i->sp = 0;
+    i->key_size = 64;
+    i->key = malloc_or_die(i->key_size);
+    i->len = 0;
+    iter_push(i, 0, 0);
+    iter_advance(i);
+    return i;
+}
+
+void louds_iter_next(louds_iter_t* i)
+{
+    if (!i->finished) iter_advance(i);
+}
+
+bool louds_iter_finished(louds_iter_t* i)
+{
+    return i->finished;
+}
+
+void louds_iter_free(louds_iter_t* i)
+{
+    if (i == NULL) return;
+    free(i->stack);
+    free(i->key);
+    free(i);
+}
+
+const char* louds_iter_key(louds_iter_t* i, size_t* len)
+{
+    if (i->finished) return NULL;
+    *len = i->len;
+    return i->key;
+}
+
+size_t louds_iter_id(louds_iter_t* i)
+{
+    return i->id;
+}
@@ -0,0 +1,131 @@
+/*
+ * This file is part of hat-trie.
+ *
+ * Succinct tries.
+ *
+ * A trie over a sorted key set whose topology takes a few bits per edge. It
+ * is encoded in level order (LOUDS, Jacobson 1989, in the sparse form of
+ * Zhang et al. 2018): the edges of every node are laid out together, nodes
+ * level by level, and navigation uses rank and select over bit vectors
+ * rather than pointers.
+ *
+ * Every edge has a tail, packed without terminator or length into a single
+ * string: the path that the keys below the edge share, so that chains of
+ * nodes with a single edge collapse, or the rest of the key if a single key
+ * is left, as branching stops there. Tail lengths are kept in unary in a bit
+ * vector.
+ *
+ * Keys are numbered by id, prefix keys (those ending at a node) by node
+ * order first, then leaves by edge order. Ids are not in key order, the
+ * builder reports the id of every key added.
+ *
+ *    unsigned char labels[nedges]   edge labels, ascending per node
+ *    bits child[nedges]             the edge leads to a node, not a leaf
+ *    bits first[nedges + 1]         the edge is the first of its node, and a
+ *                                   final one
+ *    bits prefix[nnodes]            a key ends at the node
+ *    bits tails[tail_len + nedges]  tail lengths in unary, zeros then a one
+ *    unsigned char tail[tail_len]
+ *
+ */
+
+#ifndef HATTRIE_LOUDS_H
+#define HATTRIE_LOUDS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include "pstdint.h"
+#include "common.h"
+
+/* A bit vector with a directory of ones before every 512 bits, so that rank
+ * takes a lookup and at most eight popcounts, and the block of every 512th
+ * one, so that select searches a few blocks. Words are followed by the
+ * directories in memory. At most 2^32 - 1 bits. */
+typedef struct louds_bits_t_
+{
+    size_t nbits;
+    const uint64_t* words;
+    const uint32_t* ranks;   // ones before each block, and in total
+    const uint32_t* samples; // block of each sampled one, and the end
+} louds_bits_t;
+
+/** Bytes taken by a bit vector of the given length and ones, with its
+ * directories. */
+size_t louds_bits_size (size_t nbits, size_t ones);
+
+/** Bytes taken by a bit vector. */
+size_t louds_bits_bytes (const louds_bits_t*);
+
+/** View a bit vector of the given length stored at p, returning false if its
+ * size or directory is wrong. */
+bool louds_bits_map (louds_bits_t*, const void* p, size_t len, size_t nbits);
+
+size_t louds_rank1   (const louds_bits_t*, size_t i); //< Ones before position i.
+size_t louds_select1 (const louds_bits_t*, size_t j); //< Position of the j-th one.
+
+
+typedef struct louds_t_
+{
+    size_t n;         // number of keys
+    size_t nnodes;
+    size_t nedges;
+    size_t nprefix;   // keys ending at a node
+    const unsigned char* labels;
+    louds_bits_t child;
+    louds_bits_t first;
+    louds_bits_t prefix;
+    louds_bits_t tails;
+    const unsigned char* tail;
+    size_t tail_len;
+} louds_t;
+
+/** Check the structure of a trie, so that lookups and iteration stay within
+ * bounds and terminate. */
+bool louds_check (const louds_t*);
+
+/** Find a given key, setting its id. */
+bool louds_get (const louds_t*, const char* key, size_t len, size_t* id);
+
+/** Find a key that is exact match or lexicographic predecessor, setting its
+ * id. Returns 0 on an exact match, -1 for a predecessor and 1 if there is
+ * none. */
+int louds_find_leq (const louds_t*, const char* key, size_t len, size_t* id);
+
+/** Bytes used by labels, bit vectors and tails. */
+size_t louds_bytes (const louds_t*);
+
+
+/* Build a trie from keys added in ascending order. Keys are buffered until
+ * the trie is finished. */
+typedef struct louds_builder_t_ louds_builder_t;
+
+louds_builder_t* louds_builder_create (void);
+void             louds_builder_free   (louds_builder_t*);
+void             louds_builder_add    (louds_builder_t*, const char* key, size_t len);
+
+/** Lay the trie out, setting ids[i] to the id of the i-th key added if ids is
+ * not NULL. No keys may be added afterwards. The view is valid until the
+ * builder is freed. */
+void louds_builder_finish (louds_builder_t*, louds_t* dst, size_t* ids);
+
+
+/* Sorted iteration. Keys are decoded into the iterator, and are valid until
+ * the next call to louds_iter_next. */
+typedef struct louds_iter_t_ louds_iter_t;
+
+louds_iter_t* louds_iter_begin    (const louds_t*);
+void          louds_iter_next     (louds_iter_t*);
+bool          louds_iter_finished (louds_iter_t*);
+void          louds_iter_free     (louds_iter_t*);
+const char*   louds_iter_key      (louds_iter_t*, size_t* len);
+size_t        louds_iter_id       (louds_iter_t*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
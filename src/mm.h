@@ -0,0 +1,57 @@
+/*
+ * This file is part of hat-trie.
+ *
+ * Memory contexts.
+ *
+ * A memory context routes the allocations of a trie (trie nodes, buckets and
+ * their slot arrays) to a custom allocator. A NULL context means malloc.
+ * Allocators do not return NULL; like malloc_or_die they give up on the
+ * process instead.
+ *
+ */
+
+#ifndef HATTRIE_MM_H
+#define HATTRIE_MM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+#include "misc.h"
+
+typedef void* (*mm_alloc_t)   (void* ctx, size_t len);
+typedef void* (*mm_realloc_t) (void* ctx, void* p, size_t len);
+typedef void  (*mm_free_t)    (void* ctx, void* p);
+
+typedef struct mm_ctx_t_
+{
+    void*        ctx;
+    mm_alloc_t   alloc;
+    mm_realloc_t realloc;
+    mm_free_t    free;
+} mm_ctx_t;
+
+static inline void* mm_alloc(const mm_ctx_t* mm, size_t len)
+{
+    return mm ? mm->alloc(mm->ctx, len) : malloc_or_die(len);
+}
+
+static inline void* mm_realloc(const mm_ctx_t* mm, void* p, size_t len)
+{
+    return mm ? mm->realloc(mm->ctx, p, len) : realloc_or_die(p, len);
+}
+
+static inline void mm_free(const mm_ctx_t* mm, void* p)
+{
+    if (mm) {
+        if (p) mm->free(mm->ctx, p);
+    }
+    else free(p);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,192 @@
+/*
+ * This file is part of hat-trie.
+ *
+ */
+
+#include "mph.h"
+#include "misc.h"
+#include "murmurhash3.h"
+#include <assert.h>
+#include <string.h>
+
+static inline uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+/* 60% of the keys go to the first 30% of the buckets */
+static inline size_t bucket_of(size_t nbuckets, uint64_t h)
+{
+    size_t dense = nbuckets * 3 / 10;
+    uint64_t x = h >> 32;
+    if (dense == 0) return (size_t) (x % nbuckets);
+    if ((h & 0xffffffff) < 2576980378ULL) return (size_t) (x % dense);
+    return dense + (size_t) (x % (nbuckets - dense));
+}
+
+static inline size_t position(size_t m, uint64_t h, uint32_t pilot)
+{
+    return (size_t) (mix64(h ^ (pilot * 0x9e3779b97f4a7c15ULL)) % m);
+}
+
+size_t mph_lookup(const mph_t* T, const char* key, size_t len)
+{
+    if (T->n == 0) return 0;
+    uint64_t h = hash64(key, len, T->seed);
+    size_t p = position(T->m, h, T->pilots[bucket_of(T->nbuckets, h)]);
+    return p < T->n ? p : T->remap[p - T->n];
+}
+
+bool mph_check(const mph_t* T)
+{
+    size_t i;
+    if (T->m < T->n || (T->n > 0 && T->nbuckets == 0)) return false;
+    for (i = 0; i < T->m - T->n; ++i) {
+        if (T->remap[i] >= T->n) return false;
+    }
+    return true;
+}
+
+size_t mph_bytes(const mph_t* T)
+{
+    return (T->nbuckets + T->m - T->n) * sizeof(uint32_t);
+}
+
+
+struct mph_builder_t_
+{
+    uint32_t seed;
+    uint64_t* hs;
+    size_t n, size;
+
+    mph_t T;
+    uint32_t* pilots;
+    uint32_t* remap;
+};
+
+mph_builder_t* mph_builder_create(uint32_t seed)
+{
+    mph_builder_t* b = malloc_or_die(sizeof(mph_builder_t));
+    memset(b, 0, sizeof(mph_builder_t));
+    b->seed = seed;
+    b->size = 1024;
+    b->hs = malloc_or_die(b->size * sizeof(uint64_t));
+    return b;
+}
+
+void mph_builder_free(mph_builder_t* b)
+{
+    if (b == NULL) return;
+    free(b->hs);
+    free(b->pilots);
+    free(b->remap);
+    free(b);
+}
+
+void mph_builder_add(mph_builder_t* b, const char* key, size_t len)
+{
+    if (b->n == b->size) {
+        b->size *= 2;
+        b->hs = realloc_or_die(b->hs, b->size * sizeof(uint64_t));
+    }
+    b->hs[b->n++] = hash64(key, len, b->seed);
+}
+
+bool mph_builder_finish(mph_builder_t* b, mph_t* dst)
+{
+    size_t n = b->n, m = n + n / 100, i, j;
+    size_t nb = n ? (n + MPH_BUCKET - 1) / MPH_BUCKET : 0;
+    free(b->pilots);
+    free(b->remap);
+    b->pilots = malloc_or_die((nb ? nb : 1) * sizeof(uint32_t));
+    b->remap = malloc_or_die((m > n ? m - n : 1) * sizeof(uint32_t));
+    memset(b->pilots, 0, (nb ? nb : 1) * sizeof(uint32_t));
+    memset(b->remap, 0, (m > n ? m - n : 1) * sizeof(uint32_t));
+
+    b->T.n        = n;
+    b->T.m        = m;
+    b->T.nbuckets = nb;
+    b->T.seed     = b->seed;
+    b->T.pilots   = b->pilots;
+    b->T.remap    = b->remap;
+    *dst = b->T;
+    if (n == 0) return true;
+
+    /* group hashes by bucket */
+    size_t* start = malloc_or_die((nb + 1) * sizeof(size_t));
+    uint64_t* hs = malloc_or_die(n * sizeof(uint64_t));
+    memset(start, 0, (nb + 1) * sizeof(size_t));
+    for (i = 0; i < n; ++i) ++start[bucket_of(nb, b->hs[i]) + 1];
+    size_t maxsize = 0;
+    for (i = 0; i < nb; ++i) {
+        if (start[i + 1] > maxsize) maxsize = start[i + 1];
+        start[i + 1] += start[i];
+    }
+    size_t* fill = malloc_or_die(nb * sizeof(size_t));
+    memcpy(fill, start, nb * sizeof(size_t));
+    for (i = 0; i < n; ++i) hs[fill[bucket_of(nb, b->hs[i])]++] = b->hs[i];
+
+    /* buckets by decreasing size */
+    size_t* bysize = malloc_or_die((maxsize + 2) * sizeof(size_t));
+    memset(bysize, 0, (maxsize + 2) * sizeof(size_t));
+    for (i = 0; i < nb; ++i) ++bysize[maxsize - (start[i + 1] - start[i]) + 1];
+    for (i = 0; i <= maxsize; ++i) bysize[i + 1] += bysize[i];
+    size_t* order = fill;
+    for (i = 0; i < nb; ++i) order[bysize[maxsize - (start[i + 1] - start[i])]++] = i;
+    free(bysize);
+
+    uint64_t* taken = malloc_or_die((m / 64 + 1) * sizeof(uint64_t));
+    memset(taken, 0, (m / 64 + 1) * sizeof(uint64_t));
+    size_t* pos = malloc_or_die((maxsize ? maxsize : 1) * sizeof(size_t));
+    bool ok = true;
+
+    for (i = 0; ok && i < nb; ++i) {
+        size_t bk = order[i], lo = start[bk], size = start[bk + 1] - lo, k;
+        if (size == 0) break;
+
+        /* equal hashes would never be told apart */
+        for (j = lo; ok && j < lo + size; ++j) {
+            for (k = j + 1; k < lo + size; ++k) {
+                if (hs[j] == hs[k]) ok = false;
+            }
+        }
+
+        uint32_t pilot;
+        for (pilot = 0; ok; ++pilot) {
+            for (j = 0; j < size; ++j) {
+                pos[j] = position(m, hs[lo + j], pilot);
+                if ((taken[pos[j] / 64] >> (pos[j] % 64)) & 1) break;
+                for (k = 0; k < j && pos[k] != pos[j]; ++k);
+                if (k < j) break;
+            }
+            if (j == size) break;
+            if (pilot == UINT32_MAX) ok = false;
+        }
+        if (!ok) break;
+
+        b->pilots[bk] = pilot;
+        for (j = 0; j < size; ++j) taken[pos[j] / 64] |= UINT64_C(1) << (pos[j] % 64);
+    }
+
+    /* send positions past n to the slots left free */
+    if (ok) {
+        size_t slot = 0;
+        for (i = n; i < m; ++i) {
+            if (!((taken[i / 64] >> (i % 64)) & 1)) continue;
+            while ((taken[slot / 64] >> (slot % 64)) & 1) ++slot;
+            b->remap[i - n] = (uint32_t) slot++;
+        }
+    }
+
+    free(pos);
+    free(taken);
+    free(order);
+    free(hs);
+    free(start);
+    return ok;
+}
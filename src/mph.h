@@ -0,0 +1,77 @@
+/*
+ * This file is part of hat-trie.
+ *
+ * Minimal perfect hashing.
+ *
+ * Maps each key of a fixed set of n keys to a distinct slot in [0, n), and
+ * any other key to some slot, in constant time: one hash of the key and two
+ * or three table lookups. It finds nothing by itself; the caller verifies
+ * the key stored for the slot.
+ *
+ * Keys are hashed into buckets of about MPH_BUCKET keys, skewed so that 60%
+ * of the keys land in 30% of the buckets. Buckets are placed largest first,
+ * each searching for a pilot that sends all of its keys to free positions
+ * (hash and displace, as in PTHash, Pibiri and Trani 2021). The table has
+ * about 1% spare positions to keep the search short, and positions past n
+ * are remapped to the slots left free below n.
+ *
+ *    uint32_t pilots[nbuckets]
+ *    uint32_t remap[m - n]       slot of each position past n
+ *
+ * That is about 7 bits per key.
+ */
+
+#ifndef HATTRIE_MPH_H
+#define HATTRIE_MPH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include "pstdint.h"
+#include "common.h"
+
+/* average keys per bucket, trading size for construction time */
+#ifndef MPH_BUCKET
+  #define MPH_BUCKET 5
+#endif
+
+typedef struct mph_t_
+{
+    size_t n;           // number of keys
+    size_t m;           // number of positions
+    size_t nbuckets;
+    uint32_t seed;
+    const uint32_t* pilots;
+    const uint32_t* remap;
+} mph_t;
+
+/** Slot of a key, in [0, n) for n > 0. */
+size_t mph_lookup (const mph_t*, const char* key, size_t len);
+
+/** Check that a table is well formed, so that lookups stay within bounds. */
+bool mph_check (const mph_t*);
+
+/** Bytes used by pilots and remapping. */
+size_t mph_bytes (const mph_t*);
+
+
+/* Build a table over keys added in any order. Only their hashes are kept. */
+typedef struct mph_builder_t_ mph_builder_t;
+
+mph_builder_t* mph_builder_create (uint32_t seed);
+void           mph_builder_free   (mph_builder_t*);
+void           mph_builder_add    (mph_builder_t*, const char* key, size_t len);
+
+/** Place the keys. Returns false if two keys have the same hash, in which
+ * case the keys must be added again to a builder with another seed. The
+ * table is valid until the builder is freed. */
+bool mph_builder_finish (mph_builder_t*, mph_t* dst);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -2,6 +2,7 @@
  * by its author, Austin Appleby. */
 
 #include "murmurhash3.h"
+#include <string.h>
 
 static inline uint32_t fmix(uint32_t h)
 {
@@ -75,3 +76,31 @@ uint32_t hash(const char* data, size_t len_)
     return h1;
 }
 
+
+/* MurmurHash64A, also by Austin Appleby. */
+uint64_t hash64(const char* key, size_t len, uint64_t seed)
+{
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const unsigned char* p = (const unsigned char*) key;
+    uint64_t h = seed ^ (len * m), k;
+    size_t i, j;
+
+    for (i = 0; i + 8 <= len; i += 8) {
+        memcpy(&k, p + i, 8);
+        k *= m;
+        k ^= k >> 47;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+    if (len & 7) {
+        for (k = 0, j = len & 7; j > 0; --j) k = (k << 8) | p[i + j - 1];
+        h ^= k;
+        h *= m;
+    }
+
+    h ^= h >> 47;
+    h *= m;
+    h ^= h >> 47;
+    return h;
+}
@@ -8,5 +8,8 @@
 
 uint32_t hash(const char* data, size_t len);
 
+/* 64-bit hash, seeded */
+uint64_t hash64(const char* data, size_t len, uint64_t seed);
+
 #endif
 
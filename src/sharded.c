@@ -0,0 +1,226 @@
+/*
+ * This file is part of hat-trie.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "sharded.h"
+#include "misc.h"
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+
+#define NODE_CHILDS (TRIE_MAXCHAR+1)
+
+/* parts of the key space per merging thread, so that skewed parts even out */
+#define MERGE_PARTS 4
+
+typedef struct shard_t_
+{
+    hattrie_t* T;
+    size_t hist[NODE_CHILDS];  // writes by first key byte since the last merge
+    int used;
+    struct shard_t_* next;
+} shard_t;
+
+struct hattrie_sharded_t_
+{
+    shard_t* shards;     // every thread that wrote
+    pthread_key_t key;   // shard of the calling thread
+};
+
+
+static void thread_exit(void* shard)
+{
+    shard_t* s = shard;
+    __atomic_store_n(&s->used, 0, __ATOMIC_RELEASE);
+}
+
+static shard_t* thread_shard(hattrie_sharded_t* S)
+{
+    shard_t* s = pthread_getspecific(S->key);
+    if (s) return s;
+
+    /* take over the shard of a thread that exited, it is merged all the same */
+    for (s = __atomic_load_n(&S->shards, __ATOMIC_ACQUIRE); s; s = s->next) {
+        int unused = 0;
+        if (__atomic_compare_exchange_n(&s->used, &unused, 1, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) break;
+    }
+    if (s == NULL) {
+        s = malloc_or_die(sizeof(shard_t));
+        memset(s, 0, sizeof(shard_t));
+        s->T = hattrie_create();
+        s->used = 1;
+        s->next = __atomic_load_n(&S->shards, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&S->shards, &s->next, s, true,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+    pthread_setspecific(S->key, s);
+    return s;
+}
+
+
+hattrie_sharded_t* hattrie_sharded_create()
+{
+    hattrie_sharded_t* S = malloc_or_die(sizeof(hattrie_sharded_t));
+    S->shards = NULL;
+    pthread_key_create(&S->key, thread_exit);
+    return S;
+}
+
+void hattrie_sharded_free(hattrie_sharded_t* S)
+{
+    if (S == NULL) return;
+    shard_t* s = S->shards;
+    while (s) {
+        shard_t* next = s->next;
+        hattrie_free(s->T);
+        free(s);
+        s = next;
+    }
+    pthread_key_delete(S->key);
+    free(S);
+}
+
+value_t* hattrie_sharded_get(hattrie_sharded_t* S, const char* key, size_t len)
+{
+    shard_t* s = thread_shard(S);
+    ++s->hist[len ? (unsigned char) *key : 0];
+    return hattrie_get(s->T, key, len);
+}
+
+
+/* A merge, as units of work taken by any number of threads. */
+typedef struct merge_t_
+{
+    hattrie_t*** parts;   // parts[i][p]: part p of trie i, the total last
+    size_t ntries;
+    size_t nparts;
+    char bounds[NODE_CHILDS]; // least first byte of part p > 0
+
+    void (*work)(struct merge_t_*, size_t);
+    size_t nwork;
+    size_t next;          // next unit of work
+} merge_t;
+
+static void* merge_run(void* arg)
+{
+    merge_t* M = arg;
+    size_t i;
+    while ((i = __atomic_fetch_add(&M->next, 1, __ATOMIC_RELAXED)) < M->nwork) {
+        M->work(M, i);
+    }
+    return NULL;
+}
+
+static void merge_all(merge_t* M, void (*work)(merge_t*, size_t), size_t nwork,
+                      size_t nthreads)
+{
+    M->work  = work;
+    M->nwork = nwork;
+    M->next  = 0;
+    if (nthreads > nwork) nthreads = nwork;
+    if (nthreads <= 1) {
+        merge_run(M);
+        return;
+    }
+
+    pthread_t* threads = malloc_or_die((nthreads - 1) * sizeof(pthread_t));
+    size_t t;
+    for (t = 0; t < nthreads - 1; ++t) pthread_create(&threads[t], NULL, merge_run, M);
+    merge_run(M);
+    for (t = 0; t < nthreads - 1; ++t) pthread_join(threads[t], NULL);
+    free(threads);
+}
+
+/* Cut trie i into parts, from the top. */
+static void split_trie(merge_t* M, size_t i)
+{
+    hattrie_t** parts = M->parts[i];
+    size_t p;
+    for (p = M->nparts - 1; p > 0; --p) {
+        hattrie_split_at(parts[0], &M->bounds[p], 1, &parts[p]);
+    }
+}
+
+/* Add part p of every shard to part p of the total. */
+static void sum_part(merge_t* M, size_t p)
+{
+    hattrie_t* dst = M->parts[M->ntries - 1][p];
+    size_t i, len;
+    const char* key;
+    for (i = 0; i + 1 < M->ntries; ++i) {
+        hattrie_t* src = M->parts[i][p];
+        hattrie_iter_t* it = hattrie_iter_begin(src, false);
+        for (; !hattrie_iter_finished(it); hattrie_iter_next(it)) {
+            key = hattrie_iter_key(it, &len);
+            *hattrie_get(dst, key, len) += *hattrie_iter_val(it);
+        }
+        hattrie_iter_free(it);
+        hattrie_free(src);
+    }
+}
+
+hattrie_t* hattrie_sharded_merge(hattrie_sharded_t* S, hattrie_t* total,
+                                 size_t nthreads)
+{
+    if (total == NULL) total = hattrie_create();
+    if (nthreads == 0) nthreads = 1;
+
+    /* shards written since the last merge, and how */
+    merge_t M;
+    size_t hist[NODE_CHILDS];
+    size_t writes = 0, c, i, p;
+    shard_t* s;
+    memset(&M, 0, sizeof(merge_t));
+    memset(hist, 0, sizeof(hist));
+    for (s = S->shards; s; s = s->next) {
+        size_t n = 0;
+        for (c = 0; c < NODE_CHILDS; ++c) n += s->hist[c];
+        if (n == 0) continue;
+        for (c = 0; c < NODE_CHILDS; ++c) hist[c] += s->hist[c];
+        writes += n;
+        ++M.ntries;
+    }
+    if (M.ntries == 0) return total;
+    ++M.ntries;
+
+    /* cut the key space where the writes are evenly divided */
+    size_t want = nthreads > 1 ? MERGE_PARTS * nthreads : 1;
+    size_t below = 0;
+    M.nparts = 1;
+    for (c = 0; c < NODE_CHILDS && M.nparts < want; ++c) {
+        if (below > 0 && below >= M.nparts * writes / want) {
+            M.bounds[M.nparts++] = (char) c;
+        }
+        below += hist[c];
+    }
+
+    M.parts = malloc_or_die(M.ntries * sizeof(hattrie_t**));
+    for (i = 0, s = S->shards; s; s = s->next) {
+        size_t n = 0;
+        for (c = 0; c < NODE_CHILDS; ++c) n += s->hist[c];
+        if (n == 0) continue;
+        M.parts[i] = malloc_or_die(M.nparts * sizeof(hattrie_t*));
+        M.parts[i++][0] = s->T;
+        memset(s->hist, 0, sizeof(s->hist));
+        s->T = hattrie_create();
+    }
+    M.parts[i] = malloc_or_die(M.nparts * sizeof(hattrie_t*));
+    M.parts[i][0] = total;
+
+    merge_all(&M, split_trie, M.ntries, nthreads);
+    merge_all(&M, sum_part, M.nparts, nthreads);
+
+    for (p = 1; p < M.nparts; ++p) {
+        int joined = hattrie_join(total, M.parts[M.ntries - 1][p]);
+        assert(joined == 0);
+        (void) joined;
+    }
+
+    for (i = 0; i < M.ntries; ++i) free(M.parts[i]);
+    free(M.parts);
+    return total;
+}
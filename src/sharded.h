@@ -0,0 +1,49 @@
+/*
+ * This file is part of hat-trie.
+ *
+ * Sharded counters.
+ *
+ * For counting keys from many threads: every thread writes to a trie of its
+ * own, without any synchronization, and a merge step sums the shards into one
+ * trie. The merge cuts all tries into ranges of first bytes, balanced by what
+ * the threads wrote, sums the ranges in parallel and joins the results.
+ *
+ */
+
+#ifndef HATTRIE_SHARDED_H
+#define HATTRIE_SHARDED_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include "common.h"
+#include "hat-trie.h"
+
+typedef struct hattrie_sharded_t_ hattrie_sharded_t;
+
+hattrie_sharded_t* hattrie_sharded_create (void);             //< No shards yet.
+void               hattrie_sharded_free   (hattrie_sharded_t*); //< Free all shards.
+
+/** Find the given key in the shard of the calling thread, inserting it with
+ * value 0 if it does not exist. The pointer is valid until the thread's next
+ * call or the next merge. */
+value_t* hattrie_sharded_get (hattrie_sharded_t*, const char* key, size_t len);
+
+/** Add the values of all shards to the trie total, inserting missing keys,
+ * and empty the shards. If total is NULL a new trie is created. Returns the
+ * total.
+ *
+ * Uses nthreads threads, including the caller. No thread may write to the
+ * shards during the merge.
+ */
+hattrie_t* hattrie_sharded_merge (hattrie_sharded_t*, hattrie_t* total,
+                                  size_t nthreads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,404 @@
+/*
+ * This file is part of hat-trie.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "wal.h"
+#include "changelog.h"
+#include "misc.h"
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define WAL_CHECKPOINT "checkpoint"
+#define WAL_SEGMENT    "wal."
+
+struct hattrie_wal_t_
+{
+    char* dir;
+    hattrie_t* T;
+    changelog_t* log;
+
+    int fd;                // current segment
+    size_t segment_bytes;  // bytes written to the current segment
+    size_t checkpoint_bytes;
+    int error;             // failed segment write
+
+    /* background checkpoint */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    bool running;  // thread was started and not joined
+    bool done;     // thread finished
+    int status;    // result of the last checkpoint
+    hattrie_t* snapshot;
+    uint64_t snapshot_seq;
+};
+
+static char* wal_path(const char* dir, const char* name, uint64_t seq, bool num)
+{
+    size_t len = strlen(dir) + strlen(name) + 32;
+    char* path = malloc_or_die(len);
+    if (num) snprintf(path, len, "%s/%s%llu", dir, name, (unsigned long long) seq);
+    else     snprintf(path, len, "%s/%s", dir, name);
+    return path;
+}
+
+static int write_all(int fd, const unsigned char* buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t r = write(fd, buf, len);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += r;
+        len -= (size_t) r;
+    }
+    return 0;
+}
+
+static int sync_dir(const char* dir)
+{
+    int fd = open(dir, O_RDONLY);
+    if (fd < 0) return -1;
+    int ret = fsync(fd);
+    close(fd);
+    return ret;
+}
+
+/* read whole file, returns -1 if it does not exist */
+static int read_file(const char* path, unsigned char** buf, size_t* len)
+{
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) return -1;
+
+    size_t size = 4096;
+    *buf = malloc_or_die(size);
+    *len = 0;
+    size_t r;
+    while ((r = fread(*buf + *len, 1, size - *len, f)) > 0) {
+        *len += r;
+        if (*len == size) {
+            size *= 2;
+            *buf = realloc_or_die(*buf, size);
+        }
+    }
+    int ret = ferror(f) ? -1 : 0;
+    fclose(f);
+    return ret;
+}
+
+/* Apply batches continuing the sequence at *seq. Batches that are already
+ * covered are skipped, a partial batch ends the replay. Returns length of the
+ * consumed prefix, *seq is updated to the next record. */
+static size_t replay(hattrie_t* T, const unsigned char* buf, size_t len,
+                     uint64_t* seq, bool* gap)
+{
+    size_t off = 0;
+    uint32_t blen, count;
+    uint64_t first;
+    *gap = false;
+    while (len - off >= CHANGELOG_HEADER_SIZE) {
+        memcpy(&blen, buf + off, sizeof(uint32_t));
+        memcpy(&count, buf + off + 4, sizeof(uint32_t));
+        memcpy(&first, buf + off + 8, sizeof(uint64_t));
+        if (blen > len - off - CHANGELOG_HEADER_SIZE) break;
+
+        size_t end = off + CHANGELOG_HEADER_SIZE + blen;
+        if (first + count <= *seq) {
+            off = end;
+            continue;
+        }
+        if (first != *seq) {
+            *gap = true;
+            break;
+        }
+        if (changelog_apply(T, buf + off, end - off, seq) < 0) break;
+        off = end;
+    }
+    return off;
+}
+
+static void wal_sink(const unsigned char* batch, size_t len, void* ctx)
+{
+    hattrie_wal_t* W = ctx;
+    if (W->fd < 0 || write_all(W->fd, batch, len) != 0) {
+        W->error = -1;
+        return;
+    }
+    W->segment_bytes += len;
+}
+
+static int wal_open_segment(hattrie_wal_t* W, uint64_t seq)
+{
+    char* path = wal_path(W->dir, WAL_SEGMENT, seq, true);
+    W->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    free(path);
+    W->segment_bytes = 0;
+    if (W->fd < 0) return -1;
+    return sync_dir(W->dir);
+}
+
+static int cmp_seq(const void* a_, const void* b_)
+{
+    uint64_t a = *(const uint64_t*) a_, b = *(const uint64_t*) b_;
+    return a < b ? -1 : a > b;
+}
+
+/* list segment sequence numbers in ascending order */
+static size_t list_segments(const char* dir, uint64_t** segs)
+{
+    size_t n = 0, size = 16;
+    *segs = malloc_or_die(size * sizeof(uint64_t));
+    DIR* d = opendir(dir);
+    if (d == NULL) return 0;
+
+    struct dirent* e;
+    size_t plen = strlen(WAL_SEGMENT);
+    while ((e = readdir(d)) != NULL) {
+        if (strncmp(e->d_name, WAL_SEGMENT, plen) != 0) continue;
+        char* end;
+        unsigned long long seq = strtoull(e->d_name + plen, &end, 10);
+        if (*end != '\0' || end == e->d_name + plen) continue;
+        if (n == size) {
+            size *= 2;
+            *segs = realloc_or_die(*segs, size * sizeof(uint64_t));
+        }
+        (*segs)[n++] = (uint64_t) seq;
+    }
+    closedir(d);
+
+    qsort(*segs, n, sizeof(uint64_t), cmp_seq);
+    return n;
+}
+
+/* Write snapshot to a temporary file and atomically replace the checkpoint,
+ * then drop segments it covers. */
+static int write_checkpoint(const char* dir, hattrie_t* S, uint64_t seq)
+{
+    char* tmp  = wal_path(dir, WAL_CHECKPOINT ".tmp", 0, false);
+    char* path = wal_path(dir, WAL_CHECKPOINT, 0, false);
+    int ret = -1;
+
+    FILE* f = fopen(tmp, "wb");
+    if (f == NULL) goto out;
+
+    if (fwrite(&seq, sizeof(uint64_t), 1, f) == 1) {
+        changelog_t* log = changelog_create(1 << 16, changelog_sink_file, f);
+        size_t len;
+        const char* key;
+        hattrie_iter_t* i = hattrie_iter_begin(S, false);
+        while (!hattrie_iter_finished(i)) {
+            key = hattrie_iter_key(i, &len);
+            changelog_append(log, CHANGELOG_SET, key, len, *hattrie_iter_val(i));
+            hattrie_iter_next(i);
+        }
+        hattrie_iter_free(i);
+        changelog_free(log);
+        ret = 0;
+    }
+    if (fflush(f) != 0 || fsync(fileno(f)) != 0) ret = -1;
+    if (fclose(f) != 0) ret = -1;
+    if (ret == 0 && rename(tmp, path) != 0) ret = -1;
+    if (ret == 0) ret = sync_dir(dir);
+
+    /* segments starting before the checkpoint end before it */
+    if (ret == 0) {
+        uint64_t* segs;
+        size_t j, n = list_segments(dir, &segs);
+        for (j = 0; j < n && segs[j] < seq; ++j) {
+            char* seg = wal_path(dir, WAL_SEGMENT, segs[j], true);
+            unlink(seg);
+            free(seg);
+        }
+        free(segs);
+    }
+
+out:
+    free(tmp);
+    free(path);
+    return ret;
+}
+
+static void* checkpoint_thread(void* arg)
+{
+    hattrie_wal_t* W = arg;
+    int ret = write_checkpoint(W->dir, W->snapshot, W->snapshot_seq);
+
+    pthread_mutex_lock(&W->lock);
+    W->status = ret;
+    W->done = true;
+    pthread_mutex_unlock(&W->lock);
+    return NULL;
+}
+
+/* wait for a background checkpoint, returns its result */
+static int wal_join(hattrie_wal_t* W)
+{
+    if (!W->running) return W->status;
+    pthread_join(W->thread, NULL);
+    hattrie_free(W->snapshot);
+    W->snapshot = NULL;
+    W->running = false;
+    W->done = false;
+    return W->status;
+}
+
+/* Load the checkpoint and replay the WAL tail into W->T. Returns -1 if
+ * records are missing or a segment is corrupted before its tail. */
+static int wal_load(hattrie_wal_t* W, uint64_t* seq)
+{
+    unsigned char* buf;
+    size_t len;
+    bool gap = false;
+    *seq = 0;
+
+    /* load checkpoint */
+    char* path = wal_path(W->dir, WAL_CHECKPOINT, 0, false);
+    int r = read_file(path, &buf, &len);
+    free(path);
+    if (r == 0) {
+        if (len >= sizeof(uint64_t)) {
+            memcpy(seq, buf, sizeof(uint64_t));
+            uint64_t cseq = 0;
+            /* snapshot batches are numbered from zero */
+            replay(W->T, buf + sizeof(uint64_t), len - sizeof(uint64_t), &cseq, &gap);
+        }
+        free(buf);
+    }
+
+    /* replay WAL tail */
+    uint64_t* segs;
+    size_t j, n = list_segments(W->dir, &segs);
+    for (j = 0; j < n && !gap; ++j) {
+        /* a segment starting past the replayed records means some are lost */
+        if (segs[j] > *seq) {
+            gap = true;
+            break;
+        }
+        path = wal_path(W->dir, WAL_SEGMENT, segs[j], true);
+        if (read_file(path, &buf, &len) == 0) {
+            size_t valid = replay(W->T, buf, len, seq, &gap);
+            free(buf);
+            /* torn write at the tail */
+            if (valid < len && j + 1 == n && !gap) {
+                if (truncate(path, (off_t) valid) != 0) gap = true;
+            }
+            else if (valid < len) gap = true;
+        } else {
+            gap = true;
+        }
+        free(path);
+    }
+    free(segs);
+    return gap ? -1 : 0;
+}
+
+hattrie_wal_t* hattrie_wal_open(const char* dir, size_t batch_size,
+                                size_t checkpoint_bytes, hattrie_t** T)
+{
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) return NULL;
+
+    hattrie_wal_t* W = malloc_or_die(sizeof(hattrie_wal_t));
+    memset(W, 0, sizeof(hattrie_wal_t));
+    W->dir = malloc_or_die(strlen(dir) + 1);
+    strcpy(W->dir, dir);
+    W->fd = -1;
+    W->checkpoint_bytes = checkpoint_bytes;
+    W->T = hattrie_create();
+    pthread_mutex_init(&W->lock, NULL);
+
+    /* A checkpoint finishing while we read may remove the segments following
+     * the checkpoint we loaded, so a gap is retried with the new checkpoint. */
+    uint64_t seq;
+    int tries = 3;
+    while (wal_load(W, &seq) != 0) {
+        if (--tries == 0) {
+            hattrie_wal_close(W);
+            return NULL;
+        }
+        hattrie_free(W->T);
+        W->T = hattrie_create();
+    }
+
+    W->log = changelog_create(batch_size, wal_sink, W);
+    changelog_set_seq(W->log, seq);
+    if (wal_open_segment(W, seq) != 0) {
+        /* close as a failed open, freeing the trie not handed out */
+        changelog_free(W->log);
+        W->log = NULL;
+        hattrie_wal_close(W);
+        return NULL;
+    }
+    hattrie_set_log(W->T, W->log);
+
+    *T = W->T;
+    return W;
+}
+
+int hattrie_wal_commit(hattrie_wal_t* W)
+{
+    changelog_flush(W->log);
+    if (W->error || fsync(W->fd) != 0) return -1;
+
+    if (W->checkpoint_bytes && W->segment_bytes >= W->checkpoint_bytes) {
+        pthread_mutex_lock(&W->lock);
+        bool busy = W->running && !W->done;
+        pthread_mutex_unlock(&W->lock);
+        if (!busy) return hattrie_wal_checkpoint(W, true);
+    }
+    return 0;
+}
+
+int hattrie_wal_checkpoint(hattrie_wal_t* W, bool background)
+{
+    int ret = wal_join(W);
+    W->status = 0;
+
+    /* start a new segment at the checkpoint position */
+    changelog_flush(W->log);
+    if (W->error || fsync(W->fd) != 0) return -1;
+    uint64_t seq = changelog_seq(W->log);
+    close(W->fd);
+    if (wal_open_segment(W, seq) != 0) return -1;
+
+    W->snapshot = hattrie_dup(W->T);
+    W->snapshot_seq = seq;
+    if (background &&
+        pthread_create(&W->thread, NULL, checkpoint_thread, W) == 0) {
+        W->running = true;
+        return ret;
+    }
+
+    int r = write_checkpoint(W->dir, W->snapshot, seq);
+    hattrie_free(W->snapshot);
+    W->snapshot = NULL;
+    return ret != 0 ? ret : r;
+}
+
+int hattrie_wal_close(hattrie_wal_t* W)
+{
+    int ret = 0;
+    if (W->log) {
+        ret = hattrie_wal_commit(W);
+        if (wal_join(W) != 0) ret = -1;
+        hattrie_set_log(W->T, NULL);
+        changelog_free(W->log);
+    } else {
+        /* failed open, the trie was not handed out */
+        hattrie_free(W->T);
+    }
+    if (W->fd >= 0) close(W->fd);
+    pthread_mutex_destroy(&W->lock);
+    free(W->dir);
+    free(W);
+    return ret;
+}
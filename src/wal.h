@@ -0,0 +1,69 @@
+/*
+ * This file is part of hat-trie.
+ *
+ * Durable tries: write-ahead log with checkpoints.
+ *
+ * Mutations of the trie are recorded by a change log whose batches are
+ * appended to WAL segment files. hattrie_wal_commit makes all mutations since
+ * the previous commit durable with a single fsync, so many updates can share
+ * one commit. A checkpoint writes a snapshot of the trie, possibly in the
+ * background, and removes the WAL segments it covers. Recovery loads the
+ * latest checkpoint and replays the WAL tail.
+ *
+ * Directory layout:
+ *
+ *    checkpoint      uint64_t seq, followed by change log batches of the snapshot
+ *    wal.<seq>       change log batches, starting with record seq
+ *
+ */
+
+#ifndef HATTRIE_WAL_H
+#define HATTRIE_WAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include "pstdint.h"
+#include "hat-trie.h"
+
+typedef struct hattrie_wal_t_ hattrie_wal_t;
+
+/** Open a durable trie stored in the given directory.
+ *
+ * The trie is recovered from the directory (created if missing) and stored in
+ * T; it remains owned by the caller and must outlive the WAL. Inserts,
+ * value writes and deletes are logged, in batches of about batch_size bytes.
+ * A value written through the pointer returned by hattrie_get is logged as it
+ * is at the next flush (see changelog.h). If checkpoint_bytes is not zero, a
+ * background checkpoint is started by hattrie_wal_commit once the current WAL
+ * segment exceeds it.
+ *
+ * Returns NULL on I/O error or if the log is corrupted before its tail.
+ */
+hattrie_wal_t* hattrie_wal_open (const char* dir, size_t batch_size,
+                                 size_t checkpoint_bytes, hattrie_t** T);
+
+/** Write pending records and fsync the WAL. Returns 0 on success. */
+int hattrie_wal_commit (hattrie_wal_t*);
+
+/** Write a checkpoint of the current trie.
+ *
+ * The trie is copied in the foreground, serializing and syncing the copy is
+ * done in a background thread if requested. A running background checkpoint
+ * is waited for first. Returns 0 on success, or the result of the previous
+ * background checkpoint if it failed.
+ */
+int hattrie_wal_checkpoint (hattrie_wal_t*, bool background);
+
+/** Commit, wait for a running checkpoint and close the WAL.
+ * The trie is detached from the log. Returns 0 on success. */
+int hattrie_wal_close (hattrie_wal_t*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
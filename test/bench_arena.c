@@ -0,0 +1,96 @@
+
+/* Restart time of a persistent trie compared to rebuilding it.
+ *
+ * usage: bench_arena [keys] [capacity in GB] [path]
+ *
+ * E.g. 'bench_arena 100000000 16' builds a trie of roughly 10 GB. Keys are
+ * regenerated from a fixed seed rather than kept in memory. Rebuilding only
+ * counts inserting the keys, not reading them from wherever they are stored,
+ * so it is a lower bound.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../src/hat-trie.h"
+#include "../src/arena.h"
+#include "random_keys.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+const size_t m_low  = 10; // minimum length of each string
+const size_t m_high = 50; // maximum length of each string
+const unsigned seed = 1234;
+
+/* insert the key set, or look it up if lookup is set */
+size_t run(hattrie_t* T, size_t n, bool lookup)
+{
+    char x[51];
+    size_t i, m, found = 0;
+    srand(seed);
+    for (i = 0; i < n; ++i) {
+        m = m_low + rand() % (m_high - m_low);
+        randstr(x, m);
+        if (lookup) found += hattrie_tryget(T, x, m) != NULL;
+        else        *hattrie_get(T, x, m) = i;
+    }
+    return found;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    size_t gb = argc > 2 ? strtoul(argv[2], NULL, 10) : 4;
+    const char* path = argc > 3 ? argv[3] : "/tmp/bench_arena.hat";
+    double t0;
+
+    unlink(path);
+    hattrie_t* T;
+    hattrie_arena_t* A = hattrie_arena_open(path, gb << 30, &T);
+    if (A == NULL) {
+        fprintf(stderr, "cannot create arena %s\n", path);
+        return EXIT_FAILURE;
+    }
+
+    fprintf(stderr, "building %zu keys in the arena ... ", n);
+    t0 = now();
+    run(T, n, false);
+    fprintf(stderr, "finished. (%0.2f seconds)\n", now() - t0);
+
+    fprintf(stderr, "checkpointing %0.2f MB ... ",
+            (double) hattrie_arena_used(A) / 1e6);
+    t0 = now();
+    hattrie_arena_close(A);
+    fprintf(stderr, "finished. (%0.2f seconds)\n", now() - t0);
+
+    fprintf(stderr, "reopening ... ");
+    t0 = now();
+    A = hattrie_arena_open(path, 0, &T);
+    fprintf(stderr, "finished. (%0.6f seconds)\n", now() - t0);
+    if (A == NULL) return EXIT_FAILURE;
+
+    fprintf(stderr, "looking up all keys after reopen ... ");
+    t0 = now();
+    size_t found = run(T, n, true);
+    fprintf(stderr, "finished. (%0.2f seconds, %zu found)\n", now() - t0, found);
+    hattrie_arena_close(A);
+
+    fprintf(stderr, "rebuilding in memory ... ");
+    t0 = now();
+    T = hattrie_create();
+    run(T, n, false);
+    fprintf(stderr, "finished. (%0.2f seconds)\n", now() - t0);
+    hattrie_free(T);
+
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,143 @@
+
+/* Throughput of the concurrent trie and of a flat-combining front-end against
+ * a trie behind one mutex, for a growing number of threads and several shares
+ * of writes.
+ *
+ * usage: bench_concurrent [keys] [ops per thread]
+ *
+ * Reads look up stored keys, writes add to the value of a random key, which
+ * inserts it if it is new.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../src/concurrent.h"
+#include "../src/combining.h"
+#include "random_keys.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+const size_t m_low  = 10; // minimum length of each string
+const size_t m_high = 50; // maximum length of each string
+
+char** xs;
+size_t nx;
+size_t ops;
+
+typedef struct bench_t_
+{
+    hattrie_concurrent_t* C;  // concurrent trie, or
+    hattrie_combining_t* F;   // flat combining, or
+    hattrie_t* T;             // shared trie
+    pthread_mutex_t lock;     // guarding it
+    unsigned writes;          // percent
+} bench_t;
+
+typedef struct worker_t_
+{
+    bench_t* b;
+    unsigned seed;
+    size_t found;
+} worker_t;
+
+void* run(void* arg)
+{
+    worker_t* w = arg;
+    bench_t* b = w->b;
+    size_t i;
+    value_t v;
+    for (i = 0; i < ops; ++i) {
+        const char* x = xs[rand_r(&w->seed) % nx];
+        size_t len = strlen(x);
+        bool write = (unsigned) (rand_r(&w->seed) % 100) < b->writes;
+        if (b->C) {
+            if (write) hattrie_concurrent_add(b->C, x, len, 1);
+            else w->found += hattrie_concurrent_tryget(b->C, x, len, &v);
+        } else if (b->F) {
+            if (write) hattrie_combining_add(b->F, x, len, 1);
+            else w->found += hattrie_combining_tryget(b->F, x, len, &v);
+        } else {
+            pthread_mutex_lock(&b->lock);
+            if (write) *hattrie_get(b->T, x, len) += 1;
+            else w->found += hattrie_tryget(b->T, x, len) != NULL;
+            pthread_mutex_unlock(&b->lock);
+        }
+    }
+    return NULL;
+}
+
+/* millions of operations per second */
+double measure(bench_t* b, size_t nthreads)
+{
+    pthread_t threads[64];
+    worker_t workers[64];
+    size_t i;
+    double t0 = now();
+    for (i = 0; i < nthreads; ++i) {
+        workers[i].b = b;
+        workers[i].seed = 1234 + i;
+        workers[i].found = 0;
+        pthread_create(&threads[i], NULL, run, &workers[i]);
+    }
+    for (i = 0; i < nthreads; ++i) pthread_join(threads[i], NULL);
+    return 1e-6 * (double) (nthreads * ops) / (now() - t0);
+}
+
+int main(int argc, char* argv[])
+{
+    nx  = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    ops = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000;
+    const unsigned writes[] = { 0, 10, 50 };
+    const size_t threads[] = { 1, 2, 4, 8 };
+    size_t i, w, t;
+
+    srand(1234);
+    xs = random_keys(nx, m_low, m_high);
+
+    fprintf(stderr, "%7s %8s %14s %14s %14s\n", "writes", "threads", "mutex Mops/s",
+            "olc Mops/s", "fc Mops/s");
+    for (w = 0; w < sizeof(writes) / sizeof(writes[0]); ++w) {
+        for (t = 0; t < sizeof(threads) / sizeof(threads[0]); ++t) {
+            bench_t b;
+            memset(&b, 0, sizeof(bench_t));
+            b.writes = writes[w];
+
+            b.T = hattrie_create();
+            pthread_mutex_init(&b.lock, NULL);
+            for (i = 0; i < nx; i += 2) *hattrie_get(b.T, xs[i], strlen(xs[i])) = 1;
+            double locked = measure(&b, threads[t]);
+            pthread_mutex_destroy(&b.lock);
+
+            hattrie_free(b.T);
+            b.T = hattrie_create();
+            for (i = 0; i < nx; i += 2) *hattrie_get(b.T, xs[i], strlen(xs[i])) = 1;
+            b.F = hattrie_combining_create(b.T);
+            double fc = measure(&b, threads[t]);
+            hattrie_combining_free(b.F);
+            b.F = NULL;
+            hattrie_free(b.T);
+            b.T = NULL;
+
+            b.C = hattrie_concurrent_create();
+            for (i = 0; i < nx; i += 2) hattrie_concurrent_set(b.C, xs[i], strlen(xs[i]), 1);
+            double olc = measure(&b, threads[t]);
+            hattrie_concurrent_free(b.C);
+
+            fprintf(stderr, "%6u%% %8zu %14.2f %14.2f %14.2f\n", writes[w], threads[t],
+                    locked, olc, fc);
+        }
+    }
+
+    free_strings(xs, nx);
+    return 0;
+}
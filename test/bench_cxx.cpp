@@ -0,0 +1,97 @@
+
+/* The C++ interface against the C API it wraps: inserts, lookups and sorted
+ * iteration should cost the same. (find costs a copy of the key on top of a
+ * lookup, for the iterator it returns.)
+ *
+ * usage: bench_cxx [keys] [repetitions]
+ */
+
+#include "../src/hat-trie.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <vector>
+
+
+/* Simple random string generation. */
+std::string randstr(size_t len)
+{
+    std::string x(len, '\0');
+    while (len > 0) {
+        x[--len] = '\x20' + (rand() % ('\x7e' - '\x20' + 1));
+    }
+    return x;
+}
+
+std::vector<std::string> xs;
+size_t repetitions;
+
+double elapsed(clock_t t0)
+{
+    return (double) (clock() - t0) / (double) CLOCKS_PER_SEC;
+}
+
+void report(const char* what, double c, double cxx, size_t s1, size_t s2)
+{
+    double n = (double) (xs.size() * repetitions);
+    fprintf(stderr, "%-9s C %6.2f ns/key, C++ %6.2f ns/key%s\n",
+            what, 1e9 * c / n, 1e9 * cxx / n, s1 == s2 ? "" : " (results differ)");
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    repetitions = argc > 2 ? strtoul(argv[2], NULL, 10) : 5;
+    const size_t m_low  = 5;   // minimum length of each string
+    const size_t m_high = 50;  // maximum length of each string
+
+    size_t i, r, s1 = 0, s2 = 0;
+    for (i = 0; i < n; ++i) xs.push_back(randstr(m_low + rand() % (m_high - m_low)));
+
+    hattrie_t* T = hattrie_create();
+    hat_trie<value_t> W;
+
+    clock_t t0 = clock();
+    for (r = 0; r < repetitions; ++r) {
+        for (const std::string& x : xs) ++*hattrie_get(T, x.data(), x.size());
+    }
+    double c = elapsed(t0);
+    t0 = clock();
+    for (r = 0; r < repetitions; ++r) {
+        for (const std::string& x : xs) ++W[x];
+    }
+    report("insert", c, elapsed(t0), hattrie_size(T), W.size());
+
+    t0 = clock();
+    for (r = 0; r < repetitions; ++r) {
+        for (const std::string& x : xs) s1 += *hattrie_tryget(T, x.data(), x.size());
+    }
+    c = elapsed(t0);
+    t0 = clock();
+    for (r = 0; r < repetitions; ++r) {
+        for (const std::string& x : xs) s2 += W.at(x);
+    }
+    report("lookup", c, elapsed(t0), s1, s2);
+
+    s1 = s2 = 0;
+    t0 = clock();
+    for (r = 0; r < repetitions; ++r) {
+        hattrie_iter_t* it = hattrie_iter_begin(T, true);
+        for (; !hattrie_iter_finished(it); hattrie_iter_next(it)) {
+            size_t len;
+            const char* key = hattrie_iter_key(it, &len);
+            s1 += len + (unsigned char) key[0] + *hattrie_iter_val(it);
+        }
+        hattrie_iter_free(it);
+    }
+    c = elapsed(t0);
+    t0 = clock();
+    for (r = 0; r < repetitions; ++r) {
+        for (auto [key, val] : W) s2 += key.size() + (unsigned char) key[0] + val;
+    }
+    report("iterate", c, elapsed(t0), s1, s2);
+
+    hattrie_free(T);
+    return 0;
+}
@@ -0,0 +1,80 @@
+
+/* The compile-time specialized engine against the C library: inserts and
+ * lookups of the same keys, with the library's parameters and with a 7-bit
+ * alphabet and 32-bit values.
+ *
+ * usage: bench_engine [keys] [repetitions]
+ */
+
+#include "../src/hat-trie.h"
+#include "../src/hat-trie-engine.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <vector>
+
+
+/* Simple random string generation. */
+std::string randstr(size_t len)
+{
+    std::string x(len, '\0');
+    while (len > 0) {
+        x[--len] = '\x20' + (rand() % ('\x7e' - '\x20' + 1));
+    }
+    return x;
+}
+
+std::vector<std::string> xs;
+size_t repetitions;
+
+double elapsed(clock_t t0)
+{
+    return 1e9 * (double) (clock() - t0) / (double) CLOCKS_PER_SEC /
+           (double) (xs.size() * repetitions);
+}
+
+/* ns per insert and per lookup */
+template <typename Trie>
+void measure(const char* what)
+{
+    size_t r, sum = 0;
+    Trie T;
+    clock_t t0 = clock();
+    for (r = 0; r < repetitions; ++r) {
+        for (const std::string& x : xs) ++T[x];
+    }
+    double ins = elapsed(t0);
+    t0 = clock();
+    for (r = 0; r < repetitions; ++r) {
+        for (const std::string& x : xs) sum += *T.find(x);
+    }
+    fprintf(stderr, "%-26s insert %7.2f ns/key, lookup %7.2f ns/key (%zu keys, sum %zu)\n",
+            what, ins, elapsed(t0), T.size(), sum);
+}
+
+/* the C library, behind the interface of the engine */
+struct c_trie
+{
+    hattrie_t* T = hattrie_create();
+    ~c_trie() { hattrie_free(T); }
+    value_t& operator[](const std::string& x) { return *hattrie_get(T, x.data(), x.size()); }
+    value_t* find(const std::string& x) { return hattrie_tryget(T, x.data(), x.size()); }
+    size_t size() const { return hattrie_size(T); }
+};
+
+int main(int argc, char* argv[])
+{
+    const size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    repetitions = argc > 2 ? strtoul(argv[2], NULL, 10) : 3;
+    const size_t m_low  = 5;   // minimum length of each string
+    const size_t m_high = 50;  // maximum length of each string
+
+    for (size_t i = 0; i < n; ++i) xs.push_back(randstr(m_low + rand() % (m_high - m_low)));
+
+    measure<c_trie>("C library");
+    measure<hat_trie_engine<>>("engine, as the library");
+    measure<hat_trie_engine<uint32_t, ascii_alphabet>>("engine, ASCII, uint32_t");
+    measure<hat_trie_engine<uint32_t, ascii_alphabet, 4096>>("engine, ..., buckets 4096");
+    return 0;
+}
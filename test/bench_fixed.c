@@ -0,0 +1,75 @@
+
+/* Fixed key tables against generic ones, for binary keys of one length such
+ * as UUIDs and SHA-1 digests: inserts, and lookups of present and absent
+ * keys.
+ *
+ * usage: bench_fixed [keys] [repetitions]
+ */
+
+#include "../src/ahtable.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+
+size_t n, repetitions;
+
+double elapsed(clock_t t0)
+{
+    return 1e9 * (double) (clock() - t0) / (double) CLOCKS_PER_SEC /
+           (double) (n * repetitions);
+}
+
+/* ns per insert, hit and miss; keys past the first n are absent */
+void measure(ahtable_t* T, const char* keys, size_t klen, double* ns)
+{
+    size_t r, i, found = 0;
+    clock_t t0 = clock();
+    for (i = 0; i < n; ++i) *ahtable_get(T, keys + i * klen, klen) = i;
+    ns[0] = elapsed(t0) * (double) repetitions;
+
+    t0 = clock();
+    for (r = 0; r < repetitions; ++r) {
+        for (i = 0; i < n; ++i) found += *ahtable_tryget(T, keys + i * klen, klen) == i;
+    }
+    ns[1] = elapsed(t0);
+
+    t0 = clock();
+    for (r = 0; r < repetitions; ++r) {
+        for (i = n; i < 2 * n; ++i) found += ahtable_tryget(T, keys + i * klen, klen) != NULL;
+    }
+    ns[2] = elapsed(t0);
+
+    if (found != n * repetitions) fprintf(stderr, "(results differ) ");
+}
+
+int main(int argc, char* argv[])
+{
+    n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    repetitions = argc > 2 ? strtoul(argv[2], NULL, 10) : 5;
+    const size_t klens[] = { 8, 16, 20, 32 };
+    double g[3], f[3];
+    size_t i, j;
+
+    fprintf(stderr, "%5s %22s %22s %22s\n", "bytes",
+            "insert generic/fixed", "hit generic/fixed", "miss generic/fixed");
+    for (j = 0; j < sizeof(klens) / sizeof(klens[0]); ++j) {
+        size_t klen = klens[j];
+        char* keys = malloc(2 * n * klen);
+        for (i = 0; i < 2 * n * klen; ++i) keys[i] = (char) (rand() % 256);
+
+        /* about four keys per slot, as in trie buckets */
+        ahtable_t* T = ahtable_create_n(n / 4 + 1);
+        measure(T, keys, klen, g);
+        ahtable_free(T);
+
+        T = ahtable_create_fixed(n / 4 + 1, klen);
+        measure(T, keys, klen, f);
+        ahtable_free(T);
+
+        fprintf(stderr, "%5zu %10.2f %10.2f  %10.2f %10.2f  %10.2f %10.2f ns/key\n",
+                klen, g[0], f[0], g[1], f[1], g[2], f[2]);
+        free(keys);
+    }
+    return 0;
+}
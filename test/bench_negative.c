@@ -0,0 +1,90 @@
+
+/* Lookup latency with and without bucket filters, as the share of lookups
+ * that find their key varies.
+ *
+ * usage: bench_negative [keys]
+ *
+ * Absent keys are drawn like the stored ones, so they descend to the same
+ * buckets and only the filter or the slot scan can turn them away.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../src/hat-trie.h"
+#include "random_keys.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+const size_t m_low  = 10; // minimum length of each string
+const size_t m_high = 50; // maximum length of each string
+
+char** xs;  // stored keys
+char** ys;  // absent keys
+char** qs;  // lookups
+size_t nx;
+
+/* nanoseconds per lookup, returns the number of hits through found */
+double time_lookups(hattrie_t* T, size_t* found)
+{
+    size_t i;
+    *found = 0;
+    double t0 = now();
+    for (i = 0; i < nx; ++i) {
+        *found += hattrie_tryget(T, qs[i], strlen(qs[i])) != NULL;
+    }
+    return 1e9 * (now() - t0) / (double) nx;
+}
+
+int main(int argc, char* argv[])
+{
+    nx = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    const int ratios[] = { 0, 10, 50, 90, 100 };
+    size_t i, r, found;
+
+    srand(1234);
+    xs = random_keys(nx, m_low, m_high);
+    ys = random_keys(nx, m_low, m_high);
+    qs = malloc(nx * sizeof(char*));
+
+    hattrie_t* T = hattrie_create();
+    for (i = 0; i < nx; ++i) *hattrie_get(T, xs[i], strlen(xs[i])) = i + 1;
+
+    /* random strings of these lengths are absent with near certainty */
+    for (i = 0; i < nx; ++i) {
+        if (hattrie_tryget(T, ys[i], strlen(ys[i]))) ys[i][0] = '\x7f';
+    }
+
+    fprintf(stderr, "%6s %14s %14s\n", "hits", "plain ns/get", "filter ns/get");
+    for (r = 0; r < sizeof(ratios) / sizeof(ratios[0]); ++r) {
+        for (i = 0; i < nx; ++i) {
+            qs[i] = (size_t) (rand() % 100) < (size_t) ratios[r] ?
+                    xs[rand() % nx] : ys[rand() % nx];
+        }
+
+        hattrie_filter_enable(T, false);
+        double plain = time_lookups(T, &found);
+        hattrie_filter_enable(T, true);
+        size_t found_filtered;
+        double filtered = time_lookups(T, &found_filtered);
+        if (found != found_filtered) {
+            fprintf(stderr, "(%zu found with filters, %zu without) ",
+                    found_filtered, found);
+        }
+        fprintf(stderr, "%5d%% %14.0f %14.0f\n", ratios[r], plain, filtered);
+    }
+
+    hattrie_free(T);
+    free_strings(xs, nx);
+    free_strings(ys, nx);
+    free(qs);
+    return 0;
+}
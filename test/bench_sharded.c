@@ -0,0 +1,133 @@
+
+/* Counting keys from several threads: one trie behind a mutex against a trie
+ * per thread merged at the end, merge time included.
+ *
+ * usage: bench_sharded [distinct keys] [ops per thread]
+ *
+ * Keys are drawn with a skew towards the first ones, as words of a text are.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../src/sharded.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+
+/* Random lowercase word, as in a text. */
+void randword(char* x, size_t len, unsigned* seed)
+{
+    x[len] = '\0';
+    while (len > 0) {
+        x[--len] = 'a' + (rand_r(seed) % 26);
+    }
+}
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+const size_t m_low  = 3;  // minimum length of each string
+const size_t m_high = 12; // maximum length of each string
+
+char** xs;
+size_t* lens;
+size_t nx;
+size_t ops;
+
+typedef struct bench_t_
+{
+    hattrie_sharded_t* S;  // a trie per thread, or
+    hattrie_t* T;          // shared trie
+    pthread_mutex_t lock;  // guarding it
+} bench_t;
+
+typedef struct worker_t_
+{
+    bench_t* b;
+    unsigned seed;
+} worker_t;
+
+void* run(void* arg)
+{
+    worker_t* w = arg;
+    bench_t* b = w->b;
+    size_t i;
+    for (i = 0; i < ops; ++i) {
+        /* the product of two uniform picks favours small indexes */
+        size_t j = (size_t) ((double) (rand_r(&w->seed) % nx) *
+                             (double) (rand_r(&w->seed) % nx) / (double) nx);
+        if (b->S) {
+            ++*hattrie_sharded_get(b->S, xs[j], lens[j]);
+        } else {
+            pthread_mutex_lock(&b->lock);
+            ++*hattrie_get(b->T, xs[j], lens[j]);
+            pthread_mutex_unlock(&b->lock);
+        }
+    }
+    return NULL;
+}
+
+/* millions of operations per second */
+double measure(bench_t* b, size_t nthreads)
+{
+    pthread_t threads[64];
+    worker_t workers[64];
+    size_t i;
+    double t0 = now();
+    for (i = 0; i < nthreads; ++i) {
+        workers[i].b = b;
+        workers[i].seed = 1234 + i;
+        pthread_create(&threads[i], NULL, run, &workers[i]);
+    }
+    for (i = 0; i < nthreads; ++i) pthread_join(threads[i], NULL);
+    if (b->S) b->T = hattrie_sharded_merge(b->S, NULL, nthreads);
+    return 1e-6 * (double) (nthreads * ops) / (now() - t0);
+}
+
+int main(int argc, char* argv[])
+{
+    nx  = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    ops = argc > 2 ? strtoul(argv[2], NULL, 10) : 2000000;
+    const size_t threads[] = { 1, 2, 4, 8 };
+    unsigned seed = 1234;
+    size_t i, t;
+    char x[64];
+
+    xs = malloc(nx * sizeof(char*));
+    lens = malloc(nx * sizeof(size_t));
+    for (i = 0; i < nx; ++i) {
+        randword(x, m_low + rand_r(&seed) % (m_high - m_low), &seed);
+        xs[i] = strdup(x);
+        lens[i] = strlen(x);
+    }
+
+    fprintf(stderr, "%8s %14s %14s\n", "threads", "mutex Mops/s", "shards Mops/s");
+    for (t = 0; t < sizeof(threads) / sizeof(threads[0]); ++t) {
+        bench_t b;
+        memset(&b, 0, sizeof(bench_t));
+
+        b.T = hattrie_create();
+        pthread_mutex_init(&b.lock, NULL);
+        double locked = measure(&b, threads[t]);
+        pthread_mutex_destroy(&b.lock);
+        hattrie_free(b.T);
+
+        b.S = hattrie_sharded_create();
+        double sharded = measure(&b, threads[t]);
+        hattrie_free(b.T);
+        hattrie_sharded_free(b.S);
+
+        fprintf(stderr, "%8zu %14.2f %14.2f\n", threads[t], locked, sharded);
+    }
+
+    for (i = 0; i < nx; ++i) free(xs[i]);
+    free(xs);
+    free(lens);
+    return 0;
+}
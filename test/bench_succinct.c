@@ -0,0 +1,141 @@
+
+/* Size and lookup latency of frozen images compared to the live trie.
+ *
+ * usage: bench_succinct [keys] [urls]
+ *
+ * Keys are random strings, or URL-like keys sharing long prefixes if a second
+ * argument is given. The live trie is built in an arena so that all of its
+ * memory is counted. Sizes are reported in bits per key, values included.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../src/hat-trie.h"
+#include "../src/arena.h"
+#include "../src/frozen.h"
+#include "random_keys.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+const size_t m_low  = 10; // minimum length of each string
+const size_t m_high = 50; // maximum length of each string
+
+char** xs;
+size_t* order;  // lookup order
+size_t nx;
+
+void make_keys(size_t n, bool urls)
+{
+    char x[128];
+    size_t i;
+    xs = malloc(n * sizeof(char*));
+    order = malloc(n * sizeof(size_t));
+    for (nx = 0; nx < n; ++nx) {
+        if (urls) {
+            snprintf(x, sizeof(x), "http://www.site%04d.example.com/%s/item%07d.html",
+                     rand() % 5000, rand() % 2 ? "catalog/books" : "blog/archive",
+                     rand() % 10000000);
+        } else {
+            randstr(x, m_low + rand() % (m_high - m_low));
+        }
+        xs[nx] = strdup(x);
+    }
+    for (i = 0; i < nx; ++i) order[i] = i;
+    for (i = nx; i > 1; --i) {
+        size_t j = rand() % i, t = order[i - 1];
+        order[i - 1] = order[j];
+        order[j] = t;
+    }
+}
+
+double bits_per_key(size_t bytes)
+{
+    return 8.0 * (double) bytes / (double) nx;
+}
+
+/* nanoseconds per lookup of every key in random order */
+double time_frozen(const hattrie_frozen_t* F)
+{
+    size_t i, found = 0;
+    double t0 = now();
+    for (i = 0; i < nx; ++i) {
+        found += hattrie_frozen_tryget(F, xs[order[i]], strlen(xs[order[i]])) != NULL;
+    }
+    double t = now() - t0;
+    if (found != nx) fprintf(stderr, "(only %zu found) ", found);
+    return 1e9 * t / (double) nx;
+}
+
+void bench_image(hattrie_t* T, const char* name, const char* path,
+                 int (*freeze)(const hattrie_t*, const char*))
+{
+    double t0 = now();
+    if (freeze(T, path) != 0) {
+        fprintf(stderr, "cannot write %s\n", path);
+        return;
+    }
+    double build = now() - t0;
+
+    struct stat st;
+    stat(path, &st);
+    hattrie_frozen_t* F = hattrie_frozen_open(path);
+    if (F == NULL) return;
+    fprintf(stderr, "%-10s %8.1f bits/key %8.0f ns/lookup  (%0.2f s to build)\n",
+            name, bits_per_key((size_t) st.st_size), time_frozen(F), build);
+    hattrie_frozen_close(F);
+    unlink(path);
+}
+
+int main(int argc, char* argv[])
+{
+    size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    bool urls = argc > 2;
+    const char* arena = "/tmp/bench_succinct.hat";
+    const char* path = "/tmp/bench_succinct.frozen";
+    size_t i, len, found = 0;
+
+    srand(1234);
+    make_keys(n, urls);
+
+    unlink(arena);
+    hattrie_t* T;
+    hattrie_arena_t* A = hattrie_arena_open(arena, (size_t) 64 << 30, &T);
+    if (A == NULL) {
+        fprintf(stderr, "cannot create arena %s\n", arena);
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < nx; ++i) {
+        len = strlen(xs[i]);
+        *hattrie_get(T, xs[i], len) = i;
+    }
+
+    double t0 = now();
+    for (i = 0; i < nx; ++i) {
+        found += hattrie_tryget(T, xs[order[i]], strlen(xs[order[i]])) != NULL;
+    }
+    fprintf(stderr, "%-10s %8.1f bits/key %8.0f ns/lookup\n", "live",
+            bits_per_key(hattrie_arena_used(A)), 1e9 * (now() - t0) / (double) nx);
+
+    bench_image(T, "front", path, hattrie_freeze);
+    bench_image(T, "hashed", path, hattrie_freeze_hashed);
+    bench_image(T, "dawg", path, hattrie_freeze_dawg);
+    bench_image(T, "succinct", path, hattrie_freeze_succinct);
+
+    hattrie_arena_close(A);
+    unlink(arena);
+    for (i = 0; i < nx; ++i) free(xs[i]);
+    free(xs);
+    free(order);
+    return 0;
+}
@@ -0,0 +1,96 @@
+
+/* Integer keys: a trie from hattrie_create_u64 through the _u64 functions,
+ * against a generic trie given the same keys as 8-byte strings. Keys are
+ * dense runs, as for row ids and timestamps, or spread uniformly.
+ *
+ * usage: bench_u64 [keys] [repetitions]
+ */
+
+#include "../src/hat-trie.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+
+size_t n, repetitions;
+
+double elapsed(clock_t t0)
+{
+    return 1e9 * (double) (clock() - t0) / (double) CLOCKS_PER_SEC /
+           (double) (n * repetitions);
+}
+
+void encode(char* key, uint64_t x)
+{
+    int i;
+    for (i = 7; i >= 0; --i, x >>= 8) key[i] = (char) (x & 0xff);
+}
+
+/* ns per insert, lookup and iterated key */
+void measure(const uint64_t* ks, bool native, double* ns)
+{
+    hattrie_t* T = native ? hattrie_create_u64() : hattrie_create();
+    size_t r, i, sum = 0;
+    char key[8];
+
+    clock_t t0 = clock();
+    for (i = 0; i < n; ++i) {
+        if (native) *hattrie_get_u64(T, ks[i]) = i;
+        else {
+            encode(key, ks[i]);
+            *hattrie_get(T, key, sizeof(key)) = i;
+        }
+    }
+    ns[0] = elapsed(t0) * (double) repetitions;
+
+    t0 = clock();
+    for (r = 0; r < repetitions; ++r) {
+        for (i = 0; i < n; ++i) {
+            if (native) sum += *hattrie_tryget_u64(T, ks[i]);
+            else {
+                encode(key, ks[i]);
+                sum += *hattrie_tryget(T, key, sizeof(key));
+            }
+        }
+    }
+    ns[1] = elapsed(t0);
+
+    t0 = clock();
+    for (r = 0; r < repetitions; ++r) {
+        hattrie_iter_t* it = hattrie_iter_begin(T, true);
+        for (; !hattrie_iter_finished(it); hattrie_iter_next(it)) {
+            sum += hattrie_iter_key_u64(it);
+        }
+        hattrie_iter_free(it);
+    }
+    ns[2] = elapsed(t0);
+
+    if (sum == 0) fprintf(stderr, "(no keys) ");
+    hattrie_free(T);
+}
+
+int main(int argc, char* argv[])
+{
+    n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    repetitions = argc > 2 ? strtoul(argv[2], NULL, 10) : 5;
+    uint64_t* ks = malloc(n * sizeof(uint64_t));
+    double g[3], f[3];
+    size_t i, j;
+
+    fprintf(stderr, "%-8s %22s %22s %22s\n", "keys",
+            "insert generic/u64", "lookup generic/u64", "sorted generic/u64");
+    for (j = 0; j < 2; ++j) {
+        for (i = 0; i < n; ++i) {
+            ks[i] = j == 0 ? 1000000 + 3 * i
+                           : ((uint64_t) rand() << 42) ^ ((uint64_t) rand() << 21) ^
+                             (uint64_t) rand();
+        }
+        measure(ks, false, g);
+        measure(ks, true, f);
+        fprintf(stderr, "%-8s %10.2f %10.2f  %10.2f %10.2f  %10.2f %10.2f ns/key\n",
+                j == 0 ? "dense" : "random", g[0], f[0], g[1], f[1], g[2], f[2]);
+    }
+
+    free(ks);
+    return 0;
+}
@@ -0,0 +1,93 @@
+
+/* Full scans with hattrie_walk_all and with hattrie_iter_fill against the
+ * iterator, out of order and in order.
+ *
+ * usage: bench_walk [keys] [repetitions]
+ */
+
+#include "../src/hat-trie.h"
+#include "random_keys.h"
+#include <stdio.h>
+#include <time.h>
+
+
+size_t repetitions;
+
+/* what a scan typically does with a key */
+static int visit(const char* prefix, size_t plen, const char* suffix,
+                 size_t slen, value_t* val, void* ctx)
+{
+    size_t* sum = ctx;
+    *sum += plen + slen + (unsigned char) (plen ? prefix[0] : slen ? suffix[0] : 0) + *val;
+    return 0;
+}
+
+enum { ITER, FILL, WALK };
+
+double scan(hattrie_t* T, bool sorted, int how, size_t* sum)
+{
+    value_t buf[8192];
+    clock_t t0 = clock();
+    size_t r, len, count, j;
+    const char* key;
+    for (r = 0; r < repetitions; ++r) {
+        if (how == WALK) {
+            hattrie_walk_all(T, sorted, visit, sum);
+            continue;
+        }
+        hattrie_iter_t* it = hattrie_iter_begin(T, sorted);
+        if (how == FILL) {
+            while (hattrie_iter_fill(it, buf, sizeof(buf), &count) > 0) {
+                const void* rec = buf;
+                for (j = 0; j < count; ++j, rec = hattrie_record_next(rec)) {
+                    key = hattrie_record_key(rec, &len);
+                    *sum += len + (unsigned char) (len ? key[0] : 0) + hattrie_record_val(rec);
+                }
+            }
+        }
+        for (; !hattrie_iter_finished(it); hattrie_iter_next(it)) {
+            key = hattrie_iter_key(it, &len);
+            *sum += len + (unsigned char) (len ? key[0] : 0) + *hattrie_iter_val(it);
+        }
+        hattrie_iter_free(it);
+    }
+    return (double) (clock() - t0) / (double) CLOCKS_PER_SEC;
+}
+
+void report(hattrie_t* T, bool sorted, const char* what, double n)
+{
+    size_t s1 = 0, s2 = 0, s3 = 0;
+    double it = scan(T, sorted, ITER, &s1);
+    double fl = scan(T, sorted, FILL, &s2);
+    double wk = scan(T, sorted, WALK, &s3);
+    fprintf(stderr, "%-9s iterator %6.2f ns/key, fill %6.2f ns/key, walk %6.2f ns/key%s\n",
+            what, 1e9 * it / n, 1e9 * fl / n, 1e9 * wk / n,
+            s1 == s2 && s1 == s3 ? "" : " (results differ)");
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    repetitions = argc > 2 ? strtoul(argv[2], NULL, 10) : 10;
+    const size_t m_low  = 5;   // minimum length of each string
+    const size_t m_high = 50;  // maximum length of each string
+    char x[51];
+
+    hattrie_t* T = hattrie_create();
+    size_t i, m;
+    for (i = 0; i < n; ++i) {
+        m = m_low + rand() % (m_high - m_low);
+        randstr(x, m);
+        *hattrie_get(T, x, m) = i;
+    }
+
+    report(T, false, "unsorted", (double) (n * repetitions));
+    report(T, true, "sorted", (double) (n * repetitions));
+
+    /* with order indexes, as sorted iteration of a static trie would */
+    hattrie_build_index(T);
+    report(T, true, "indexed", (double) (n * repetitions));
+
+    hattrie_free(T);
+    return 0;
+}
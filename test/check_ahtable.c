@@ -241,6 +241,98 @@ void test_ahtable_find_prev()
 }
 
 
+/* Random binary keys of one length in a fixed key table, checked against a
+ * map through lookups, ordered iteration, deletes and a cold round trip. */
+void test_ahtable_fixed(size_t klen)
+{
+    fprintf(stderr, "checking a table of %zu byte keys ... ", klen);
+
+    const size_t nkeys = 20000;
+    ahtable_t* F = ahtable_create_fixed(256, klen);
+    str_map* R = str_map_create();
+    char* keys = malloc(nkeys * klen);
+    char* probe = malloc(klen + 1);
+    size_t i, j, len, count = 0;
+    const char* key;
+
+    for (i = 0; i < nkeys * klen; ++i) keys[i] = (char) (rand() % 256);
+    for (i = 0; i < 2 * nkeys; ++i) {
+        key = keys + (rand() % nkeys) * klen;
+        ++*ahtable_get(F, key, klen);
+        str_map_set(R, key, klen, str_map_get(R, key, klen) + 1);
+    }
+    if (ahtable_size(F) != R->m) {
+        fprintf(stderr, "[error] %zu keys, expected %zu\n", ahtable_size(F), R->m);
+    }
+
+    /* keys differing in one byte, or of another length, are absent */
+    for (i = 0; i < nkeys; ++i) {
+        key = keys + i * klen;
+        value_t* u = ahtable_tryget(F, key, klen);
+        if ((u ? *u : 0) != str_map_get(R, key, klen)) {
+            fprintf(stderr, "[error] wrong value of a fixed key\n");
+        }
+        memcpy(probe, key, klen);
+        probe[rand() % klen] ^= 0x1;
+        if (str_map_get(R, probe, klen) == 0 && ahtable_tryget(F, probe, klen)) {
+            fprintf(stderr, "[error] found a key differing in one byte\n");
+        }
+        if (ahtable_tryget(F, key, klen - 1) || ahtable_del(F, key, klen - 1) == 0) {
+            fprintf(stderr, "[error] found a key of another length\n");
+        }
+    }
+
+    ahtable_iter_t it;
+    ahtable_iter_begin(F, &it, true);
+    for (; !ahtable_iter_finished(&it); ahtable_iter_next(&it), ++count) {
+        key = ahtable_iter_key(&it, &len);
+        if (len != klen || *ahtable_iter_val(&it) != str_map_get(R, key, len) ||
+            (count > 0 && memcmp(probe, key, klen) >= 0)) {
+            fprintf(stderr, "[error] wrong sorted iteration of fixed keys\n");
+            break;
+        }
+        memcpy(probe, key, klen);
+    }
+    ahtable_iter_free(&it);
+    if (count != R->m) fprintf(stderr, "[error] iterated %zu fixed keys\n", count);
+
+    /* delete half, then look the rest up through the index and cold */
+    for (i = 0; i < nkeys; i += 2) {
+        key = keys + i * klen;
+        if ((ahtable_del(F, key, klen) == 0) != (str_map_get(R, key, klen) != 0)) {
+            fprintf(stderr, "[error] wrong result of deleting a fixed key\n");
+        }
+        str_map_del(R, key, klen);
+    }
+    ahtable_build_index(F);
+    ahtable_filter(F, true);
+    ahtable_compress(F);
+    for (j = 0; j < 2; ++j) {
+        for (i = 0; i < nkeys; ++i) {
+            key = keys + i * klen;
+            value_t* u = NULL;
+            int r = ahtable_find_leq(F, key, klen, &u);
+            if ((r == 0) != (str_map_get(R, key, klen) != 0) ||
+                (r == 0 && *u != str_map_get(R, key, klen))) {
+                fprintf(stderr, "[error] wrong lookup of a fixed key in order\n");
+                break;
+            }
+        }
+        ahtable_decompress(F);
+    }
+    if (ahtable_size(F) != R->m) {
+        fprintf(stderr, "[error] %zu keys after deletes, expected %zu\n",
+                ahtable_size(F), R->m);
+    }
+
+    free(keys);
+    free(probe);
+    str_map_destroy(R);
+    ahtable_free(F);
+    fprintf(stderr, "done.\n");
+}
+
+
 int main()
 {
     setup();
@@ -258,5 +350,9 @@ int main()
     test_ahtable_find_prev();
     teardown();
 
+    test_ahtable_fixed(16);
+    test_ahtable_fixed(20);
+    test_ahtable_fixed(3);
+
     return 0;
 }
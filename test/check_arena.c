@@ -0,0 +1,163 @@
+
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE /* MAP_ANONYMOUS */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "str_map.h"
+#include "random_keys.h"
+#include "../src/hat-trie.h"
+#include "../src/arena.h"
+
+const size_t n = 50000;   // how many unique strings
+const size_t m_low  = 5;  // minimum length of each string
+const size_t m_high = 50; // maximum length of each string
+const size_t k = 200000;  // number of operations
+const size_t capacity = (size_t) 1 << 30;
+
+char** xs;
+str_map* M;
+char path[] = "/tmp/check_arena.XXXXXX";
+
+
+void setup()
+{
+    fprintf(stderr, "generating %zu keys ... ", n);
+    xs = random_keys(n, m_low, m_high);
+    M = str_map_create();
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "[error] cannot create file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+    fprintf(stderr, "done.\n");
+}
+
+
+void teardown()
+{
+    str_map_destroy(M);
+    free_strings(xs, n);
+    unlink(path);
+}
+
+
+/* apply random mutations to the trie and the reference map */
+void mutate(hattrie_t* T, size_t count)
+{
+    size_t i, j, len;
+    for (j = 0; j < count; ++j) {
+        i = rand() % n;
+        len = strlen(xs[i]);
+        if (rand() % 4 == 0) {
+            hattrie_del(T, xs[i], len);
+            str_map_del(M, xs[i], len);
+        } else {
+            value_t v = 1 + rand() % 1000;
+            *hattrie_get(T, xs[i], len) = v;
+            str_map_set(M, xs[i], len, v);
+        }
+    }
+}
+
+
+void check(hattrie_t* T, const char* what)
+{
+    size_t i, len, count = 0;
+    value_t* u;
+    for (i = 0; i < n; ++i) {
+        len = strlen(xs[i]);
+        value_t v = str_map_get(M, xs[i], len);
+        u = hattrie_tryget(T, xs[i], len);
+        if ((u == NULL) != (v == 0) || (u && *u != v)) {
+            fprintf(stderr, "[error] wrong value for %s after %s\n", xs[i], what);
+        }
+    }
+
+    hattrie_iter_t* it = hattrie_iter_begin(T, true);
+    while (!hattrie_iter_finished(it)) {
+        ++count;
+        hattrie_iter_next(it);
+    }
+    hattrie_iter_free(it);
+
+    if (count != M->m) {
+        fprintf(stderr, "[error] iterated %zu keys after %s, expected %zu\n",
+                count, what, M->m);
+    }
+}
+
+
+void test_arena()
+{
+    fprintf(stderr, "persisting %zu mutations ... \n", k);
+
+    hattrie_t* T;
+    hattrie_arena_t* A = hattrie_arena_open(path, capacity, &T);
+    if (A == NULL) {
+        fprintf(stderr, "[error] cannot create arena %s\n", path);
+        return;
+    }
+    mutate(T, k);
+    hattrie_build_index(T);
+    check(T, "mutate");
+    if (hattrie_arena_close(A) != 0) {
+        fprintf(stderr, "[error] failed to close arena.\n");
+    }
+
+    /* reopen at the recorded address */
+    A = hattrie_arena_open(path, 0, &T);
+    if (A == NULL) {
+        fprintf(stderr, "[error] cannot reopen arena %s\n", path);
+        return;
+    }
+    check(T, "reopen");
+    mutate(T, k / 2);
+    hattrie_build_index(T);
+    hattrie_arena_sync(A);
+    check(T, "sync");
+    void* old = T;
+    hattrie_arena_close(A);
+
+    /* take part of the old range, forcing the arena to be rebased */
+    long page = sysconf(_SC_PAGESIZE);
+    void* addr = (void*) ((uintptr_t) old / (uintptr_t) page * (uintptr_t) page);
+    void* hole = mmap(addr, (size_t) page, PROT_READ,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    A = hattrie_arena_open(path, 0, &T);
+    if (A == NULL) {
+        fprintf(stderr, "[error] cannot rebase arena %s\n", path);
+    } else {
+        if (hole == addr && (void*) T == old) {
+            fprintf(stderr, "[error] arena was mapped over a used range\n");
+        }
+        check(T, "rebase");
+        mutate(T, k / 2);
+        hattrie_build_index(T);
+        check(T, "rebased mutate");
+        hattrie_arena_close(A);
+    }
+    if (hole != MAP_FAILED) munmap(hole, (size_t) page);
+
+    A = hattrie_arena_open(path, 0, &T);
+    check(T, "reopen after rebase");
+    hattrie_arena_close(A);
+
+    fprintf(stderr, "done.\n");
+}
+
+
+int main()
+{
+    setup();
+    test_arena();
+    teardown();
+
+    return 0;
+}
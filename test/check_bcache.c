@@ -0,0 +1,188 @@
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "str_map.h"
+#include "random_keys.h"
+#include "../src/hat-trie.h"
+#include "../src/bcache.h"
+
+const size_t n = 50000;   // how many unique strings
+const size_t m_low  = 5;  // minimum length of each string
+const size_t m_high = 50; // maximum length of each string
+const size_t k = 100000;  // number of operations
+const size_t run = 500;   // operations on neighbouring keys in a row
+const size_t budget = 512 * 1024;
+
+char** xs;
+str_map* M;
+char path[] = "/tmp/check_bcache.XXXXXX";
+
+
+int cmpkey(const void* a, const void* b)
+{
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+
+void setup()
+{
+    fprintf(stderr, "generating %zu keys ... ", n);
+    xs = random_keys(n, m_low, m_high);
+    /* keys in order, so that neighbours share buckets */
+    qsort(xs, n, sizeof(char*), cmpkey);
+    M = str_map_create();
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "[error] cannot create file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+    fprintf(stderr, "done.\n");
+}
+
+
+void teardown()
+{
+    str_map_destroy(M);
+    free_strings(xs, n);
+}
+
+
+/* apply random mutations to the trie and the reference map, in runs over
+ * neighbouring keys, as a whole-trie random workload would only measure disk
+ * speed */
+void mutate(hattrie_t* T, size_t count)
+{
+    size_t i = 0, j, len;
+    for (j = 0; j < count; ++j) {
+        if (j % run == 0) i = rand() % n;
+        i = (i + 1 + rand() % 4) % n;
+        len = strlen(xs[i]);
+        if (rand() % 4 == 0) {
+            hattrie_del(T, xs[i], len);
+            str_map_del(M, xs[i], len);
+        } else {
+            value_t v = 1 + rand() % 1000;
+            *hattrie_get(T, xs[i], len) = v;
+            str_map_set(M, xs[i], len, v);
+        }
+    }
+}
+
+
+void check(hattrie_t* T, const char* what)
+{
+    size_t i, len, count = 0;
+    value_t* u;
+    for (i = 0; i < n; ++i) {
+        len = strlen(xs[i]);
+        value_t v = str_map_get(M, xs[i], len);
+        u = hattrie_tryget(T, xs[i], len);
+        if ((u == NULL) != (v == 0) || (u && *u != v)) {
+            fprintf(stderr, "[error] wrong value for %s after %s\n", xs[i], what);
+        }
+    }
+
+    /* sorted iteration pins one bucket at a time */
+    char* prev = NULL;
+    size_t prev_len = 0;
+    hattrie_iter_t* it = hattrie_iter_begin(T, true);
+    while (!hattrie_iter_finished(it)) {
+        const char* key = hattrie_iter_key(it, &len);
+        if (*hattrie_iter_val(it) != str_map_get(M, key, len)) {
+            fprintf(stderr, "[error] iterated wrong value after %s\n", what);
+        }
+        if (prev) {
+            size_t l = prev_len < len ? prev_len : len;
+            int c = memcmp(prev, key, l);
+            if (c > 0 || (c == 0 && prev_len >= len)) {
+                fprintf(stderr, "[error] keys out of order after %s\n", what);
+            }
+        }
+        free(prev);
+        prev = malloc(len + 1);
+        memcpy(prev, key, len);
+        prev_len = len;
+        ++count;
+        hattrie_iter_next(it);
+    }
+    hattrie_iter_free(it);
+    free(prev);
+
+    if (count != M->m) {
+        fprintf(stderr, "[error] iterated %zu keys after %s, expected %zu\n",
+                count, what, M->m);
+    }
+}
+
+
+void test_bcache()
+{
+    fprintf(stderr, "paging %zu mutations through a %zu byte cache ... \n",
+            k, budget);
+
+    hattrie_bcache_t* C = hattrie_bcache_create(path, budget);
+    if (C == NULL) {
+        fprintf(stderr, "[error] cannot create bucket cache %s\n", path);
+        return;
+    }
+
+    hattrie_t* T = hattrie_create();
+    hattrie_set_bcache(T, C);
+    mutate(T, k);
+    check(T, "mutate");
+
+    size_t loads, writes;
+    hattrie_bcache_stats(C, &loads, &writes);
+    if (loads == 0 || writes == 0) {
+        fprintf(stderr, "[error] no buckets were paged (%zu loads, %zu writes)\n",
+                loads, writes);
+    }
+    if (hattrie_bcache_resident(C) > budget) {
+        fprintf(stderr, "[error] %zu bytes resident over a budget of %zu\n",
+                hattrie_bcache_resident(C), budget);
+    }
+
+    /* reading alone writes nothing back */
+    check(T, "recheck");
+    size_t writes2;
+    hattrie_bcache_stats(C, &loads, &writes2);
+    if (writes2 != writes) {
+        fprintf(stderr, "[error] unchanged buckets were written back\n");
+    }
+
+    /* bring everything back in memory, then page it out again */
+    hattrie_set_bcache(T, NULL);
+    if (hattrie_bcache_resident(C) != 0) {
+        fprintf(stderr, "[error] detached buckets still counted\n");
+    }
+    check(T, "detach");
+    hattrie_set_bcache(T, C);
+    mutate(T, k / 2);
+    check(T, "reattach");
+
+    hattrie_free(T);
+    hattrie_bcache_free(C);
+
+    if (access(path, F_OK) == 0) {
+        fprintf(stderr, "[error] bucket file %s was not removed\n", path);
+        unlink(path);
+    }
+
+    fprintf(stderr, "done.\n");
+}
+
+
+int main()
+{
+    setup();
+    test_bcache();
+    teardown();
+
+    return 0;
+}
@@ -0,0 +1,207 @@
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "str_map.h"
+#include "random_keys.h"
+#include "../src/combining.h"
+
+const size_t n = 100000;   // how many unique strings
+const size_t m_high = 20;  // maximum length of each string
+const size_t k = 300000;   // number of operations
+const size_t nthreads = 4;
+const size_t rounds = 10;  // increments of every key by every thread
+
+char** xs;
+
+
+void setup()
+{
+    /* the root value of a trie always reads as present, leave it out */
+    xs = random_keys(n, 1, m_high + 1);
+}
+
+void teardown()
+{
+    free_strings(xs, n);
+}
+
+/* The shared trie holds the same keys and values as the map. */
+void check_trie(hattrie_t* T, str_map* M, const char* what)
+{
+    size_t i, len, count = 0;
+    for (i = 0; i < n; ++i) {
+        len = strlen(xs[i]);
+        value_t v = str_map_get(M, xs[i], len);
+        value_t* u = hattrie_tryget(T, xs[i], len);
+        if ((u == NULL) != (v == 0) || (u && *u != v)) {
+            fprintf(stderr, "[error] trie differs for key %zu after %s\n", i, what);
+            break;
+        }
+    }
+    hattrie_iter_t* it = hattrie_iter_begin(T, false);
+    for (; !hattrie_iter_finished(it); hattrie_iter_next(it)) ++count;
+    hattrie_iter_free(it);
+    if (count != M->m) {
+        fprintf(stderr, "[error] trie of %zu keys after %s, expected %zu\n",
+                count, what, M->m);
+    }
+}
+
+
+void test_single()
+{
+    fprintf(stderr, "checking flat combining in one thread ... ");
+
+    hattrie_t* T = hattrie_create();
+    hattrie_combining_t* C = hattrie_combining_create(T);
+    str_map* M = str_map_create();
+    size_t i, j, len;
+    value_t u, v;
+
+    for (j = 0; j < k; ++j) {
+        i = rand() % n;
+        len = strlen(xs[i]);
+        v = str_map_get(M, xs[i], len);
+        switch (rand() % 4) {
+            case 0:
+                if (hattrie_combining_del(C, xs[i], len) != (v ? 0 : -1)) {
+                    fprintf(stderr, "[error] wrong result of deleting key %zu\n", i);
+                }
+                str_map_del(M, xs[i], len);
+                break;
+            case 1:
+                hattrie_combining_set(C, xs[i], len, j + 1);
+                str_map_set(M, xs[i], len, j + 1);
+                break;
+            default:
+                if (hattrie_combining_add(C, xs[i], len, 1) != v + 1) {
+                    fprintf(stderr, "[error] wrong sum for key %zu\n", i);
+                }
+                str_map_set(M, xs[i], len, v + 1);
+        }
+
+        i = rand() % n;
+        len = strlen(xs[i]);
+        v = str_map_get(M, xs[i], len);
+        if (hattrie_combining_tryget(C, xs[i], len, &u) != (v != 0) || (v && u != v)) {
+            fprintf(stderr, "[error] wrong value for key %zu\n", i);
+        }
+    }
+    hattrie_combining_free(C);
+    check_trie(T, M, "updates");
+
+    str_map_destroy(M);
+    hattrie_free(T);
+    fprintf(stderr, "done.\n");
+}
+
+
+typedef struct worker_t_
+{
+    hattrie_combining_t* C;
+    size_t id;
+    size_t errors;
+} worker_t;
+
+/* Increment every key once per round, with a thread of its own inserting
+ * and deleting keys of its own, and check that counts never go down. */
+void* count_keys(void* arg)
+{
+    worker_t* w = arg;
+    size_t r, i, len;
+    value_t u, v;
+    for (r = 0; r < rounds; ++r) {
+        for (i = w->id; i < n + w->id; i += 7) {
+            size_t x = i % n;
+            len = strlen(xs[x]);
+            v = hattrie_combining_add(w->C, xs[x], len, 1);
+            if (!hattrie_combining_tryget(w->C, xs[x], len, &u) || u < v) {
+                ++w->errors;
+            }
+        }
+    }
+    return NULL;
+}
+
+void* churn_keys(void* arg)
+{
+    worker_t* w = arg;
+    char x[32];
+    size_t i, len;
+    value_t u;
+    for (i = 0; i < k / 3; ++i) {
+        snprintf(x, sizeof(x), "\x7f%zu", i % 5000);
+        len = strlen(x);
+        if (i % 3 == 2) {
+            hattrie_combining_del(w->C, x, len);
+        } else {
+            hattrie_combining_set(w->C, x, len, i);
+            if (!hattrie_combining_tryget(w->C, x, len, &u) || u != i) ++w->errors;
+        }
+    }
+    return NULL;
+}
+
+
+void test_threads()
+{
+    fprintf(stderr, "checking flat combining in %zu threads ... ", nthreads + 1);
+
+    hattrie_t* T = hattrie_create();
+    hattrie_combining_t* C = hattrie_combining_create(T);
+    pthread_t threads[8];
+    worker_t workers[8];
+    size_t i, j;
+
+    for (i = 0; i <= nthreads; ++i) {
+        workers[i].C = C;
+        workers[i].id = i;
+        workers[i].errors = 0;
+        pthread_create(&threads[i], NULL, i < nthreads ? count_keys : churn_keys,
+                       &workers[i]);
+    }
+    for (i = 0; i <= nthreads; ++i) {
+        pthread_join(threads[i], NULL);
+        if (workers[i].errors) {
+            fprintf(stderr, "[error] %zu wrong results in thread %zu\n",
+                    workers[i].errors, i);
+        }
+    }
+    hattrie_combining_free(C);
+
+    /* every thread added its share to every key, duplicates added up */
+    str_map* M = str_map_create();
+    for (i = 0; i < nthreads; ++i) {
+        for (j = i; j < n + i; j += 7) {
+            const char* x = xs[j % n];
+            size_t len = strlen(x);
+            str_map_set(M, x, len, str_map_get(M, x, len) + rounds);
+        }
+    }
+    char x[32];
+    for (i = 0; i < 5000; ++i) {
+        snprintf(x, sizeof(x), "\x7f%zu", i);
+        hattrie_del(T, x, strlen(x));
+    }
+    check_trie(T, M, "concurrent updates");
+
+    str_map_destroy(M);
+    hattrie_free(T);
+    fprintf(stderr, "done.\n");
+}
+
+
+int main()
+{
+    setup();
+    test_single();
+    test_threads();
+    teardown();
+
+    return 0;
+}
@@ -0,0 +1,203 @@
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+
+#include "../src/hat-trie.hpp"
+
+/* Short keys over a small alphabet, so that many of them end on trie nodes. */
+std::string randstr(size_t len)
+{
+    std::string x(len, '\0');
+    for (size_t i = 0; i < len; ++i) x[i] = 'a' + rand() % 8;
+    return x;
+}
+
+const size_t n = 200000;  // number of insertions
+const size_t m_high = 10; // maximum length of each string
+
+typedef std::map<std::string, int> ref_map;
+
+
+/* The trie holds the same keys and values, in the same order, as the map. */
+void check_equal(const hat_trie<int>& T, const ref_map& M, const char* what)
+{
+    if (T.size() != M.size()) {
+        fprintf(stderr, "[error] %zu keys after %s, expected %zu\n",
+                T.size(), what, M.size());
+    }
+
+    ref_map::const_iterator j = M.begin();
+    for (auto [key, val] : T) {
+        if (j == M.end() || key != j->first || val != j->second) {
+            fprintf(stderr, "[error] wrong key or value after %s\n", what);
+            return;
+        }
+        ++j;
+    }
+    if (j != M.end()) fprintf(stderr, "[error] keys missing after %s\n", what);
+}
+
+
+void test_insert(hat_trie<int>& T, ref_map& M)
+{
+    fprintf(stderr, "inserting %zu keys ... ", n);
+
+    for (size_t i = 0; i < n; ++i) {
+        std::string key = randstr(rand() % (m_high + 1));
+        if (i % 3 == 0) {
+            auto [it, inserted] = T.try_emplace(key, (int) i);
+            bool absent = M.find(key) == M.end();
+            if (inserted != absent || it->first != key) {
+                fprintf(stderr, "[error] wrong result of try_emplace\n");
+            }
+            if (absent) M[key] = (int) i;
+        }
+        else {
+            T[key] += 1;
+            M[key] += 1;
+        }
+    }
+    check_equal(T, M, "inserting");
+
+    fprintf(stderr, "done.\n");
+}
+
+
+void test_find(hat_trie<int>& T, const ref_map& M)
+{
+    fprintf(stderr, "finding keys and lower bounds ... ");
+
+    for (size_t i = 0; i < 20000; ++i) {
+        std::string key = randstr(rand() % (m_high + 2));
+        ref_map::const_iterator j = M.find(key);
+        hat_trie<int>::iterator it = T.find(key);
+        if ((j == M.end()) != (it == T.end()) || T.contains(key) != (j != M.end())) {
+            fprintf(stderr, "[error] find disagrees on '%s'\n", key.c_str());
+            continue;
+        }
+
+        /* the iterator found goes on in order */
+        if (j != M.end()) {
+            if (it->second != j->second) fprintf(stderr, "[error] wrong value found\n");
+            ++it;
+            ++j;
+            if ((j == M.end()) != (it == T.end()) ||
+                (j != M.end() && it->first != j->first)) {
+                fprintf(stderr, "[error] wrong key after '%s'\n", key.c_str());
+            }
+        }
+
+        j = M.lower_bound(key);
+        hat_trie<int>::const_iterator lb = std::as_const(T).lower_bound(key);
+        if ((j == M.end()) != (lb == T.cend()) ||
+            (j != M.end() && (lb->first != j->first || lb->second != j->second))) {
+            fprintf(stderr, "[error] wrong lower bound of '%s'\n", key.c_str());
+        }
+    }
+
+    try {
+        T.at(std::string(m_high + 1, 'z'));
+        fprintf(stderr, "[error] at found an absent key\n");
+    }
+    catch (const std::out_of_range&) {}
+
+    /* STL algorithms, and copies of iterators moving on independently */
+    size_t odd = std::count_if(T.begin(), T.end(), [](auto kv) { return kv.second % 2; });
+    size_t expected = std::count_if(M.begin(), M.end(), [](auto& kv) { return kv.second % 2; });
+    if (odd != expected || (size_t) std::distance(T.begin(), T.end()) != M.size()) {
+        fprintf(stderr, "[error] wrong result of STL algorithms\n");
+    }
+
+    hat_trie<int>::iterator a = T.begin(), b = a;
+    ++a;
+    if (b != T.begin() || a == b || (++b, a != b)) {
+        fprintf(stderr, "[error] copies of iterators are not independent\n");
+    }
+
+    fprintf(stderr, "done.\n");
+}
+
+
+void test_erase(hat_trie<int>& T, ref_map& M)
+{
+    fprintf(stderr, "erasing keys ... ");
+
+    for (size_t i = 0; i < 20000; ++i) {
+        std::string key = randstr(rand() % (m_high + 1));
+        if (T.erase(key) != M.erase(key)) {
+            fprintf(stderr, "[error] wrong result of erase\n");
+        }
+    }
+
+    /* every other key of a range, through iterators */
+    hat_trie<int>::iterator it = T.lower_bound("c");
+    ref_map::iterator j = M.lower_bound("c");
+    while (it != T.end() && it->first < "e") {
+        it = T.erase(it);
+        j = M.erase(j);
+        if (it == T.end() || j == M.end()) break;
+        if (it->first != j->first) {
+            fprintf(stderr, "[error] wrong key after an erased one\n");
+            break;
+        }
+        ++it;
+        ++j;
+    }
+    check_equal(T, M, "erasing");
+
+    fprintf(stderr, "done.\n");
+}
+
+
+void test_copy_move(hat_trie<int>& T, ref_map& M)
+{
+    fprintf(stderr, "copying and moving ... ");
+
+    hat_trie<int> C(T);
+    C["copy only"] = 1;
+    check_equal(T, M, "copying");
+
+    hat_trie<int> D(std::move(C));
+    T = std::move(D);
+    M["copy only"] = 1;
+    check_equal(T, M, "moving");
+
+    /* moved-from tries are empty and usable */
+    if (!C.empty() || C.contains("copy only") || C.find("copy only") != C.end()) {
+        fprintf(stderr, "[error] moved-from trie is not empty.\n");
+    }
+    C["copy only"] = 2;
+    if (C.size() != 1 || C.at("copy only") != 2) {
+        fprintf(stderr, "[error] moved-from trie is not usable.\n");
+    }
+
+    T.clear();
+    M.clear();
+    check_equal(T, M, "clearing");
+    T[""] = 2;
+    M[""] = 2;
+    check_equal(T, M, "clearing and inserting");
+
+    fprintf(stderr, "done.\n");
+}
+
+
+int main()
+{
+    hat_trie<int> T;
+    ref_map M;
+
+    if (!T.empty() || T.contains("") || T.begin() != T.end()) {
+        fprintf(stderr, "[error] new trie is not empty\n");
+    }
+
+    test_insert(T, M);
+    test_find(T, M);
+    test_erase(T, M);
+    test_copy_move(T, M);
+
+    return 0;
+}
@@ -0,0 +1,164 @@
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "../src/dawg.h"
+#include "../src/frozen.h"
+#include "../src/hat-trie.h"
+#include "sorted_keys.h"
+
+const size_t n = 50000;   // how many unique strings
+const size_t m_high = 30; // maximum length of each string
+const size_t k = 100000;  // number of probes
+
+
+void test_dawg(dawg_t* D)
+{
+    size_t i;
+    bool found;
+    if (D->n != nx) {
+        fprintf(stderr, "[error] DAWG has %zu keys, expected %zu\n", D->n, nx);
+    }
+
+    for (i = 0; i < nx; ++i) {
+        if (dawg_search(D, xs[i], strlen(xs[i]), &found) != i || !found) {
+            fprintf(stderr, "[error] wrong rank for %s\n", xs[i]);
+        }
+    }
+
+    char x[64];
+    for (i = 0; i < k; ++i) {
+        probe(x, m_high);
+        size_t r = dawg_search(D, x, strlen(x), &found);
+        size_t expect = lower_bound(x);
+        if (r != expect ||
+            found != (expect < nx && strcmp(xs[expect], x) == 0)) {
+            fprintf(stderr, "[error] wrong rank %zu for %s, expected %zu\n",
+                    r, x, expect);
+        }
+    }
+
+    size_t len;
+    const char* key;
+    dawg_iter_t* it = dawg_iter_begin(D);
+    for (i = 0; !dawg_iter_finished(it); ++i, dawg_iter_next(it)) {
+        key = dawg_iter_key(it, &len);
+        if (i >= nx || len != strlen(xs[i]) || memcmp(key, xs[i], len) != 0 ||
+            dawg_iter_rank(it) != i) {
+            fprintf(stderr, "[error] iterated wrong key at rank %zu\n", i);
+            break;
+        }
+    }
+    dawg_iter_free(it);
+    if (i != nx) {
+        fprintf(stderr, "[error] iterated %zu keys, expected %zu\n", i, nx);
+    }
+}
+
+void build(dawg_builder_t** b, dawg_t* D)
+{
+    size_t i;
+    *b = dawg_builder_create();
+    for (i = 0; i < nx; ++i) dawg_builder_add(*b, xs[i], strlen(xs[i]));
+    dawg_builder_finish(*b, D);
+}
+
+
+void test_random()
+{
+    fprintf(stderr, "checking DAWG of random keys ... ");
+
+    xs = random_keys(n, 0, m_high);
+    nx = n;
+    sort_keys();
+
+    dawg_builder_t* b;
+    dawg_t D;
+    build(&b, &D);
+    test_dawg(&D);
+    dawg_builder_free(b);
+    free_keys();
+
+    /* empty and tiny key sets */
+    xs = malloc(3 * sizeof(char*));
+    nx = 0;
+    build(&b, &D);
+    test_dawg(&D);
+    dawg_builder_free(b);
+    xs[nx++] = strdup("");
+    build(&b, &D);
+    test_dawg(&D);
+    dawg_builder_free(b);
+    xs[nx++] = strdup("a");
+    xs[nx++] = strdup("ab");
+    build(&b, &D);
+    test_dawg(&D);
+    dawg_builder_free(b);
+    free_keys();
+
+    fprintf(stderr, "done.\n");
+}
+
+
+/* Words built from stems and a few inflections share suffixes, and should
+ * need far fewer states than a trie has nodes. */
+void test_words()
+{
+    fprintf(stderr, "checking DAWG of inflected words ... ");
+
+    static const char* suffixes[] = {
+        "", "s", "ed", "ing", "er", "ers", "ness", "ly", "able", "ment"
+    };
+    const size_t nsuffixes = sizeof(suffixes) / sizeof(suffixes[0]);
+    char stem[16], x[64];
+
+    xs = malloc(n * sizeof(char*));
+    nx = 0;
+    while (nx + nsuffixes <= n) {
+        size_t j, len = 3 + rand() % 6;
+        for (j = 0; j < len; ++j) stem[j] = 'a' + rand() % 26;
+        stem[len] = '\0';
+        for (j = 0; j < nsuffixes; ++j) {
+            if (rand() % 4 == 0) continue;
+            snprintf(x, sizeof(x), "%s%s", stem, suffixes[j]);
+            xs[nx++] = strdup(x);
+        }
+    }
+    sort_keys();
+
+    /* trie nodes are the distinct prefixes */
+    size_t i, nodes = 1;
+    for (i = 0; i < nx; ++i) {
+        size_t c = 0;
+        if (i > 0) while (xs[i - 1][c] && xs[i - 1][c] == xs[i][c]) ++c;
+        nodes += strlen(xs[i]) - c;
+    }
+
+    dawg_builder_t* b;
+    dawg_t D;
+    build(&b, &D);
+    test_dawg(&D);
+    if (4 * D.nstates > nodes) {
+        fprintf(stderr, "[error] DAWG has %zu states, trie %zu nodes\n",
+                D.nstates, nodes);
+    }
+    fprintf(stderr, "%zu states for %zu trie nodes ... ", D.nstates, nodes);
+    dawg_builder_free(b);
+
+    check_frozen(hattrie_freeze_dawg, 3, k, m_high);
+
+    free_keys();
+    fprintf(stderr, "done.\n");
+}
+
+
+int main()
+{
+    test_random();
+    test_words();
+
+    return 0;
+}
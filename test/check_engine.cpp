@@ -0,0 +1,135 @@
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+#include "../src/hat-trie-engine.hpp"
+
+/* Random keys over the bytes lo to hi. */
+std::string randstr(size_t len, unsigned char lo, unsigned char hi)
+{
+    std::string x(len, '\0');
+    for (size_t i = 0; i < len; ++i) x[i] = (char) (lo + rand() % (hi - lo + 1));
+    return x;
+}
+
+/* FNV-1a, to check that the hash can be replaced. */
+struct fnv_hash
+{
+    uint32_t operator()(const char* key, size_t len) const
+    {
+        uint32_t h = 2166136261u;
+        for (size_t i = 0; i < len; ++i) {
+            h ^= (unsigned char) key[i];
+            h *= 16777619u;
+        }
+        return h;
+    }
+};
+
+
+/* Insert, look up and delete random keys, checking the trie against a map
+ * after every phase. */
+template <typename Trie, typename Value>
+void check_engine(const char* what, size_t n, size_t m_high,
+                  unsigned char lo, unsigned char hi)
+{
+    fprintf(stderr, "checking %s with %zu keys ... ", what, n);
+
+    Trie T;
+    std::map<std::string, Value> M;
+    size_t i;
+
+    auto check_equal = [&](const char* phase) {
+        if (T.size() != M.size()) {
+            fprintf(stderr, "[error] %zu keys after %s, expected %zu\n",
+                    T.size(), phase, M.size());
+        }
+        auto j = M.begin();
+        bool ok = true;
+        T.for_each([&](std::string_view key, Value& val) {
+            if (ok && (j == M.end() || key != j->first || val != j->second)) {
+                fprintf(stderr, "[error] wrong key or value after %s\n", phase);
+                ok = false;
+            }
+            if (j != M.end()) ++j;
+        });
+        if (ok && j != M.end()) fprintf(stderr, "[error] keys missing after %s\n", phase);
+    };
+
+    for (i = 0; i < n; ++i) {
+        std::string key = randstr(rand() % (m_high + 1), lo, hi);
+        T[key] += (Value) 1;
+        M[key] += (Value) 1;
+    }
+    check_equal("inserting");
+
+    for (i = 0; i < n; ++i) {
+        std::string key = randstr(rand() % (m_high + 2), lo, hi);
+        auto j = M.find(key);
+        Value* val = T.find(key);
+        if ((val == nullptr) != (j == M.end()) || (val && *val != j->second)) {
+            fprintf(stderr, "[error] find disagrees on a key\n");
+        }
+    }
+
+    for (i = 0; i < n / 2; ++i) {
+        std::string key = randstr(rand() % (m_high + 1), lo, hi);
+        if (T.erase(key) != (M.erase(key) == 1)) {
+            fprintf(stderr, "[error] wrong result of erase\n");
+        }
+    }
+    check_equal("erasing");
+
+    /* keys with a byte outside the alphabet are rejected and not found */
+    if (lo > 0x00 || hi < 0xff) {
+        char out = (char) (lo > 0x00 ? lo - 1 : hi + 1);
+        for (i = 0; i < 100; ++i) {
+            std::string key = randstr(rand() % (m_high + 1), lo, hi);
+            key.insert(rand() % (key.size() + 1), 1, out);
+            bool thrown = false;
+            try {
+                T[key] += (Value) 1;
+            } catch (const std::invalid_argument&) {
+                thrown = true;
+            }
+            if (!thrown || T.find(key) != nullptr || T.erase(key)) {
+                fprintf(stderr, "[error] accepted a key outside the alphabet\n");
+            }
+        }
+        check_equal("keys outside the alphabet");
+    }
+
+    /* keys erased and inserted again start at zero */
+    for (i = 0; i < n / 4; ++i) {
+        std::string key = randstr(rand() % (m_high + 1), lo, hi);
+        T[key] += (Value) 2;
+        M[key] += (Value) 2;
+    }
+    check_equal("inserting again");
+
+    fprintf(stderr, "done.\n");
+}
+
+
+int main()
+{
+    /* as the C library is built */
+    check_engine<hat_trie_engine<>, value_t>("bytes", 200000, 20, 0x00, 0xff);
+
+    /* small buckets and a small alphabet: many bursts and a deep trie */
+    check_engine<hat_trie_engine<uint32_t, range_alphabet<'a', 'h'>, 64>, uint32_t>(
+        "'a' to 'h', buckets of 64", 200000, 10, 'a', 'h');
+
+    /* a single symbol, pure buckets all the way down */
+    check_engine<hat_trie_engine<uint16_t, range_alphabet<'x', 'x'>, 4>, uint16_t>(
+        "one symbol, buckets of 4", 5000, 200, 'x', 'x');
+
+    check_engine<hat_trie_engine<double, ascii_alphabet, 1024, fnv_hash>, double>(
+        "ASCII, FNV-1a, buckets of 1024", 200000, 30, 0x00, 0x7f);
+
+    return 0;
+}
@@ -0,0 +1,164 @@
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "../src/fcbucket.h"
+#include "sorted_keys.h"
+
+const size_t n = 50000;   // how many unique strings
+const size_t m_low  = 0;  // minimum length of each string
+const size_t m_high = 30; // maximum length of each string
+const size_t k = 100000;  // number of probes
+
+
+void test_bucket(unsigned flags)
+{
+    fprintf(stderr, "checking %zu front-coded keys (flags %u) ... ", nx, flags);
+
+    fcbucket_builder_t* w = fcbucket_builder_create(flags);
+    size_t i;
+    for (i = 0; i < nx; ++i) {
+        fcbucket_builder_add(w, xs[i], strlen(xs[i]), i * 7);
+    }
+    fcbucket_t B;
+    fcbucket_builder_view(w, &B);
+    if (B.n != nx) {
+        fprintf(stderr, "[error] bucket has %zu keys, expected %zu\n", B.n, nx);
+    }
+
+    /* present keys */
+    value_t v;
+    for (i = 0; i < nx; ++i) {
+        if (!fcbucket_get(&B, xs[i], strlen(xs[i]), &v) || v != i * 7) {
+            fprintf(stderr, "[error] wrong value for %s\n", xs[i]);
+        }
+        if (i % 97 == 0 && fcbucket_value(&B, i) != i * 7) {
+            fprintf(stderr, "[error] wrong value at rank %zu\n", i);
+        }
+        if (!fcbucket_equal(&B, i, xs[i], strlen(xs[i])) ||
+            (i > 0 && fcbucket_equal(&B, i, xs[i - 1], strlen(xs[i - 1])))) {
+            fprintf(stderr, "[error] wrong comparison at rank %zu\n", i);
+        }
+    }
+
+    /* random probes, mostly absent */
+    char x[64];
+    bool found;
+    for (i = 0; i < k; ++i) {
+        size_t len = rand() % m_high;
+        if (i % 3 == 0 && nx > 0) {
+            /* extend or cut a stored key, to hit shared prefixes */
+            const char* y = xs[rand() % nx];
+            size_t ylen = strlen(y);
+            len = ylen > 0 ? rand() % (ylen + 2) : 1;
+            if (len > ylen) {
+                memcpy(x, y, ylen);
+                x[ylen] = '\x20';
+                x[len] = '\0';
+            } else {
+                memcpy(x, y, len);
+                x[len] = '\0';
+            }
+        } else {
+            randstr(x, len);
+        }
+        len = strlen(x);
+        size_t r = fcbucket_search(&B, x, len, &found);
+        size_t expect = lower_bound(x);
+        if (r != expect ||
+            found != (expect < nx && strcmp(xs[expect], x) == 0)) {
+            fprintf(stderr, "[error] wrong rank %zu for %s, expected %zu\n",
+                    r, x, expect);
+        }
+    }
+
+    /* iteration */
+    size_t len;
+    const char* key;
+    fcbucket_iter_t* it = fcbucket_iter_begin(&B);
+    for (i = 0; !fcbucket_iter_finished(it); ++i, fcbucket_iter_next(it)) {
+        key = fcbucket_iter_key(it, &len);
+        if (i >= nx || len != strlen(xs[i]) || memcmp(key, xs[i], len) != 0 ||
+            fcbucket_iter_val(it) != i * 7) {
+            fprintf(stderr, "[error] iterated wrong key at rank %zu\n", i);
+            break;
+        }
+    }
+    fcbucket_iter_free(it);
+    if (i != nx) {
+        fprintf(stderr, "[error] iterated %zu keys, expected %zu\n", i, nx);
+    }
+
+    fcbucket_builder_free(w);
+    fprintf(stderr, "done.\n");
+}
+
+
+void test_random()
+{
+    xs = random_keys(n, m_low, m_high);
+    nx = n;
+    sort_keys();
+    test_bucket(0);
+    test_bucket(FCBUCKET_VARINT);
+    free_keys();
+
+    /* empty and tiny buckets */
+    xs = malloc(2 * sizeof(char*));
+    nx = 0;
+    test_bucket(0);
+    xs[nx++] = strdup("");
+    test_bucket(FCBUCKET_VARINT);
+    xs[nx++] = strdup("a");
+    test_bucket(0);
+    free_keys();
+}
+
+
+/* URL-like keys share long prefixes, and should take well under half the
+ * space of keys stored in full with an offset and a value each. */
+void test_compression()
+{
+    fprintf(stderr, "compressing URL keys ... ");
+
+    char x[128];
+    size_t i, raw = 0;
+    xs = malloc(n * sizeof(char*));
+    for (nx = 0; nx < n; ++nx) {
+        snprintf(x, sizeof(x), "http://www.site%03d.example.com/%s/item%06d.html",
+                 rand() % 200, rand() % 2 ? "catalog/books" : "blog/archive",
+                 rand() % 1000000);
+        xs[nx] = strdup(x);
+    }
+    sort_keys();
+
+    fcbucket_builder_t* w = fcbucket_builder_create(0);
+    for (i = 0; i < nx; ++i) {
+        raw += strlen(xs[i]) + sizeof(uint64_t) + sizeof(value_t);
+        fcbucket_builder_add(w, xs[i], strlen(xs[i]), i);
+    }
+    fcbucket_t B;
+    fcbucket_builder_view(w, &B);
+    size_t bytes = fcbucket_bytes(&B);
+    if (2 * bytes > raw) {
+        fprintf(stderr, "[error] front coding took %zu bytes, %zu in full\n",
+                bytes, raw);
+    }
+    fprintf(stderr, "%.2fx ... ", (double) raw / (double) bytes);
+    fcbucket_builder_free(w);
+
+    free_keys();
+    fprintf(stderr, "done.\n");
+}
+
+
+int main()
+{
+    test_random();
+    test_compression();
+
+    return 0;
+}
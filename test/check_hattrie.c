@@ -4,6 +4,7 @@
 
 #include "str_map.h"
 #include "../src/hat-trie.h"
+#include "../src/changelog.h"
 
 /* Simple random string generation. */
 void randstr(char* x, size_t len)
@@ -226,6 +227,198 @@ void test_hattrie_sorted_iteration()
 }
 
 
+void test_hattrie_iter_fill()
+{
+    fprintf(stderr, "filling buffers with %zu keys ... \n", M->m);
+
+    value_t buf[512];
+    char* prev = malloc(m_high + 1);
+    size_t prev_len = 0, total = 0, count, used, j, len;
+    const char* key;
+
+    hattrie_iter_t* it = hattrie_iter_begin(T, true);
+
+    /* too small for any record */
+    if (hattrie_iter_fill(it, buf, 8, &count) != 0 || count != 0) {
+        fprintf(stderr, "[error] record written to a buffer too small for it.\n");
+    }
+
+    while (!hattrie_iter_finished(it)) {
+        used = hattrie_iter_fill(it, buf, sizeof(buf), &count);
+        if (count == 0 || used > sizeof(buf)) {
+            fprintf(stderr, "[error] filled %zu records in %zu bytes.\n", count, used);
+            break;
+        }
+
+        const void* rec = buf;
+        for (j = 0; j < count; ++j) {
+            key = hattrie_record_key(rec, &len);
+            if (total > 0 && cmpkey(prev, prev_len, key, len) >= 0) {
+                fprintf(stderr, "[error] records are not correctly ordered.\n");
+            }
+            if (hattrie_record_val(rec) != str_map_get(M, key, len)) {
+                fprintf(stderr, "[error] incorrect value in record.\n");
+            }
+            memcpy(prev, key, len);
+            prev_len = len;
+            ++total;
+            rec = hattrie_record_next(rec);
+        }
+        if ((const char*) rec != (const char*) buf + used) {
+            fprintf(stderr, "[error] records do not add up to %zu bytes.\n", used);
+        }
+    }
+    hattrie_iter_free(it);
+    free(prev);
+
+    if (total != M->m) {
+        fprintf(stderr, "[error] filled %zu records, expected %zu\n", total, M->m);
+    }
+
+    fprintf(stderr, "done.\n");
+}
+
+
+typedef struct walk_check_t_
+{
+    char* key;        // previous key
+    size_t len;
+    size_t count;
+    size_t stop;      // stop after this many keys
+    bool sorted;
+    bool wrong_order;
+    bool wrong_val;
+} walk_check_t;
+
+static int walk_visit(const char* prefix, size_t plen, const char* suffix,
+                      size_t slen, value_t* val, void* ctx)
+{
+    walk_check_t* w = ctx;
+    char* key = malloc(plen + slen + 1);
+    memcpy(key, prefix, plen);
+    memcpy(key + plen, suffix, slen);
+
+    if (w->sorted && w->count > 0 && cmpkey(w->key, w->len, key, plen + slen) >= 0) {
+        w->wrong_order = true;
+    }
+    if (*val != str_map_get(M, key, plen + slen)) w->wrong_val = true;
+
+    free(w->key);
+    w->key = key;
+    w->len = plen + slen;
+    return ++w->count == w->stop;
+}
+
+void test_hattrie_walk_all()
+{
+    fprintf(stderr, "walking through %zu keys ... \n", M->m);
+
+    int sorted;
+    for (sorted = 0; sorted <= 1; ++sorted) {
+        walk_check_t w;
+        memset(&w, 0, sizeof(w));
+        w.sorted = sorted;
+        if (hattrie_walk_all(T, sorted, walk_visit, &w) != 0 || w.count != M->m) {
+            fprintf(stderr, "[error] walk visited %zu keys, expected %zu\n",
+                    w.count, M->m);
+        }
+        if (w.wrong_order) fprintf(stderr, "[error] walk is not correctly ordered.\n");
+        if (w.wrong_val)   fprintf(stderr, "[error] incorrect value in walk.\n");
+        free(w.key);
+
+        /* stopped by the callback */
+        memset(&w, 0, sizeof(w));
+        w.stop = M->m / 2;
+        if (hattrie_walk_all(T, sorted, walk_visit, &w) != 1 || w.count != w.stop) {
+            fprintf(stderr, "[error] walk did not stop after %zu keys\n", w.stop);
+        }
+        free(w.key);
+    }
+
+    fprintf(stderr, "done.\n");
+}
+
+
+void test_hattrie_lower_bound()
+{
+    fprintf(stderr, "finding lower bounds among %zu keys ... \n", M->m);
+
+    if (hattrie_size(T) != M->m) {
+        fprintf(stderr, "[error] size is %zu, expected %zu\n", hattrie_size(T), M->m);
+    }
+
+    /* all keys in order */
+    char** keys = malloc(M->m * sizeof(char*));
+    size_t* lens = malloc(M->m * sizeof(size_t));
+    size_t count = 0, len, i, j, lo, hi, mid, plen;
+    const char* key;
+    hattrie_iter_t* it = hattrie_iter_begin(T, true);
+    for (; !hattrie_iter_finished(it) && count < M->m; hattrie_iter_next(it), ++count) {
+        key = hattrie_iter_key(it, &len);
+        keys[count] = malloc(len + 1);
+        memcpy(keys[count], key, len);
+        lens[count] = len;
+    }
+    hattrie_iter_free(it);
+
+    char* probe = malloc(m_high + 2);
+    for (i = 0; i < 2000; ++i) {
+        /* a key, a prefix of it, or a key just past it */
+        j = rand() % count;
+        plen = lens[j];
+        memcpy(probe, keys[j], plen);
+        if (i % 3 == 1) plen = rand() % 4;
+        if (i % 3 == 2) probe[plen++] = '\0';
+
+        lo = 0;
+        hi = count;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (cmpkey(keys[mid], lens[mid], probe, plen) < 0) lo = mid + 1;
+            else hi = mid;
+        }
+
+        it = hattrie_iter_lower_bound(T, probe, plen);
+        if (lo == count) {
+            if (!hattrie_iter_finished(it)) {
+                fprintf(stderr, "[error] lower bound past the last key is not the end.\n");
+            }
+            hattrie_iter_free(it);
+            continue;
+        }
+
+        /* copies move on independently */
+        hattrie_iter_t* dup = hattrie_iter_dup(it);
+        hattrie_iter_next(it);
+        key = hattrie_iter_finished(dup) ? NULL : hattrie_iter_key(dup, &len);
+        if (key == NULL || cmpkey(key, len, keys[lo], lens[lo]) != 0 ||
+            *hattrie_iter_val(dup) != str_map_get(M, key, len)) {
+            fprintf(stderr, "[error] wrong lower bound.\n");
+        }
+        hattrie_iter_next(dup);
+        if (lo + 1 < count) {
+            key = hattrie_iter_key(it, &len);
+            if (cmpkey(key, len, keys[lo + 1], lens[lo + 1]) != 0 ||
+                hattrie_iter_val(it) != hattrie_iter_val(dup)) {
+                fprintf(stderr, "[error] wrong key after the lower bound.\n");
+            }
+        }
+        else if (!hattrie_iter_finished(it) || !hattrie_iter_finished(dup)) {
+            fprintf(stderr, "[error] iteration goes on past the last key.\n");
+        }
+        hattrie_iter_free(dup);
+        hattrie_iter_free(it);
+    }
+
+    for (i = 0; i < count; ++i) free(keys[i]);
+    free(keys);
+    free(lens);
+    free(probe);
+
+    fprintf(stderr, "done.\n");
+}
+
+
 void test_hattrie_find_prev()
 {
     fprintf(stderr, "finding previous for %zu keys ... \n", k);
@@ -278,6 +471,922 @@ void test_hattrie_find_prev()
 }
 
 
+static void check_setop(hattrie_setop_t* it, const str_map* MA, const str_map* MB,
+                        char op, size_t expected)
+{
+    size_t count = 0, len = 0, prev_len = 0;
+    const char* key;
+    char* prev = NULL;
+    value_t *va, *vb;
+
+    while (!hattrie_setop_finished(it)) {
+        key = hattrie_setop_key(it, &len);
+        hattrie_setop_val(it, &va, &vb);
+
+        if (prev && cmpkey(prev, prev_len, key, len) >= 0) {
+            fprintf(stderr, "[error] set operation is not correctly ordered.\n");
+        }
+        prev = realloc(prev, len + 1);
+        memcpy(prev, key, len);
+        prev_len = len;
+
+        value_t u = str_map_get(MA, key, len);
+        value_t v = str_map_get(MB, key, len);
+        if ((va == NULL) != (u == 0) || (va && *va != u) ||
+            (vb == NULL) != (v == 0) || (vb && *vb != v)) {
+            fprintf(stderr, "[error] set operation value mismatch.\n");
+        }
+        if ((op == 'i' && !(va && vb)) || (op == 'd' && !(va && !vb)) ||
+            (op == 'u' && !(va || vb))) {
+            fprintf(stderr, "[error] set operation produced wrong key.\n");
+        }
+
+        ++count;
+        hattrie_setop_next(it);
+    }
+
+    if (count != expected) {
+        fprintf(stderr, "[error] set operation produced %zu keys, expected %zu\n",
+                count, expected);
+    }
+
+    free(prev);
+    hattrie_setop_free(it);
+}
+
+
+void test_hattrie_setops()
+{
+    fprintf(stderr, "checking set operations ... \n");
+
+    hattrie_t* B = hattrie_create();
+    str_map* MB = str_map_create();
+
+    /* overlap with T, prefixes give values on trie nodes and empty suffixes */
+    size_t i, j, len;
+    for (j = 0; j < k / 2; ++j) {
+        i = rand() % n;
+        len = strlen(xs[i]);
+        if (rand() % 2) len = 1 + rand() % len;
+        value_t v = 1 + rand() % 1000;
+        *hattrie_get(B, xs[i], len) = v;
+        str_map_set(MB, xs[i], len, v);
+    }
+
+    size_t na = 0, nb = 0, both = 0;
+    hattrie_iter_t* it = hattrie_iter_begin(T, false);
+    while (!hattrie_iter_finished(it)) {
+        const char* key = hattrie_iter_key(it, &len);
+        if (str_map_get(MB, key, len)) ++both;
+        ++na;
+        hattrie_iter_next(it);
+    }
+    hattrie_iter_free(it);
+    nb = MB->m;
+
+    check_setop(hattrie_intersect(T, B), M, MB, 'i', both);
+    check_setop(hattrie_difference(T, B), M, MB, 'd', na - both);
+    check_setop(hattrie_difference(B, T), MB, M, 'd', nb - both);
+    check_setop(hattrie_union(T, B), M, MB, 'u', na + nb - both);
+
+    hattrie_free(B);
+    str_map_destroy(MB);
+
+    fprintf(stderr, "done.\n");
+}
+
+
+/* check that all keys of a trie are on one side of the split key */
+static size_t check_split_side(hattrie_t* S, const char* skey, size_t slen,
+                               int side)
+{
+    size_t count = 0, len;
+    const char* key;
+    hattrie_iter_t* i = hattrie_iter_begin(S, false);
+    while (!hattrie_iter_finished(i)) {
+        key = hattrie_iter_key(i, &len);
+        int c = cmpkey(key, len, skey, slen);
+        if ((side < 0 && c >= 0) || (side > 0 && c < 0)) {
+            fprintf(stderr, "[error] key on wrong side of split.\n");
+        }
+        if (*hattrie_iter_val(i) != str_map_get(M, key, len)) {
+            fprintf(stderr, "[error] incorrect value after split.\n");
+        }
+        ++count;
+        hattrie_iter_next(i);
+    }
+    hattrie_iter_free(i);
+    return count;
+}
+
+
+void test_hattrie_split_at()
+{
+    fprintf(stderr, "splitting trie ... \n");
+
+    /* split in the middle of a key, so the path crosses trie nodes */
+    const char* skey = xs[rand() % n];
+    size_t slen = strlen(skey) / 2;
+
+    hattrie_t* R = NULL;
+    hattrie_split_at(T, skey, slen, &R);
+    size_t left  = check_split_side(T, skey, slen, -1);
+    size_t right = check_split_side(R, skey, slen, 1);
+    if (left + right != M->m || left == 0 || right == 0) {
+        fprintf(stderr, "[error] split produced %zu + %zu keys, expected %zu\n",
+                left, right, M->m);
+    }
+
+    /* both halves remain usable */
+    size_t j;
+    for (j = 0; j < n; ++j) {
+        size_t len = strlen(xs[j]);
+        value_t* u = cmpkey(xs[j], len, skey, slen) < 0 ?
+                     hattrie_tryget(T, xs[j], len) : hattrie_tryget(R, xs[j], len);
+        value_t v = str_map_get(M, xs[j], len);
+        if ((u == NULL) != (v == 0) || (u && *u != v)) {
+            fprintf(stderr, "[error] lookup mismatch after split.\n");
+        }
+    }
+    *hattrie_get(R, skey, slen) = 1;
+    str_map_set(M, skey, slen, 1);
+
+    /* empty split key moves everything */
+    hattrie_t* R2 = NULL;
+    hattrie_split_at(R, skey, 0, &R2);
+    if (check_split_side(R, skey, 0, -1) != 0 ||
+        check_split_side(R2, skey, 0, 1) != right + 1) {
+        fprintf(stderr, "[error] split at empty key did not move all keys.\n");
+    }
+
+    hattrie_free(R);
+    hattrie_free(R2);
+
+    fprintf(stderr, "done.\n");
+}
+
+
+void test_hattrie_join()
+{
+    fprintf(stderr, "joining tries ... \n");
+
+    /* split at one-byte keys, then put the parts back together */
+    const char bounds[] = { '+', 'A', 'B', 'a', 'q' };
+    const size_t nb = sizeof(bounds);
+    hattrie_t* parts[sizeof(bounds)];
+    size_t j;
+    for (j = nb; j-- > 0;) hattrie_split_at(T, &bounds[j], 1, &parts[j]);
+
+    /* overlapping parts are refused */
+    if (hattrie_join(parts[0], parts[0]) != -1 ||
+        hattrie_join(parts[2], parts[1]) != -1) {
+        fprintf(stderr, "[error] joined overlapping tries.\n");
+    }
+
+    for (j = 0; j < nb; ++j) {
+        if (hattrie_join(T, parts[j]) != 0) {
+            fprintf(stderr, "[error] join of part %zu failed.\n", j);
+        }
+    }
+
+    /* the joined trie keeps growing and splitting */
+    for (j = 0; j < k; ++j) {
+        size_t i = rand() % n;
+        size_t len = strlen(xs[i]);
+        value_t v = 1 + str_map_get(M, xs[i], len);
+        str_map_set(M, xs[i], len, v);
+        *hattrie_get(T, xs[i], len) = v;
+    }
+
+    /* into an empty trie */
+    hattrie_t* E = hattrie_create();
+    if (hattrie_join(E, T) != 0) {
+        fprintf(stderr, "[error] join into an empty trie failed.\n");
+    }
+    T = E;
+
+    /* digests of a part that did not track them are recomputed once joined */
+    hattrie_digest_enable(T, true);
+    hattrie_digest(T, NULL, 0);
+    hattrie_t* D;
+    hattrie_split_at(T, "q", 1, &D);
+    hattrie_iter_t* it = hattrie_iter_begin(D, false);
+    for (; !hattrie_iter_finished(it); hattrie_iter_next(it)) {
+        size_t len;
+        const char* key = hattrie_iter_key(it, &len);
+        str_map_set(M, key, len, ++*hattrie_iter_val(it));
+    }
+    hattrie_iter_free(it);
+    hattrie_join(T, D);
+
+    hattrie_t* B = hattrie_create();
+    hattrie_digest_enable(B, true);
+    it = hattrie_iter_begin(T, false);
+    for (; !hattrie_iter_finished(it); hattrie_iter_next(it)) {
+        size_t len;
+        const char* key = hattrie_iter_key(it, &len);
+        hattrie_set(B, key, len, *hattrie_iter_val(it));
+    }
+    hattrie_iter_free(it);
+    if (hattrie_digest(T, NULL, 0) != hattrie_digest(B, NULL, 0)) {
+        fprintf(stderr, "[error] joined trie kept stale digests.\n");
+    }
+    hattrie_free(B);
+    hattrie_digest_enable(T, false);
+
+    fprintf(stderr, "done.\n");
+}
+
+
+void test_hattrie_digest()
+{
+    fprintf(stderr, "checking digests ... \n");
+
+    hattrie_digest_enable(T, true);
+    hattrie_t* B = hattrie_dup(T);
+    hattrie_digest_enable(B, true);
+
+    if (hattrie_digest(T, NULL, 0) != hattrie_digest(B, NULL, 0)) {
+        fprintf(stderr, "[error] digests of equal tries differ.\n");
+    }
+    hattrie_setop_t* it = hattrie_diff(T, B);
+    if (!hattrie_setop_finished(it)) {
+        fprintf(stderr, "[error] equal tries reported as different.\n");
+    }
+    hattrie_setop_free(it);
+
+    /* change a few values, delete and insert some keys */
+    str_map* D = str_map_create();
+    size_t i, j, len;
+    for (j = 0; j < 100; ++j) {
+        i = rand() % n;
+        len = strlen(xs[i]);
+        switch (j % 3) {
+        case 0: *hattrie_get(B, xs[i], len) += 1; break;
+        case 1: if (hattrie_del(B, xs[i], len) != 0) continue; break;
+        case 2: *hattrie_get(B, xs[i], len / 2) = 1; len /= 2; break;
+        }
+        str_map_set(D, xs[i], len, 1);
+    }
+
+    /* reported keys must differ and only keys that were touched */
+    size_t count = 0;
+    const char* key;
+    value_t *va, *vb;
+    it = hattrie_diff(T, B);
+    while (!hattrie_setop_finished(it)) {
+        key = hattrie_setop_key(it, &len);
+        hattrie_setop_val(it, &va, &vb);
+        if (!str_map_get(D, key, len) || (va && vb && *va == *vb)) {
+            fprintf(stderr, "[error] diff reported unchanged key.\n");
+        }
+        ++count;
+        hattrie_setop_next(it);
+    }
+    hattrie_setop_free(it);
+
+    /* count changed keys by lookup */
+    size_t expected = 0;
+    for (j = 0; j < D->n; ++j) {
+        str_map_pair* p;
+        for (p = D->A[j]; p; p = p->next) {
+            va = hattrie_tryget(T, p->key, p->keylen);
+            vb = hattrie_tryget(B, p->key, p->keylen);
+            if ((va == NULL) != (vb == NULL) || (va && *va != *vb)) ++expected;
+        }
+    }
+    if (count != expected || count == 0) {
+        fprintf(stderr, "[error] diff reported %zu keys, expected %zu\n",
+                count, expected);
+    }
+
+    /* prefix digests match where nothing changed */
+    for (i = 0; i < 100; ++i) {
+        const char* pfx = xs[rand() % n];
+        bool changed = false;
+        for (j = 0; j < D->n; ++j) {
+            str_map_pair* p;
+            for (p = D->A[j]; p; p = p->next) {
+                if (memcmp(p->key, pfx, 2) == 0) changed = true;
+            }
+        }
+        if ((hattrie_digest(T, pfx, 2) != hattrie_digest(B, pfx, 2)) != changed) {
+            fprintf(stderr, "[error] prefix digests do not match changes.\n");
+        }
+    }
+
+    /* a write through a value pointer found in the hot-key cache */
+    hattrie_hot_cache_enable(B, 256);
+    for (i = 0; hattrie_tryget(B, xs[i], strlen(xs[i])) == NULL; ++i);
+    len = strlen(xs[i]);
+    uint64_t d = hattrie_digest(B, NULL, 0);
+    hattrie_tryget(B, xs[i], len);
+    *hattrie_get(B, xs[i], len) += 1;
+    if (hattrie_digest(B, NULL, 0) == d) {
+        fprintf(stderr, "[error] digest missed a write to a cached key.\n");
+    }
+
+    str_map_destroy(D);
+    hattrie_free(B);
+
+    fprintf(stderr, "done.\n");
+}
+
+
+typedef struct
+{
+    unsigned char* buf;
+    size_t len;
+    size_t batches;
+} log_buffer;
+
+static void log_buffer_sink(const unsigned char* batch, size_t len, void* ctx)
+{
+    log_buffer* b = ctx;
+    b->buf = realloc(b->buf, b->len + len);
+    memcpy(b->buf + b->len, batch, len);
+    b->len += len;
+    ++b->batches;
+}
+
+
+void test_hattrie_changelog()
+{
+    fprintf(stderr, "checking change log replication ... \n");
+
+    log_buffer lb = { NULL, 0, 0 };
+    changelog_t* log = changelog_create(4096, log_buffer_sink, &lb);
+    hattrie_t* L = hattrie_create();
+    hattrie_set_log(L, log);
+
+    size_t i, j, len;
+    for (j = 0; j < k; ++j) {
+        i = rand() % n;
+        len = strlen(xs[i]);
+        switch (rand() % 5) {
+        case 0:  hattrie_get(L, xs[i], len); break;
+        case 1:  hattrie_del(L, xs[i], len); break;
+        case 2:  *hattrie_get(L, xs[i], len) += 1 + rand() % 100; break;
+        default: hattrie_set(L, xs[i], len, rand()); break;
+        }
+    }
+    hattrie_set(L, "", 0, 1);
+
+    /* keys split off are deleted on the replica, and joined ones set */
+    hattrie_t* S;
+    hattrie_split_at(L, "t", 1, &S);
+    hattrie_free(S);
+    hattrie_split_at(L, "m", 1, &S);
+    hattrie_join(L, S);
+    changelog_flush(log);
+
+    /* replay batches on a replica */
+    hattrie_t* R = hattrie_create();
+    size_t off = 0;
+    uint64_t seq = 0, next;
+    while (off < lb.len) {
+        uint32_t blen;
+        memcpy(&blen, lb.buf + off, sizeof(uint32_t));
+        blen += CHANGELOG_HEADER_SIZE;
+        int r = changelog_apply(R, lb.buf + off, blen, &next);
+        if (r <= 0 || next != seq + (uint64_t) r) {
+            fprintf(stderr, "[error] failed to apply change log batch.\n");
+            break;
+        }
+        seq = next;
+        off += blen;
+    }
+    if (seq != changelog_seq(log) || lb.batches < 2) {
+        fprintf(stderr, "[error] replayed %lu records, expected %lu\n",
+                (unsigned long) seq, (unsigned long) changelog_seq(log));
+    }
+
+    hattrie_setop_t* it = hattrie_diff(L, R);
+    if (!hattrie_setop_finished(it)) {
+        fprintf(stderr, "[error] replica differs from the logged trie.\n");
+    }
+    hattrie_setop_free(it);
+
+    hattrie_free(L);
+    hattrie_free(R);
+    changelog_free(log);
+    free(lb.buf);
+
+    fprintf(stderr, "done.\n");
+}
+
+
+/* compare all stored keys to the reference map, without iterating */
+static void check_lookups(const char* what)
+{
+    size_t i, len;
+    value_t* u;
+    for (i = 0; i < n; ++i) {
+        len = strlen(xs[i]);
+        value_t v = str_map_get(M, xs[i], len);
+        u = hattrie_tryget(T, xs[i], len);
+        if ((u == NULL) != (v == 0) || (u && *u != v)) {
+            fprintf(stderr, "[error] wrong value for key %zu after %s\n", i, what);
+        }
+    }
+}
+
+
+void test_hattrie_tier()
+{
+    fprintf(stderr, "checking hot/cold tiering ... \n");
+
+    const unsigned never = 1u << 20;
+    hattrie_tier_stats_t hot, st;
+    hattrie_tier(T, 0, never, &hot);
+    if (hot.cold != 0 || hot.hot == 0) {
+        fprintf(stderr, "[error] buckets went cold without a threshold.\n");
+    }
+
+    /* everything goes cold, and stays cold while read and updated */
+    hattrie_tier(T, never, never, &st);
+    if (st.hot != 0 || st.cold != hot.hot || st.cold_bytes >= hot.hot_bytes) {
+        fprintf(stderr, "[error] tiering kept %zu hot buckets, %zu cold bytes "
+                "for %zu hot bytes\n", st.hot, st.cold_bytes, hot.hot_bytes);
+    }
+    check_lookups("compress");
+
+    size_t i, j, len;
+    value_t* u;
+    for (i = 0; i < n; i += 3) {
+        len = strlen(xs[i]);
+        if ((u = hattrie_tryget(T, xs[i], len)) == NULL) continue;
+        *hattrie_get(T, xs[i], len) += 1;
+        str_map_set(M, xs[i], len, *u);
+    }
+    check_lookups("cold update");
+
+    /* exact and predecessor lookups in cold buckets */
+    value_t* fp;
+    for (i = 0; i < n; ++i) {
+        len = strlen(xs[i]);
+        value_t v = str_map_get(M, xs[i], len);
+        int r = hattrie_find_leq(T, xs[i], len, &fp);
+        if (v != 0 && (r != 0 || *fp != v)) {
+            fprintf(stderr, "[error] hattrie_find_leq missed a cold key\n");
+        }
+        if (v == 0 && (r == 0 || (r == -1) != (fp != NULL))) {
+            fprintf(stderr, "[error] hattrie_find_leq found a deleted key\n");
+        }
+    }
+
+    /* sorted and unsorted iteration and set operations read the cold copy */
+    size_t count[3] = { 0, 0, 0 };
+    hattrie_iter_t* it;
+    for (i = 0; i < 2; ++i) {
+        it = hattrie_iter_begin(T, i == 1);
+        for (; !hattrie_iter_finished(it); hattrie_iter_next(it)) {
+            const char* key = hattrie_iter_key(it, &len);
+            if (*hattrie_iter_val(it) != str_map_get(M, key, len)) {
+                fprintf(stderr, "[error] wrong value iterating cold buckets\n");
+            }
+            ++count[i];
+        }
+        hattrie_iter_free(it);
+    }
+    for (j = 0; j < 100; ++j) {
+        i = rand() % n;
+        len = strlen(xs[i]);
+        if (str_map_get(M, xs[i], len) == 0) continue;
+        it = hattrie_iter_lower_bound(T, xs[i], len);
+        hattrie_iter_t* d = hattrie_iter_dup(it);
+        const char* a = hattrie_iter_key(it, &len);
+        if (len != strlen(xs[i]) || memcmp(a, xs[i], len) != 0) {
+            fprintf(stderr, "[error] lower bound missed a cold key\n");
+        }
+        hattrie_iter_next(it);
+        hattrie_iter_next(d);
+        bool same = hattrie_iter_finished(it) == hattrie_iter_finished(d);
+        if (same && !hattrie_iter_finished(it)) {
+            size_t dlen;
+            a = hattrie_iter_key(it, &len);
+            const char* b = hattrie_iter_key(d, &dlen);
+            same = len == dlen && memcmp(a, b, len) == 0;
+        }
+        if (!same) {
+            fprintf(stderr, "[error] copied iterator over cold keys differs\n");
+        }
+        hattrie_iter_free(d);
+        hattrie_iter_free(it);
+    }
+    hattrie_setop_t* so = hattrie_intersect(T, T);
+    for (; !hattrie_setop_finished(so); hattrie_setop_next(so)) ++count[2];
+    hattrie_setop_free(so);
+    if (count[0] != hattrie_size(T) || count[1] != count[0] ||
+        count[2] != count[0]) {
+        fprintf(stderr, "[error] iterated %zu, %zu and %zu cold keys of %zu\n",
+                count[0], count[1], count[2], hattrie_size(T));
+    }
+
+    hattrie_tier(T, 0, never, &st);
+    if (st.hot != 0) {
+        fprintf(stderr, "[error] %zu buckets expanded by lookups\n", st.hot);
+    }
+
+    /* lookups are counted, and hot buckets expanded by the next pass only */
+    hattrie_tier(T, never, 2, &st);
+    for (i = 0; i < n && hattrie_tryget(T, xs[i], strlen(xs[i])) == NULL; ++i);
+    u = i < n ? hattrie_tryget(T, xs[i], strlen(xs[i])) : NULL;
+    check_lookups("heat");
+    check_lookups("heat");
+    if (u && hattrie_tryget(T, xs[i], strlen(xs[i])) != u) {
+        fprintf(stderr, "[error] a lookup moved a cold value\n");
+    }
+    hattrie_tier(T, never, 2, &st);
+    if (st.hot == 0) {
+        fprintf(stderr, "[error] no bucket was expanded by hot lookups\n");
+    }
+
+    /* inserts and deletes expand cold buckets */
+    hattrie_tier(T, never, never, &st);
+    for (i = 0; i < n; i += 2) {
+        len = strlen(xs[i]);
+        if (i % 4 == 0) {
+            hattrie_del(T, xs[i], len);
+            str_map_del(M, xs[i], len);
+        } else {
+            *hattrie_get(T, xs[i], len) = i + 1;
+            str_map_set(M, xs[i], len, i + 1);
+        }
+    }
+    check_lookups("cold insert");
+
+    fprintf(stderr, "done.\n");
+}
+
+
+void test_hattrie_filter()
+{
+    fprintf(stderr, "checking bucket filters ... \n");
+
+    hattrie_filter_enable(T, true);
+    check_lookups("enabling filters");
+
+    /* absent keys of the same shape */
+    size_t i, len;
+    char x[600];
+    for (i = 0; i < n; ++i) {
+        randstr(x, m_low + rand() % (m_high - m_low));
+        len = strlen(x);
+        if ((hattrie_tryget(T, x, len) != NULL) != (str_map_get(M, x, len) != 0)) {
+            fprintf(stderr, "[error] filtered lookup of an absent key differs\n");
+        }
+    }
+
+    /* grow the trie: filters are doubled and inherited by split buckets */
+    char** ys = malloc(n * sizeof(char*));
+    for (i = 0; i < n; ++i) {
+        len = 1 + rand() % 20;
+        ys[i] = malloc(len + 1);
+        randstr(ys[i], len);
+        *hattrie_get(T, ys[i], len) = i + 1;
+        str_map_set(M, ys[i], len, i + 1);
+    }
+    for (i = 0; i < n; i += 3) {
+        len = strlen(ys[i]);
+        hattrie_del(T, ys[i], len);
+        str_map_del(M, ys[i], len);
+    }
+    check_lookups("inserts with filters");
+    for (i = 0; i < n; ++i) {
+        len = strlen(ys[i]);
+        value_t v = str_map_get(M, ys[i], len);
+        value_t* u = hattrie_tryget(T, ys[i], len);
+        if ((u == NULL) != (v == 0) || (u && *u != v)) {
+            fprintf(stderr, "[error] wrong value for key %zu after splits\n", i);
+        }
+    }
+
+    /* cold buckets keep their filters, new buckets are counted from a pass */
+    hattrie_tier(T, 0, 1u << 20, NULL);
+    hattrie_tier(T, 1u << 20, 1u << 20, NULL);
+    check_lookups("compressing filtered buckets");
+    hattrie_tier(T, 0, 0, NULL);
+
+    hattrie_filter_enable(T, false);
+    check_lookups("disabling filters");
+
+    for (i = 0; i < n; ++i) free(ys[i]);
+    free(ys);
+    fprintf(stderr, "done.\n");
+}
+
+
+typedef struct scan_count_t_
+{
+    size_t keys[8];   // per worker
+    size_t wrong[8];
+} scan_count_t;
+
+static void scan_visit(const char* key, size_t len, value_t* val,
+                       size_t worker, void* ctx)
+{
+    scan_count_t* count = ctx;
+    if (strlen(key) != len) ++count->wrong[worker];
+    ++count->keys[worker];
+    ++*val;
+}
+
+void test_hattrie_parallel_for_each()
+{
+    const size_t nthreads = 4;
+    fprintf(stderr, "scanning in %zu threads ... \n", nthreads);
+
+    scan_count_t count;
+    memset(&count, 0, sizeof(count));
+    hattrie_parallel_for_each(T, nthreads, scan_visit, &count);
+
+    /* every key was visited once */
+    size_t j, keys = 0, wrong = 0;
+    for (j = 0; j < nthreads; ++j) {
+        keys  += count.keys[j];
+        wrong += count.wrong[j];
+    }
+    if (keys != M->m || wrong > 0) {
+        fprintf(stderr, "[error] scan visited %zu keys, %zu of them wrong, expected %zu\n",
+                keys, wrong, M->m);
+    }
+    for (j = 0; j < n; ++j) {
+        size_t len = strlen(xs[j]);
+        value_t v = str_map_get(M, xs[j], len);
+        if (v == 0) continue;
+        value_t* u = hattrie_tryget(T, xs[j], len);
+        if (u == NULL || *u != v + 1) {
+            fprintf(stderr, "[error] value not updated once by the scan.\n");
+            break;
+        }
+        str_map_set(M, xs[j], len, v + 1);
+    }
+
+    /* one thread */
+    memset(&count, 0, sizeof(count));
+    hattrie_parallel_for_each(T, 1, scan_visit, &count);
+    if (count.keys[0] != M->m) {
+        fprintf(stderr, "[error] scan in one thread visited %zu keys, expected %zu\n",
+                count.keys[0], M->m);
+    }
+    for (j = 0; j < n; ++j) {
+        size_t len = strlen(xs[j]);
+        value_t v = str_map_get(M, xs[j], len);
+        if (v) str_map_set(M, xs[j], len, v + 1);
+    }
+
+    fprintf(stderr, "done.\n");
+}
+
+
+void test_hattrie_hot_cache()
+{
+    fprintf(stderr, "checking hot-key cache ... \n");
+
+    hattrie_hot_cache_enable(T, 256);
+    check_lookups("enabling the cache");
+    check_lookups("cached lookups");
+
+    /* writes between repeated lookups */
+    size_t i, j, len;
+    value_t* u;
+    for (j = 0; j < 20; ++j) {
+        for (i = j; i < n; i += 97) {
+            len = strlen(xs[i]);
+            if ((u = hattrie_tryget(T, xs[i], len)) == NULL) continue;
+            *hattrie_get(T, xs[i], len) += 1;
+            str_map_set(M, xs[i], len, *u);
+        }
+        i = rand() % n;
+        len = strlen(xs[i]);
+        if (j % 2) {
+            hattrie_del(T, xs[i], len);
+            str_map_del(M, xs[i], len);
+        } else {
+            *hattrie_get(T, xs[i], len) = j + 1;
+            str_map_set(M, xs[i], len, j + 1);
+        }
+    }
+    check_lookups("writes");
+
+    /* keys ending on trie nodes, and bursts */
+    char x[8];
+    for (i = 0; i < 20000; ++i) {
+        randstr(x, 1 + rand() % 3);
+        len = strlen(x);
+        *hattrie_get(T, x, len) = i + 1;
+        str_map_set(M, x, len, i + 1);
+        if (*hattrie_tryget(T, x, len) != i + 1) {
+            fprintf(stderr, "[error] stale value for a short key\n");
+        }
+    }
+    check_lookups("bursts");
+
+    /* cache hits count as lookups of their bucket for tiering */
+    hattrie_t* H = hattrie_create();
+    for (i = 0; i < 1000; ++i) *hattrie_get(H, xs[i], strlen(xs[i])) = 1;
+    hattrie_hot_cache_enable(H, 256);
+    hattrie_tier(H, 0, 1u << 20, NULL);
+    for (j = 0; j < 100; ++j) {
+        for (i = 0; i < 64; ++i) hattrie_tryget(H, xs[i], strlen(xs[i]));
+    }
+    hattrie_tier_stats_t st;
+    hattrie_tier(H, 100, 1u << 20, &st);
+    if (st.hot == 0) {
+        fprintf(stderr, "[error] cache hits were not counted by tiering\n");
+    }
+    hattrie_free(H);
+
+    hattrie_tier(T, 0, 1u << 20, NULL);
+    hattrie_tier(T, 1u << 20, 1u << 20, NULL);
+    check_lookups("tiering");
+    hattrie_hot_cache_enable(T, 0);
+    check_lookups("disabling the cache");
+
+    fprintf(stderr, "done.\n");
+}
+
+
+static int cmp_u64(const void* a_, const void* b_)
+{
+    uint64_t a = *(const uint64_t*) a_, b = *(const uint64_t*) b_;
+    return (a > b) - (a < b);
+}
+
+/* index of the last of the sorted keys not greater than x, or -1 */
+static long leq_u64(const uint64_t* ks, size_t m, uint64_t x)
+{
+    size_t lo = 0, hi = m;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (ks[mid] <= x) lo = mid + 1;
+        else hi = mid;
+    }
+    return (long) lo - 1;
+}
+
+static int walk_u64(const char* prefix, size_t plen, const char* key, size_t len,
+                    value_t* val, void* ctx)
+{
+    (void) prefix;
+    (void) key;
+    (void) val;
+    if (plen + len != sizeof(uint64_t)) {
+        fprintf(stderr, "[error] walk found a key of %zu bytes\n", plen + len);
+    }
+    ++*(size_t*) ctx;
+    return 0;
+}
+
+void test_hattrie_u64()
+{
+    const size_t m_max = 200000;
+    fprintf(stderr, "checking %zu integer keys ... \n", m_max);
+
+    /* dense runs, to burst down to the last byte, and random keys */
+    uint64_t* ks = malloc(m_max * sizeof(uint64_t));
+    size_t i, m = 0;
+    uint64_t x = 0;
+    while (m < m_max) {
+        if (rand() % 1000 == 0) {
+            x = ((uint64_t) rand() << 42) ^ ((uint64_t) rand() << 21) ^ (uint64_t) rand();
+        }
+        ks[m++] = x;
+        x += 1 + rand() % 3;
+        if (m < m_max && rand() % 2) ks[m++] = ((uint64_t) rand() << 33) ^ (uint64_t) rand();
+    }
+
+    hattrie_t* U = hattrie_create_u64();
+    hattrie_t* G = hattrie_create();
+    for (i = 0; i < m; ++i) {
+        *hattrie_get_u64(U, ks[i]) = ks[i] + 1;
+        *hattrie_get_u64(G, ks[i]) = ks[i] + 1;
+    }
+
+    qsort(ks, m, sizeof(uint64_t), cmp_u64);
+    size_t u = 0;
+    for (i = 0; i < m; ++i) {
+        if (i == 0 || ks[i] != ks[i - 1]) ks[u++] = ks[i];
+    }
+    m = u;
+    if (hattrie_size(U) != m || hattrie_size(G) != m) {
+        fprintf(stderr, "[error] %zu and %zu integer keys, expected %zu\n",
+                hattrie_size(U), hattrie_size(G), m);
+    }
+
+    /* lookups of present and absent keys */
+    value_t* val;
+    for (i = 0; i < m; ++i) {
+        val = hattrie_tryget_u64(U, ks[i]);
+        if (val == NULL || *val != ks[i] + 1) {
+            fprintf(stderr, "[error] integer key %llu not found\n",
+                    (unsigned long long) ks[i]);
+        }
+        x = ks[i] + 1;
+        if ((i + 1 == m || ks[i + 1] != x) && hattrie_tryget_u64(U, x) != NULL) {
+            fprintf(stderr, "[error] absent integer key %llu found\n",
+                    (unsigned long long) x);
+        }
+        val = hattrie_tryget_u64(G, ks[i]);
+        if (val == NULL || *val != ks[i] + 1) {
+            fprintf(stderr, "[error] integer key not found in a generic trie\n");
+        }
+    }
+
+    /* numeric order */
+    hattrie_iter_t* it = hattrie_iter_begin(U, true);
+    for (i = 0; !hattrie_iter_finished(it); hattrie_iter_next(it), ++i) {
+        x = hattrie_iter_key_u64(it);
+        if (i >= m || x != ks[i] || *hattrie_iter_val(it) != x + 1) {
+            fprintf(stderr, "[error] integer keys out of order\n");
+            break;
+        }
+    }
+    hattrie_iter_free(it);
+    if (i != m) fprintf(stderr, "[error] iterated %zu integer keys\n", i);
+
+    size_t walked = 0;
+    hattrie_walk_all(U, true, walk_u64, &walked);
+    if (walked != m) fprintf(stderr, "[error] walked %zu integer keys\n", walked);
+
+    /* predecessors, exact and not */
+    hattrie_build_index(U);
+    for (i = 0; i < 20000; ++i) {
+        x = rand() % 2 ? ks[rand() % m] + rand() % 3 - 1
+                       : ((uint64_t) rand() << 33) ^ (uint64_t) rand();
+        long j = leq_u64(ks, m, x);
+        val = NULL;
+        int r = hattrie_find_leq_u64(U, x, &val);
+        int expected = j < 0 ? 1 : ks[j] == x ? 0 : -1;
+        if (r != expected || (j >= 0 && (val == NULL || *val != ks[j] + 1))) {
+            fprintf(stderr, "[error] wrong predecessor of %llu\n",
+                    (unsigned long long) x);
+        }
+    }
+
+    /* fixed key buckets against generic ones */
+    hattrie_setop_t* op = hattrie_intersect(U, G);
+    size_t both = 0;
+    value_t *va, *vb;
+    for (; !hattrie_setop_finished(op); hattrie_setop_next(op)) {
+        hattrie_setop_val(op, &va, &vb);
+        both += *va == *vb;
+    }
+    hattrie_setop_free(op);
+    if (both != m) fprintf(stderr, "[error] %zu integer keys in common\n", both);
+
+    hattrie_t* D = hattrie_dup(U);
+    hattrie_clear(U);
+    *hattrie_get_u64(U, 1) = 2;
+    if (hattrie_size(D) != m || hattrie_size(U) != 1 ||
+        hattrie_tryget_u64(D, ks[m / 2]) == NULL) {
+        fprintf(stderr, "[error] wrong copy of integer keys\n");
+    }
+
+    /* split, then insert the keys of each side into the other, which go to
+     * the empty buckets left on the split path */
+    uint64_t mid = ks[m / 2];
+    char split[8];
+    for (i = 0; i < 8; ++i) split[i] = (char) (mid >> (56 - 8 * i));
+    hattrie_t* R;
+    hattrie_split_at(D, split, sizeof(split), &R);
+    for (i = 0; i < m; ++i) {
+        *hattrie_get_u64(ks[i] < mid ? R : D, ks[i]) = ks[i] + 2;
+    }
+    for (i = 0; i < m; ++i) {
+        va = hattrie_tryget_u64(D, ks[i]);
+        vb = hattrie_tryget_u64(R, ks[i]);
+        if (va == NULL || vb == NULL ||
+            *va != ks[i] + (ks[i] < mid ? 1 : 2) ||
+            *vb != ks[i] + (ks[i] < mid ? 2 : 1)) {
+            fprintf(stderr, "[error] wrong integer key across a split\n");
+            break;
+        }
+    }
+    it = hattrie_iter_begin(R, true);
+    for (i = 0, x = 0; !hattrie_iter_finished(it); hattrie_iter_next(it), ++i) {
+        if (i > 0 && hattrie_iter_key_u64(it) <= x) {
+            fprintf(stderr, "[error] integer keys out of order after a split\n");
+        }
+        x = hattrie_iter_key_u64(it);
+    }
+    hattrie_iter_free(it);
+    if (i != hattrie_size(R)) {
+        fprintf(stderr, "[error] iterated %zu of %zu split integer keys\n",
+                i, hattrie_size(R));
+    }
+    hattrie_free(R);
+
+    hattrie_free(D);
+    hattrie_free(G);
+    hattrie_free(U);
+    free(ks);
+
+    fprintf(stderr, "done.\n");
+}
+
+
 void test_trie_non_ascii()
 {
     fprintf(stderr, "checking non-ascii... \n");
@@ -302,6 +1411,11 @@ void test_trie_non_ascii()
 int main()
 {
     test_trie_non_ascii();
+    test_hattrie_u64();
+
+    setup();
+    test_hattrie_changelog();
+    teardown();
 
     setup();
     test_hattrie_insert();
@@ -310,12 +1424,61 @@ int main()
 
     setup();
     test_hattrie_insert();
+    test_hattrie_walk_all();
+    test_hattrie_iter_fill();
     test_hattrie_sorted_iteration();
     teardown();
     
     setup();
     test_hattrie_insert();
     test_hattrie_find_prev();
+    test_hattrie_lower_bound();
+    teardown();
+
+    setup();
+    test_hattrie_insert();
+    test_hattrie_setops();
+    teardown();
+
+    setup();
+    test_hattrie_insert();
+    test_hattrie_split_at();
+    teardown();
+
+    setup();
+    test_hattrie_insert();
+    test_hattrie_join();
+    test_hattrie_sorted_iteration();
+    teardown();
+
+    setup();
+    test_hattrie_insert();
+    test_hattrie_parallel_for_each();
+    test_hattrie_sorted_iteration();
+    teardown();
+
+    setup();
+    test_hattrie_insert();
+    test_hattrie_digest();
+    teardown();
+
+    setup();
+    test_hattrie_insert();
+    test_hattrie_tier();
+    test_hattrie_walk_all();
+    test_hattrie_sorted_iteration();
+    teardown();
+
+    setup();
+    test_hattrie_insert();
+    test_hattrie_filter();
+    test_hattrie_sorted_iteration();
+    teardown();
+
+    setup();
+    test_hattrie_insert();
+    test_hattrie_hot_cache();
+    test_hattrie_sorted_iteration();
     teardown();
 
     return 0;
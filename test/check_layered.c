@@ -0,0 +1,255 @@
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "str_map.h"
+#include "random_keys.h"
+#include "../src/hat-trie.h"
+#include "../src/frozen.h"
+#include "../src/layered.h"
+
+const size_t n = 20000;   // how many unique strings
+const size_t m_low  = 5;  // minimum length of each string
+const size_t m_high = 50; // maximum length of each string
+const size_t k = 100000;  // number of operations
+
+char** xs;
+str_map* M;
+char dir[] = "/tmp/check_layered.XXXXXX";
+char path[256];
+
+
+void setup()
+{
+    fprintf(stderr, "generating %zu keys ... ", n);
+    xs = random_keys(n, m_low, m_high);
+    M = str_map_create();
+    if (mkdtemp(dir) == NULL) {
+        fprintf(stderr, "[error] cannot create directory %s\n", dir);
+        exit(EXIT_FAILURE);
+    }
+    snprintf(path, sizeof(path), "%s/base", dir);
+    fprintf(stderr, "done.\n");
+}
+
+
+void teardown()
+{
+    str_map_destroy(M);
+    free_strings(xs, n);
+
+    unlink(path);
+    rmdir(dir);
+}
+
+
+/* compare sorted iteration to the reference map */
+void check_sorted(const char* prev, size_t prevlen, const char* key, size_t len)
+{
+    int c = memcmp(prev, key, prevlen < len ? prevlen : len);
+    if (c > 0 || (c == 0 && prevlen >= len)) {
+        fprintf(stderr, "[error] keys are not in sorted order\n");
+    }
+}
+
+
+void test_frozen()
+{
+    fprintf(stderr, "freezing %zu keys ... \n", n);
+
+    hattrie_t* T = hattrie_create();
+    size_t i, len;
+    for (i = 0; i < n; ++i) {
+        len = strlen(xs[i]);
+        value_t v = 1 + rand() % 1000;
+        *hattrie_get(T, xs[i], len) = v;
+        str_map_set(M, xs[i], len, v);
+    }
+
+    if (hattrie_freeze(T, path) != 0) {
+        fprintf(stderr, "[error] cannot write %s\n", path);
+        hattrie_free(T);
+        return;
+    }
+
+    hattrie_frozen_t* F = hattrie_frozen_open(path);
+    if (F == NULL) {
+        fprintf(stderr, "[error] cannot open %s\n", path);
+        hattrie_free(T);
+        return;
+    }
+    if (hattrie_frozen_size(F) != M->m) {
+        fprintf(stderr, "[error] frozen size %zu, expected %zu\n",
+                hattrie_frozen_size(F), M->m);
+    }
+
+    const value_t* u;
+    value_t* v;
+    hattrie_build_index(T);
+    for (i = 0; i < n; ++i) {
+        len = strlen(xs[i]);
+        u = hattrie_frozen_tryget(F, xs[i], len);
+        if (u == NULL || *u != str_map_get(M, xs[i], len)) {
+            fprintf(stderr, "[error] frozen tryget failed for %s\n", xs[i]);
+        }
+
+        /* a missing key shares its predecessor with the trie */
+        int r = hattrie_find_leq(T, xs[i], len - 1, &v);
+        int s = hattrie_frozen_find_leq(F, xs[i], len - 1, &u);
+        if (r != s || (r <= 0 && *u != *v)) {
+            fprintf(stderr, "[error] frozen find_leq differs for %s\n", xs[i]);
+        }
+    }
+
+    /* iteration matches the sorted trie */
+    hattrie_iter_t* it = hattrie_iter_begin(T, true);
+    hattrie_frozen_iter_t* ft = hattrie_frozen_iter_begin(F);
+    size_t flen;
+    const char *key, *fkey;
+    while (!hattrie_iter_finished(it) && !hattrie_frozen_iter_finished(ft)) {
+        key  = hattrie_iter_key(it, &len);
+        fkey = hattrie_frozen_iter_key(ft, &flen);
+        if (len != flen || memcmp(key, fkey, len) != 0 ||
+            *hattrie_iter_val(it) != *hattrie_frozen_iter_val(ft)) {
+            fprintf(stderr, "[error] frozen iteration differs\n");
+            break;
+        }
+        hattrie_iter_next(it);
+        hattrie_frozen_iter_next(ft);
+    }
+    if (!hattrie_iter_finished(it) || !hattrie_frozen_iter_finished(ft)) {
+        fprintf(stderr, "[error] frozen iteration has wrong length\n");
+    }
+    hattrie_iter_free(it);
+    hattrie_frozen_iter_free(ft);
+
+    hattrie_frozen_close(F);
+    hattrie_free(T);
+    fprintf(stderr, "done.\n");
+}
+
+
+/* apply random mutations to the trie and the reference map */
+void mutate(hattrie_layered_t* L, size_t count)
+{
+    size_t i, j, len;
+    for (j = 0; j < count; ++j) {
+        i = rand() % n;
+        len = strlen(xs[i]);
+        if (rand() % 4 == 0) {
+            int r = hattrie_layered_del(L, xs[i], len);
+            if ((r == 0) != (str_map_get(M, xs[i], len) != 0)) {
+                fprintf(stderr, "[error] layered del returned %d for %s\n", r, xs[i]);
+            }
+            str_map_del(M, xs[i], len);
+        } else if (rand() % 2 == 0) {
+            value_t* v = hattrie_layered_get(L, xs[i], len);
+            if (*v != str_map_get(M, xs[i], len)) {
+                fprintf(stderr, "[error] layered get lost the value of %s\n", xs[i]);
+            }
+            *v += 1;
+            str_map_set(M, xs[i], len, *v);
+        } else {
+            value_t v = 1 + rand() % 1000;
+            *hattrie_layered_get(L, xs[i], len) = v;
+            str_map_set(M, xs[i], len, v);
+        }
+    }
+}
+
+
+void check(hattrie_layered_t* L, const char* what)
+{
+    size_t i, len, count = 0, prevlen = 0;
+    const value_t* u;
+    for (i = 0; i < n; ++i) {
+        len = strlen(xs[i]);
+        value_t v = str_map_get(M, xs[i], len);
+        u = hattrie_layered_tryget(L, xs[i], len);
+        if ((u == NULL) != (v == 0) || (u && *u != v)) {
+            fprintf(stderr, "[error] layered tryget wrong for %s after %s\n", xs[i], what);
+        }
+    }
+
+    char* prev = malloc(m_high);
+    const char* key;
+    hattrie_layered_iter_t* it = hattrie_layered_iter_begin(L);
+    while (!hattrie_layered_iter_finished(it)) {
+        key = hattrie_layered_iter_key(it, &len);
+        if (*hattrie_layered_iter_val(it) != str_map_get(M, key, len)) {
+            fprintf(stderr, "[error] incorrect value after %s\n", what);
+        }
+        if (count > 0) check_sorted(prev, prevlen, key, len);
+        memcpy(prev, key, len);
+        prevlen = len;
+        ++count;
+        hattrie_layered_iter_next(it);
+    }
+    hattrie_layered_iter_free(it);
+    free(prev);
+
+    if (count != M->m) {
+        fprintf(stderr, "[error] iterated %zu keys after %s, expected %zu\n",
+                count, what, M->m);
+    }
+}
+
+
+void test_layered()
+{
+    fprintf(stderr, "layering %zu mutations ... \n", k);
+
+    hattrie_layered_t* L = hattrie_layered_open(path);
+    if (L == NULL) {
+        fprintf(stderr, "[error] cannot open layered trie on %s\n", path);
+        return;
+    }
+    check(L, "open");
+
+    mutate(L, k / 4);
+    check(L, "mutate");
+
+    /* updates continue while the compaction runs */
+    if (hattrie_layered_compact(L, true) != 0) {
+        fprintf(stderr, "[error] background compaction failed to start.\n");
+    }
+    mutate(L, k / 4);
+    check(L, "background compaction");
+    if (hattrie_layered_compact_finish(L, true) != 1) {
+        fprintf(stderr, "[error] background compaction was not installed.\n");
+    }
+    check(L, "install");
+
+    mutate(L, k / 4);
+    if (hattrie_layered_compact(L, false) != 0) {
+        fprintf(stderr, "[error] compaction failed.\n");
+    }
+    check(L, "compaction");
+    hattrie_layered_close(L);
+
+    /* the compacted base survives a reopen */
+    L = hattrie_layered_open(path);
+    check(L, "reopen");
+    mutate(L, k / 4);
+    hattrie_layered_compact(L, true);
+    check(L, "second compaction");
+    hattrie_layered_compact(L, true);
+    hattrie_layered_close(L);
+
+    fprintf(stderr, "done.\n");
+}
+
+
+int main()
+{
+    setup();
+    test_frozen();
+    test_layered();
+    teardown();
+
+    return 0;
+}
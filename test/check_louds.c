@@ -0,0 +1,198 @@
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "../src/louds.h"
+#include "../src/frozen.h"
+#include "../src/hat-trie.h"
+#include "sorted_keys.h"
+
+const size_t n = 50000;   // how many unique strings
+const size_t m_high = 30; // maximum length of each string
+const size_t k = 100000;  // number of probes
+
+
+void test_bits()
+{
+    fprintf(stderr, "checking rank and select ... ");
+
+    size_t sizes[] = { 0, 1, 63, 64, 65, 511, 512, 513, 10000 };
+    size_t s, i, j;
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        size_t nbits = sizes[s], nw = (nbits + 63) / 64, nb = (nw + 7) / 8;
+        size_t bytes = louds_bits_size(nbits, nbits);
+        uint64_t* buf = calloc(bytes / 8 + 1, 8);
+        uint32_t* ranks = (uint32_t*) (buf + nw);
+        uint32_t* samples = ranks + nb + 1;
+        uint32_t r = 0;
+        int density = 1 + rand() % 8;
+        for (i = 0; i < nbits; ++i) {
+            if (i % 512 == 0) ranks[i / 512] = r;
+            if (rand() % density == 0) {
+                buf[i / 64] |= (uint64_t) 1 << (i % 64);
+                if (r % 512 == 0) samples[r / 512] = i / 512;
+                ++r;
+            }
+        }
+        ranks[nb] = r;
+        samples[(r + 511) / 512] = nb;
+        bytes = louds_bits_size(nbits, r);
+
+        louds_bits_t B;
+        if (!louds_bits_map(&B, buf, bytes, nbits)) {
+            fprintf(stderr, "[error] bit vector of %zu bits rejected\n", nbits);
+            free(buf);
+            continue;
+        }
+        for (i = 0, j = 0; i <= nbits; ++i) {
+            if (louds_rank1(&B, i) != j) {
+                fprintf(stderr, "[error] wrong rank at %zu of %zu\n", i, nbits);
+                break;
+            }
+            if (i < nbits && (buf[i / 64] >> (i % 64)) & 1) {
+                if (louds_select1(&B, j) != i) {
+                    fprintf(stderr, "[error] wrong select of %zu\n", j);
+                    break;
+                }
+                ++j;
+            }
+        }
+
+        /* a wrong directory is caught */
+        if (nbits > 0) {
+            ranks[0] = 1;
+            if (louds_bits_map(&B, buf, bytes, nbits)) {
+                fprintf(stderr, "[error] bad directory accepted\n");
+            }
+        }
+        free(buf);
+    }
+
+    fprintf(stderr, "done.\n");
+}
+
+
+void test_louds()
+{
+    size_t i, id;
+    louds_builder_t* b = louds_builder_create();
+    size_t* ids = malloc((nx + 1) * sizeof(size_t));
+    for (i = 0; i < nx; ++i) louds_builder_add(b, xs[i], strlen(xs[i]));
+    louds_t L;
+    louds_builder_finish(b, &L, ids);
+
+    if (L.n != nx || !louds_check(&L)) {
+        fprintf(stderr, "[error] malformed trie of %zu keys\n", nx);
+    }
+
+    /* ids are a permutation */
+    char* seen = calloc(nx + 1, 1);
+    for (i = 0; i < nx; ++i) {
+        if (ids[i] >= nx || seen[ids[i]]++) {
+            fprintf(stderr, "[error] bad id %zu\n", ids[i]);
+        }
+    }
+    free(seen);
+
+    for (i = 0; i < nx; ++i) {
+        if (!louds_get(&L, xs[i], strlen(xs[i]), &id) || id != ids[i]) {
+            fprintf(stderr, "[error] wrong id for %s\n", xs[i]);
+        }
+    }
+
+    char x[64];
+    for (i = 0; i < k; ++i) {
+        probe(x, m_high);
+        size_t r = lower_bound(x);
+        bool hit = r < nx && strcmp(xs[r], x) == 0;
+        if (louds_get(&L, x, strlen(x), &id) != hit) {
+            fprintf(stderr, "[error] wrong get for %s\n", x);
+        }
+        int c = louds_find_leq(&L, x, strlen(x), &id);
+        if ((hit && (c != 0 || id != ids[r])) ||
+            (!hit && r == 0 && c != 1) ||
+            (!hit && r > 0 && (c != -1 || id != ids[r - 1]))) {
+            fprintf(stderr, "[error] wrong find_leq for %s\n", x);
+        }
+    }
+
+    size_t len;
+    const char* key;
+    louds_iter_t* it = louds_iter_begin(&L);
+    for (i = 0; !louds_iter_finished(it); ++i, louds_iter_next(it)) {
+        key = louds_iter_key(it, &len);
+        if (i >= nx || len != strlen(xs[i]) || memcmp(key, xs[i], len) != 0 ||
+            louds_iter_id(it) != ids[i]) {
+            fprintf(stderr, "[error] iterated wrong key at rank %zu\n", i);
+            break;
+        }
+    }
+    louds_iter_free(it);
+    if (i != nx) {
+        fprintf(stderr, "[error] iterated %zu keys, expected %zu\n", i, nx);
+    }
+
+    free(ids);
+    louds_builder_free(b);
+}
+
+
+void test_random()
+{
+    fprintf(stderr, "checking succinct trie of random keys ... ");
+
+    xs = random_keys(n, 0, m_high);
+    nx = n;
+    sort_keys();
+    test_louds();
+    free_keys();
+
+    /* empty and tiny key sets */
+    xs = malloc(4 * sizeof(char*));
+    nx = 0;
+    test_louds();
+    xs[nx++] = strdup("");
+    test_louds();
+    xs[nx++] = strdup("a");
+    xs[nx++] = strdup("ab");
+    xs[nx++] = strdup("b");
+    test_louds();
+    free_keys();
+
+    fprintf(stderr, "done.\n");
+}
+
+
+/* Keys sharing long prefixes, through a frozen image. */
+void test_frozen()
+{
+    fprintf(stderr, "checking succinct frozen image ... ");
+
+    char x[128];
+    xs = malloc(n * sizeof(char*));
+    for (nx = 0; nx < n; ++nx) {
+        snprintf(x, sizeof(x), "/home/user%02d/%s/file%05d%s",
+                 rand() % 50, rand() % 2 ? "src" : "doc", rand() % 100000,
+                 rand() % 3 ? ".c" : "");
+        xs[nx] = strdup(x);
+    }
+    sort_keys();
+    test_louds();
+    check_frozen(hattrie_freeze_succinct, 3, k, m_high);
+
+    free_keys();
+    fprintf(stderr, "done.\n");
+}
+
+
+int main()
+{
+    test_bits();
+    test_random();
+    test_frozen();
+
+    return 0;
+}
@@ -0,0 +1,117 @@
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "../src/mph.h"
+#include "../src/frozen.h"
+#include "../src/hat-trie.h"
+#include "sorted_keys.h"
+
+const size_t n = 100000;  // how many unique strings
+const size_t m_high = 30; // maximum length of each string
+const size_t k = 100000;  // number of probes
+
+
+void test_table()
+{
+    size_t i;
+    mph_builder_t* b = mph_builder_create(42);
+    for (i = 0; i < nx; ++i) mph_builder_add(b, xs[i], strlen(xs[i]));
+    mph_t H;
+    if (!mph_builder_finish(b, &H)) {
+        fprintf(stderr, "[error] no table for %zu keys\n", nx);
+        mph_builder_free(b);
+        return;
+    }
+    if (H.n != nx || !mph_check(&H)) {
+        fprintf(stderr, "[error] malformed table for %zu keys\n", nx);
+    }
+
+    /* every key has its own slot */
+    char* seen = calloc(nx + 1, 1);
+    for (i = 0; i < nx; ++i) {
+        size_t s = mph_lookup(&H, xs[i], strlen(xs[i]));
+        if (s >= nx || seen[s]++) {
+            fprintf(stderr, "[error] slot %zu taken twice or out of range\n", s);
+            break;
+        }
+    }
+    free(seen);
+
+    /* other keys land in range too */
+    char x[64];
+    for (i = 0; i < 1000 && nx > 0; ++i) {
+        randstr(x, rand() % m_high);
+        if (mph_lookup(&H, x, strlen(x)) >= nx) {
+            fprintf(stderr, "[error] slot out of range for %s\n", x);
+        }
+    }
+    mph_builder_free(b);
+}
+
+
+void test_random()
+{
+    fprintf(stderr, "checking minimal perfect hash of %zu keys ... ", n);
+
+    xs = random_keys(n, 0, m_high);
+    nx = n;
+    sort_keys();
+    test_table();
+    free_keys();
+
+    /* empty and tiny key sets */
+    xs = malloc(3 * sizeof(char*));
+    nx = 0;
+    test_table();
+    xs[nx++] = strdup("");
+    test_table();
+    xs[nx++] = strdup("a");
+    xs[nx++] = strdup("b");
+    test_table();
+    free_keys();
+
+    /* the same hash twice cannot be placed */
+    mph_builder_t* b = mph_builder_create(0);
+    mph_t H;
+    mph_builder_add(b, "abc", 3);
+    mph_builder_add(b, "abc", 3);
+    if (mph_builder_finish(b, &H)) {
+        fprintf(stderr, "[error] duplicate keys placed\n");
+    }
+    mph_builder_free(b);
+
+    fprintf(stderr, "done.\n");
+}
+
+
+/* A hashed image answers like a plain one. */
+void test_frozen()
+{
+    fprintf(stderr, "checking hashed frozen image ... ");
+
+    xs = random_keys(n, 0, m_high);
+    nx = n;
+    sort_keys();
+    check_frozen(hattrie_freeze_hashed, 1, k, m_high);
+
+    /* an empty image */
+    free_keys();
+    xs = NULL;
+    nx = 0;
+    check_frozen(hattrie_freeze_hashed, 1, 100, m_high);
+
+    fprintf(stderr, "done.\n");
+}
+
+
+int main()
+{
+    test_random();
+    test_frozen();
+
+    return 0;
+}
@@ -0,0 +1,143 @@
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "str_map.h"
+#include "random_keys.h"
+#include "../src/sharded.h"
+
+const size_t n = 100000;   // how many unique strings
+const size_t m_high = 20;  // maximum length of each string
+const size_t nthreads = 4;
+const size_t rounds = 3;   // increments of every key by every thread
+
+char** xs;
+
+
+void setup()
+{
+    size_t i;
+    xs = random_keys(n, 0, m_high);
+    for (i = 0; i < n; ++i) {
+        /* skew the first bytes, most keys start with a few letters */
+        if (xs[i][0] != '\0' && i % 4 != 0) xs[i][0] = 'a' + i % 3;
+    }
+}
+
+void teardown()
+{
+    free_strings(xs, n);
+}
+
+/* The trie holds the same keys and values as the map. */
+void check_trie(hattrie_t* T, str_map* M, const char* what)
+{
+    size_t count = 0, len;
+    const char* key;
+    hattrie_iter_t* it = hattrie_iter_begin(T, true);
+    for (; !hattrie_iter_finished(it); hattrie_iter_next(it)) {
+        key = hattrie_iter_key(it, &len);
+        if (*hattrie_iter_val(it) != str_map_get(M, key, len)) {
+            fprintf(stderr, "[error] wrong sum after %s\n", what);
+            break;
+        }
+        ++count;
+    }
+    hattrie_iter_free(it);
+    if (count != M->m) {
+        fprintf(stderr, "[error] %zu keys after %s, expected %zu\n",
+                count, what, M->m);
+    }
+}
+
+
+typedef struct worker_t_
+{
+    hattrie_sharded_t* S;
+    size_t id;
+} worker_t;
+
+/* Add id + 1 to the keys not congruent to id, once per round. */
+void* count_keys(void* arg)
+{
+    worker_t* w = arg;
+    size_t r, i;
+    for (r = 0; r < rounds; ++r) {
+        for (i = 0; i < n; ++i) {
+            if (i % nthreads == w->id) continue;
+            *hattrie_sharded_get(w->S, xs[i], strlen(xs[i])) += w->id + 1;
+        }
+    }
+    return NULL;
+}
+
+void count_all(hattrie_sharded_t* S, str_map* M)
+{
+    pthread_t threads[8];
+    worker_t workers[8];
+    size_t i, t;
+
+    for (t = 0; t < nthreads; ++t) {
+        workers[t].S = S;
+        workers[t].id = t;
+        pthread_create(&threads[t], NULL, count_keys, &workers[t]);
+    }
+    for (t = 0; t < nthreads; ++t) pthread_join(threads[t], NULL);
+
+    for (t = 0; t < nthreads; ++t) {
+        for (i = 0; i < n; ++i) {
+            if (i % nthreads == t) continue;
+            size_t len = strlen(xs[i]);
+            str_map_set(M, xs[i], len, str_map_get(M, xs[i], len) + rounds * (t + 1));
+        }
+    }
+}
+
+
+void test_merge()
+{
+    fprintf(stderr, "checking sharded counting in %zu threads ... ", nthreads);
+
+    hattrie_sharded_t* S = hattrie_sharded_create();
+    str_map* M = str_map_create();
+
+    count_all(S, M);
+    hattrie_t* T = hattrie_sharded_merge(S, NULL, nthreads);
+    check_trie(T, M, "first merge");
+
+    /* keys only in the total keep their values */
+    *hattrie_get(T, "\x7f total", 7) = 5;
+    str_map_set(M, "\x7f total", 7, 5);
+
+    /* the shards start over, new threads take them over */
+    count_all(S, M);
+    if (hattrie_sharded_merge(S, T, 3) != T) {
+        fprintf(stderr, "[error] merge did not return the total\n");
+    }
+    check_trie(T, M, "second merge");
+
+    /* one thread, and nothing to merge */
+    count_all(S, M);
+    hattrie_sharded_merge(S, T, 1);
+    hattrie_sharded_merge(S, T, nthreads);
+    check_trie(T, M, "merges in one thread");
+
+    hattrie_free(T);
+    str_map_destroy(M);
+    hattrie_sharded_free(S);
+    fprintf(stderr, "done.\n");
+}
+
+
+int main()
+{
+    setup();
+    test_merge();
+    teardown();
+
+    return 0;
+}
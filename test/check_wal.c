@@ -0,0 +1,162 @@
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "str_map.h"
+#include "random_keys.h"
+#include "../src/hat-trie.h"
+#include "../src/wal.h"
+
+const size_t n = 20000;   // how many unique strings
+const size_t m_low  = 5;  // minimum length of each string
+const size_t m_high = 50; // maximum length of each string
+const size_t k = 100000;  // number of operations
+
+char** xs;
+str_map* M;
+char dir[] = "/tmp/check_wal.XXXXXX";
+
+
+void setup()
+{
+    fprintf(stderr, "generating %zu keys ... ", n);
+    xs = random_keys(n, m_low, m_high);
+    M = str_map_create();
+    if (mkdtemp(dir) == NULL) {
+        fprintf(stderr, "[error] cannot create directory %s\n", dir);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "done.\n");
+}
+
+
+void teardown()
+{
+    str_map_destroy(M);
+    free_strings(xs, n);
+
+    DIR* d = opendir(dir);
+    struct dirent* e;
+    char path[512];
+    while (d && (e = readdir(d)) != NULL) {
+        if (e->d_name[0] == '.') continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        unlink(path);
+    }
+    if (d) closedir(d);
+    rmdir(dir);
+}
+
+
+/* apply random mutations to the trie and the reference map */
+void mutate(hattrie_t* T, hattrie_wal_t* W, size_t count)
+{
+    size_t i, j, len;
+    for (j = 0; j < count; ++j) {
+        i = rand() % n;
+        len = strlen(xs[i]);
+        if (rand() % 4 == 0) {
+            hattrie_del(T, xs[i], len);
+            str_map_del(M, xs[i], len);
+        } else {
+            value_t v = 1 + rand() % 1000;
+            if (rand() % 2) hattrie_set(T, xs[i], len, v);
+            else *hattrie_get(T, xs[i], len) = v;
+            str_map_set(M, xs[i], len, v);
+        }
+        if (j % 1000 == 0) hattrie_wal_commit(W);
+    }
+}
+
+
+void check(hattrie_t* T, const char* what)
+{
+    size_t count = 0, len;
+    const char* key;
+    hattrie_iter_t* i = hattrie_iter_begin(T, false);
+    while (!hattrie_iter_finished(i)) {
+        key = hattrie_iter_key(i, &len);
+        if (*hattrie_iter_val(i) != str_map_get(M, key, len)) {
+            fprintf(stderr, "[error] incorrect value after %s\n", what);
+        }
+        ++count;
+        hattrie_iter_next(i);
+    }
+    hattrie_iter_free(i);
+
+    if (count != M->m) {
+        fprintf(stderr, "[error] recovered %zu keys after %s, expected %zu\n",
+                count, what, M->m);
+    }
+}
+
+
+void test_wal_recovery()
+{
+    fprintf(stderr, "logging %zu mutations ... \n", k);
+
+    hattrie_t* T;
+    hattrie_wal_t* W = hattrie_wal_open(dir, 4096, 256 * 1024, &T);
+    if (W == NULL) {
+        fprintf(stderr, "[error] cannot open WAL in %s\n", dir);
+        return;
+    }
+
+    mutate(T, W, k / 2);
+    if (hattrie_wal_checkpoint(W, true) != 0) {
+        fprintf(stderr, "[error] background checkpoint failed.\n");
+    }
+    mutate(T, W, k / 2);
+    hattrie_wal_commit(W);
+
+    /* state after the last commit is recoverable without a clean close */
+    hattrie_t* R;
+    hattrie_wal_t* V = hattrie_wal_open(dir, 4096, 0, &R);
+    if (V == NULL) {
+        fprintf(stderr, "[error] cannot recover WAL in %s\n", dir);
+    } else {
+        check(R, "crash");
+        hattrie_wal_close(V);
+        hattrie_free(R);
+    }
+
+    mutate(T, W, k / 10);
+    if (hattrie_wal_close(W) != 0) {
+        fprintf(stderr, "[error] failed to close WAL.\n");
+    }
+    hattrie_free(T);
+
+    /* reopen after clean shutdown */
+    W = hattrie_wal_open(dir, 4096, 0, &T);
+    if (W == NULL) {
+        fprintf(stderr, "[error] cannot reopen WAL in %s\n", dir);
+        return;
+    }
+    check(T, "reopen");
+    mutate(T, W, k / 10);
+    hattrie_wal_checkpoint(W, false);
+    hattrie_wal_close(W);
+    hattrie_free(T);
+
+    W = hattrie_wal_open(dir, 4096, 0, &T);
+    check(T, "checkpoint");
+    hattrie_wal_close(W);
+    hattrie_free(T);
+
+    fprintf(stderr, "done.\n");
+}
+
+
+int main()
+{
+    setup();
+    test_wal_recovery();
+    teardown();
+
+    return 0;
+}
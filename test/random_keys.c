@@ -0,0 +1,39 @@
+/*
+ * random_keys :
+ * Random strings shared by the tests and benchmarks.
+ *
+ */
+
+
+#include "random_keys.h"
+
+
+/* Simple random string generation. */
+void randstr(char* x, size_t len)
+{
+    x[len] = '\0';
+    while (len > 0) {
+        x[--len] = '\x20' + (rand() % ('\x7e' - '\x20' + 1));
+    }
+}
+
+
+char** random_keys(size_t n, size_t lo, size_t hi)
+{
+    char** xs = malloc(n * sizeof(char*));
+    size_t i, m;
+    for (i = 0; i < n; ++i) {
+        m = lo + rand() % (hi - lo);
+        xs[i] = malloc(m + 1);
+        randstr(xs[i], m);
+    }
+    return xs;
+}
+
+
+void free_strings(char** xs, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; ++i) free(xs[i]);
+    free(xs);
+}
@@ -0,0 +1,17 @@
+/*
+ * random_keys :
+ * Random strings shared by the tests and benchmarks.
+ *
+ */
+
+
+#ifndef HATTRIE_RANDOM_KEYS_H
+#define HATTRIE_RANDOM_KEYS_H
+
+#include <stdlib.h>
+
+void   randstr(char* x, size_t len);                   /* random printable string */
+char** random_keys(size_t n, size_t lo, size_t hi);    /* n strings, lengths in [lo, hi) */
+void   free_strings(char** xs, size_t n);
+
+#endif
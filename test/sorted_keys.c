@@ -0,0 +1,145 @@
+/*
+ * sorted_keys :
+ * A sorted array of random strings shared by the tests of the static key
+ * sets.
+ *
+ */
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "sorted_keys.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+char** xs;
+size_t nx;
+
+
+static int cmpkey(const void* a, const void* b)
+{
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+void sort_keys(void)
+{
+    qsort(xs, nx, sizeof(char*), cmpkey);
+    size_t i, j = 0;
+    for (i = 0; i < nx; ++i) {
+        if (j > 0 && strcmp(xs[j - 1], xs[i]) == 0) free(xs[i]);
+        else xs[j++] = xs[i];
+    }
+    nx = j;
+}
+
+void free_keys(void)
+{
+    free_strings(xs, nx);
+}
+
+size_t lower_bound(const char* x)
+{
+    size_t lo = 0, hi = nx;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(xs[mid], x) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* A probe near the keys: a stored key, cut or extended, and sometimes a
+ * random string shorter than maxlen. */
+void probe(char* x, size_t maxlen)
+{
+    if (rand() % 3 == 0 || nx == 0) {
+        randstr(x, rand() % maxlen);
+        return;
+    }
+    const char* y = xs[rand() % nx];
+    size_t ylen = strlen(y);
+    size_t len = rand() % (ylen + 2);
+    if (len > ylen) {
+        memcpy(x, y, ylen);
+        x[ylen] = '\x20' + rand() % 95;
+    } else {
+        memcpy(x, y, len);
+    }
+    x[len] = '\0';
+}
+
+/* Freeze a trie of the keys, key i holding value i * scale, and check the
+ * image against the keys: size, lookups of every key, k probes through
+ * tryget and find_leq, and sorted iteration. */
+void check_frozen(int (*freeze)(const hattrie_t*, const char*),
+                  value_t scale, size_t k, size_t maxlen)
+{
+    size_t i, len, xlen = maxlen + 2;
+    for (i = 0; i < nx; ++i) {
+        if (strlen(xs[i]) + 2 > xlen) xlen = strlen(xs[i]) + 2;
+    }
+    char* x = malloc(xlen);
+
+    hattrie_t* T = hattrie_create();
+    for (i = 0; i < nx; ++i) {
+        *hattrie_get(T, xs[i], strlen(xs[i])) = i * scale;
+    }
+    char path[] = "/tmp/check_frozen_XXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+    if (freeze(T, path) != 0) {
+        fprintf(stderr, "[error] freezing the trie failed\n");
+    }
+    hattrie_frozen_t* F = hattrie_frozen_open(path);
+    if (F == NULL) {
+        fprintf(stderr, "[error] hattrie_frozen_open failed\n");
+    } else {
+        const value_t* u;
+        if (hattrie_frozen_size(F) != nx) {
+            fprintf(stderr, "[error] frozen size %zu, expected %zu\n",
+                    hattrie_frozen_size(F), nx);
+        }
+        for (i = 0; i < nx; ++i) {
+            u = hattrie_frozen_tryget(F, xs[i], strlen(xs[i]));
+            if (u == NULL || *u != i * scale) {
+                fprintf(stderr, "[error] frozen tryget failed for %s\n", xs[i]);
+            }
+        }
+        for (i = 0; i < k; ++i) {
+            probe(x, maxlen);
+            len = strlen(x);
+            size_t r = lower_bound(x);
+            bool hit = r < nx && strcmp(xs[r], x) == 0;
+            u = hattrie_frozen_tryget(F, x, len);
+            if ((u != NULL) != hit || (hit && *u != r * scale)) {
+                fprintf(stderr, "[error] frozen tryget differs for %s\n", x);
+            }
+            int s = hattrie_frozen_find_leq(F, x, len, &u);
+            if ((hit && (s != 0 || *u != r * scale)) ||
+                (!hit && r == 0 && (s != 1 || u != NULL)) ||
+                (!hit && r > 0 && (s != -1 || *u != (r - 1) * scale))) {
+                fprintf(stderr, "[error] frozen find_leq wrong for %s\n", x);
+            }
+        }
+
+        hattrie_frozen_iter_t* it = hattrie_frozen_iter_begin(F);
+        for (i = 0; !hattrie_frozen_iter_finished(it);
+             ++i, hattrie_frozen_iter_next(it)) {
+            const char* key = hattrie_frozen_iter_key(it, &len);
+            if (i >= nx || len != strlen(xs[i]) || memcmp(key, xs[i], len) != 0 ||
+                *hattrie_frozen_iter_val(it) != i * scale) {
+                fprintf(stderr, "[error] frozen iteration differs at %zu\n", i);
+                break;
+            }
+        }
+        hattrie_frozen_iter_free(it);
+        if (i != nx) {
+            fprintf(stderr, "[error] frozen iteration has wrong length\n");
+        }
+        hattrie_frozen_close(F);
+    }
+    unlink(path);
+    hattrie_free(T);
+    free(x);
+}
@@ -0,0 +1,28 @@
+/*
+ * sorted_keys :
+ * A sorted array of random strings shared by the tests of the static key
+ * sets (front-coded buckets, LOUDS tries, DAWGs and perfect hashing).
+ *
+ */
+
+
+#ifndef HATTRIE_SORTED_KEYS_H
+#define HATTRIE_SORTED_KEYS_H
+
+#include <stdlib.h>
+#include "random_keys.h"
+#include "../src/frozen.h"
+
+extern char** xs; /* keys, sorted and unique after sort_keys */
+extern size_t nx; /* number of keys */
+
+void   sort_keys(void);                    /* sort and remove duplicates */
+void   free_keys(void);
+size_t lower_bound(const char* x);         /* rank of the first key not less than x */
+void   probe(char* x, size_t maxlen);      /* a key, cut or extended, or a random string */
+
+/* round trip of the sorted keys through an image written by freeze */
+void   check_frozen(int (*freeze)(const hattrie_t*, const char*),
+                    value_t scale, size_t k, size_t maxlen);
+
+#endif